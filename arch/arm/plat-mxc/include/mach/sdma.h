@@ -350,10 +350,6 @@ typedef struct mxc_sdma_channel_ext_params {
 
 /*! Private SDMA data structure */
 typedef struct mxc_dma_channel_private {
-	/*! ID of the buffer that was processed */
-	unsigned int buf_tail;
-	/*! Tasklet for the channel */
-	struct tasklet_struct chnl_tasklet;
 	/*! Flag indicates if interrupt is required after every BD transfer */
 	int intr_after_every_bd;
 } mxc_dma_channel_private_t;
@@ -405,6 +401,38 @@ int mxc_request_dma(int *channel, const char *devicename);
 /* int mxc_dma_set_config(int channel, dma_request_t *p, int bd_index); */
 int mxc_dma_set_config(int channel, dma_request_t * p, int bd_index);
 
+/*!
+ * Queues one transfer on the channel BD ring without sleeping. Can be
+ * called from any context, including the completion callback. If the
+ * channel has been started with mxc_dma_start() the transfer begins at
+ * once.
+ *
+ * @param   channel           channel number
+ * @param   p                 request parameters pointer
+ * @param   callback          called from the channel tasklet when the BD
+ *                            completes, or NULL to not raise an interrupt
+ * @param   arg               argument for callback
+ * @return  0 on success, -EBUSY if the ring is full
+ */
+int mxc_sdma_submit(int channel, dma_request_t * p,
+		    mxc_dma_callback_t callback, void *arg);
+
+/*!
+ * Returns the number of BDs queued with mxc_sdma_submit() that have not
+ * completed yet.
+ *
+ * @param   channel           channel number
+ */
+int mxc_sdma_ring_pending(int channel);
+
+/*!
+ * Drops every BD queued with mxc_sdma_submit() on a stopped channel
+ * without running their callbacks. Never sleeps.
+ *
+ * @param   channel           channel number
+ */
+void mxc_sdma_ring_reset(int channel);
+
 /*!
  * Returns request parameters.
  *
@@ -481,6 +509,23 @@ void *sdma_malloc(size_t size);
  * @return  pointer to buffer
  */
 void *sdma_iram_malloc(size_t size);
+
+/*!
+ * Allocates a buffer descriptor ring, in IRAM if the channel priority
+ * allows it and there is room, otherwise in DDR.
+ *
+ * @param   size      size of allocated buffer
+ * @param   channel   channel number
+ * @param   priority  channel priority
+ * @return  pointer to buffer
+ */
+void *sdma_bd_malloc(size_t size, int channel, int priority);
+
+/*!
+ * Reports SDMA IRAM occupancy and DDR fallbacks in /proc/sdma/iram.
+ */
+int sdma_iram_read_proc(char *buf, char **start, off_t offset, int count,
+			int *eof, void *data);
 #endif				/*CONFIG_SDMA_IRAM */
 
 /*!
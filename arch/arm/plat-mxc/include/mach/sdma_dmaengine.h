@@ -0,0 +1,58 @@
+/*
+ * Copyright 2009 Freescale Semiconductor, Inc. All Rights Reserved.
+ */
+
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef __ASM_ARCH_MXC_SDMA_DMAENGINE_H__
+#define __ASM_ARCH_MXC_SDMA_DMAENGINE_H__
+
+/*!
+ * @file arch-mxc/sdma_dmaengine.h
+ *
+ * @brief Client interface of the SDMA dmaengine driver.
+ *
+ * @ingroup SDMA
+ */
+
+#include <linux/dmaengine.h>
+#include <mach/dma.h>
+
+/*!
+ * SDMA specific slave information for the dmaengine driver.
+ * The peripheral address, watermark and script all come from the
+ * platform channel parameters of \b dma_id, so the tx_reg, rx_reg and
+ * reg_width fields of the generic slave are not used.
+ */
+struct mxc_sdma_slave {
+	struct dma_slave slave;	/*!< generic slave, dma_dev must be set */
+	mxc_dma_device_t dma_id;	/*!< platform DMA request id */
+};
+
+static inline struct mxc_sdma_slave *to_mxc_sdma_slave(struct dma_slave *s)
+{
+	return container_of(s, struct mxc_sdma_slave, slave);
+}
+
+/*!
+ * Prepares a cyclic transfer on a dmaengine channel allocated for an
+ * SDMA slave. The descriptor callback runs once per completed period
+ * until the channel is terminated.
+ *
+ * @param chan        dmaengine channel
+ * @param buf_addr    bus address of the ring buffer
+ * @param buf_len     length of the ring buffer
+ * @param period_len  length of one period
+ * @param direction   DMA_TO_DEVICE or DMA_FROM_DEVICE
+ * @return the prepared descriptor, or NULL on error
+ */
+struct dma_async_tx_descriptor *
+mxc_sdma_prep_dma_cyclic(struct dma_chan *chan, dma_addr_t buf_addr,
+			 size_t buf_len, size_t period_len,
+			 enum dma_data_direction direction);
+
+#endif
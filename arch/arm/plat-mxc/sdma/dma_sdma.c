@@ -34,47 +34,20 @@ static mxc_dma_channel_private_t mxc_sdma_private[MAX_DMA_CHANNELS];
 extern struct clk *mxc_sdma_ahb_clk, *mxc_sdma_ipg_clk;
 
 /*!
- * Tasket to handle processing the channel buffers
+ * Completion of a BD queued by mxc_dma_config(). Called from the SDMA
+ * channel tasklet.
  *
- * @param arg channel id
+ * @param arg    channel number
+ * @param error  MXC_DMA_DONE or MXC_DMA_TRANSFER_ERROR
+ * @param count  number of bytes transferred by the BD
  */
-static void mxc_sdma_channeltasklet(unsigned long arg)
+static void mxc_dma_bd_done(void *arg, int error, unsigned int count)
 {
-	dma_request_t request_t;
-	dma_channel_params chnl_param;
-	mxc_dma_channel_t *chnl_info;
-	mxc_dma_channel_private_t *data_priv;
-	int bd_intr = 0, error = MXC_DMA_DONE;
-
-	chnl_info = &mxc_sdma_channels[arg];
-	data_priv = chnl_info->private;
-	chnl_param =
-	    mxc_sdma_get_channel_params(chnl_info->channel)->chnl_params;
-
-	mxc_dma_get_config(arg, &request_t, data_priv->buf_tail);
+	mxc_dma_channel_t *chnl_info = &mxc_sdma_channels[(int)arg];
 
-	while (request_t.bd_done == 0) {
-		bd_intr = mxc_dma_get_bd_intr(arg, data_priv->buf_tail);
-		if ((data_priv->buf_tail += 1) >= chnl_param.bd_number) {
-			data_priv->buf_tail = 0;
-		}
-		chnl_info->active = 0;
-		if (request_t.bd_error) {
-			error = MXC_DMA_TRANSFER_ERROR;
-		}
-
-		if (bd_intr != 0) {
-			chnl_info->cb_fn(chnl_info->cb_args, error,
-					 request_t.count);
-			error = MXC_DMA_DONE;
-		}
-
-		if (data_priv->buf_tail == chnl_info->curr_buf) {
-			break;
-		}
-		memset(&request_t, 0, sizeof(dma_request_t));
-		mxc_dma_get_config(arg, &request_t, data_priv->buf_tail);
-	}
+	chnl_info->active = 0;
+	if (chnl_info->cb_fn)
+		chnl_info->cb_fn(chnl_info->cb_args, error, count);
 }
 
 /*!
@@ -151,20 +124,21 @@ int mxc_dma_request_ext(mxc_dma_device_t channel_id, char *dev_name,
 		}
 	}
 
+	/* Set the priority first, it decides where the BD ring is placed */
+	if (chnl->chnl_priority != MXC_SDMA_DEFAULT_PRIORITY) {
+		ret = mxc_dma_set_channel_priority(channel_num,
+						   chnl->chnl_priority);
+		if (ret != 0) {
+			pr_info("Failed to set channel prority,\
+				  continue with the existing \
+				  priority\n");
+			goto err_ret;
+		}
+	}
+
 	ret = mxc_dma_setup_channel(channel_num, &chnl->chnl_params);
 
 	if (ret == 0) {
-		if (chnl->chnl_priority != MXC_SDMA_DEFAULT_PRIORITY) {
-			ret =
-			    mxc_dma_set_channel_priority(channel_num,
-							 chnl->chnl_priority);
-			if (ret != 0) {
-				pr_info("Failed to set channel prority,\
-					  continue with the existing \
-					  priority\n");
-				goto err_ret;
-			}
-		}
 		mxc_sdma_channels[channel_num].lock = 1;
 		if ((chnl->chnl_params.transfer_type == per_2_emi)
 		    || (chnl->chnl_params.transfer_type == dsp_2_emi)) {
@@ -175,8 +149,6 @@ int mxc_dma_request_ext(mxc_dma_device_t channel_id, char *dev_name,
 		}
 		mxc_sdma_channels[channel_num].channel = channel_id;
 		data_priv = mxc_sdma_channels[channel_num].private;
-		tasklet_init(&data_priv->chnl_tasklet,
-			     mxc_sdma_channeltasklet, channel_num);
 		if ((channel_id == MXC_DMA_ATA_RX)
 		    || (channel_id == MXC_DMA_ATA_TX)) {
 			data_priv->intr_after_every_bd = 0;
@@ -206,8 +178,6 @@ int mxc_dma_request_ext(mxc_dma_device_t channel_id, char *dev_name,
  */
 int mxc_dma_free(int channel_num)
 {
-	mxc_dma_channel_private_t *data_priv;
-
 	if ((channel_num >= MAX_DMA_CHANNELS) || (channel_num < 0)) {
 		return -EINVAL;
 	}
@@ -224,30 +194,10 @@ int mxc_dma_free(int channel_num)
 
 	mxc_sdma_channels[channel_num].lock = 0;
 	mxc_sdma_channels[channel_num].active = 0;
-	mxc_sdma_channels[channel_num].curr_buf = 0;
-	data_priv = mxc_sdma_channels[channel_num].private;
-	data_priv->buf_tail = 0;
-	tasklet_kill(&data_priv->chnl_tasklet);
 
 	return 0;
 }
 
-/*!
- * Callback function called from the SDMA Interrupt routine
- *
- * @param arg driver specific argument that was registered
- */
-static void mxc_dma_chnl_callback(void *arg)
-{
-	int priv;
-	mxc_dma_channel_private_t *data_priv;
-
-	priv = (int)arg;
-	data_priv = mxc_sdma_channels[priv].private;
-	/* Process the buffers in a tasklet */
-	tasklet_schedule(&data_priv->chnl_tasklet);
-}
-
 /*!
  * This function would just configure the buffers specified by the user into
  * dma channel. The caller must call mxc_dma_enable to start this transfer.
@@ -267,12 +217,13 @@ static void mxc_dma_chnl_callback(void *arg)
 int mxc_dma_config(int channel_num, mxc_dma_requestbuf_t * dma_buf,
 		   int num_buf, mxc_dma_mode_t mode)
 {
-	int ret = 0, i = 0, prev_buf;
+	int ret = 0, i = 0, room;
 	mxc_dma_channel_t *chnl_info;
 	mxc_dma_channel_private_t *data_priv;
 	mxc_sdma_channel_params_t *chnl;
 	dma_channel_params chnl_param;
 	dma_request_t request_t;
+	mxc_dma_callback_t callback;
 
 	if ((channel_num >= MAX_DMA_CHANNELS) || (channel_num < 0)) {
 		return -EINVAL;
@@ -288,16 +239,15 @@ int mxc_dma_config(int channel_num, mxc_dma_requestbuf_t * dma_buf,
 		return -ENODEV;
 	}
 
-	/* Check to see if all buffers are taken */
-	if (chnl_info->active == 1) {
-		return -EBUSY;
-	}
-
 	chnl = mxc_sdma_get_channel_params(chnl_info->channel);
 	chnl_param = chnl->chnl_params;
 
 	/* Re-setup the SDMA channel if the transfer direction is changed */
 	if ((chnl_param.peripheral_type != MEMORY) && (mode != chnl_info->mode)) {
+		/* Reloading the script needs an idle ring */
+		if (mxc_sdma_ring_pending(channel_num)) {
+			return -EBUSY;
+		}
 		if (chnl_param.peripheral_type == DSP) {
 			if (mode == MXC_DMA_MODE_READ) {
 				chnl_param.transfer_type = dsp_2_emi;
@@ -317,30 +267,26 @@ int mxc_dma_config(int channel_num, mxc_dma_requestbuf_t * dma_buf,
 				chnl_param.transfer_type = emi_2_per;
 			}
 		}
-		chnl_param.callback = mxc_dma_chnl_callback;
-		chnl_param.arg = (void *)channel_num;
+		/* The channel keeps its priority across the setup */
 		ret = mxc_dma_setup_channel(channel_num, &chnl_param);
 		if (ret != 0) {
 			return ret;
 		}
-		if (chnl->chnl_priority != MXC_SDMA_DEFAULT_PRIORITY) {
-			ret =
-			    mxc_dma_set_channel_priority(channel_num,
-							 chnl->chnl_priority);
-			if (ret != 0) {
-				pr_info("Failed to set channel prority,\
-					  continue with the existing \
-					  priority\n");
-			}
-		}
 		chnl_info->mode = mode;
 	}
 
+	/* Only queue what fits, so the last BD queued gets the interrupt */
+	room = ((chnl_param.bd_number <= 0) ? 1 : chnl_param.bd_number) -
+	    mxc_sdma_ring_pending(channel_num);
+	if (room <= 0) {
+		chnl_info->active = 1;
+		return -EBUSY;
+	}
+	if (num_buf > room) {
+		num_buf = room;
+	}
+
 	for (i = 0; i < num_buf; i++, dma_buf++) {
-		/* Check to see if all buffers are taken */
-		if (chnl_info->active == 1) {
-			break;
-		}
 		request_t.destAddr = (__u8 *) dma_buf->dst_addr;
 		request_t.sourceAddr = (__u8 *) dma_buf->src_addr;
 		if (chnl_param.peripheral_type == ASRC)
@@ -348,36 +294,22 @@ int mxc_dma_config(int channel_num, mxc_dma_requestbuf_t * dma_buf,
 		else
 			request_t.count = dma_buf->num_of_bytes;
 		request_t.bd_cont = 1;
-		ret = mxc_dma_set_config(channel_num, &request_t,
-					 chnl_info->curr_buf);
+
+		if (data_priv->intr_after_every_bd || (i == num_buf - 1)) {
+			callback = mxc_dma_bd_done;
+		} else {
+			callback = NULL;
+		}
+
+		ret = mxc_sdma_submit(channel_num, &request_t, callback,
+				      (void *)channel_num);
 		if (ret != 0) {
 			break;
 		}
-		if (data_priv->intr_after_every_bd == 0) {
-			if (i == num_buf - 1) {
-				mxc_dma_set_bd_intr(channel_num,
-						    chnl_info->curr_buf, 1);
-			} else {
-				mxc_dma_set_bd_intr(channel_num,
-						    chnl_info->curr_buf, 0);
-			}
-		}
+	}
 
-		prev_buf = chnl_info->curr_buf;
-		if ((chnl_info->curr_buf += 1) >= chnl_param.bd_number) {
-			chnl_info->curr_buf = 0;
-		}
-		if (chnl_info->curr_buf == data_priv->buf_tail) {
-			if ((data_priv->intr_after_every_bd == 0)
-			    && (i != num_buf - 1)) {
-				/*
-				 * Set the BD_INTR flag on the last BD that
-				 * was queued
-				 */
-				mxc_dma_set_bd_intr(channel_num, prev_buf, 1);
-			}
-			chnl_info->active = 1;
-		}
+	if (mxc_sdma_ring_pending(channel_num) >= chnl_param.bd_number) {
+		chnl_info->active = 1;
 	}
 
 	if (i == 0) {
@@ -485,9 +417,6 @@ int mxc_dma_callback_set(int channel_num,
 	mxc_sdma_channels[channel_num].cb_fn = callback;
 	mxc_sdma_channels[channel_num].cb_args = arg;
 
-	mxc_dma_set_callback(channel_num, mxc_dma_chnl_callback,
-			     (void *)channel_num);
-
 	return 0;
 }
 
@@ -551,9 +480,7 @@ static int __init mxc_dma_init(void)
 	for (i = 0; i < MAX_DMA_CHANNELS; i++) {
 		mxc_sdma_channels[i].active = 0;
 		mxc_sdma_channels[i].lock = 0;
-		mxc_sdma_channels[i].curr_buf = 0;
 		mxc_sdma_channels[i].dynamic = 1;
-		mxc_sdma_private[i].buf_tail = 0;
 		mxc_sdma_channels[i].private = &mxc_sdma_private[i];
 	}
 	/*
@@ -89,6 +89,7 @@
 #define IAPI_ERR_RROR_BIT_WRITE        0x19000
 #define IAPI_ERR_NOT_ALLOWED           0x1A000
 #define IAPI_ERR_NO_OS_FN              0x1B000
+#define IAPI_ERR_TIMEOUT               0x1C000
 
 
 /*
@@ -70,7 +70,7 @@ void iapi_AttachCallbackISR (channelDescriptor * cd_p,
 void iapi_DetachCallbackISR (channelDescriptor * cd_p);
 void iapi_ChangeCallbackISR (channelDescriptor * cd_p,
                       void (* func_p)(channelDescriptor * cd_p, void * arg));
-void iapi_lowSynchChannel ( unsigned char channel );
+int iapi_lowSynchChannel ( unsigned char channel );
 void iapi_SetBufferDescriptor(bufferDescriptor *bd_p, unsigned char command,
                        unsigned char status, unsigned short count,
                        void * buffAddr, void * extBufferAddr);
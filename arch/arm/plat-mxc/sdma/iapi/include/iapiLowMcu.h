@@ -45,13 +45,13 @@ int  iapi_ChannelConfig(unsigned char channel, unsigned eventOverride,
 			               unsigned mcuOverride, unsigned dspOverride);
 int  iapi_Channel0Command(channelDescriptor * cd_p, void * buf,
                           unsigned short nbyte, unsigned char command);
-void iapi_lowGetScript(channelDescriptor * cd_p, void * buf, unsigned short size,
+int  iapi_lowGetScript(channelDescriptor * cd_p, void * buf, unsigned short size,
                     unsigned long address);
-void iapi_lowGetContext(channelDescriptor * cd_p, void * buf,
+int  iapi_lowGetContext(channelDescriptor * cd_p, void * buf,
                      unsigned char channel);
-void  iapi_lowSetScript(channelDescriptor * cd_p, void * buf, unsigned short nbyte,
+int  iapi_lowSetScript(channelDescriptor * cd_p, void * buf, unsigned short nbyte,
                      unsigned long destAddr);
-void iapi_lowSetContext(channelDescriptor * cd_p, void * buf,
+int  iapi_lowSetContext(channelDescriptor * cd_p, void * buf,
                      unsigned char channel);
 int iapi_lowAssignScript(channelDescriptor * cd_p, script_data * data_p);
 
@@ -72,6 +72,7 @@
 
 #ifdef CONFIG_SDMA_IRAM
 extern void*(* iapi_iram_Malloc) (size_t size);
+extern void*(* iapi_bd_Malloc) (size_t size, unsigned char channel);
 #endif /*CONFIG_SDMA_IRAM*/
 
 extern void*(* iapi_Malloc) (size_t size);
@@ -81,7 +82,7 @@ extern void*(* iapi_Virt2Phys) (void * ptr);
 extern void*(* iapi_Phys2Virt) (void * ptr);
 
 extern void (* iapi_WakeUp)(int);
-extern void (* iapi_GotoSleep)(int);
+extern int (* iapi_GotoSleep)(int);
 extern void (* iapi_InitSleep)(int);
 
 extern void*(* iapi_memcpy)(void *dest, const void *src, size_t count);
@@ -697,7 +697,12 @@ iapi_Read (channelDescriptor * cd_p, void * buf, unsigned short nbyte)
    * 4. Synchronization mechanism handling
    */
   if( cd_p->callbackSynch == DEFAULT_POLL){
-    iapi_SynchChannel(chNum);
+    result = iapi_SynchChannel(chNum);
+    if (result != IAPI_SUCCESS)
+    {
+      iapi_ReleaseChannel(chNum);
+      return result;
+    }
 
     bd_p = (bufferDescriptor *)iapi_Phys2Virt(ccb_p->baseBDptr);
     toRead = nbyte;
@@ -1033,7 +1038,12 @@ iapi_Write (channelDescriptor * cd_p, void * buf, unsigned short nbyte)
 
   if( cd_p->callbackSynch == DEFAULT_POLL)
   {
-      iapi_SynchChannel(chNum);
+      result = iapi_SynchChannel(chNum);
+      if (result != IAPI_SUCCESS)
+      {
+         iapi_ReleaseChannel(chNum);
+         return result;
+      }
       /*
        * Check the 'RROR' bit on all buffer descriptors, set error number
        *    and return IAPI_FAILURE if set.
@@ -2436,15 +2446,15 @@ iapi_StopChannel(unsigned char channel)
 /**High layer interface for synchronising a channel
  *
  * <b>Algorithm:</b>\n
- *    - call low layer function for stopping a channel
+ *    - call low layer function for synchronising a channel
  *
  * @return
  *     - IAPI_SUCCESS
+ *     - -iapi_errno : the channel did not complete in time
  */
 int iapi_SynchChannel(unsigned char channel)
 {
-   iapi_lowSynchChannel(channel);
-   return IAPI_SUCCESS;
+   return iapi_lowSynchChannel(channel);
 }
 
 #ifdef MCU
@@ -2461,8 +2471,7 @@ int
 iapi_GetScript(channelDescriptor * cd_p, void * buf, unsigned short size,
                     unsigned long address)
 {
-   iapi_lowGetScript(cd_p, buf, size, address);
-   return IAPI_SUCCESS;
+   return iapi_lowGetScript(cd_p, buf, size, address);
 }
 
 /* ***************************************************************************/
@@ -2478,8 +2487,7 @@ int
 iapi_GetContext(channelDescriptor * cd_p, void * buf,
                      unsigned char channel)
 {
-   iapi_lowGetContext(cd_p, buf, channel);
-   return IAPI_SUCCESS;
+   return iapi_lowGetContext(cd_p, buf, channel);
 }
 
 /* ***************************************************************************/
@@ -2495,8 +2503,7 @@ int
 iapi_SetScript(channelDescriptor * cd_p, void * buf, unsigned short nbyte,
                      unsigned long destAddr)
 {
-   iapi_lowSetScript(cd_p, buf, nbyte, destAddr);
-   return IAPI_SUCCESS;
+   return iapi_lowSetScript(cd_p, buf, nbyte, destAddr);
 }
 
 /* ***************************************************************************/
@@ -2512,8 +2519,7 @@ int
 iapi_SetContext(channelDescriptor * cd_p, void * buf,
                      unsigned char channel)
 {
-   iapi_lowSetContext(cd_p, buf, channel);
-   return IAPI_SUCCESS;
+   return iapi_lowSetContext(cd_p, buf, channel);
 }
 
 /* ***************************************************************************/
@@ -2712,7 +2718,7 @@ int iapi_MemCopy(channelDescriptor * cd_p, void* dest, void* src, unsigned long
    {
       iapi_StartChannel(cd_p->channelNumber);
       /* Call synchronization routine*/
-      iapi_SynchChannel(cd_p->channelNumber);
+      result = iapi_SynchChannel(cd_p->channelNumber);
    }
    else
    {
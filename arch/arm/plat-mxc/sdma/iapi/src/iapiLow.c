@@ -107,24 +107,35 @@ iapi_ChangeCallbackISR (channelDescriptor * cd_p,
 }
 
 /* ***************************************************************************/
-/**Loop while the channel is not done on the SDMA
+/**Wait until the channel is done on the SDMA
  *
  * <b>Algorithm:</b>\n
- *    - Loop doing nothing but checking the I.API global variable to indicate
+ *    - Let the OS wait for the I.API global variable to indicate
  * that the channel has been completed (interrupt from SDMA)
+ *    - Stop the channel if the OS gave up waiting
  *
  * <b>Notes:</b>\n
  *    - The ISR must update the I.API global variable iapi_SDMAIntr.
  *
- * @param channel channel number to poll on
+ * @param channel channel number to wait on
  *
- * @return none
+ * @return
+ *     - IAPI_SUCCESS : OK
+ *     - -iapi_errno : the channel did not complete in time
  */
-void
+int
 iapi_lowSynchChannel (unsigned char channel)
 {
-  while (!((1UL << channel) & iapi_SDMAIntr)) ;
+  int result;
+
+  if (GOTO_SLEEP(channel) != 0) {
+   iapi_lowStopChannel(channel);
+   result = IAPI_ERR_TIMEOUT | channel;
+   iapi_errno = result;
+   return -result;
+  }
   iapi_SDMAIntr &= ~(1UL << channel);
+  return IAPI_SUCCESS;
 }
 
 /* ***************************************************************************/
@@ -111,13 +111,13 @@ iapi_Channel0Command( channelDescriptor * cd_p, void * buf,
 
   /* Actually the transfer */
   iapi_lowStartChannel( cd_p->channelNumber );
-  iapi_lowSynchChannel( cd_p->channelNumber );
+  result = iapi_lowSynchChannel( cd_p->channelNumber );
 
   /* Cleaning of allocation */
   FREE( bd_p );
   ccb_p->baseBDptr = NULL;
 
-  return IAPI_SUCCESS;
+  return result;
 
 }
 
@@ -250,9 +250,11 @@ iapi_ChannelConfig (unsigned char channel, unsigned eventOverride,
  * @param *buf pointer to receive context data
  * @param channel channel for which the context data is requested
  *
- * @return none
+ * @return
+ *     - IAPI_SUCCESS : OK
+ *     - -iapi_errno : the channel did not complete in time
  */
-void
+int
 iapi_lowGetContext(channelDescriptor * cd_p, void * buf, unsigned char channel)
 {
   bufferDescriptor * bd_p;
@@ -268,7 +270,7 @@ iapi_lowGetContext(channelDescriptor * cd_p, void * buf, unsigned char channel)
       (void *)(CHANNEL_CONTEXT_BASE_ADDRESS + (sizeof(contextData)*channel/4)));
   /* Receive, polling method*/
   iapi_lowStartChannel(cd_p->channelNumber);
-  iapi_lowSynchChannel(cd_p->channelNumber);
+  return iapi_lowSynchChannel(cd_p->channelNumber);
 }
 /* ***************************************************************************/
 /**Read "size" byte /2 at SDMA address (address) and write them in buf
@@ -288,9 +290,11 @@ iapi_lowGetContext(channelDescriptor * cd_p, void * buf, unsigned char channel)
  * @param size number of bytes to read
  * @param address address in SDMA RAM to start reading from
  *
- * @return none
+ * @return
+ *     - IAPI_SUCCESS : OK
+ *     - -iapi_errno : the channel did not complete in time
  */
-void
+int
 iapi_lowGetScript(channelDescriptor * cd_p, void * buf, unsigned short size,
              unsigned long address)
 {
@@ -307,7 +311,7 @@ iapi_lowGetScript(channelDescriptor * cd_p, void * buf, unsigned short size,
                        (void *)address);
   /* Receive, polling method*/
   iapi_lowStartChannel(cd_p->channelNumber);
-  iapi_lowSynchChannel(cd_p->channelNumber);
+  return iapi_lowSynchChannel(cd_p->channelNumber);
 }
 
 /* ***************************************************************************/
@@ -328,9 +332,11 @@ iapi_lowGetScript(channelDescriptor * cd_p, void * buf, unsigned short size,
  * @param size size of the script, in bytes
  * @param address address in SDMA RAM to place the script
  *
- * @return none
+ * @return
+ *     - IAPI_SUCCESS : OK
+ *     - -iapi_errno : the channel did not complete in time
  */
-void
+int
 iapi_lowSetScript(channelDescriptor * cd_p, void * buf, unsigned short size,
                 unsigned long address)
 {
@@ -347,7 +353,7 @@ iapi_lowSetScript(channelDescriptor * cd_p, void * buf, unsigned short size,
                        (void *)(address));
   /* Receive, polling method*/
   iapi_lowStartChannel(cd_p->channelNumber);
-  iapi_lowSynchChannel(cd_p->channelNumber);
+  return iapi_lowSynchChannel(cd_p->channelNumber);
 }
 
 
@@ -361,9 +367,11 @@ iapi_lowSetScript(channelDescriptor * cd_p, void * buf, unsigned short size,
  * @param *buf pointer to context data
  * @param channel channel to place the context for
  *
- * @return none
+ * @return
+ *     - IAPI_SUCCESS : OK
+ *     - -iapi_errno : the channel did not complete in time
  */
-void
+int
 iapi_lowSetContext(channelDescriptor * cd_p, void * buf, unsigned char channel)
 {
 
@@ -399,8 +407,7 @@ iapi_lowSetContext(channelDescriptor * cd_p, void * buf, unsigned char channel)
 #endif
   /* Send */
   iapi_lowStartChannel( cd_p->channelNumber );
-  iapi_lowSynchChannel( cd_p->channelNumber );
-
+  return iapi_lowSynchChannel( cd_p->channelNumber );
 }
 
 /* ***************************************************************************/
@@ -467,12 +474,12 @@ iapi_lowAssignScript(channelDescriptor * cd_p, script_data * data_p)
    cd0_p = (cd_p->ccb_ptr - cd_p->channelNumber)->channelDescriptor;
 
    /*load the context*/
-   iapi_lowSetContext(cd0_p, chContext, cd_p->channelNumber);
+   result = iapi_lowSetContext(cd0_p, chContext, cd_p->channelNumber);
 
    /* release allocated memory*/
    FREE(chContext);
 
-   return IAPI_SUCCESS;
+   return result;
 }
 
 /* ***************************************************************************/
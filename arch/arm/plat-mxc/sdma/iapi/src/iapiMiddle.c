@@ -68,18 +68,16 @@ iapi_AllocBD (channelControlBlock * ccb_p)
 
   if (ccb_p->channelDescriptor->bufferDescNumber != 0){
 #ifdef CONFIG_SDMA_IRAM
-     channelDescriptor * cd_p = ccb_p->channelDescriptor;
-     if(cd_p->channelNumber >= MXC_DMA_CHANNEL_IRAM) {
-         ptrBD = (bufferDescriptor *)
-           MALLOC( ccb_p->channelDescriptor->bufferDescNumber *
-               sizeof(bufferDescriptor), SDMA_IRAM);
-     } else
+     /* The OS layer picks IRAM or DDR for the ring */
+     ptrBD = (bufferDescriptor *)
+       (* iapi_bd_Malloc)( ccb_p->channelDescriptor->bufferDescNumber *
+           sizeof(bufferDescriptor),
+           ccb_p->channelDescriptor->channelNumber);
+#else /*CONFIG_SDMA_IRAM*/
+     ptrBD = (bufferDescriptor *)
+       MALLOC( ccb_p->channelDescriptor->bufferDescNumber *
+           sizeof(bufferDescriptor), SDMA_ERAM);
 #endif /*CONFIG_SDMA_IRAM*/
-     {
-     	ptrBD = (bufferDescriptor *)
-       		MALLOC( ccb_p->channelDescriptor->bufferDescNumber * 
-           		sizeof(bufferDescriptor), SDMA_ERAM);   
-     }
   }
   if (ptrBD != NULL) {
    ptrBD->mode.command = 0;
@@ -42,6 +42,7 @@
  */
 #ifdef CONFIG_SDMA_IRAM
 void*(* iapi_iram_Malloc) (size_t size);
+void*(* iapi_bd_Malloc) (size_t size, unsigned char channel);
 #endif /*CONFIG_SDMA_IRAM*/
 
 void*(* iapi_Malloc) (size_t size);
@@ -51,7 +52,7 @@ void*(* iapi_Virt2Phys) (void * ptr);
 void*(* iapi_Phys2Virt) (void * ptr);
 
 void (* iapi_WakeUp)(int);
-void (* iapi_GotoSleep)(int);
+int (* iapi_GotoSleep)(int);
 void (* iapi_InitSleep)(int);
 
 void*(* iapi_memcpy)(void *dest, const void *src, size_t count);
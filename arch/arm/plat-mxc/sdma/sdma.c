@@ -25,8 +25,8 @@
 #include <linux/mm.h>
 #include <linux/interrupt.h>
 #include <linux/clk.h>
-#include <linux/semaphore.h>
 #include <linux/spinlock.h>
+#include <linux/delay.h>
 #include <linux/device.h>
 #include <linux/dma-mapping.h>
 #include <linux/proc_fs.h>
@@ -42,20 +42,32 @@
 #define CHAD(ch) sdma_data[0].cd->ccb_ptr[ch].channelDescriptor
 
 /*!
- * SDMA status mutex
+ * Protects channel allocation
  */
-static struct semaphore sdma_status_mutex;
+static DEFINE_SPINLOCK(sdma_status_lock);
 
 /*!
  * SDMA channel sleep queues
  */
-//static struct semaphore sdma_sleep_mutex[MAX_DMA_CHANNELS];
 static wait_queue_head_t sdma_sleep_queue[MAX_DMA_CHANNELS];
 
 /*!
- * SDMA channel synchronization
+ * SDMA channel ownership, one bit per channel, taken by I.API around
+ * channel descriptor updates and released by it when the channel is done.
+ * The BD submission path does not go through I.API.
  */
-static struct semaphore sdma_synch_mutex[MAX_DMA_CHANNELS];
+static unsigned long sdma_channel_owned;
+
+/*!
+ * Waiters for the ownership of a channel
+ */
+static wait_queue_head_t sdma_owner_queue[MAX_DMA_CHANNELS];
+
+/*!
+ * Longest time, in microseconds, a channel command is polled for when
+ * the caller cannot sleep
+ */
+#define SDMA_ATOMIC_WAIT_US	1000
 
 /*!
  * SDMA buffers pool initialization function
@@ -69,6 +81,14 @@ unsigned long flags;
 
 struct clk *mxc_sdma_ahb_clk, *mxc_sdma_ipg_clk;
 
+/*!
+ * Completion callback of a BD queued with mxc_sdma_submit()
+ */
+struct sdma_bd_cb {
+	mxc_dma_callback_t callback;
+	void *arg;
+};
+
 /*!
  * Structure containing sdma channels information.
  */
@@ -101,6 +121,26 @@ typedef struct {
 	unsigned long word_size:8;
 	/*! channel descriptor pointer */
 	channelDescriptor *cd;
+	/*! channel priority, also decides where the BD ring is placed */
+	int priority;
+	/*! Set by mxc_dma_start(), cleared by mxc_dma_stop() */
+	int enabled;
+	/*! BDs are queued with mxc_sdma_submit() and reaped by ring_tasklet */
+	int ring;
+	/*! virtual address of the channel BD array */
+	bufferDescriptor *bd;
+	/*! completion callbacks, one per BD */
+	struct sdma_bd_cb *bd_cb;
+	/*! next BD to fill */
+	int bd_head;
+	/*! next BD to reap */
+	int bd_tail;
+	/*! number of BDs owned by SDMA */
+	int bd_queued;
+	/*! protects the ring indexes and callbacks */
+	spinlock_t ring_lock;
+	/*! reaps completed BDs and runs their callbacks */
+	struct tasklet_struct ring_tasklet;
 } sdma_struct;
 
 /*!
@@ -116,7 +156,7 @@ static sdma_script_start_addrs sdma_script_addrs;
 extern void mxc_sdma_get_script_info(sdma_script_start_addrs * sdma_script_add);
 
 /*!
- * Init sleep mutex of the channel
+ * Init sleep queue of the channel
  *
  * @param  channel  channel number
  */
@@ -126,17 +166,32 @@ static void sdma_init_sleep(int channel)
 }
 
 /*!
- * Puts channel to sleep
+ * Puts channel to sleep until its interrupt. A caller that cannot sleep
+ * polls for at most SDMA_ATOMIC_WAIT_US instead.
  *
  * @param  channel  channel number
+ *
+ * @return 0 once the channel is done, -ETIMEDOUT if an atomic caller gave up
  */
-static void sdma_sleep_channel(int channel)
+static int sdma_sleep_channel(int channel)
 {
+	int us;
+
+	if (irqs_disabled() || in_atomic()) {
+		for (us = 0; us < SDMA_ATOMIC_WAIT_US; us++) {
+			if (iapi_SDMAIntr & (1 << channel))
+				return 0;
+			udelay(1);
+		}
+		return -ETIMEDOUT;
+	}
+
 	while ((iapi_SDMAIntr & (1 << channel)) == 0) {
 		wait_event_interruptible(sdma_sleep_queue[channel],
 					 ((iapi_SDMAIntr & (1 << channel)) !=
 					  0));
 	}
+	return 0;
 }
 
 /*!
@@ -180,6 +235,11 @@ static void iapi_interrupt_callback(channelDescriptor * cd,
 
 	channel_data->running = 0;
 
+	if (channel_data->ring) {
+		tasklet_schedule(&channel_data->ring_tasklet);
+		return;
+	}
+
 	arg = channel_data->arg;
 
 	if (arg == 0) {
@@ -563,6 +623,92 @@ static int sdma_load_context(int channel, dma_channel_params * p)
 	return res;
 }
 
+/*!
+ * Reaps the BDs SDMA has handed back and runs their callbacks, in
+ * submission order. Runs from the channel tasklet.
+ *
+ * @param   data              channel number
+ */
+static void sdma_ring_tasklet(unsigned long data)
+{
+	sdma_struct *s = &sdma_data[data];
+	struct sdma_bd_cb cb;
+	modeCount mode;
+	unsigned long flags;
+	int error;
+
+	spin_lock_irqsave(&s->ring_lock, flags);
+	while (s->bd_queued) {
+		mode = s->bd[s->bd_tail].mode;
+		if (mode.status & BD_DONE)
+			break;
+
+		error = (mode.status & BD_RROR) ?
+		    MXC_DMA_TRANSFER_ERROR : MXC_DMA_DONE;
+		cb = s->bd_cb[s->bd_tail];
+
+		if (++s->bd_tail == s->bd_number)
+			s->bd_tail = 0;
+		s->bd_queued--;
+
+		if (cb.callback) {
+			spin_unlock_irqrestore(&s->ring_lock, flags);
+			cb.callback(cb.arg, error, mode.count);
+			spin_lock_irqsave(&s->ring_lock, flags);
+		}
+	}
+	spin_unlock_irqrestore(&s->ring_lock, flags);
+}
+
+/*!
+ * (Re)initializes the submission ring after the channel BDs have been
+ * (re)allocated. The channel must be idle.
+ *
+ * @param   channel           channel number
+ * @return  0 on success, error code on fail
+ */
+static int sdma_ring_init(int channel)
+{
+	sdma_struct *s = &sdma_data[channel];
+	struct sdma_bd_cb *bd_cb;
+	unsigned long flags;
+
+	bd_cb = kcalloc(s->bd_number, sizeof(*bd_cb), GFP_KERNEL);
+	if (bd_cb == NULL)
+		return -ENOMEM;
+
+	tasklet_kill(&s->ring_tasklet);
+
+	spin_lock_irqsave(&s->ring_lock, flags);
+	kfree(s->bd_cb);
+	s->bd_cb = bd_cb;
+	s->bd = iapi_Phys2Virt(s->cd->ccb_ptr->baseBDptr);
+	s->bd_head = 0;
+	s->bd_tail = 0;
+	s->bd_queued = 0;
+	s->ring = 0;
+	spin_unlock_irqrestore(&s->ring_lock, flags);
+
+	return 0;
+}
+
+/*!
+ * Releases the submission ring of a channel being freed.
+ *
+ * @param   channel           channel number
+ */
+static void sdma_ring_free(int channel)
+{
+	sdma_struct *s = &sdma_data[channel];
+
+	tasklet_kill(&s->ring_tasklet);
+	kfree(s->bd_cb);
+	s->bd_cb = NULL;
+	s->bd = NULL;
+	s->bd_queued = 0;
+	s->ring = 0;
+}
+
 /*!
  * Setup channel according to parameters. Must be called once after mxc_request_dma()
  *
@@ -604,6 +750,10 @@ descriptors (0x%x)\n", err);
 		goto setup_channel_fail;
 	}
 
+	err = sdma_ring_init(channel);
+	if (err < 0)
+		goto setup_channel_fail;
+
 	if (channel != 0) {
 		switch (p->transfer_type) {
 		case dsp_2_per:
@@ -675,7 +825,7 @@ descriptors (0x%x)\n", err);
 		if (err == 0) {
 			err = sdma_load_context(channel, p);
 			iapi_IoCtl(sdma_data[channel].cd, IAPI_CHANGE_PRIORITY,
-				   MXC_SDMA_DEFAULT_PRIORITY);
+				   sdma_data[channel].priority);
 		}
 	}
       setup_channel_fail:
@@ -693,12 +843,18 @@ descriptors (0x%x)\n", err);
  */
 int mxc_dma_set_channel_priority(unsigned int channel, unsigned int priority)
 {
+	int err;
+
 	if (priority < MXC_SDMA_MIN_PRIORITY
 	    || priority > MXC_SDMA_MAX_PRIORITY) {
 		return -EINVAL;
 	}
-	return iapi_IoCtl(sdma_data[channel].cd, IAPI_CHANGE_PRIORITY,
-			  priority);
+	err = iapi_IoCtl(sdma_data[channel].cd, IAPI_CHANGE_PRIORITY,
+			 priority);
+	if (err == 0) {
+		sdma_data[channel].priority = priority;
+	}
+	return err;
 }
 
 /*!
@@ -715,10 +871,11 @@ int mxc_dma_set_channel_priority(unsigned int channel, unsigned int priority)
 int mxc_request_dma(int *channel, const char *devicename)
 {
 	int i, res;
+	unsigned long flags;
 
 	res = 0;
 
-	down(&sdma_status_mutex);
+	spin_lock_irqsave(&sdma_status_lock, flags);
 
 	/* Dynamic allocation */
 	if (*channel == 0) {
@@ -737,30 +894,37 @@ int mxc_request_dma(int *channel, const char *devicename)
 
 	if (*channel > 0 && *channel < MAX_DMA_CHANNELS &&
 	    sdma_data[*channel].in_use == 0) {
-		res = iapi_Open(sdma_data[0].cd, *channel);
-
-		if (res < 0) {
-			printk(KERN_ERR "Failed iapi_Open channel %d, 0x%x\n",
-			       *channel, res);
-		} else {
-			sdma_data[*channel].in_use = 1;
-			strcpy(sdma_data[*channel].devicename, devicename);
-			sdma_data[*channel].cd = CHAD(*channel);
-
-			iapi_IoCtl(sdma_data[*channel].cd, IAPI_CHANGE_SYNCH,
-				   CALLBACK_ISR);
-			iapi_IoCtl(sdma_data[*channel].cd,
-				   IAPI_CHANGE_CALLBACKFUNC,
-				   (unsigned long)iapi_interrupt_callback);
-			iapi_IoCtl(sdma_data[*channel].cd,
-				   IAPI_CHANGE_USER_ARG,
-				   (unsigned long)&(sdma_data[*channel]));
-		}
+		/* Reserve the channel, iapi_Open() allocates and may sleep */
+		sdma_data[*channel].in_use = 1;
+		sdma_data[*channel].priority = MXC_SDMA_DEFAULT_PRIORITY;
 	} else {
 		res = -EBUSY;
 	}
 
-	up(&sdma_status_mutex);
+	spin_unlock_irqrestore(&sdma_status_lock, flags);
+
+	if (res < 0)
+		return res;
+
+	res = iapi_Open(sdma_data[0].cd, *channel);
+
+	if (res < 0) {
+		printk(KERN_ERR "Failed iapi_Open channel %d, 0x%x\n",
+		       *channel, res);
+		sdma_data[*channel].in_use = 0;
+	} else {
+		strcpy(sdma_data[*channel].devicename, devicename);
+		sdma_data[*channel].cd = CHAD(*channel);
+
+		iapi_IoCtl(sdma_data[*channel].cd, IAPI_CHANGE_SYNCH,
+			   CALLBACK_ISR);
+		iapi_IoCtl(sdma_data[*channel].cd,
+			   IAPI_CHANGE_CALLBACKFUNC,
+			   (unsigned long)iapi_interrupt_callback);
+		iapi_IoCtl(sdma_data[*channel].cd,
+			   IAPI_CHANGE_USER_ARG,
+			   (unsigned long)&(sdma_data[*channel]));
+	}
 
 	return res;
 }
@@ -855,6 +1019,135 @@ int mxc_dma_set_config(int channel, dma_request_t * p, int bd_index)
 	return 0;
 }
 
+/*!
+ * Queues one transfer on the channel BD ring. Unlike
+ * mxc_dma_set_config() this writes the BD directly, never sleeps and may
+ * be called from any context, including a completion callback. If the
+ * channel has been started the transfer is kicked at once, so that
+ * back-to-back submissions run without idle gaps.
+ *
+ * @param   channel           channel number
+ * @param   p                 request parameters pointer
+ * @param   callback          called from the channel tasklet once SDMA is
+ *                            done with the BD, or NULL for no interrupt
+ * @param   arg               argument for callback
+ * @return  0 on success, -EBUSY if all BDs are in use, -EINVAL if the
+ *          channel is not set up
+ */
+int mxc_sdma_submit(int channel, dma_request_t * p,
+		    mxc_dma_callback_t callback, void *arg)
+{
+	sdma_struct *s = &sdma_data[channel];
+	bufferDescriptor *bd;
+	modeCount mode;
+	unsigned long flags;
+	int index;
+
+	if (!s->in_use || s->bd == NULL)
+		return -EINVAL;
+
+	spin_lock_irqsave(&s->ring_lock, flags);
+
+	if (s->bd_queued == s->bd_number) {
+		spin_unlock_irqrestore(&s->ring_lock, flags);
+		return -EBUSY;
+	}
+
+	index = s->bd_head;
+	bd = &s->bd[index];
+
+	switch (s->transfer_type) {
+	case emi_2_int:
+	case emi_2_emi:
+	case int_2_int:
+	case int_2_emi:
+		bd->bufferAddr = p->sourceAddr;
+		bd->extBufferAddr = p->destAddr;
+		break;
+	case per_2_int:
+	case per_2_emi:
+	case per_2_dsp:
+	case dsp_2_int:
+	case dsp_2_emi:
+	case dsp_2_dsp:
+	case dsp_2_emi_loop:
+		bd->bufferAddr = p->destAddr;
+		break;
+	default:
+		bd->bufferAddr = p->sourceAddr;
+		break;
+	}
+
+	s->bd_cb[index].callback = callback;
+	s->bd_cb[index].arg = arg;
+
+	mode.command = s->word_size;
+	mode.count = p->count;
+	mode.status = BD_DONE | BD_EXTD;
+	if (callback)
+		mode.status |= BD_INTR;
+	if (s->bd_number > 1 && p->bd_cont)
+		mode.status |= BD_CONT;
+	if (index == s->bd_number - 1)
+		mode.status |= BD_WRAP;
+
+	/* Hand the BD over to SDMA only once the addresses are visible */
+	wmb();
+	bd->mode = mode;
+
+	if (++s->bd_head == s->bd_number)
+		s->bd_head = 0;
+	s->bd_queued++;
+	s->ring = 1;
+
+	spin_unlock_irqrestore(&s->ring_lock, flags);
+
+	if (s->enabled)
+		iapi_StartChannel(channel);
+
+	return 0;
+}
+
+/*!
+ * Returns the number of BDs queued with mxc_sdma_submit() that SDMA has
+ * not handed back yet.
+ *
+ * @param   channel           channel number
+ */
+int mxc_sdma_ring_pending(int channel)
+{
+	return sdma_data[channel].bd_queued;
+}
+
+/*!
+ * Drops every BD queued with mxc_sdma_submit() on a stopped channel, so
+ * that the next submission starts again at the first BD. Callbacks of the
+ * dropped BDs are not run. Never sleeps and may be called from any
+ * context, including a completion callback.
+ *
+ * @param   channel           channel number
+ */
+void mxc_sdma_ring_reset(int channel)
+{
+	sdma_struct *s = &sdma_data[channel];
+	unsigned long flags;
+	int i;
+
+	spin_lock_irqsave(&s->ring_lock, flags);
+	if (s->bd != NULL) {
+		for (i = 0; i < s->bd_number; i++) {
+			s->bd[i].mode.status = 0;
+			s->bd_cb[i].callback = NULL;
+		}
+		/* SDMA picks the current BD up from the CCB on the next start */
+		s->cd->ccb_ptr->currentBDptr = s->cd->ccb_ptr->baseBDptr;
+	}
+	s->bd_head = 0;
+	s->bd_tail = 0;
+	s->bd_queued = 0;
+	spin_unlock_irqrestore(&s->ring_lock, flags);
+}
+
 /*!
  * Configures the BD_INTR bit on a buffer descriptor parameters.
  *
@@ -1032,7 +1325,13 @@ int mxc_sdma_read_ipcv2(int channel, void *ctrl_ptr)
  */
 int mxc_dma_start(int channel)
 {
-	if (sdma_data[channel].running == 0) {
+	sdma_data[channel].enabled = 1;
+
+	/*
+	 * A ring channel may have stopped on its last BD before the
+	 * interrupt cleared running, so always kick it.
+	 */
+	if (sdma_data[channel].running == 0 || sdma_data[channel].ring) {
 		sdma_data[channel].running = 1;
 		iapi_StartChannel(channel);
 	}
@@ -1047,6 +1346,7 @@ int mxc_dma_start(int channel)
  */
 int mxc_dma_stop(int channel)
 {
+	sdma_data[channel].enabled = 0;
 	iapi_StopChannel(channel);
 	sdma_data[channel].running = 0;
 
@@ -1085,6 +1385,8 @@ void mxc_free_dma(int channel)
 			   IAPI_CHANGE_SET_STATUS, (unsigned long)0);
 	}
 
+	sdma_ring_free(channel);
+
 	iapi_Close(sdma_data[channel].cd);
 
 	strcpy(sdma_data[channel].devicename, "not used");
@@ -1128,33 +1430,39 @@ void mxc_dma_set_callback(int channel, dma_callback_t callback, void *arg)
 }
 
 /*!
- * Synchronization function used by I.API
+ * Synchronization function used by I.API. Takes the ownership bit of the
+ * channel; process context waits for a busy channel to be released, atomic
+ * callers get -EBUSY.
  *
  * @param channel        channel number
  */
 static int getChannel(int channel)
 {
-	if (irqs_disabled() || in_atomic()) {
-		if (down_trylock(&sdma_synch_mutex[channel])) {
-			return -EBUSY;
-		}
-	} else {
-		if (down_interruptible(&sdma_synch_mutex[channel])) {
-			return -EBUSY;
-		}
-	}
+	if (!test_and_set_bit(channel, &sdma_channel_owned))
+		return 0;
+
+	if (irqs_disabled() || in_atomic())
+		return -EBUSY;
+
+	if (wait_event_interruptible(sdma_owner_queue[channel],
+				     !test_and_set_bit(channel,
+						       &sdma_channel_owned)))
+		return -EBUSY;
 
 	return 0;
 }
 
 /*!
- * Synchronization function used by I.API
+ * Synchronization function used by I.API, also called from the SDMA
+ * interrupt once a channel is done
  *
  * @param channel        channel number
  */
 static int releaseChannel(int channel)
 {
-	up(&sdma_synch_mutex[channel]);
+	smp_mb__before_clear_bit();
+	clear_bit(channel, &sdma_channel_owned);
+	wake_up_interruptible(&sdma_owner_queue[channel]);
 	return 0;
 }
 
@@ -1180,6 +1488,20 @@ static void mask_sdma_interrupt(void)
 	 */
 }
 
+#ifdef CONFIG_SDMA_IRAM
+/*!
+ * Allocates the BD ring of a channel according to its priority
+ *
+ * @param   size     size of the ring in bytes
+ * @param   channel  channel number
+ * @return  pointer to the ring
+ */
+static void *sdma_channel_bd_malloc(size_t size, unsigned char channel)
+{
+	return sdma_bd_malloc(size, channel, sdma_data[channel].priority);
+}
+#endif				/*CONFIG_SDMA_IRAM */
+
 /*!
  * Initializes I.API
  */
@@ -1192,6 +1514,7 @@ static void __init init_iapi_struct(void)
 	iapi_Malloc = &sdma_malloc;
 #ifdef CONFIG_SDMA_IRAM
 	iapi_iram_Malloc = &sdma_iram_malloc;
+	iapi_bd_Malloc = &sdma_channel_bd_malloc;
 #endif				/*CONFIG_SDMA_IRAM */
 
 	iapi_Free = &sdma_free;
@@ -1216,20 +1539,6 @@ static void __init init_iapi_struct(void)
 	sdma_data[0].cd = cd;
 }
 
-/*!
- * Initializes channel synchronization mutexes
- */
-static void __init init_mutexes(void)
-{
-	int i;
-
-	for (i = 0; i < MAX_DMA_CHANNELS; i++) {
-		init_MUTEX(&sdma_synch_mutex[i]);
-	}
-
-	init_MUTEX(&sdma_status_mutex);
-}
-
 /*!
  * Channels status read proc file system function
  *
@@ -1302,6 +1611,10 @@ static int __init init_proc_fs(void)
 	sdma_proc_dir = proc_mkdir("sdma", NULL);
 	create_proc_read_entry("channels", 0, sdma_proc_dir,
 			       proc_read_channels, NULL);
+#ifdef CONFIG_SDMA_IRAM
+	create_proc_read_entry("iram", 0, sdma_proc_dir,
+			       sdma_iram_read_proc, NULL);
+#endif				/*CONFIG_SDMA_IRAM */
 
 	if (res < 0) {
 		printk(KERN_WARNING "Failed create SDMA proc entry\n");
@@ -1323,6 +1636,9 @@ static void __init init_sdma_data(void)
 
 	for (i = 0; i < MAX_DMA_CHANNELS; i++) {
 		sdma_data[i].channel = i;
+		init_waitqueue_head(&sdma_owner_queue[i]);
+		spin_lock_init(&sdma_data[i].ring_lock);
+		tasklet_init(&sdma_data[i].ring_tasklet, sdma_ring_tasklet, i);
 	}
 }
 
@@ -1411,8 +1727,6 @@ int __init sdma_init(void)
 		goto sdma_init_fail;
 	}
 
-	init_mutexes();
-
 	init_iapi_struct();
 
 	mxc_sdma_get_script_info(&sdma_script_addrs);
@@ -1462,6 +1776,9 @@ EXPORT_SYMBOL(mxc_free_dma);
 EXPORT_SYMBOL(mxc_dma_setup_channel);
 EXPORT_SYMBOL(mxc_dma_set_channel_priority);
 EXPORT_SYMBOL(mxc_dma_set_config);
+EXPORT_SYMBOL(mxc_sdma_submit);
+EXPORT_SYMBOL(mxc_sdma_ring_pending);
+EXPORT_SYMBOL(mxc_sdma_ring_reset);
 EXPORT_SYMBOL(mxc_dma_get_config);
 EXPORT_SYMBOL(mxc_dma_set_bd_intr);
 EXPORT_SYMBOL(mxc_dma_get_bd_intr);
@@ -30,6 +30,8 @@
 #include <linux/device.h>
 #include <linux/dma-mapping.h>
 #include <linux/dmapool.h>
+#include <linux/genalloc.h>
+#include <linux/spinlock.h>
 
 #define DEBUG 0
 
@@ -42,19 +44,15 @@
 #ifdef CONFIG_SDMA_IRAM
 #define IRAM_VIRT_BASE  IRAM_BASE_ADDR_VIRT
 #define IRAM_PHYS_BASE  IRAM_BASE_ADDR
-#if (CONFIG_SDMA_IRAM_SIZE&0x3FF)
-#error  "IRAM size of SDMA should be multiple of 1Kbytes"
-#else
 #define IRAM_SDMA_SIZE  CONFIG_SDMA_IRAM_SIZE	/* 4K */
-#endif
-#define IRAM_UNIT_SIZE  512
-#define IRAM_POOL_SIZE  (IRAM_SDMA_SIZE/IRAM_UNIT_SIZE)
+/*! IRAM allocation granule (32 bytes) as an order of 2 */
+#define IRAM_MIN_ORDER  5
 
-#define IS_IRAM_VIRT(x) (((x)<IRAM_VIRT_BASE)?0:\
-                                (((x) - IRAM_VIRT_BASE)>IRAM_SDMA_SIZE)?0:1)
+#define IS_IRAM_VIRT(x) (((x) >= IRAM_VIRT_BASE) && \
+			 (((x) - IRAM_VIRT_BASE) < iram_size))
 
-#define IS_IRAM_PHYS(x) (((x)<IRAM_PHYS_BASE)?0:\
-                                (((x) - IRAM_PHYS_BASE)>IRAM_SDMA_SIZE)?0:1)
+#define IS_IRAM_PHYS(x) (((x) >= IRAM_PHYS_BASE) && \
+			 (((x) - IRAM_PHYS_BASE) < iram_size))
 #endif				/*CONFIG_SDMA_IRAM */
 
 /*!
@@ -63,15 +61,52 @@
 static struct dma_pool *pool;
 
 #ifdef CONFIG_SDMA_IRAM
-typedef struct iram_head_s {
+/*!
+ * IRAM allocation record, needed because gen_pool_free() wants the size
+ */
+typedef struct iram_block_s {
 	struct list_head list;
-} iram_head_t;
-
-static spinlock_t iram_pool_lock = SPIN_LOCK_UNLOCKED;
-static struct list_head iram_free_list;
-static unsigned char iram_pool_flag[IRAM_POOL_SIZE];
+	unsigned long addr;
+	size_t size;
+	/*! Owning channel, -1 for the channel control blocks */
+	int channel;
+} iram_block_t;
+
+static DEFINE_SPINLOCK(iram_pool_lock);
+static LIST_HEAD(iram_blocks);
+static struct gen_pool *iram_pool;
+
+/*! Bytes of IRAM handed to SDMA, may be lowered with "sdma_iram=" */
+static unsigned long iram_size = IRAM_SDMA_SIZE;
+
+/*! IRAM occupancy and placement statistics, reported in /proc/sdma/iram */
+static struct {
+	unsigned long used;
+	unsigned long peak;
+	unsigned long iram_allocs;
+	unsigned long ddr_fallbacks;
+} iram_stats;
 
 static void sdma_iram_free(void *buf);
+
+/*!
+ * Parses "sdma_iram=<size>". The SDMA region can only be shrunk at boot,
+ * the IRAM behind it is laid out at build time. 0 keeps everything in DDR.
+ */
+static int __init sdma_iram_setup(char *str)
+{
+	unsigned long size = memparse(str, &str);
+
+	if (size > IRAM_SDMA_SIZE) {
+		printk(KERN_WARNING "sdma_iram: limiting to %d bytes\n",
+		       IRAM_SDMA_SIZE);
+		size = IRAM_SDMA_SIZE;
+	}
+	iram_size = size & ~((1UL << IRAM_MIN_ORDER) - 1);
+	return 1;
+}
+
+__setup("sdma_iram=", sdma_iram_setup);
 #endif				/*CONFIG_SDMA_IRAM */
 
 /*!
@@ -174,10 +209,6 @@ unsigned long sdma_virt_to_phys(void *buf)
 
 #ifdef CONFIG_SDMA_IRAM
 	if (IS_IRAM_VIRT((unsigned long)buf)) {
-		if ((unsigned long)buf & (IRAM_UNIT_SIZE - 1)) {
-			printk(KERN_WARNING "%s buffer offset = %ld\n",
-			       __FUNCTION__, (unsigned long)buf);
-		}
 		return (unsigned long)buf + IRAM_PHYS_BASE - IRAM_VIRT_BASE;
 	}
 #endif				/*CONFIG_SDMA_IRAM */
@@ -211,10 +242,6 @@ void *sdma_phys_to_virt(unsigned long buf)
 
 #ifdef CONFIG_SDMA_IRAM
 	if (IS_IRAM_PHYS((unsigned long)buf)) {
-		if (buf & (IRAM_UNIT_SIZE - 1)) {
-			printk(KERN_WARNING "%s buffer offset = %ld\n",
-			       __FUNCTION__, (unsigned long)buf);
-		}
 		return (void *)buf + IRAM_VIRT_BASE - IRAM_PHYS_BASE;
 	}
 #endif				/*CONFIG_SDMA_IRAM */
@@ -284,49 +311,105 @@ void sdma_free(void *buf)
 
 #ifdef CONFIG_SDMA_IRAM
 /*!
- * Allocates uncacheable buffer from IRAM
+ * Carves a block out of the SDMA IRAM region
+ *
+ * @param   size     size of the block
+ * @param   limit    IRAM occupancy the block may not push the region past
+ * @param   channel  owning channel, -1 for shared structures
+ * @return  pointer to the block, NULL if it does not fit
+ */
+static void *iram_alloc(size_t size, unsigned long limit, int channel)
+{
+	iram_block_t *blk;
+	unsigned long addr, flags;
+
+	if (iram_pool == NULL || size == 0) {
+		return NULL;
+	}
+
+	size = ALIGN(size, 1UL << IRAM_MIN_ORDER);
+
+	blk = kmalloc(sizeof(iram_block_t), GFP_KERNEL);
+	if (blk == NULL) {
+		return NULL;
+	}
+
+	spin_lock_irqsave(&iram_pool_lock, flags);
+	if (iram_stats.used + size > limit) {
+		spin_unlock_irqrestore(&iram_pool_lock, flags);
+		kfree(blk);
+		return NULL;
+	}
+	addr = gen_pool_alloc(iram_pool, size);
+	if (addr == 0) {
+		spin_unlock_irqrestore(&iram_pool_lock, flags);
+		kfree(blk);
+		return NULL;
+	}
+	blk->addr = addr;
+	blk->size = size;
+	blk->channel = channel;
+	list_add_tail(&blk->list, &iram_blocks);
+	iram_stats.used += size;
+	if (iram_stats.used > iram_stats.peak) {
+		iram_stats.peak = iram_stats.used;
+	}
+	iram_stats.iram_allocs++;
+	spin_unlock_irqrestore(&iram_pool_lock, flags);
+
+	DPRINTK("allocated %zu bytes of IRAM at 0x%08lx\n", size, addr);
+	return (void *)addr;
+}
+
+/*!
+ * Allocates uncacheable buffer from IRAM. Used for the channel control
+ * blocks, which may take the whole region.
+ *
+ * @param   size    size of allocated buffer
+ * @return  pointer to buffer
  */
 void *sdma_iram_malloc(size_t size)
 {
-	void *buf = NULL;
-	int index = -1;
-	unsigned long flags;
-	if (size > IRAM_UNIT_SIZE) {
-		printk(KERN_WARNING
-		       "size in sdma_iram_malloc is more than %d bytes\n",
-		       IRAM_UNIT_SIZE);
+	return iram_alloc(size, iram_size, -1);
+}
+
+/*!
+ * Allocates a channel's buffer descriptor ring. The ring goes to IRAM when
+ * there is room for it, otherwise to DDR. Channels at the default priority
+ * may only fill part of the region so that higher priority channels set up
+ * later still find space; the statically mapped IRAM channels and priority
+ * MXC_SDMA_MAX_PRIORITY may use all of it.
+ *
+ * @param   size      size of the ring in bytes
+ * @param   channel   channel number
+ * @param   priority  channel priority
+ * @return  pointer to buffer
+ */
+void *sdma_bd_malloc(size_t size, int channel, int priority)
+{
+	unsigned long limit, flags;
+	void *buf;
+
+	if (channel >= MXC_DMA_CHANNEL_IRAM || priority >= MXC_SDMA_MAX_PRIORITY) {
+		limit = iram_size;
 	} else {
+		limit = iram_size * (MXC_SDMA_MAX_PRIORITY + priority) /
+		    (2 * MXC_SDMA_MAX_PRIORITY);
+	}
+
+	buf = iram_alloc(size, limit, channel);
+	if (buf != NULL) {
+		return buf;
+	}
+
+	if (iram_size != 0) {
 		spin_lock_irqsave(&iram_pool_lock, flags);
-		if (!list_empty(&iram_free_list)) {
-			buf =
-			    list_entry(iram_free_list.next, iram_head_t, list);
-			list_del(iram_free_list.next);
-			index =
-			    ((unsigned long)buf -
-			     IRAM_VIRT_BASE) / IRAM_UNIT_SIZE;
-			if (index < 0 || index >= IRAM_POOL_SIZE) {
-				spin_unlock_irqrestore(&iram_pool_lock, flags);
-				printk(KERN_ERR "The iram pool has crashed\n");
-				return NULL;
-			}
-			if (iram_pool_flag[index]) {
-				spin_unlock_irqrestore(&iram_pool_lock, flags);
-				printk(KERN_WARNING
-				       "iram block %d  already has been allocated \n",
-				       index);
-			}
-			iram_pool_flag[index] = 1;
-		}
+		iram_stats.ddr_fallbacks++;
 		spin_unlock_irqrestore(&iram_pool_lock, flags);
-		if ((unsigned long)buf & (IRAM_UNIT_SIZE - 1)) {
-			printk(KERN_WARNING
-			       "the start address is not align of %d, buffer offset %ld\n",
-			       IRAM_UNIT_SIZE, (unsigned long)buf);
-
-			buf = PTR_ALIGN(buf, IRAM_UNIT_SIZE);
-		}
+		DPRINTK("channel %d ring (%zu bytes) falls back to DDR\n",
+			channel, size);
 	}
-	return buf;
+	return sdma_malloc(size);
 }
 
 /*!
@@ -334,38 +417,102 @@ void *sdma_iram_malloc(size_t size)
  */
 static void sdma_iram_free(void *buf)
 {
-	iram_head_t *p;
-	int index;
+	iram_block_t *blk;
 	unsigned long flags;
-	/* The check of parameter will be done in sdma_free */
-	index = ((unsigned long)buf - IRAM_VIRT_BASE) / IRAM_UNIT_SIZE;
+
 	spin_lock_irqsave(&iram_pool_lock, flags);
-	p = (iram_head_t *) ((unsigned long)buf & (~(IRAM_UNIT_SIZE - 1)));
-	list_add_tail(&(p->list), &iram_free_list);
-	if (iram_pool_flag[index]) {
-		iram_pool_flag[index] = 0;
-		spin_unlock_irqrestore(&iram_pool_lock, flags);
-	} else {
-		printk(KERN_WARNING
-		       "Free %p which IRAM block %d is already freed\n", buf,
-		       index);
-		spin_unlock_irqrestore(&iram_pool_lock, flags);
+	list_for_each_entry(blk, &iram_blocks, list) {
+		if (blk->addr == (unsigned long)buf) {
+			list_del(&blk->list);
+			gen_pool_free(iram_pool, blk->addr, blk->size);
+			iram_stats.used -= blk->size;
+			spin_unlock_irqrestore(&iram_pool_lock, flags);
+			kfree(blk);
+			return;
+		}
 	}
+	spin_unlock_irqrestore(&iram_pool_lock, flags);
+
+	printk(KERN_WARNING "SDMA malloc: free of unknown IRAM block %p\n",
+	       buf);
 }
 
 /*!
- * Initialized the free list of IRAM.
+ * IRAM statistics read proc file system function
+ *
+ * @param    buf	pointer to the buffer the data shuld be written to.
+ * @param    start	pointer to the pointer where the new data is
+ *                      written to.
+ * @param    offset	offset from start of the file
+ * @param    count	number of bytes to read.
+ * @param    eof	pointer to eof flag.
+ * @param    data	driver specific data pointer.
+ *
+ * @return   number of bytes written to the buffer.
+ */
+int sdma_iram_read_proc(char *buf, char **start, off_t offset, int count,
+			int *eof, void *data)
+{
+	iram_block_t *blk;
+	unsigned long flags;
+	int len = 0;
+
+	*eof = 1;
+	if (offset > 0) {
+		return 0;
+	}
+
+	spin_lock_irqsave(&iram_pool_lock, flags);
+	len += sprintf(buf + len, "size:          %lu\n", iram_size);
+	len += sprintf(buf + len, "used:          %lu\n", iram_stats.used);
+	len += sprintf(buf + len, "peak:          %lu\n", iram_stats.peak);
+	len += sprintf(buf + len, "iram allocs:   %lu\n",
+		       iram_stats.iram_allocs);
+	len += sprintf(buf + len, "ddr fallbacks: %lu\n",
+		       iram_stats.ddr_fallbacks);
+	list_for_each_entry(blk, &iram_blocks, list) {
+		if (len > count - 48) {
+			break;
+		}
+		if (blk->channel < 0) {
+			len += sprintf(buf + len, "0x%08lx %5zu ccb\n",
+				       blk->addr - IRAM_VIRT_BASE +
+				       IRAM_PHYS_BASE, blk->size);
+		} else {
+			len += sprintf(buf + len, "0x%08lx %5zu channel %d\n",
+				       blk->addr - IRAM_VIRT_BASE +
+				       IRAM_PHYS_BASE, blk->size,
+				       blk->channel);
+		}
+	}
+	spin_unlock_irqrestore(&iram_pool_lock, flags);
+
+	return len;
+}
+
+/*!
+ * Creates the IRAM pool.
  */
 static void iram_pool_init(void)
 {
-	int i;
-	iram_head_t *p;
-	memset(iram_pool_flag, 0, IRAM_POOL_SIZE);
-	INIT_LIST_HEAD(&iram_free_list);
-	for (i = 0; i < IRAM_POOL_SIZE; i++) {
-		p = (iram_head_t *) (IRAM_VIRT_BASE + i * IRAM_UNIT_SIZE);
-		list_add_tail(&(p->list), &iram_free_list);
+	if (iram_size == 0) {
+		return;
+	}
+
+	iram_pool = gen_pool_create(IRAM_MIN_ORDER, -1);
+	if (iram_pool == NULL) {
+		goto err;
 	}
+	if (gen_pool_add(iram_pool, IRAM_VIRT_BASE, iram_size, -1) < 0) {
+		gen_pool_destroy(iram_pool);
+		iram_pool = NULL;
+		goto err;
+	}
+	return;
+
+      err:
+	printk(KERN_ERR "SDMA malloc: no IRAM pool, using DDR only\n");
+	iram_size = 0;
 }
 #endif				/*CONFIG_SDMA_IRAM */
 
@@ -0,0 +1,732 @@
+/*
+ * DMA engine driver for the Freescale MXC Smart DMA (SDMA) controller
+ *
+ * Copyright 2009 Freescale Semiconductor, Inc. All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * The SDMA core in arch/arm/plat-mxc/sdma owns the hardware: script
+ * loading, channel contexts and the buffer descriptor (BD) rings. This
+ * driver sits on top of the mxc_dma_* front-end and exposes the engine
+ * through the generic dmaengine interface, so that clients such as
+ * dmatest, async_tx and net_dma can use it.
+ *
+ * Each dmaengine channel grabs one SDMA channel when its first client
+ * shows up. Descriptors are split into BD-sized pieces and fed into the
+ * channel BD ring as space becomes available; the front-end tasklet
+ * reports every completed BD back to us.
+ */
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/interrupt.h>
+#include <linux/dmaengine.h>
+#include <linux/dma-mapping.h>
+#include <linux/platform_device.h>
+#include <linux/scatterlist.h>
+
+#include <mach/sdma_dmaengine.h>
+
+#define MXC_SDMA_DESCS_PER_CHAN	16
+
+/* The BD count field is 16 bits wide; keep pieces word aligned */
+#define MXC_SDMA_BD_MAX_BYTES	0xfffc
+
+static int nr_channels = 4;
+module_param(nr_channels, int, 0444);
+MODULE_PARM_DESC(nr_channels, "Number of dmaengine channels to register");
+
+struct mxc_sdma_desc {
+	struct dma_async_tx_descriptor	txd;
+	struct list_head		desc_node;
+
+	mxc_dma_requestbuf_t		*bufs;
+	int				nbufs;
+	int				queued;	/* BDs handed to the ring */
+	int				done;	/* BDs completed */
+	mxc_dma_mode_t			mode;
+	int				cyclic;
+
+	/* memcpy only, for unmapping on completion */
+	dma_addr_t			src;
+	dma_addr_t			dst;
+	size_t				len;
+};
+
+struct mxc_sdma_chan {
+	struct dma_chan		chan;
+	spinlock_t		lock;
+
+	int			channel;	/* SDMA channel, -1 if none */
+	mxc_dma_device_t	dma_id;
+	struct mxc_sdma_slave	*slave;
+	int			bd_count;	/* size of the BD ring */
+	int			bd_busy;	/* BDs owned by the engine */
+	mxc_dma_mode_t		mode;		/* direction of the script */
+
+	dma_cookie_t		completed;
+	struct list_head	active_list;	/* issued, oldest first */
+	struct list_head	queue;		/* submitted, not issued */
+	struct list_head	free_list;
+	int			descs_allocated;
+};
+
+struct mxc_sdma_dma {
+	struct dma_device	dma;
+	struct mxc_sdma_chan	*chan;
+};
+
+static struct platform_device *mxc_sdma_dma_pdev;
+static struct mxc_sdma_dma *mxc_sdma_dma;
+
+static inline struct mxc_sdma_chan *to_mxc_sdma_chan(struct dma_chan *chan)
+{
+	return container_of(chan, struct mxc_sdma_chan, chan);
+}
+
+static inline struct mxc_sdma_desc *
+txd_to_mxc_sdma_desc(struct dma_async_tx_descriptor *txd)
+{
+	return container_of(txd, struct mxc_sdma_desc, txd);
+}
+
+/*----------------------------------------------------------------------*/
+
+static struct mxc_sdma_desc *mxc_sdma_desc_get(struct mxc_sdma_chan *mchan,
+					       int nbufs)
+{
+	struct mxc_sdma_desc *desc = NULL;
+	unsigned long flags;
+
+	spin_lock_irqsave(&mchan->lock, flags);
+	if (!list_empty(&mchan->free_list)) {
+		desc = list_first_entry(&mchan->free_list,
+					struct mxc_sdma_desc, desc_node);
+		list_del(&desc->desc_node);
+	}
+	spin_unlock_irqrestore(&mchan->lock, flags);
+
+	if (!desc) {
+		dev_dbg(&mchan->chan.dev, "out of descriptors\n");
+		return NULL;
+	}
+
+	desc->bufs = kcalloc(nbufs, sizeof(*desc->bufs), GFP_ATOMIC);
+	if (!desc->bufs) {
+		spin_lock_irqsave(&mchan->lock, flags);
+		list_add(&desc->desc_node, &mchan->free_list);
+		spin_unlock_irqrestore(&mchan->lock, flags);
+		return NULL;
+	}
+
+	desc->nbufs = nbufs;
+	desc->queued = 0;
+	desc->done = 0;
+	desc->cyclic = 0;
+	desc->len = 0;
+	desc->txd.callback = NULL;
+	desc->txd.callback_param = NULL;
+
+	return desc;
+}
+
+static void mxc_sdma_desc_put(struct mxc_sdma_chan *mchan,
+			      struct mxc_sdma_desc *desc)
+{
+	unsigned long flags;
+
+	kfree(desc->bufs);
+	desc->bufs = NULL;
+
+	spin_lock_irqsave(&mchan->lock, flags);
+	list_add(&desc->desc_node, &mchan->free_list);
+	spin_unlock_irqrestore(&mchan->lock, flags);
+}
+
+/* Releases the buffers of a memcpy descriptor that is done with */
+static void mxc_sdma_desc_unmap(struct mxc_sdma_chan *mchan,
+				struct mxc_sdma_desc *desc)
+{
+	struct dma_async_tx_descriptor *txd = &desc->txd;
+	struct device *dev = mchan->chan.dev.parent;
+
+	if (!desc->len)
+		return;
+
+	if (!(txd->flags & DMA_COMPL_SKIP_DEST_UNMAP))
+		dma_unmap_page(dev, desc->dst, desc->len, DMA_FROM_DEVICE);
+	if (!(txd->flags & DMA_COMPL_SKIP_SRC_UNMAP))
+		dma_unmap_page(dev, desc->src, desc->len, DMA_TO_DEVICE);
+}
+
+/* Called with mchan->lock held */
+static dma_cookie_t mxc_sdma_assign_cookie(struct mxc_sdma_chan *mchan,
+					   struct mxc_sdma_desc *desc)
+{
+	dma_cookie_t cookie = mchan->chan.cookie;
+
+	if (++cookie < 0)
+		cookie = 1;
+
+	mchan->chan.cookie = cookie;
+	desc->txd.cookie = cookie;
+
+	return cookie;
+}
+
+/*
+ * Feed issued descriptors into the BD ring, oldest first, as far as the
+ * ring has room. Called with mchan->lock held.
+ */
+static void mxc_sdma_start_pending(struct mxc_sdma_chan *mchan)
+{
+	struct mxc_sdma_desc *desc;
+	int n, started = 0;
+
+	list_for_each_entry(desc, &mchan->active_list, desc_node) {
+		if (desc->queued == desc->nbufs)
+			continue;
+
+		/* A cyclic descriptor must own the whole ring */
+		if (mchan->bd_busy && desc->cyclic)
+			break;
+
+		n = min(mchan->bd_count - mchan->bd_busy,
+			desc->nbufs - desc->queued);
+		if (n <= 0)
+			break;
+
+		if (mxc_dma_config(mchan->channel, &desc->bufs[desc->queued],
+				   n, desc->mode) < 0) {
+			dev_err(&mchan->chan.dev, "failed to queue BDs\n");
+			break;
+		}
+
+		desc->queued += n;
+		mchan->bd_busy += n;
+		started = 1;
+
+		if (desc->queued < desc->nbufs)
+			break;
+	}
+
+	if (started)
+		mxc_dma_enable(mchan->channel);
+}
+
+static void mxc_sdma_desc_complete(struct mxc_sdma_chan *mchan,
+				   struct mxc_sdma_desc *desc)
+{
+	dma_async_tx_callback callback = desc->txd.callback;
+	void *param = desc->txd.callback_param;
+
+	mxc_sdma_desc_unmap(mchan, desc);
+	mxc_sdma_desc_put(mchan, desc);
+
+	if (callback)
+		callback(param);
+}
+
+/*
+ * Per-BD completion, called from the SDMA front-end tasklet.
+ */
+static void mxc_sdma_dma_callback(void *arg, int error, unsigned int count)
+{
+	struct mxc_sdma_chan *mchan = arg;
+	struct mxc_sdma_desc *desc;
+	struct mxc_sdma_desc *done = NULL;
+	dma_async_tx_callback callback = NULL;
+	void *param = NULL;
+	unsigned long flags;
+
+	spin_lock_irqsave(&mchan->lock, flags);
+
+	/* Stale completion for a terminated transfer */
+	if (list_empty(&mchan->active_list) || !mchan->bd_busy) {
+		spin_unlock_irqrestore(&mchan->lock, flags);
+		return;
+	}
+
+	mchan->bd_busy--;
+	desc = list_first_entry(&mchan->active_list, struct mxc_sdma_desc,
+				desc_node);
+
+	if (error != MXC_DMA_DONE)
+		dev_err(&mchan->chan.dev, "BD error on cookie %d\n",
+			desc->txd.cookie);
+
+	if (desc->cyclic) {
+		/* Hand the period straight back to the engine */
+		if (mxc_dma_config(mchan->channel, &desc->bufs[desc->done],
+				   1, desc->mode) == 0) {
+			mchan->bd_busy++;
+			mxc_dma_enable(mchan->channel);
+		}
+		if (++desc->done == desc->nbufs)
+			desc->done = 0;
+		callback = desc->txd.callback;
+		param = desc->txd.callback_param;
+	} else {
+		if (++desc->done == desc->nbufs) {
+			list_del(&desc->desc_node);
+			mchan->completed = desc->txd.cookie;
+			done = desc;
+		}
+		/* Refill the BD that just came back */
+		mxc_sdma_start_pending(mchan);
+	}
+
+	spin_unlock_irqrestore(&mchan->lock, flags);
+
+	if (done)
+		mxc_sdma_desc_complete(mchan, done);
+	else if (callback)
+		callback(param);
+}
+
+/*----------------------------------------------------------------------*/
+
+static int mxc_sdma_chan_request(struct mxc_sdma_chan *mchan)
+{
+	mxc_sdma_channel_params_t *params;
+	int channel;
+
+	params = mxc_sdma_get_channel_params(mchan->dma_id);
+	if (!params)
+		return -EINVAL;
+
+	channel = mxc_dma_request(mchan->dma_id, mchan->chan.dev.bus_id);
+	if (channel < 0)
+		return channel;
+
+	mxc_dma_callback_set(channel, mxc_sdma_dma_callback, mchan);
+
+	mchan->channel = channel;
+	mchan->bd_count = params->chnl_params.bd_number;
+	if (mchan->bd_count <= 0)
+		mchan->bd_count = 1;
+	mchan->bd_busy = 0;
+
+	/*
+	 * Slave channels stay in the direction their script was loaded
+	 * for: reloading it sleeps, and BDs are queued with the lock held.
+	 */
+	if (params->chnl_params.transfer_type == per_2_emi ||
+	    params->chnl_params.transfer_type == dsp_2_emi)
+		mchan->mode = MXC_DMA_MODE_READ;
+	else
+		mchan->mode = MXC_DMA_MODE_WRITE;
+
+	return 0;
+}
+
+static void mxc_sdma_chan_release(struct mxc_sdma_chan *mchan)
+{
+	if (mchan->channel < 0)
+		return;
+
+	mxc_dma_disable(mchan->channel);
+	mxc_dma_free(mchan->channel);
+	mchan->channel = -1;
+}
+
+/*----------------------------------------------------------------------*/
+
+static dma_cookie_t mxc_sdma_tx_submit(struct dma_async_tx_descriptor *tx)
+{
+	struct mxc_sdma_desc *desc = txd_to_mxc_sdma_desc(tx);
+	struct mxc_sdma_chan *mchan = to_mxc_sdma_chan(tx->chan);
+	dma_cookie_t cookie;
+	unsigned long flags;
+
+	spin_lock_irqsave(&mchan->lock, flags);
+	cookie = mxc_sdma_assign_cookie(mchan, desc);
+	list_add_tail(&desc->desc_node, &mchan->queue);
+	spin_unlock_irqrestore(&mchan->lock, flags);
+
+	return cookie;
+}
+
+static struct dma_async_tx_descriptor *
+mxc_sdma_prep_dma_memcpy(struct dma_chan *chan, dma_addr_t dest,
+			 dma_addr_t src, size_t len, unsigned long flags)
+{
+	struct mxc_sdma_chan *mchan = to_mxc_sdma_chan(chan);
+	struct mxc_sdma_desc *desc;
+	size_t offset, xfer;
+	int i;
+
+	if (unlikely(!len) || mchan->slave)
+		return NULL;
+
+	desc = mxc_sdma_desc_get(mchan, DIV_ROUND_UP(len,
+						     MXC_SDMA_BD_MAX_BYTES));
+	if (!desc)
+		return NULL;
+
+	for (i = 0, offset = 0; offset < len; i++, offset += xfer) {
+		xfer = min_t(size_t, len - offset, MXC_SDMA_BD_MAX_BYTES);
+		desc->bufs[i].src_addr = src + offset;
+		desc->bufs[i].dst_addr = dest + offset;
+		desc->bufs[i].num_of_bytes = xfer;
+	}
+
+	desc->mode = MXC_DMA_MODE_WRITE;
+	desc->src = src;
+	desc->dst = dest;
+	desc->len = len;
+	desc->txd.flags = flags;
+
+	return &desc->txd;
+}
+
+static struct dma_async_tx_descriptor *
+mxc_sdma_prep_slave_sg(struct dma_chan *chan, struct scatterlist *sgl,
+		       unsigned int sg_len, enum dma_data_direction direction,
+		       unsigned long flags)
+{
+	struct mxc_sdma_chan *mchan = to_mxc_sdma_chan(chan);
+	struct mxc_sdma_desc *desc;
+	struct scatterlist *sg;
+	dma_addr_t addr;
+	mxc_dma_mode_t mode;
+	size_t len, xfer;
+	int i, n = 0;
+
+	if (unlikely(!mchan->slave || !sg_len))
+		return NULL;
+
+	mode = (direction == DMA_FROM_DEVICE) ?
+	    MXC_DMA_MODE_READ : MXC_DMA_MODE_WRITE;
+	if (mode != mchan->mode) {
+		dev_dbg(&chan->dev,
+			"channel is set up for the other direction\n");
+		return NULL;
+	}
+
+	for_each_sg(sgl, sg, sg_len, i)
+		n += DIV_ROUND_UP(sg_dma_len(sg), MXC_SDMA_BD_MAX_BYTES);
+
+	desc = mxc_sdma_desc_get(mchan, n);
+	if (!desc)
+		return NULL;
+
+	desc->mode = mode;
+
+	n = 0;
+	for_each_sg(sgl, sg, sg_len, i) {
+		addr = sg_dma_address(sg);
+		for (len = sg_dma_len(sg); len; len -= xfer, addr += xfer) {
+			xfer = min_t(size_t, len, MXC_SDMA_BD_MAX_BYTES);
+			if (desc->mode == MXC_DMA_MODE_READ)
+				desc->bufs[n].dst_addr = addr;
+			else
+				desc->bufs[n].src_addr = addr;
+			desc->bufs[n++].num_of_bytes = xfer;
+		}
+	}
+
+	desc->txd.flags = flags;
+
+	return &desc->txd;
+}
+
+/**
+ * mxc_sdma_prep_dma_cyclic - prepare a cyclic transfer on a slave channel
+ * @chan: channel allocated for an SDMA slave
+ * @buf_addr: bus address of the ring buffer
+ * @buf_len: length of the ring buffer
+ * @period_len: length of one period; the descriptor callback runs once
+ *	per completed period
+ * @direction: DMA_TO_DEVICE or DMA_FROM_DEVICE
+ *
+ * The transfer loops over the buffer until device_terminate_all() is
+ * called on the channel, so its cookie never completes. The buffer must
+ * not hold more periods than the channel BD ring, and @direction must be
+ * the one the slave's SDMA script runs in.
+ */
+struct dma_async_tx_descriptor *
+mxc_sdma_prep_dma_cyclic(struct dma_chan *chan, dma_addr_t buf_addr,
+			 size_t buf_len, size_t period_len,
+			 enum dma_data_direction direction)
+{
+	struct mxc_sdma_chan *mchan = to_mxc_sdma_chan(chan);
+	struct mxc_sdma_desc *desc;
+	mxc_dma_mode_t mode;
+	int i, periods;
+
+	if (unlikely(!mchan->slave || !period_len ||
+		     period_len > MXC_SDMA_BD_MAX_BYTES ||
+		     buf_len % period_len))
+		return NULL;
+
+	mode = (direction == DMA_FROM_DEVICE) ?
+	    MXC_DMA_MODE_READ : MXC_DMA_MODE_WRITE;
+	if (mode != mchan->mode) {
+		dev_dbg(&chan->dev,
+			"channel is set up for the other direction\n");
+		return NULL;
+	}
+
+	periods = buf_len / period_len;
+	if (!periods || periods > mchan->bd_count)
+		return NULL;
+
+	desc = mxc_sdma_desc_get(mchan, periods);
+	if (!desc)
+		return NULL;
+
+	desc->mode = mode;
+	desc->cyclic = 1;
+
+	for (i = 0; i < periods; i++) {
+		if (desc->mode == MXC_DMA_MODE_READ)
+			desc->bufs[i].dst_addr = buf_addr + i * period_len;
+		else
+			desc->bufs[i].src_addr = buf_addr + i * period_len;
+		desc->bufs[i].num_of_bytes = period_len;
+	}
+
+	desc->txd.flags = DMA_CTRL_ACK;
+
+	return &desc->txd;
+}
+EXPORT_SYMBOL(mxc_sdma_prep_dma_cyclic);
+
+/*
+ * Stops the channel and drops every queued transfer. The SDMA channel
+ * stays allocated and its BD ring is just rewound, so this never sleeps
+ * and may be called from atomic context or from a descriptor callback.
+ */
+static void mxc_sdma_terminate_all(struct dma_chan *chan)
+{
+	struct mxc_sdma_chan *mchan = to_mxc_sdma_chan(chan);
+	struct mxc_sdma_desc *desc, *_desc;
+	unsigned long flags;
+	LIST_HEAD(list);
+
+	spin_lock_irqsave(&mchan->lock, flags);
+	if (mchan->channel >= 0) {
+		mxc_dma_disable(mchan->channel);
+		mxc_sdma_ring_reset(mchan->channel);
+	}
+	list_splice_init(&mchan->queue, &list);
+	list_splice_init(&mchan->active_list, &list);
+	list_for_each_entry(desc, &list, desc_node) {
+		desc->queued = 0;
+		desc->done = 0;
+	}
+	mchan->bd_busy = 0;
+	spin_unlock_irqrestore(&mchan->lock, flags);
+
+	list_for_each_entry_safe(desc, _desc, &list, desc_node) {
+		mxc_sdma_desc_unmap(mchan, desc);
+		mxc_sdma_desc_put(mchan, desc);
+	}
+}
+
+static enum dma_status
+mxc_sdma_is_tx_complete(struct dma_chan *chan, dma_cookie_t cookie,
+			dma_cookie_t *done, dma_cookie_t *used)
+{
+	struct mxc_sdma_chan *mchan = to_mxc_sdma_chan(chan);
+	dma_cookie_t last_used;
+	dma_cookie_t last_complete;
+	unsigned long flags;
+
+	spin_lock_irqsave(&mchan->lock, flags);
+	last_complete = mchan->completed;
+	last_used = chan->cookie;
+	spin_unlock_irqrestore(&mchan->lock, flags);
+
+	if (done)
+		*done = last_complete;
+	if (used)
+		*used = last_used;
+
+	return dma_async_is_complete(cookie, last_complete, last_used);
+}
+
+static void mxc_sdma_issue_pending(struct dma_chan *chan)
+{
+	struct mxc_sdma_chan *mchan = to_mxc_sdma_chan(chan);
+	unsigned long flags;
+
+	spin_lock_irqsave(&mchan->lock, flags);
+	if (!list_empty(&mchan->queue)) {
+		list_splice_tail_init(&mchan->queue, &mchan->active_list);
+		mxc_sdma_start_pending(mchan);
+	}
+	spin_unlock_irqrestore(&mchan->lock, flags);
+}
+
+static int mxc_sdma_alloc_chan_resources(struct dma_chan *chan,
+					 struct dma_client *client)
+{
+	struct mxc_sdma_chan *mchan = to_mxc_sdma_chan(chan);
+	struct mxc_sdma_desc *desc;
+	struct dma_slave *slave = client->slave;
+	int ret;
+
+	/* Channels doing slave DMA can only handle one client. */
+	if (mchan->slave || slave) {
+		if (chan->client_count)
+			return -EBUSY;
+	}
+
+	if (mchan->channel >= 0)
+		return mchan->descs_allocated;
+
+	if (slave) {
+		BUG_ON(!slave->dma_dev || slave->dma_dev != chan->device->dev);
+		mchan->slave = to_mxc_sdma_slave(slave);
+		mchan->dma_id = mchan->slave->dma_id;
+	} else {
+		mchan->slave = NULL;
+		mchan->dma_id = MXC_DMA_MEMORY;
+	}
+
+	ret = mxc_sdma_chan_request(mchan);
+	if (ret) {
+		mchan->slave = NULL;
+		return ret;
+	}
+
+	mchan->completed = chan->cookie = 1;
+
+	while (mchan->descs_allocated < MXC_SDMA_DESCS_PER_CHAN) {
+		desc = kzalloc(sizeof(*desc), GFP_KERNEL);
+		if (!desc)
+			break;
+
+		dma_async_tx_descriptor_init(&desc->txd, chan);
+		desc->txd.tx_submit = mxc_sdma_tx_submit;
+		INIT_LIST_HEAD(&desc->txd.tx_list);
+
+		spin_lock_irq(&mchan->lock);
+		list_add(&desc->desc_node, &mchan->free_list);
+		mchan->descs_allocated++;
+		spin_unlock_irq(&mchan->lock);
+	}
+
+	dev_dbg(&chan->dev, "SDMA channel %d, %d descriptors\n",
+		mchan->channel, mchan->descs_allocated);
+
+	return mchan->descs_allocated;
+}
+
+static void mxc_sdma_free_chan_resources(struct dma_chan *chan)
+{
+	struct mxc_sdma_chan *mchan = to_mxc_sdma_chan(chan);
+	struct mxc_sdma_desc *desc, *_desc;
+	LIST_HEAD(list);
+
+	BUG_ON(!list_empty(&mchan->active_list));
+	BUG_ON(!list_empty(&mchan->queue));
+
+	mxc_sdma_chan_release(mchan);
+
+	spin_lock_irq(&mchan->lock);
+	list_splice_init(&mchan->free_list, &list);
+	mchan->descs_allocated = 0;
+	mchan->slave = NULL;
+	spin_unlock_irq(&mchan->lock);
+
+	list_for_each_entry_safe(desc, _desc, &list, desc_node)
+		kfree(desc);
+}
+
+/*----------------------------------------------------------------------*/
+
+static int __init mxc_sdma_dma_init(void)
+{
+	struct mxc_sdma_dma *mdma;
+	struct mxc_sdma_chan *mchan;
+	int i, ret;
+
+	if (nr_channels <= 0 || nr_channels > MAX_DMA_CHANNELS - 1)
+		return -EINVAL;
+
+	mdma = kzalloc(sizeof(*mdma), GFP_KERNEL);
+	if (!mdma)
+		return -ENOMEM;
+
+	mdma->chan = kcalloc(nr_channels, sizeof(*mdma->chan), GFP_KERNEL);
+	if (!mdma->chan) {
+		ret = -ENOMEM;
+		goto err_chan;
+	}
+
+	mxc_sdma_dma_pdev = platform_device_register_simple("mxc_sdma_dma",
+							    -1, NULL, 0);
+	if (IS_ERR(mxc_sdma_dma_pdev)) {
+		ret = PTR_ERR(mxc_sdma_dma_pdev);
+		goto err_pdev;
+	}
+
+	INIT_LIST_HEAD(&mdma->dma.channels);
+	for (i = 0; i < nr_channels; i++) {
+		mchan = &mdma->chan[i];
+
+		mchan->chan.device = &mdma->dma;
+		mchan->channel = -1;
+		spin_lock_init(&mchan->lock);
+		INIT_LIST_HEAD(&mchan->active_list);
+		INIT_LIST_HEAD(&mchan->queue);
+		INIT_LIST_HEAD(&mchan->free_list);
+
+		list_add_tail(&mchan->chan.device_node, &mdma->dma.channels);
+		mdma->dma.chancnt++;
+	}
+
+	dma_cap_set(DMA_MEMCPY, mdma->dma.cap_mask);
+	dma_cap_set(DMA_SLAVE, mdma->dma.cap_mask);
+	mdma->dma.dev = &mxc_sdma_dma_pdev->dev;
+	mdma->dma.device_alloc_chan_resources = mxc_sdma_alloc_chan_resources;
+	mdma->dma.device_free_chan_resources = mxc_sdma_free_chan_resources;
+
+	mdma->dma.device_prep_dma_memcpy = mxc_sdma_prep_dma_memcpy;
+
+	mdma->dma.device_prep_slave_sg = mxc_sdma_prep_slave_sg;
+	mdma->dma.device_terminate_all = mxc_sdma_terminate_all;
+
+	mdma->dma.device_is_tx_complete = mxc_sdma_is_tx_complete;
+	mdma->dma.device_issue_pending = mxc_sdma_issue_pending;
+
+	ret = dma_async_device_register(&mdma->dma);
+	if (ret)
+		goto err_register;
+
+	mxc_sdma_dma = mdma;
+	printk(KERN_INFO "MXC SDMA dmaengine driver, %d channels\n",
+	       mdma->dma.chancnt);
+
+	return 0;
+
+      err_register:
+	platform_device_unregister(mxc_sdma_dma_pdev);
+      err_pdev:
+	kfree(mdma->chan);
+      err_chan:
+	kfree(mdma);
+	return ret;
+}
+
+static void __exit mxc_sdma_dma_exit(void)
+{
+	dma_async_device_unregister(&mxc_sdma_dma->dma);
+	platform_device_unregister(mxc_sdma_dma_pdev);
+	kfree(mxc_sdma_dma->chan);
+	kfree(mxc_sdma_dma);
+}
+
+module_init(mxc_sdma_dma_init);
+module_exit(mxc_sdma_dma_exit);
+
+MODULE_AUTHOR("Freescale Semiconductor, Inc.");
+MODULE_DESCRIPTION("MXC SDMA dmaengine driver");
+MODULE_LICENSE("GPL");
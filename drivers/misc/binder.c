@@ -20,6 +20,7 @@
 #include <linux/fdtable.h>
 #include <linux/file.h>
 #include <linux/fs.h>
+#include <linux/hrtimer.h>
 #include <linux/list.h>
 #include <linux/miscdevice.h>
 #include <linux/mm.h>
@@ -32,8 +33,16 @@
 #include <linux/sched.h>
 #include <linux/uaccess.h>
 #include <linux/vmalloc.h>
+#include <linux/workqueue.h>
 
+/*
+ * binder_lock protects what processes share: nodes, refs, transactions and
+ * todo lists.  Each proc's buffer allocator has its own alloc_lock, which
+ * nests inside binder_lock but is also taken without it, so that page
+ * population and payload copies do not hold up unrelated IPC.
+ */
 static DEFINE_MUTEX(binder_lock);
+static DEFINE_MUTEX(binder_mmap_lock);
 static HLIST_HEAD(binder_procs);
 static struct binder_node *binder_context_mgr_node;
 static uid_t binder_context_mgr_uid = -1;
@@ -42,6 +51,15 @@ static struct proc_dir_entry *binder_proc_dir_entry_root;
 static struct proc_dir_entry *binder_proc_dir_entry_proc;
 static struct hlist_head binder_dead_nodes;
 
+/*
+ * Pages of freed buffers stay mapped, in the kernel and in the owning
+ * process, until the shrinker takes them back; the next buffer to cover
+ * them gets them for free.
+ */
+static LIST_HEAD(binder_lru_pages);
+static DEFINE_SPINLOCK(binder_lru_lock);
+static int binder_lru_count;
+
 static int binder_read_proc_proc(
 	char *page, char **start, off_t off, int count, int *eof, void *data);
 
@@ -120,7 +138,7 @@ enum {
 
 struct binder_stats {
 	int br[_IOC_NR(BR_FAILED_REPLY) + 1];
-	int bc[_IOC_NR(BC_DEAD_BINDER_DONE) + 1];
+	int bc[_IOC_NR(BC_REPLY_SG) + 1];
 	int obj_created[BINDER_STAT_COUNT];
 	int obj_deleted[BINDER_STAT_COUNT];
 };
@@ -161,6 +179,63 @@ static struct binder_transaction_log_entry *binder_transaction_log_add(
 	return e;
 }
 
+/*
+ * Latency histograms, in microseconds: bucket i counts latencies below
+ * 2 << i, the last bucket everything longer.
+ */
+#define BINDER_LATENCY_BUCKETS 16
+
+struct binder_latency {
+	unsigned int count[BINDER_LATENCY_BUCKETS];
+	unsigned int max_us;
+	u64 total_us;
+};
+
+static void binder_latency_add(struct binder_latency *lat, s64 delta_us)
+{
+	unsigned int us = delta_us < 0 ? 0 : delta_us > UINT_MAX ? UINT_MAX : delta_us;
+	int i = fls(us >> 1);
+
+	if (i >= BINDER_LATENCY_BUCKETS)
+		i = BINDER_LATENCY_BUCKETS - 1;
+	lat->count[i]++;
+	lat->total_us += us;
+	if (us > lat->max_us)
+		lat->max_us = us;
+}
+
+/* completed transactions, with their latencies */
+struct binder_latency_log_entry {
+	int debug_id;
+	int call_type;
+	int from_proc;
+	int to_proc;
+	int to_node;
+	unsigned int code;
+	unsigned int queue_us; /* submit to dequeue */
+	unsigned int reply_us; /* submit to reply, 0 for one-way calls */
+};
+struct binder_latency_log {
+	int next;
+	int full;
+	struct binder_latency_log_entry entry[64];
+};
+static struct binder_latency_log binder_latency_log;
+
+static struct binder_latency_log_entry *binder_latency_log_add(
+	struct binder_latency_log *log)
+{
+	struct binder_latency_log_entry *e;
+	e = &log->entry[log->next];
+	memset(e, 0, sizeof(*e));
+	log->next++;
+	if (log->next == ARRAY_SIZE(log->entry)) {
+		log->next = 0;
+		log->full = 1;
+	}
+	return e;
+}
+
 struct binder_work {
 	struct list_head entry;
 	enum {
@@ -195,6 +270,7 @@ struct binder_node {
 	unsigned accept_fds : 1;
 	int min_priority : 8;
 	struct list_head async_todo;
+	struct binder_latency reply_latency;
 };
 
 struct binder_ref_death {
@@ -233,9 +309,16 @@ struct binder_buffer {
 	struct binder_node *target_node;
 	size_t data_size;
 	size_t offsets_size;
+	size_t extra_buffers_size;
 	uint8_t data[0];
 };
 
+struct binder_lru_page {
+	struct list_head lru; /* on binder_lru_pages while mapped but unused */
+	struct page *page_ptr;
+	struct binder_proc *proc;
+};
+
 struct binder_proc {
 	struct hlist_node proc_node;
 	struct rb_root threads;
@@ -245,6 +328,8 @@ struct binder_proc {
 	int pid;
 	struct vm_area_struct *vma;
 	struct task_struct *tsk;
+	atomic_t tmp_ref; /* the file, plus transactions being prepared */
+	struct mutex alloc_lock; /* buffers, free/allocated trees, pages */
 	void *buffer;
 	size_t user_buffer_offset;
 
@@ -253,7 +338,7 @@ struct binder_proc {
 	struct rb_root allocated_buffers;
 	size_t free_async_space;
 
-	struct page **pages;
+	struct binder_lru_page *pages;
 	size_t buffer_size;
 	uint32_t buffer_free;
 	struct list_head todo;
@@ -265,6 +350,9 @@ struct binder_proc {
 	int requested_threads_started;
 	int ready_threads;
 	long default_priority;
+	struct work_struct free_work;
+	struct binder_latency queue_latency; /* incoming calls, until read */
+	struct binder_latency reply_latency; /* incoming calls, until replied */
 };
 
 enum {
@@ -308,6 +396,9 @@ struct binder_transaction {
 	long	priority;
 	long	saved_priority;
 	uid_t	sender_euid;
+	int	sender_pid;
+	ktime_t	submit_time;
+	ktime_t	dequeue_time;
 };
 
 /*
@@ -561,14 +652,33 @@ static struct binder_buffer *binder_buffer_lookup(
 	return NULL;
 }
 
+static void binder_lru_add_range(struct binder_proc *proc,
+	void *start, void *end)
+{
+	void *page_addr;
+	struct binder_lru_page *page;
+
+	spin_lock(&binder_lru_lock);
+	for (page_addr = start; page_addr < end; page_addr += PAGE_SIZE) {
+		page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
+		if (page->page_ptr == NULL)
+			continue;
+		BUG_ON(!list_empty(&page->lru));
+		list_add_tail(&page->lru, &binder_lru_pages);
+		binder_lru_count++;
+	}
+	spin_unlock(&binder_lru_lock);
+}
+
 static int binder_update_page_range(struct binder_proc *proc, int allocate,
 	void *start, void *end, struct vm_area_struct *vma)
 {
 	void *page_addr;
 	unsigned long user_page_addr;
 	struct vm_struct tmp_area;
-	struct page **page;
+	struct binder_lru_page *page;
 	struct mm_struct *mm;
+	int missing = 0;
 
 	if (binder_debug_mask & BINDER_DEBUG_BUFFER_ALLOC)
 		printk(KERN_INFO "binder: %d: %s pages %p-%p\n",
@@ -577,6 +687,25 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 	if (end <= start)
 		return 0;
 
+	if (allocate == 0) {
+		binder_lru_add_range(proc, start, end);
+		return 0;
+	}
+
+	spin_lock(&binder_lru_lock);
+	for (page_addr = start; page_addr < end; page_addr += PAGE_SIZE) {
+		page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
+		if (page->page_ptr) {
+			BUG_ON(list_empty(&page->lru));
+			list_del_init(&page->lru);
+			binder_lru_count--;
+		} else
+			missing++;
+	}
+	spin_unlock(&binder_lru_lock);
+	if (!missing)
+		return 0;
+
 	if (vma)
 		mm = NULL;
 	else
@@ -587,9 +716,6 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 		vma = proc->vma;
 	}
 
-	if (allocate == 0)
-		goto free_range;
-
 	if (vma == NULL) {
 		printk(KERN_ERR "binder: %d: binder_alloc_buf failed to "
 		       "map pages in userspace, no vma\n", proc->pid);
@@ -601,16 +727,17 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 		struct page **page_array_ptr;
 		page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
 
-		BUG_ON(*page);
-		*page = alloc_page(GFP_KERNEL | __GFP_ZERO);
-		if (*page == NULL) {
+		if (page->page_ptr)
+			continue;
+		page->page_ptr = alloc_page(GFP_KERNEL | __GFP_ZERO);
+		if (page->page_ptr == NULL) {
 			printk(KERN_ERR "binder: %d: binder_alloc_buf failed "
 			       "for page at %p\n", proc->pid, page_addr);
 			goto err_alloc_page_failed;
 		}
 		tmp_area.addr = page_addr;
 		tmp_area.size = PAGE_SIZE + PAGE_SIZE /* guard page? */;
-		page_array_ptr = page;
+		page_array_ptr = &page->page_ptr;
 		ret = map_vm_area(&tmp_area, PAGE_KERNEL, &page_array_ptr);
 		if (ret) {
 			printk(KERN_ERR "binder: %d: binder_alloc_buf failed "
@@ -619,7 +746,7 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 			goto err_map_kernel_failed;
 		}
 		user_page_addr = (size_t)page_addr + proc->user_buffer_offset;
-		ret = vm_insert_page(vma, user_page_addr, page[0]);
+		ret = vm_insert_page(vma, user_page_addr, page->page_ptr);
 		if (ret) {
 			printk(KERN_ERR "binder: %d: binder_alloc_buf failed "
 			       "to map page at %lx in userspace\n",
@@ -634,31 +761,25 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 	}
 	return 0;
 
-free_range:
-	for (page_addr = end - PAGE_SIZE; page_addr >= start;
-	     page_addr -= PAGE_SIZE) {
-		page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
-		if (vma)
-			zap_page_range(vma, (size_t)page_addr +
-				proc->user_buffer_offset, PAGE_SIZE, NULL);
 err_vm_insert_page_failed:
-		unmap_kernel_range((unsigned long)page_addr, PAGE_SIZE);
+	unmap_kernel_range((unsigned long)page_addr, PAGE_SIZE);
 err_map_kernel_failed:
-		__free_page(*page);
-		*page = NULL;
+	__free_page(page->page_ptr);
+	page->page_ptr = NULL;
 err_alloc_page_failed:
-		;
-	}
 err_no_vma:
 	if (mm) {
 		up_write(&mm->mmap_sem);
 		mmput(mm);
 	}
+	/* whatever did get mapped is left for reuse or the shrinker */
+	binder_lru_add_range(proc, start, end);
 	return -ENOMEM;
 }
 
-static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
-	size_t data_size, size_t offsets_size, int is_async)
+static struct binder_buffer *__binder_alloc_buf(struct binder_proc *proc,
+	size_t data_size, size_t offsets_size, size_t extra_buffers_size,
+	int is_async)
 {
 	struct rb_node *n = proc->free_buffers.rb_node;
 	struct binder_buffer *buffer;
@@ -666,20 +787,24 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 	struct rb_node *best_fit = NULL;
 	void *has_page_addr;
 	void *end_page_addr;
-	size_t size;
+	size_t data_offsets_size, size;
 
 	if (proc->vma == NULL) {
 		printk(KERN_ERR "binder: %d: binder_alloc_buf, no vma\n",
 		       proc->pid);
 		return NULL;
 	}
+	smp_rmb(); /* pairs with binder_mmap */
 
-	size = ALIGN(data_size, sizeof(void *)) +
+	data_offsets_size = ALIGN(data_size, sizeof(void *)) +
 		ALIGN(offsets_size, sizeof(void *));
+	size = data_offsets_size + ALIGN(extra_buffers_size, sizeof(void *));
 
-	if (size < data_size || size < offsets_size) {
+	if (data_offsets_size < data_size || data_offsets_size < offsets_size ||
+	    size < data_offsets_size || size < extra_buffers_size) {
 		binder_user_error("binder: %d: got transaction with invalid "
-			"size %d-%d\n", proc->pid, data_size, offsets_size);
+			"size %d-%d-%d\n", proc->pid, data_size, offsets_size,
+			extra_buffers_size);
 		return NULL;
 	}
 
@@ -748,7 +873,11 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 		       "%p\n", proc->pid, size, buffer);
 	buffer->data_size = data_size;
 	buffer->offsets_size = offsets_size;
+	buffer->extra_buffers_size = extra_buffers_size;
 	buffer->async_transaction = is_async;
+	buffer->allow_user_free = 0;
+	buffer->transaction = NULL;
+	buffer->target_node = NULL;
 	if (is_async) {
 		proc->free_async_space -= size + sizeof(struct binder_buffer);
 		if (binder_debug_mask & BINDER_DEBUG_BUFFER_ALLOC_ASYNC)
@@ -760,6 +889,19 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 	return buffer;
 }
 
+static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
+	size_t data_size, size_t offsets_size, size_t extra_buffers_size,
+	int is_async)
+{
+	struct binder_buffer *buffer;
+
+	mutex_lock(&proc->alloc_lock);
+	buffer = __binder_alloc_buf(proc, data_size, offsets_size,
+		extra_buffers_size, is_async);
+	mutex_unlock(&proc->alloc_lock);
+	return buffer;
+}
+
 static void *buffer_start_page(struct binder_buffer *buffer)
 {
 	return (void *)((size_t)buffer & PAGE_MASK);
@@ -817,7 +959,7 @@ static void binder_delete_free_buffer(
 	}
 }
 
-static void binder_free_buf(
+static void __binder_free_buf(
 	struct binder_proc *proc, struct binder_buffer *buffer)
 {
 	size_t size, buffer_size;
@@ -825,7 +967,8 @@ static void binder_free_buf(
 	buffer_size = binder_buffer_size(proc, buffer);
 
 	size = ALIGN(buffer->data_size, sizeof(void *)) +
-		ALIGN(buffer->offsets_size, sizeof(void *));
+		ALIGN(buffer->offsets_size, sizeof(void *)) +
+		ALIGN(buffer->extra_buffers_size, sizeof(void *));
 	if (binder_debug_mask & BINDER_DEBUG_BUFFER_ALLOC)
 		printk(KERN_INFO "binder: %d: binder_free_buf %p size %d buffer"
 		       "_size %d\n", proc->pid, buffer, size, buffer_size);
@@ -870,6 +1013,153 @@ static void binder_free_buf(
 	binder_insert_free_buffer(proc, buffer);
 }
 
+static void binder_free_buf(
+	struct binder_proc *proc, struct binder_buffer *buffer)
+{
+	mutex_lock(&proc->alloc_lock);
+	__binder_free_buf(proc, buffer);
+	mutex_unlock(&proc->alloc_lock);
+}
+
+static void binder_free_proc(struct binder_proc *proc)
+{
+	struct rb_node *n;
+	int buffers, page_count;
+
+	buffers = 0;
+	while ((n = rb_first(&proc->allocated_buffers))) {
+		struct binder_buffer *buffer = rb_entry(n, struct binder_buffer, rb_node);
+		binder_free_buf(proc, buffer);
+		buffers++;
+	}
+
+	page_count = 0;
+	if (proc->pages) {
+		int i;
+		for (i = 0; i < proc->buffer_size / PAGE_SIZE; i++) {
+			struct binder_lru_page *page = &proc->pages[i];
+
+			if (page->page_ptr == NULL)
+				continue;
+			spin_lock(&binder_lru_lock);
+			if (!list_empty(&page->lru)) {
+				list_del_init(&page->lru);
+				binder_lru_count--;
+			} else if (binder_debug_mask & BINDER_DEBUG_BUFFER_ALLOC)
+				printk(KERN_INFO "binder_release: %d: page %d at %p not freed\n", proc->pid, i, proc->buffer + i * PAGE_SIZE);
+			spin_unlock(&binder_lru_lock);
+			__free_page(page->page_ptr);
+			page_count++;
+		}
+		kfree(proc->pages);
+		vfree(proc->buffer);
+	}
+
+	put_task_struct(proc->tsk);
+
+	if (binder_debug_mask & BINDER_DEBUG_OPEN_CLOSE)
+		printk(KERN_INFO "binder_release: %d buffers %d, pages %d\n",
+		       proc->pid, buffers, page_count);
+
+	kfree(proc);
+}
+
+/*
+ * Drop a reference taken on a proc whose buffer a transaction is being
+ * prepared in; the last one frees the proc, which binder_release has
+ * already taken out of the object graph.
+ */
+static void binder_proc_put(struct binder_proc *proc)
+{
+	if (atomic_dec_and_test(&proc->tmp_ref))
+		binder_free_proc(proc);
+}
+
+static void binder_free_proc_work(struct work_struct *work)
+{
+	binder_free_proc(container_of(work, struct binder_proc, free_work));
+}
+
+static int binder_shrink(int nr_to_scan, gfp_t gfp_mask)
+{
+	struct binder_lru_page *page;
+	struct binder_proc *proc;
+	struct mm_struct *mm;
+	struct vm_area_struct *vma;
+	void *page_addr;
+
+	if (nr_to_scan == 0)
+		return binder_lru_count;
+
+	spin_lock(&binder_lru_lock);
+	while (nr_to_scan-- > 0 && !list_empty(&binder_lru_pages)) {
+		page = list_first_entry(&binder_lru_pages, struct binder_lru_page, lru);
+		proc = page->proc;
+		list_move_tail(&page->lru, &binder_lru_pages);
+
+		/*
+		 * Everything here is a trylock: we may be reclaiming on behalf
+		 * of binder_update_page_range, with these held.
+		 */
+		if (!atomic_inc_not_zero(&proc->tmp_ref))
+			continue;
+		if (!mutex_trylock(&proc->alloc_lock))
+			goto put_proc;
+		list_del_init(&page->lru);
+		binder_lru_count--;
+		spin_unlock(&binder_lru_lock);
+
+		page_addr = proc->buffer + (page - proc->pages) * PAGE_SIZE;
+		mm = get_task_mm(proc->tsk);
+		if (mm && !down_write_trylock(&mm->mmap_sem)) {
+			mmput(mm);
+			goto keep_page;
+		}
+		vma = mm ? proc->vma : NULL;
+		if (vma == NULL && proc->vma) {
+			/* still mapped somewhere we cannot get at */
+			if (mm) {
+				up_write(&mm->mmap_sem);
+				mmput(mm);
+			}
+			goto keep_page;
+		}
+		if (vma)
+			zap_page_range(vma, (size_t)page_addr +
+				proc->user_buffer_offset, PAGE_SIZE, NULL);
+		if (mm) {
+			up_write(&mm->mmap_sem);
+			mmput(mm);
+		}
+		unmap_kernel_range((unsigned long)page_addr, PAGE_SIZE);
+		__free_page(page->page_ptr);
+		page->page_ptr = NULL;
+		if (binder_debug_mask & BINDER_DEBUG_BUFFER_ALLOC)
+			printk(KERN_INFO "binder: %d: shrinker freed page at %p\n",
+			       proc->pid, page_addr);
+		mutex_unlock(&proc->alloc_lock);
+		spin_lock(&binder_lru_lock);
+		goto put_proc;
+
+keep_page:
+		mutex_unlock(&proc->alloc_lock);
+		spin_lock(&binder_lru_lock);
+		list_add_tail(&page->lru, &binder_lru_pages);
+		binder_lru_count++;
+put_proc:
+		/* not from reclaim: freeing the proc takes mmap_sem */
+		if (atomic_dec_and_test(&proc->tmp_ref))
+			schedule_work(&proc->free_work);
+	}
+	spin_unlock(&binder_lru_lock);
+	return binder_lru_count;
+}
+
+static struct shrinker binder_shrinker = {
+	.shrink = binder_shrink,
+	.seeks = DEFAULT_SEEKS,
+};
+
 static struct binder_node *
 binder_get_node(struct binder_proc *proc, void __user *ptr)
 {
@@ -1250,9 +1540,124 @@ static void
 binder_transaction_buffer_release(struct binder_proc *proc,
 			struct binder_buffer *buffer, size_t *failed_at);
 
+/*
+ * Guess which proc a transaction is headed for, so that its buffer can be
+ * allocated and filled before the rest of the transaction is done under
+ * binder_lock.  Returns the proc with a temporary reference held, or NULL
+ * to leave everything, including reporting errors, to binder_transaction.
+ */
+static struct binder_proc *
+binder_peek_target_proc(struct binder_proc *proc, struct binder_thread *thread,
+	struct binder_transaction_data *tr, int reply)
+{
+	struct binder_proc *target_proc = NULL;
+
+	if (reply) {
+		struct binder_transaction *in_reply_to = thread->transaction_stack;
+		if (in_reply_to && in_reply_to->to_thread == thread &&
+		    in_reply_to->from)
+			target_proc = in_reply_to->from->proc;
+	} else if (tr->target.handle) {
+		struct binder_ref *ref = binder_get_ref(proc, tr->target.handle);
+		if (ref)
+			target_proc = ref->node->proc;
+	} else if (binder_context_mgr_node)
+		target_proc = binder_context_mgr_node->proc;
+	if (target_proc)
+		atomic_inc(&target_proc->tmp_ref);
+	return target_proc;
+}
+
+/*
+ * Copy the data of each BINDER_TYPE_PTR object into the space following the
+ * offsets, and point the object at the receiver's view of it.  Offsets that
+ * are out of range are left for binder_transaction to reject.
+ */
+static int binder_gather_buffers(struct binder_proc *target_proc,
+	struct binder_buffer *buffer)
+{
+	size_t *offp, *off_end;
+	void *sg_bufp, *sg_buf_end;
+
+	offp = (size_t *)(buffer->data + ALIGN(buffer->data_size, sizeof(void *)));
+	off_end = (void *)offp + buffer->offsets_size;
+	sg_bufp = (void *)offp + ALIGN(buffer->offsets_size, sizeof(void *));
+	sg_buf_end = sg_bufp + buffer->extra_buffers_size;
+	for (; offp < off_end; offp++) {
+		struct flat_binder_object *fp;
+		size_t remaining;
+
+		if (buffer->data_size < sizeof(*fp) ||
+		    *offp > buffer->data_size - sizeof(*fp))
+			continue;
+		fp = (struct flat_binder_object *)(buffer->data + *offp);
+		if (fp->type != BINDER_TYPE_PTR)
+			continue;
+		remaining = sg_buf_end - sg_bufp;
+		if (fp->length > remaining)
+			return -EINVAL;
+		if (copy_from_user(sg_bufp, fp->buffer, fp->length))
+			return -EFAULT;
+		fp->buffer = sg_bufp + target_proc->user_buffer_offset;
+		sg_bufp += min(ALIGN(fp->length, sizeof(void *)), remaining);
+	}
+	return 0;
+}
+
+/*
+ * Allocate a transaction buffer in target_proc and copy the payload into it,
+ * without binder_lock: page population and faulting in the sender's data
+ * are where large transactions spend their time.  The buffer is not yet
+ * visible to anybody, and allow_user_free is clear, so the target cannot
+ * free it under us.  Returns NULL on any failure; binder_transaction then
+ * repeats the work under the lock and reports the error.
+ */
+static struct binder_buffer *
+binder_prepare_buffer(struct binder_proc *target_proc,
+	struct binder_transaction_data *tr, size_t extra_buffers_size,
+	int is_async)
+{
+	struct binder_buffer *buffer;
+
+	buffer = binder_alloc_buf(target_proc, tr->data_size,
+		tr->offsets_size, extra_buffers_size, is_async);
+	if (buffer == NULL)
+		return NULL;
+	if (copy_from_user(buffer->data, tr->data.ptr.buffer, tr->data_size) ||
+	    copy_from_user(buffer->data + ALIGN(tr->data_size, sizeof(void *)),
+			   tr->data.ptr.offsets, tr->offsets_size) ||
+	    binder_gather_buffers(target_proc, buffer)) {
+		binder_free_buf(target_proc, buffer);
+		return NULL;
+	}
+	return buffer;
+}
+
+static void
+binder_record_reply(struct binder_proc *proc, struct binder_transaction *t)
+{
+	struct binder_node *node = t->buffer ? t->buffer->target_node : NULL;
+	struct binder_latency_log_entry *e;
+	s64 reply_us = ktime_us_delta(ktime_get(), t->submit_time);
+
+	binder_latency_add(&proc->reply_latency, reply_us);
+	if (node)
+		binder_latency_add(&node->reply_latency, reply_us);
+
+	e = binder_latency_log_add(&binder_latency_log);
+	e->debug_id = t->debug_id;
+	e->from_proc = t->sender_pid;
+	e->to_proc = proc->pid;
+	e->to_node = node ? node->debug_id : 0;
+	e->code = t->code;
+	e->queue_us = ktime_us_delta(t->dequeue_time, t->submit_time);
+	e->reply_us = reply_us;
+}
+
 static void
 binder_transaction(struct binder_proc *proc, struct binder_thread *thread,
-	struct binder_transaction_data *tr, int reply)
+	struct binder_transaction_data *tr, int reply,
+	size_t extra_buffers_size)
 {
 	struct binder_transaction *t;
 	struct binder_work *tcomplete;
@@ -1264,8 +1669,18 @@ binder_transaction(struct binder_proc *proc, struct binder_thread *thread,
 	wait_queue_head_t *target_wait;
 	struct binder_transaction *in_reply_to = NULL;
 	struct binder_transaction_log_entry *e;
+	struct binder_proc *prealloc_proc;
+	struct binder_buffer *prealloc = NULL;
 	uint32_t return_error;
 
+	prealloc_proc = binder_peek_target_proc(proc, thread, tr, reply);
+	if (prealloc_proc) {
+		mutex_unlock(&binder_lock);
+		prealloc = binder_prepare_buffer(prealloc_proc, tr,
+			extra_buffers_size, !reply && (tr->flags & TF_ONE_WAY));
+		mutex_lock(&binder_lock);
+	}
+
 	e = binder_transaction_log_add(&binder_transaction_log);
 	e->call_type = reply ? 2 : !!(tr->flags & TF_ONE_WAY);
 	e->from_proc = proc->pid;
@@ -1402,23 +1817,29 @@ binder_transaction(struct binder_proc *proc, struct binder_thread *thread,
 	else
 		t->from = NULL;
 	t->sender_euid = task_euid(proc->tsk);
+	t->sender_pid = proc->pid;
 	t->to_proc = target_proc;
 	t->to_thread = target_thread;
 	t->code = tr->code;
 	t->flags = tr->flags;
 	t->priority = task_nice(current);
+	if (prealloc && prealloc_proc == target_proc) {
+		t->buffer = prealloc;
+		prealloc = NULL;
+		offp = (size_t *)(t->buffer->data + ALIGN(tr->data_size, sizeof(void *)));
+		goto copied;
+	}
+	if (prealloc) {
+		binder_free_buf(prealloc_proc, prealloc);
+		prealloc = NULL;
+	}
 	t->buffer = binder_alloc_buf(target_proc, tr->data_size,
-		tr->offsets_size, !reply && (t->flags & TF_ONE_WAY));
+		tr->offsets_size, extra_buffers_size,
+		!reply && (t->flags & TF_ONE_WAY));
 	if (t->buffer == NULL) {
 		return_error = BR_FAILED_REPLY;
 		goto err_binder_alloc_buf_failed;
 	}
-	t->buffer->allow_user_free = 0;
-	t->buffer->debug_id = t->debug_id;
-	t->buffer->transaction = t;
-	t->buffer->target_node = target_node;
-	if (target_node)
-		binder_inc_node(target_node, 1, 0, NULL);
 
 	offp = (size_t *)(t->buffer->data + ALIGN(tr->data_size, sizeof(void *)));
 
@@ -1434,6 +1855,20 @@ binder_transaction(struct binder_proc *proc, struct binder_thread *thread,
 		return_error = BR_FAILED_REPLY;
 		goto err_copy_data_failed;
 	}
+	if (binder_gather_buffers(target_proc, t->buffer)) {
+		binder_user_error("binder: %d:%d got transaction with invalid "
+			"scatter-gather buffer\n", proc->pid, thread->pid);
+		return_error = BR_FAILED_REPLY;
+		goto err_copy_data_failed;
+	}
+copied:
+	t->buffer->allow_user_free = 0;
+	t->buffer->debug_id = t->debug_id;
+	t->buffer->transaction = t;
+	t->buffer->target_node = target_node;
+	if (target_node)
+		binder_inc_node(target_node, 1, 0, NULL);
+
 	off_end = (void *)offp + tr->offsets_size;
 	for (; offp < off_end; offp++) {
 		struct flat_binder_object *fp;
@@ -1557,6 +1992,13 @@ binder_transaction(struct binder_proc *proc, struct binder_thread *thread,
 			fp->handle = target_fd;
 		} break;
 
+		case BINDER_TYPE_PTR:
+			/* gathered by binder_gather_buffers */
+			if (binder_debug_mask & BINDER_DEBUG_TRANSACTION)
+				printk(KERN_INFO "        ptr %p size %d\n",
+				       fp->buffer, fp->length);
+			break;
+
 		default:
 			binder_user_error("binder: %d:%d got transactio"
 				"n with invalid object type, %lx\n",
@@ -1567,6 +2009,7 @@ binder_transaction(struct binder_proc *proc, struct binder_thread *thread,
 	}
 	if (reply) {
 		BUG_ON(t->buffer->async_transaction != 0);
+		binder_record_reply(proc, in_reply_to);
 		binder_pop_transaction(target_thread, in_reply_to);
 	} else if (!(t->flags & TF_ONE_WAY)) {
 		BUG_ON(t->buffer->async_transaction != 0);
@@ -1582,12 +2025,15 @@ binder_transaction(struct binder_proc *proc, struct binder_thread *thread,
 		} else
 			target_node->has_async_transaction = 1;
 	}
+	t->submit_time = ktime_get();
 	t->work.type = BINDER_WORK_TRANSACTION;
 	list_add_tail(&t->work.entry, target_list);
 	tcomplete->type = BINDER_WORK_TRANSACTION_COMPLETE;
 	list_add_tail(&tcomplete->entry, &thread->todo);
 	if (target_wait)
 		wake_up_interruptible(target_wait);
+	if (prealloc_proc)
+		binder_proc_put(prealloc_proc);
 	return;
 
 err_get_unused_fd_failed:
@@ -1599,7 +2045,8 @@ err_binder_new_node_failed:
 err_bad_object_type:
 err_bad_offset:
 err_copy_data_failed:
-	binder_transaction_buffer_release(target_proc, t->buffer, offp);
+	if (t->buffer->transaction)
+		binder_transaction_buffer_release(target_proc, t->buffer, offp);
 	t->buffer->transaction = NULL;
 	binder_free_buf(target_proc, t->buffer);
 err_binder_alloc_buf_failed:
@@ -1631,6 +2078,11 @@ err_no_context_mgr_node:
 		binder_send_failed_reply(in_reply_to, return_error);
 	} else
 		thread->return_error = return_error;
+
+	if (prealloc)
+		binder_free_buf(prealloc_proc, prealloc);
+	if (prealloc_proc)
+		binder_proc_put(prealloc_proc);
 }
 
 static void
@@ -1692,6 +2144,9 @@ binder_transaction_buffer_release(struct binder_proc *proc, struct binder_buffer
 				task_close_fd(proc->tsk, fp->handle);
 			break;
 
+		case BINDER_TYPE_PTR:
+			break;
+
 		default:
 			printk(KERN_ERR "binder: transaction release %d bad object type %lx\n", debug_id, fp->type);
 			break;
@@ -1847,20 +2302,26 @@ binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				return -EFAULT;
 			ptr += sizeof(void *);
 
+			mutex_lock(&proc->alloc_lock);
 			buffer = binder_buffer_lookup(proc, data_ptr);
 			if (buffer == NULL) {
+				mutex_unlock(&proc->alloc_lock);
 				binder_user_error("binder: %d:%d "
 					"BC_FREE_BUFFER u%p no match\n",
 					proc->pid, thread->pid, data_ptr);
 				break;
 			}
 			if (!buffer->allow_user_free) {
+				mutex_unlock(&proc->alloc_lock);
 				binder_user_error("binder: %d:%d "
 					"BC_FREE_BUFFER u%p matched "
 					"unreturned buffer\n",
 					proc->pid, thread->pid, data_ptr);
 				break;
 			}
+			/* ours now: a second BC_FREE_BUFFER will not match */
+			buffer->allow_user_free = 0;
+			mutex_unlock(&proc->alloc_lock);
 			if (binder_debug_mask & BINDER_DEBUG_FREE_BUFFER)
 				printk(KERN_INFO "binder: %d:%d BC_FREE_BUFFER u%p found buffer %d for %s transaction\n",
 				       proc->pid, thread->pid, data_ptr, buffer->debug_id,
@@ -1878,7 +2339,11 @@ binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 					list_move_tail(buffer->target_node->async_todo.next, &thread->todo);
 			}
 			binder_transaction_buffer_release(proc, buffer, NULL);
+
+			/* unmapping pages does not need the object graph */
+			mutex_unlock(&binder_lock);
 			binder_free_buf(proc, buffer);
+			mutex_lock(&binder_lock);
 			break;
 		}
 
@@ -1889,7 +2354,19 @@ binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 			if (copy_from_user(&tr, ptr, sizeof(tr)))
 				return -EFAULT;
 			ptr += sizeof(tr);
-			binder_transaction(proc, thread, &tr, cmd == BC_REPLY);
+			binder_transaction(proc, thread, &tr, cmd == BC_REPLY, 0);
+			break;
+		}
+
+		case BC_TRANSACTION_SG:
+		case BC_REPLY_SG: {
+			struct binder_transaction_data_sg tr;
+
+			if (copy_from_user(&tr, ptr, sizeof(tr)))
+				return -EFAULT;
+			ptr += sizeof(tr);
+			binder_transaction(proc, thread, &tr.transaction_data,
+				cmd == BC_REPLY_SG, tr.buffers_size);
 			break;
 		}
 
@@ -2360,6 +2837,23 @@ retry:
 
 		list_del(&t->work.entry);
 		t->buffer->allow_user_free = 1;
+		t->dequeue_time = ktime_get();
+		if (cmd == BR_TRANSACTION) {
+			s64 queue_us = ktime_us_delta(t->dequeue_time, t->submit_time);
+
+			binder_latency_add(&proc->queue_latency, queue_us);
+			if (t->flags & TF_ONE_WAY) {
+				struct binder_latency_log_entry *e;
+				e = binder_latency_log_add(&binder_latency_log);
+				e->debug_id = t->debug_id;
+				e->call_type = 1;
+				e->from_proc = t->sender_pid;
+				e->to_proc = proc->pid;
+				e->to_node = t->buffer->target_node->debug_id;
+				e->code = t->code;
+				e->queue_us = queue_us;
+			}
+		}
 		if (cmd == BR_TRANSACTION && !(t->flags & TF_ONE_WAY)) {
 			t->to_parent = thread->transaction_stack;
 			t->to_thread = thread;
@@ -2664,7 +3158,7 @@ static struct vm_operations_struct binder_vm_ops = {
 
 static int binder_mmap(struct file *filp, struct vm_area_struct *vma)
 {
-	int ret;
+	int ret, i;
 	struct vm_struct *area;
 	struct binder_proc *proc = filp->private_data;
 	const char *failure_string;
@@ -2683,6 +3177,13 @@ static int binder_mmap(struct file *filp, struct vm_area_struct *vma)
 	}
 	vma->vm_flags = (vma->vm_flags | VM_DONTCOPY) & ~VM_MAYWRITE;
 
+	mutex_lock(&binder_mmap_lock);
+	if (proc->buffer) {
+		ret = -EBUSY;
+		failure_string = "already mapped";
+		goto err_already_mapped;
+	}
+
 	area = get_vm_area(vma->vm_end - vma->vm_start, VM_IOREMAP);
 	if (area == NULL) {
 		ret = -ENOMEM;
@@ -2707,6 +3208,10 @@ static int binder_mmap(struct file *filp, struct vm_area_struct *vma)
 		goto err_alloc_pages_failed;
 	}
 	proc->buffer_size = vma->vm_end - vma->vm_start;
+	for (i = 0; i < proc->buffer_size / PAGE_SIZE; i++) {
+		INIT_LIST_HEAD(&proc->pages[i].lru);
+		proc->pages[i].proc = proc;
+	}
 
 	vma->vm_ops = &binder_vm_ops;
 	vma->vm_private_data = proc;
@@ -2722,18 +3227,22 @@ static int binder_mmap(struct file *filp, struct vm_area_struct *vma)
 	buffer->free = 1;
 	binder_insert_free_buffer(proc, buffer);
 	proc->free_async_space = proc->buffer_size / 2;
-	barrier();
+	smp_wmb(); /* binder_alloc_buf checks proc->vma without binder_mmap_lock */
 	proc->vma = vma;
+	mutex_unlock(&binder_mmap_lock);
 
 	/*printk(KERN_INFO "binder_mmap: %d %lx-%lx maps %p\n", proc->pid, vma->vm_start, vma->vm_end, proc->buffer);*/
 	return 0;
 
 err_alloc_small_buf_failed:
 	kfree(proc->pages);
+	proc->pages = NULL;
 err_alloc_pages_failed:
 	vfree(proc->buffer);
+	proc->buffer = NULL;
 err_get_vm_area_failed:
-	mutex_unlock(&binder_lock);
+err_already_mapped:
+	mutex_unlock(&binder_mmap_lock);
 err_bad_arg:
 	printk(KERN_ERR "binder_mmap: %d %lx-%lx %s failed %d\n", proc->pid, vma->vm_start, vma->vm_end, failure_string, ret);
 	return ret;
@@ -2751,6 +3260,9 @@ static int binder_open(struct inode *nodp, struct file *filp)
 		return -ENOMEM;
 	get_task_struct(current);
 	proc->tsk = current;
+	atomic_set(&proc->tmp_ref, 1);
+	mutex_init(&proc->alloc_lock);
+	INIT_WORK(&proc->free_work, binder_free_proc_work);
 	INIT_LIST_HEAD(&proc->todo);
 	init_waitqueue_head(&proc->wait);
 	proc->default_priority = task_nice(current);
@@ -2801,7 +3313,7 @@ static int binder_release(struct inode *nodp, struct file *filp)
 	struct binder_transaction *t;
 	struct rb_node *n;
 	struct binder_proc *proc = filp->private_data;
-	int threads, nodes, incoming_refs, outgoing_refs, buffers, active_transactions, page_count;
+	int threads, nodes, incoming_refs, outgoing_refs, active_transactions;
 
 	if (binder_proc_dir_entry_proc) {
 		char strbuf[11];
@@ -2866,9 +3378,9 @@ static int binder_release(struct inode *nodp, struct file *filp)
 		binder_delete_ref(ref);
 	}
 	binder_release_work(&proc->todo);
-	buffers = 0;
 
-	while ((n = rb_first(&proc->allocated_buffers))) {
+	mutex_lock(&proc->alloc_lock);
+	for (n = rb_first(&proc->allocated_buffers); n; n = rb_next(n)) {
 		struct binder_buffer *buffer = rb_entry(n, struct binder_buffer, rb_node);
 		t = buffer->transaction;
 		if (t) {
@@ -2877,35 +3389,18 @@ static int binder_release(struct inode *nodp, struct file *filp)
 			printk(KERN_ERR "binder: release proc %d, transaction %d, not freed\n", proc->pid, t->debug_id);
 			/*BUG();*/
 		}
-		binder_free_buf(proc, buffer);
-		buffers++;
 	}
+	mutex_unlock(&proc->alloc_lock);
 
 	binder_stats.obj_deleted[BINDER_STAT_PROC]++;
 	mutex_unlock(&binder_lock);
 
-	page_count = 0;
-	if (proc->pages) {
-		int i;
-		for (i = 0; i < proc->buffer_size / PAGE_SIZE; i++) {
-			if (proc->pages[i]) {
-				if (binder_debug_mask & BINDER_DEBUG_BUFFER_ALLOC)
-					printk(KERN_INFO "binder_release: %d: page %d at %p not freed\n", proc->pid, i, proc->buffer + i * PAGE_SIZE);
-				__free_page(proc->pages[i]);
-				page_count++;
-			}
-		}
-		kfree(proc->pages);
-		vfree(proc->buffer);
-	}
-
-	put_task_struct(proc->tsk);
-
 	if (binder_debug_mask & BINDER_DEBUG_OPEN_CLOSE)
-		printk(KERN_INFO "binder_release: %d threads %d, nodes %d (ref %d), refs %d, active transactions %d, buffers %d, pages %d\n",
-		       proc->pid, threads, nodes, incoming_refs, outgoing_refs, active_transactions, buffers, page_count);
+		printk(KERN_INFO "binder_release: %d threads %d, nodes %d (ref %d), refs %d, active transactions %d\n",
+		       proc->pid, threads, nodes, incoming_refs, outgoing_refs, active_transactions);
 
-	kfree(proc);
+	/* buffers and pages go with the last reference */
+	binder_proc_put(proc);
 	return 0;
 }
 
@@ -3018,6 +3513,31 @@ static char *print_binder_thread(char *buf, char *end, struct binder_thread *thr
 	return buf;
 }
 
+static char *print_binder_latency(char *buf, char *end, const char *prefix, struct binder_latency *lat)
+{
+	unsigned int count = 0;
+	u64 avg;
+	int i;
+
+	for (i = 0; i < BINDER_LATENCY_BUCKETS; i++)
+		count += lat->count[i];
+	if (count == 0)
+		return buf;
+	avg = lat->total_us;
+	do_div(avg, count);
+	buf += snprintf(buf, end - buf, "%s%u avg %llu max %u us, log2 buckets:",
+			prefix, count, (unsigned long long)avg, lat->max_us);
+	for (i = 0; i < BINDER_LATENCY_BUCKETS; i++) {
+		if (buf >= end)
+			return buf;
+		buf += snprintf(buf, end - buf, " %u", lat->count[i]);
+	}
+	if (buf >= end)
+		return buf;
+	buf += snprintf(buf, end - buf, "\n");
+	return buf;
+}
+
 static char *print_binder_node(char *buf, char *end, struct binder_node *node)
 {
 	struct binder_ref *ref;
@@ -3046,6 +3566,9 @@ static char *print_binder_node(char *buf, char *end, struct binder_node *node)
 		}
 	}
 	buf += snprintf(buf, end - buf, "\n");
+	if (buf >= end)
+		return buf;
+	buf = print_binder_latency(buf, end, "    reply latency: ", &node->reply_latency);
 	list_for_each_entry(w, &node->async_todo, entry) {
 		if (buf >= end)
 			break;
@@ -3084,8 +3607,12 @@ static char *print_binder_proc(char *buf, char *end, struct binder_proc *proc, i
 		for (n = rb_first(&proc->refs_by_desc); n != NULL && buf < end; n = rb_next(n))
 			buf = print_binder_ref(buf, end, rb_entry(n, struct binder_ref, rb_node_desc));
 	}
+	if (!binder_debug_no_lock)
+		mutex_lock(&proc->alloc_lock);
 	for (n = rb_first(&proc->allocated_buffers); n != NULL && buf < end; n = rb_next(n))
 		buf = print_binder_buffer(buf, end, "  buffer", rb_entry(n, struct binder_buffer, rb_node));
+	if (!binder_debug_no_lock)
+		mutex_unlock(&proc->alloc_lock);
 	list_for_each_entry(w, &proc->todo, entry) {
 		if (buf >= end)
 			break;
@@ -3141,7 +3668,9 @@ static const char *binder_command_strings[] = {
 	"BC_EXIT_LOOPER",
 	"BC_REQUEST_DEATH_NOTIFICATION",
 	"BC_CLEAR_DEATH_NOTIFICATION",
-	"BC_DEAD_BINDER_DONE"
+	"BC_DEAD_BINDER_DONE",
+	"BC_TRANSACTION_SG",
+	"BC_REPLY_SG"
 };
 
 static const char *binder_objstat_strings[] = {
@@ -3195,6 +3724,8 @@ static char *print_binder_proc_stats(char *buf, char *end, struct binder_proc *p
 	struct binder_work *w;
 	struct rb_node *n;
 	int count, strong, weak;
+	int free_count, mapped, unused;
+	size_t free_size, largest_free;
 
 	buf += snprintf(buf, end - buf, "proc %d\n", proc->pid);
 	if (buf >= end)
@@ -3232,9 +3763,42 @@ static char *print_binder_proc_stats(char *buf, char *end, struct binder_proc *p
 		return buf;
 
 	count = 0;
+	free_count = 0;
+	free_size = 0;
+	largest_free = 0;
+	mapped = 0;
+	unused = 0;
+	if (!binder_debug_no_lock)
+		mutex_lock(&proc->alloc_lock);
 	for (n = rb_first(&proc->allocated_buffers); n != NULL; n = rb_next(n))
 		count++;
+	for (n = rb_first(&proc->free_buffers); n != NULL; n = rb_next(n)) {
+		size_t size = binder_buffer_size(proc, rb_entry(n, struct binder_buffer, rb_node));
+		free_count++;
+		free_size += size;
+		if (size > largest_free)
+			largest_free = size;
+	}
+	if (proc->pages) {
+		int i;
+		for (i = 0; i < proc->buffer_size / PAGE_SIZE; i++) {
+			if (proc->pages[i].page_ptr == NULL)
+				continue;
+			mapped++;
+			if (!list_empty(&proc->pages[i].lru))
+				unused++;
+		}
+	}
+	if (!binder_debug_no_lock)
+		mutex_unlock(&proc->alloc_lock);
 	buf += snprintf(buf, end - buf, "  buffers: %d\n", count);
+	if (buf >= end)
+		return buf;
+	buf += snprintf(buf, end - buf, "  free space: %zd in %d buffers, largest %zd\n",
+			free_size, free_count, largest_free);
+	if (buf >= end)
+		return buf;
+	buf += snprintf(buf, end - buf, "  pages: %d mapped, %d unused\n", mapped, unused);
 	if (buf >= end)
 		return buf;
 
@@ -3252,6 +3816,13 @@ static char *print_binder_proc_stats(char *buf, char *end, struct binder_proc *p
 	if (buf >= end)
 		return buf;
 
+	buf = print_binder_latency(buf, end, "  queue latency: ", &proc->queue_latency);
+	if (buf >= end)
+		return buf;
+	buf = print_binder_latency(buf, end, "  reply latency: ", &proc->reply_latency);
+	if (buf >= end)
+		return buf;
+
 	buf = print_binder_stats(buf, end, "  ", &proc->stats);
 
 	return buf;
@@ -3324,6 +3895,8 @@ static int binder_read_proc_stats(
 	p += snprintf(p, PAGE_SIZE, "binder stats:\n");
 
 	p = print_binder_stats(p, page + PAGE_SIZE, "", &binder_stats);
+	if (p < page + PAGE_SIZE)
+		p += snprintf(p, page + PAGE_SIZE - p, "unused pages: %d\n", binder_lru_count);
 
 	hlist_for_each_entry(proc, pos, &binder_procs, proc_node) {
 		if (p >= page + PAGE_SIZE)
@@ -3477,6 +4050,52 @@ static struct miscdevice binder_miscdev = {
 	.fops = &binder_fops
 };
 
+static char *print_binder_latency_log_entry(char *buf, char *end, struct binder_latency_log_entry *e)
+{
+	buf += snprintf(buf, end - buf, "%d: %s from %d to %d node %d code %x queued %u us replied %u us\n",
+			e->debug_id, e->call_type ? "async" : "call ",
+			e->from_proc, e->to_proc, e->to_node, e->code,
+			e->queue_us, e->reply_us);
+	return buf;
+}
+
+static int binder_read_proc_latency_log(
+	char *page, char **start, off_t off, int count, int *eof, void *data)
+{
+	struct binder_latency_log *log = data;
+	int len = 0;
+	int i;
+	char *buf = page;
+	char *end = page + PAGE_SIZE;
+
+	if (off)
+		return 0;
+
+	/* newest first, so that a full page drops the oldest entries */
+	for (i = log->next - 1; i >= 0; i--) {
+		if (buf >= end)
+			break;
+		buf = print_binder_latency_log_entry(buf, end, &log->entry[i]);
+	}
+	if (log->full) {
+		for (i = ARRAY_SIZE(log->entry) - 1; i >= log->next; i--) {
+			if (buf >= end)
+				break;
+			buf = print_binder_latency_log_entry(buf, end, &log->entry[i]);
+		}
+	}
+
+	*start = page + off;
+
+	len = buf - page;
+	if (len > off)
+		len -= off;
+	else
+		len = 0;
+
+	return len < count ? len  : count;
+}
+
 static int __init binder_init(void)
 {
 	int ret;
@@ -3485,12 +4104,14 @@ static int __init binder_init(void)
 	if (binder_proc_dir_entry_root)
 		binder_proc_dir_entry_proc = proc_mkdir("proc", binder_proc_dir_entry_root);
 	ret = misc_register(&binder_miscdev);
+	register_shrinker(&binder_shrinker);
 	if (binder_proc_dir_entry_root) {
 		create_proc_read_entry("state", S_IRUGO, binder_proc_dir_entry_root, binder_read_proc_state, NULL);
 		create_proc_read_entry("stats", S_IRUGO, binder_proc_dir_entry_root, binder_read_proc_stats, NULL);
 		create_proc_read_entry("transactions", S_IRUGO, binder_proc_dir_entry_root, binder_read_proc_transactions, NULL);
 		create_proc_read_entry("transaction_log", S_IRUGO, binder_proc_dir_entry_root, binder_read_proc_transaction_log, &binder_transaction_log);
 		create_proc_read_entry("failed_transaction_log", S_IRUGO, binder_proc_dir_entry_root, binder_read_proc_transaction_log, &binder_transaction_log_failed);
+		create_proc_read_entry("latency_log", S_IRUGO, binder_proc_dir_entry_root, binder_read_proc_latency_log, &binder_latency_log);
 	}
 	return ret;
 }
@@ -23,25 +23,66 @@
 #include <linux/uaccess.h>
 #include <linux/poll.h>
 #include <linux/time.h>
+#include <linux/timer.h>
+#include <linux/cpumask.h>
 #include <linux/logger.h>
 
 #include <asm/ioctls.h>
+#include <asm/atomic.h>
+
+/*
+ * Each log is split into up to LOGGER_MAX_RINGS rings, and a writer appends to
+ * the ring belonging to the CPU it runs on. Rings are never smaller than
+ * LOGGER_MIN_RING_SIZE, so small logs on big machines share rings between
+ * CPUs.
+ */
+#define LOGGER_MAX_RINGS	8
+#define LOGGER_MIN_RING_SIZE	(4 * LOGGER_ENTRY_MAX_LEN)
+
+/*
+ * Readers are not woken for every entry: a ring wakes them once it has
+ * gathered LOGGER_WAKE_BATCH bytes, or LOGGER_WAKE_DELAY jiffies after the
+ * first entry nobody was woken for, whichever comes first.
+ */
+#define LOGGER_WAKE_BATCH	4096
+#define LOGGER_WAKE_DELAY	(HZ / 50)
+
+/*
+ * struct logger_ring - one per-CPU ring of a log
+ *
+ * Positions count the bytes ever written to the ring and never wrap, so a
+ * reader that has been lapped is simply one whose position is behind 'head'.
+ * Writers therefore never need to visit the readers. The offset into the
+ * buffer is the low bits of a position; see ring_offset().
+ *
+ * The structure is protected by the mutex 'mutex', which writers on other
+ * CPUs only contend for if they were preempted or migrated mid-write.
+ */
+struct logger_ring {
+	unsigned char *		buffer;	/* this ring's slice of the log */
+	size_t			size;	/* size of the ring */
+	struct mutex		mutex;	/* mutex protecting the ring */
+	u64			w_pos;	/* current write position */
+	u64			head;	/* oldest readable entry */
+	size_t			unwoken; /* bytes written since the last wakeup */
+	struct timer_list	wake_timer; /* delayed reader wakeup */
+};
 
 /*
  * struct logger_log - represents a specific log, such as 'main' or 'radio'
  *
  * This structure lives from module insertion until module removal, so it does
- * not need additional reference counting. The structure is protected by the
- * mutex 'mutex'.
+ * not need additional reference counting. The log's data lives in 'rings',
+ * each of which has its own lock, and 'seq' is atomic; the remaining fields
+ * are constant once the log has been registered.
  */
 struct logger_log {
-	unsigned char *		buffer;	/* the ring buffer itself */
+	unsigned char *		buffer;	/* backing store, split among rings */
 	struct miscdevice	misc;	/* misc device representing the log */
 	wait_queue_head_t	wq;	/* wait queue for readers */
-	struct list_head	readers; /* this log's readers */
-	struct mutex		mutex;	/* mutex protecting buffer */
-	size_t			w_off;	/* current write head offset */
-	size_t			head;	/* new readers start here */
+	struct logger_ring	rings[LOGGER_MAX_RINGS]; /* per-CPU rings */
+	int			nr_rings; /* rings in use, a power of two */
+	atomic_t		seq;	/* last sequence number handed out */
 	size_t			size;	/* size of the log */
 };
 
@@ -49,16 +90,27 @@ struct logger_log {
  * struct logger_reader - a logging device open for reading
  *
  * This object lives from open to release, so we don't need additional
- * reference counting. The structure is protected by log->mutex.
+ * reference counting. The structure is protected by the mutex 'mutex'; the
+ * per-ring positions are only compared against a ring while also holding
+ * that ring's mutex.
  */
 struct logger_reader {
 	struct logger_log *	log;	/* associated log */
-	struct list_head	list;	/* entry in logger_log's list */
-	size_t			r_off;	/* current read head offset */
+	struct mutex		mutex;	/* serializes users of this reader */
+	unsigned char *		entry;	/* bounce buffer for one entry */
+	u64			r_pos[LOGGER_MAX_RINGS]; /* read positions */
 };
 
-/* logger_offset - returns index 'n' into the log via (optimized) modulus */
-#define logger_offset(n)	((n) & (log->size - 1))
+/* ring_offset - returns the index of position 'n' into 'ring's buffer */
+#define ring_offset(ring, n)	((size_t) ((n) & ((ring)->size - 1)))
+
+/*
+ * A ring stores each entry behind a sequence number, drawn from the log's
+ * counter while holding the ring's mutex. Readers merge the rings in sequence
+ * order, which keeps a thread's entries in the order it wrote them even if it
+ * migrated between CPUs. read() returns only the entry itself.
+ */
+#define LOGGER_SEQ_LEN		sizeof(__u32)
 
 /*
  * file_get_log - Given a file structure, return the associated log
@@ -84,60 +136,150 @@ static inline struct logger_log * file_get_log(struct file *file)
 }
 
 /*
- * get_entry_len - Grabs the length of the payload of the next entry starting
- * from 'off'.
+ * do_read_ring - copies exactly 'count' bytes starting at position 'pos' of
+ * 'ring' into the kernel buffer 'buf'.
+ *
+ * Caller must hold ring->mutex.
+ */
+static void do_read_ring(struct logger_ring *ring, u64 pos, void *buf,
+			 size_t count)
+{
+	size_t off = ring_offset(ring, pos);
+	size_t len;
+
+	len = min(count, ring->size - off);
+	memcpy(buf, ring->buffer + off, len);
+
+	if (count != len)
+		memcpy(buf + len, ring->buffer, count - len);
+}
+
+/*
+ * get_entry_len - Grabs the length of the entry, as read() returns it, stored
+ * at position 'pos'.
  *
- * Caller needs to hold log->mutex.
+ * Caller needs to hold ring->mutex.
  */
-static __u32 get_entry_len(struct logger_log *log, size_t off)
+static __u32 get_entry_len(struct logger_ring *ring, u64 pos)
 {
 	__u16 val;
 
-	switch (log->size - off) {
-	case 1:
-		memcpy(&val, log->buffer + off, 1);
-		memcpy(((char *) &val) + 1, log->buffer, 1);
-		break;
-	default:
-		memcpy(&val, log->buffer + off, 2);
-	}
+	do_read_ring(ring, pos + LOGGER_SEQ_LEN, &val, sizeof(val));
 
 	return sizeof(struct logger_entry) + val;
 }
 
 /*
- * do_read_log_to_user - reads exactly 'count' bytes from 'log' into the
- * user-space buffer 'buf'. Returns 'count' on success.
+ * reader_pos - returns the reader's position in ring 'i', first pulling it
+ * forward to the ring's head if a writer lapped it.
  *
- * Caller must hold log->mutex.
+ * Caller must hold reader->mutex and the ring's mutex.
  */
-static ssize_t do_read_log_to_user(struct logger_log *log,
-				   struct logger_reader *reader,
-				   char __user *buf,
-				   size_t count)
+static u64 reader_pos(struct logger_reader *reader, int i)
 {
-	size_t len;
+	struct logger_ring *ring = &reader->log->rings[i];
 
-	/*
-	 * We read from the log in two disjoint operations. First, we read from
-	 * the current read head offset up to 'count' bytes or to the end of
-	 * the log, whichever comes first.
-	 */
-	len = min(count, log->size - reader->r_off);
-	if (copy_to_user(buf, log->buffer + reader->r_off, len))
-		return -EFAULT;
+	if (reader->r_pos[i] < ring->head)
+		reader->r_pos[i] = ring->head;
 
-	/*
-	 * Second, we read any remaining bytes, starting back at the head of
-	 * the log.
-	 */
-	if (count != len)
-		if (copy_to_user(buf + len, log->buffer, count - len))
-			return -EFAULT;
+	return reader->r_pos[i];
+}
+
+/*
+ * logger_scan_rings - returns the index of the ring whose first unread entry
+ * has the lowest sequence number, or -1 if the reader has read everything.
+ *
+ * Caller must hold reader->mutex.
+ */
+static int logger_scan_rings(struct logger_reader *reader)
+{
+	struct logger_log *log = reader->log;
+	__u32 seq, best = 0;
+	int i, next = -1;
 
-	reader->r_off = logger_offset(reader->r_off + count);
+	for (i = 0; i < log->nr_rings; i++) {
+		struct logger_ring *ring = &log->rings[i];
+		u64 pos;
 
-	return count;
+		mutex_lock(&ring->mutex);
+		pos = reader_pos(reader, i);
+		if (pos != ring->w_pos)
+			do_read_ring(ring, pos, &seq, sizeof(seq));
+		mutex_unlock(&ring->mutex);
+
+		if (pos == ring->w_pos)
+			continue;
+
+		if (next < 0 || (__s32) (seq - best) < 0) {
+			best = seq;
+			next = i;
+		}
+	}
+
+	return next;
+}
+
+/*
+ * logger_next_ring - returns the index of the ring holding the reader's next
+ * entry, or -1 if the reader has read everything.
+ *
+ * Entries within a ring are in sequence order, so only the first unread entry
+ * of each ring needs to be looked at. A single pass can miss an entry that
+ * was finished on a ring after we looked at it, while a later entry of the
+ * same thread shows up on a ring we look at afterwards. Such an entry was
+ * complete before the first pass ended, so a second pass sees it.
+ *
+ * Caller must hold reader->mutex.
+ */
+static int logger_next_ring(struct logger_reader *reader)
+{
+	int next = logger_scan_rings(reader);
+
+	if (next < 0 || reader->log->nr_rings == 1)
+		return next;
+
+	return logger_scan_rings(reader);
+}
+
+/*
+ * logger_unread - returns the bytes read() has left to return from 'ring'
+ * for a reader at position 'pos'.
+ *
+ * Caller must hold ring->mutex.
+ */
+static size_t logger_unread(struct logger_ring *ring, u64 pos)
+{
+	size_t len = 0;
+
+	while (pos != ring->w_pos) {
+		__u32 n = get_entry_len(ring, pos);
+
+		len += n;
+		pos += LOGGER_SEQ_LEN + n;
+	}
+
+	return len;
+}
+
+/*
+ * logger_pending - returns nonzero if the reader has anything left to read.
+ *
+ * Caller must hold reader->mutex.
+ */
+static int logger_pending(struct logger_reader *reader)
+{
+	struct logger_log *log = reader->log;
+	int i, ret = 0;
+
+	for (i = 0; i < log->nr_rings && !ret; i++) {
+		struct logger_ring *ring = &log->rings[i];
+
+		mutex_lock(&ring->mutex);
+		ret = (reader_pos(reader, i) != ring->w_pos);
+		mutex_unlock(&ring->mutex);
+	}
+
+	return ret;
 }
 
 /*
@@ -148,25 +290,33 @@ static ssize_t do_read_log_to_user(struct logger_log *log,
  * 	- O_NONBLOCK works
  * 	- If there are no log entries to read, blocks until log is written to
  * 	- Atomically reads exactly one log entry
+ * 	- Entries from all of the log's rings come out in the order written
  *
  * Optimal read size is LOGGER_ENTRY_MAX_LEN. Will set errno to EINVAL if read
  * buffer is insufficient to hold next entry.
+ *
+ * The entry is copied into the reader's bounce buffer under the ring's mutex
+ * and only copied out to user-space after dropping it, so a reader taking a
+ * page fault never stalls that ring's writers.
  */
 static ssize_t logger_read(struct file *file, char __user *buf,
 			   size_t count, loff_t *pos)
 {
 	struct logger_reader *reader = file->private_data;
 	struct logger_log *log = reader->log;
+	struct logger_ring *ring;
+	u64 r_pos;
 	ssize_t ret;
+	int i;
 	DEFINE_WAIT(wait);
 
 start:
 	while (1) {
 		prepare_to_wait(&log->wq, &wait, TASK_INTERRUPTIBLE);
 
-		mutex_lock(&log->mutex);
-		ret = (log->w_off == reader->r_off);
-		mutex_unlock(&log->mutex);
+		mutex_lock(&reader->mutex);
+		ret = !logger_pending(reader);
+		mutex_unlock(&reader->mutex);
 		if (!ret)
 			break;
 
@@ -187,146 +337,176 @@ start:
 	if (ret)
 		return ret;
 
-	mutex_lock(&log->mutex);
+	mutex_lock(&reader->mutex);
 
 	/* is there still something to read or did we race? */
-	if (unlikely(log->w_off == reader->r_off)) {
-		mutex_unlock(&log->mutex);
+	i = logger_next_ring(reader);
+	if (unlikely(i < 0)) {
+		mutex_unlock(&reader->mutex);
+		goto start;
+	}
+
+	ring = &log->rings[i];
+	mutex_lock(&ring->mutex);
+
+	/* a writer may have lapped us since we picked this ring */
+	r_pos = reader->r_pos[i];
+	if (unlikely(reader_pos(reader, i) != r_pos)) {
+		mutex_unlock(&ring->mutex);
+		mutex_unlock(&reader->mutex);
 		goto start;
 	}
 
 	/* get the size of the next entry */
-	ret = get_entry_len(log, reader->r_off);
+	ret = get_entry_len(ring, r_pos);
 	if (count < ret) {
+		mutex_unlock(&ring->mutex);
 		ret = -EINVAL;
 		goto out;
 	}
 
 	/* get exactly one entry from the log */
-	ret = do_read_log_to_user(log, reader, buf, ret);
-
-out:
-	mutex_unlock(&log->mutex);
-
-	return ret;
-}
-
-/*
- * get_next_entry - return the offset of the first valid entry at least 'len'
- * bytes after 'off'.
- *
- * Caller must hold log->mutex.
- */
-static size_t get_next_entry(struct logger_log *log, size_t off, size_t len)
-{
-	size_t count = 0;
+	do_read_ring(ring, r_pos + LOGGER_SEQ_LEN, reader->entry, ret);
+	mutex_unlock(&ring->mutex);
 
-	do {
-		size_t nr = get_entry_len(log, off);
-		off = logger_offset(off + nr);
-		count += nr;
-	} while (count < len);
+	if (copy_to_user(buf, reader->entry, ret)) {
+		ret = -EFAULT;
+		goto out;
+	}
 
-	return off;
-}
+	/*
+	 * Even if the entry was overwritten meanwhile, the position just past
+	 * it is either still an entry boundary or behind the ring's head.
+	 */
+	reader->r_pos[i] = r_pos + LOGGER_SEQ_LEN + ret;
 
-/*
- * clock_interval - is a < c < b in mod-space? Put another way, does the line
- * from a to b cross c?
- */
-static inline int clock_interval(size_t a, size_t b, size_t c)
-{
-	if (b < a) {
-		if (a < c || b >= c)
-			return 1;
-	} else {
-		if (a < c && b >= c)
-			return 1;
-	}
+out:
+	mutex_unlock(&reader->mutex);
 
-	return 0;
+	return ret;
 }
 
 /*
- * fix_up_readers - walk the list of all readers and "fix up" any who were
- * lapped by the writer; also do the same for the default "start head".
- * We do this by "pulling forward" the readers and start head to the first
- * entry after the new write head.
+ * fix_up_head - "pull forward" the ring's head past any entries that a write
+ * of 'len' bytes is about to overwrite. Readers still pointing at those
+ * entries notice by being behind the head, so there is no need to walk them.
  *
- * The caller needs to hold log->mutex.
+ * The caller needs to hold ring->mutex.
  */
-static void fix_up_readers(struct logger_log *log, size_t len)
+static void fix_up_head(struct logger_ring *ring, size_t len)
 {
-	size_t old = log->w_off;
-	size_t new = logger_offset(old + len);
-	struct logger_reader *reader;
-
-	if (clock_interval(old, new, log->head))
-		log->head = get_next_entry(log, log->head, len);
-
-	list_for_each_entry(reader, &log->readers, list)
-		if (clock_interval(old, new, reader->r_off))
-			reader->r_off = get_next_entry(log, reader->r_off, len);
+	while (ring->head + ring->size < ring->w_pos + len)
+		ring->head += LOGGER_SEQ_LEN + get_entry_len(ring, ring->head);
 }
 
 /*
- * do_write_log - writes 'len' bytes from 'buf' to 'log'
+ * do_write_log - writes 'len' bytes from 'buf' to 'ring'
  *
- * The caller needs to hold log->mutex.
+ * The caller needs to hold ring->mutex.
  */
-static void do_write_log(struct logger_log *log, const void *buf, size_t count)
+static void do_write_log(struct logger_ring *ring, const void *buf,
+			 size_t count)
 {
+	size_t off = ring_offset(ring, ring->w_pos);
 	size_t len;
 
-	len = min(count, log->size - log->w_off);
-	memcpy(log->buffer + log->w_off, buf, len);
+	len = min(count, ring->size - off);
+	memcpy(ring->buffer + off, buf, len);
 
 	if (count != len)
-		memcpy(log->buffer, buf + len, count - len);
+		memcpy(ring->buffer, buf + len, count - len);
 
-	log->w_off = logger_offset(log->w_off + count);
-	
+	ring->w_pos += count;
 }
 
 /*
  * do_write_log_user - writes 'len' bytes from the user-space buffer 'buf' to
- * the log 'log'
+ * the ring 'ring'
  *
- * The caller needs to hold log->mutex.
+ * The caller needs to hold ring->mutex.
  *
  * Returns 'count' on success, negative error code on failure.
  */
-static ssize_t do_write_log_from_user(struct logger_log *log,
+static ssize_t do_write_log_from_user(struct logger_ring *ring,
 				      const void __user *buf, size_t count)
 {
+	size_t off = ring_offset(ring, ring->w_pos);
 	size_t len;
 
-	len = min(count, log->size - log->w_off);
-	if (len && copy_from_user(log->buffer + log->w_off, buf, len))
+	len = min(count, ring->size - off);
+	if (len && copy_from_user(ring->buffer + off, buf, len))
 		return -EFAULT;
 
 	if (count != len)
-		if (copy_from_user(log->buffer, buf + len, count - len))
+		if (copy_from_user(ring->buffer, buf + len, count - len))
 			return -EFAULT;
 
-	log->w_off = logger_offset(log->w_off + count);
+	ring->w_pos += count;
 
 	return count;
 }
 
+/*
+ * logger_wake_timer - delayed wakeup of a log's readers, armed by
+ * logger_should_wake()
+ */
+static void logger_wake_timer(unsigned long data)
+{
+	struct logger_log *log = (struct logger_log *) data;
+
+	wake_up_interruptible(&log->wq);
+}
+
+/*
+ * logger_should_wake - account a 'len' byte write to 'ring' and decide
+ * whether the writer should wake the log's readers now. If not, make sure
+ * they get woken by the ring's timer before long.
+ *
+ * Readers queue themselves on log->wq before checking the rings under their
+ * mutexes, so holding ring->mutex here is enough for us to see any reader
+ * that missed this entry.
+ *
+ * The caller needs to hold ring->mutex.
+ */
+static int logger_should_wake(struct logger_log *log, struct logger_ring *ring,
+			      size_t len)
+{
+	if (!waitqueue_active(&log->wq)) {
+		ring->unwoken = 0;
+		return 0;
+	}
+
+	ring->unwoken += len;
+	if (ring->unwoken >= LOGGER_WAKE_BATCH) {
+		ring->unwoken = 0;
+		return 1;
+	}
+
+	if (!timer_pending(&ring->wake_timer))
+		mod_timer(&ring->wake_timer, jiffies + LOGGER_WAKE_DELAY);
+
+	return 0;
+}
+
 /*
  * logger_aio_write - our write method, implementing support for write(),
  * writev(), and aio_write(). Writes are our fast path, and we try to optimize
  * them above all else.
+ *
+ * The entry goes into the current CPU's ring. We may be migrated before we
+ * get its lock; that only costs a little contention, not correctness.
  */
 ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 			 unsigned long nr_segs, loff_t ppos)
 {
 	struct logger_log *log = file_get_log(iocb->ki_filp);
-	size_t orig = log->w_off;
+	struct logger_ring *ring;
 	struct logger_entry header;
 	struct timespec now;
 	ssize_t ret = 0;
+	__u32 seq;
+	u64 orig;
+	int wake;
 
 	now = current_kernel_time();
 
@@ -340,17 +520,28 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 	if (unlikely(!header.len))
 		return 0;
 
-	mutex_lock(&log->mutex);
+	ring = &log->rings[raw_smp_processor_id() & (log->nr_rings - 1)];
+
+	mutex_lock(&ring->mutex);
+
+	/*
+	 * Number the entry under the lock, so that each ring stays in
+	 * sequence order for the readers' merge.
+	 */
+	seq = atomic_inc_return(&log->seq);
 
 	/*
-	 * Fix up any readers, pulling them forward to the first readable
-	 * entry after (what will be) the new write offset. We do this now
+	 * Fix up the head, pulling it forward to the first readable entry
+	 * after (what will be) the new write position. We do this now
 	 * because if we partially fail, we can end up with clobbered log
 	 * entries that encroach on readable buffer.
 	 */
-	fix_up_readers(log, sizeof(struct logger_entry) + header.len);
+	fix_up_head(ring, LOGGER_SEQ_LEN + sizeof(struct logger_entry) +
+		    header.len);
 
-	do_write_log(log, &header, sizeof(struct logger_entry));
+	orig = ring->w_pos;
+	do_write_log(ring, &seq, LOGGER_SEQ_LEN);
+	do_write_log(ring, &header, sizeof(struct logger_entry));
 
 	while (nr_segs-- > 0) {
 		size_t len;
@@ -360,10 +551,10 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 		len = min_t(size_t, iov->iov_len, header.len - ret);
 
 		/* write out this segment's payload */
-		nr = do_write_log_from_user(log, iov->iov_base, len);
+		nr = do_write_log_from_user(ring, iov->iov_base, len);
 		if (unlikely(nr < 0)) {
-			log->w_off = orig;
-			mutex_unlock(&log->mutex);
+			ring->w_pos = orig;
+			mutex_unlock(&ring->mutex);
 			return nr;
 		}
 
@@ -371,10 +562,14 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 		ret += nr;
 	}
 
-	mutex_unlock(&log->mutex);
+	wake = logger_should_wake(log, ring,
+				  sizeof(struct logger_entry) + header.len);
+
+	mutex_unlock(&ring->mutex);
 
 	/* wake up any blocked readers */
-	wake_up_interruptible(&log->wq);
+	if (wake)
+		wake_up_interruptible(&log->wq);
 
 	return ret;
 }
@@ -401,18 +596,28 @@ static int logger_open(struct inode *inode, struct file *file)
 
 	if (file->f_mode & FMODE_READ) {
 		struct logger_reader *reader;
+		int i;
 
 		reader = kmalloc(sizeof(struct logger_reader), GFP_KERNEL);
 		if (!reader)
 			return -ENOMEM;
 
+		reader->entry = kmalloc(LOGGER_ENTRY_MAX_LEN, GFP_KERNEL);
+		if (!reader->entry) {
+			kfree(reader);
+			return -ENOMEM;
+		}
+
 		reader->log = log;
-		INIT_LIST_HEAD(&reader->list);
+		mutex_init(&reader->mutex);
 
-		mutex_lock(&log->mutex);
-		reader->r_off = log->head;
-		list_add_tail(&reader->list, &log->readers);
-		mutex_unlock(&log->mutex);
+		for (i = 0; i < log->nr_rings; i++) {
+			struct logger_ring *ring = &log->rings[i];
+
+			mutex_lock(&ring->mutex);
+			reader->r_pos[i] = ring->head;
+			mutex_unlock(&ring->mutex);
+		}
 
 		file->private_data = reader;
 	} else
@@ -430,7 +635,7 @@ static int logger_release(struct inode *ignored, struct file *file)
 {
 	if (file->f_mode & FMODE_READ) {
 		struct logger_reader *reader = file->private_data;
-		list_del(&reader->list);
+		kfree(reader->entry);
 		kfree(reader);
 	}
 
@@ -460,11 +665,11 @@ static unsigned int logger_poll(struct file *file, poll_table *wait)
 
 	poll_wait(file, &log->wq, wait);
 
-	mutex_lock(&log->mutex);
-	if (log->w_off != reader->r_off)
+	mutex_lock(&reader->mutex);
+	if (logger_pending(reader))
 		ret |= POLLIN | POLLRDNORM;
-	mutex_unlock(&log->mutex);
-	
+	mutex_unlock(&reader->mutex);
+
 	return ret;
 }
 
@@ -473,8 +678,7 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 	struct logger_log *log = file_get_log(file);
 	struct logger_reader *reader;
 	long ret = -ENOTTY;
-
-	mutex_lock(&log->mutex);
+	int i;
 
 	switch (cmd) {
 	case LOGGER_GET_LOG_BUF_SIZE:
@@ -486,10 +690,16 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			break;
 		}
 		reader = file->private_data;
-		if (log->w_off >= reader->r_off)
-			ret = log->w_off - reader->r_off;
-		else
-			ret = (log->size - reader->r_off) + log->w_off;
+		mutex_lock(&reader->mutex);
+		ret = 0;
+		for (i = 0; i < log->nr_rings; i++) {
+			struct logger_ring *ring = &log->rings[i];
+
+			mutex_lock(&ring->mutex);
+			ret += logger_unread(ring, reader_pos(reader, i));
+			mutex_unlock(&ring->mutex);
+		}
+		mutex_unlock(&reader->mutex);
 		break;
 	case LOGGER_GET_NEXT_ENTRY_LEN:
 		if (!(file->f_mode & FMODE_READ)) {
@@ -497,25 +707,36 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			break;
 		}
 		reader = file->private_data;
-		if (log->w_off != reader->r_off)
-			ret = get_entry_len(log, reader->r_off);
-		else
-			ret = 0;
+		mutex_lock(&reader->mutex);
+		ret = 0;
+		i = logger_next_ring(reader);
+		if (i >= 0) {
+			struct logger_ring *ring = &log->rings[i];
+
+			mutex_lock(&ring->mutex);
+			if (reader_pos(reader, i) != ring->w_pos)
+				ret = get_entry_len(ring, reader->r_pos[i]);
+			mutex_unlock(&ring->mutex);
+		}
+		mutex_unlock(&reader->mutex);
 		break;
 	case LOGGER_FLUSH_LOG:
 		if (!(file->f_mode & FMODE_WRITE)) {
 			ret = -EBADF;
 			break;
 		}
-		list_for_each_entry(reader, &log->readers, list)
-			reader->r_off = log->w_off;
-		log->head = log->w_off;
+		/* readers find themselves behind the head and skip ahead */
+		for (i = 0; i < log->nr_rings; i++) {
+			struct logger_ring *ring = &log->rings[i];
+
+			mutex_lock(&ring->mutex);
+			ring->head = ring->w_pos;
+			mutex_unlock(&ring->mutex);
+		}
 		ret = 0;
 		break;
 	}
 
-	mutex_unlock(&log->mutex);
-
 	return ret;
 }
 
@@ -546,10 +767,6 @@ static struct logger_log VAR = { \
 		.parent = NULL, \
 	}, \
 	.wq = __WAIT_QUEUE_HEAD_INITIALIZER(VAR .wq), \
-	.readers = LIST_HEAD_INIT(VAR .readers), \
-	.mutex = __MUTEX_INITIALIZER(VAR .mutex), \
-	.w_off = 0, \
-	.head = 0, \
 	.size = SIZE, \
 };
 
@@ -568,10 +785,40 @@ static struct logger_log * get_log_from_minor(int minor)
 	return NULL;
 }
 
+/*
+ * init_log_rings - split the log's buffer into per-CPU rings. We use as many
+ * rings as there are possible CPUs, rounded down to a power of two, as long as
+ * each ring stays at least LOGGER_MIN_RING_SIZE bytes.
+ */
+static void __init init_log_rings(struct logger_log *log)
+{
+	int i, nr = 1;
+
+	while (nr * 2 <= num_possible_cpus() && nr * 2 <= LOGGER_MAX_RINGS &&
+	       log->size / (nr * 2) >= LOGGER_MIN_RING_SIZE)
+		nr *= 2;
+
+	log->nr_rings = nr;
+	for (i = 0; i < nr; i++) {
+		struct logger_ring *ring = &log->rings[i];
+
+		ring->size = log->size / nr;
+		ring->buffer = log->buffer + i * ring->size;
+		mutex_init(&ring->mutex);
+		ring->w_pos = 0;
+		ring->head = 0;
+		ring->unwoken = 0;
+		setup_timer(&ring->wake_timer, logger_wake_timer,
+			    (unsigned long) log);
+	}
+}
+
 static int __init init_log(struct logger_log *log)
 {
 	int ret;
 
+	init_log_rings(log);
+
 	ret = misc_register(&log->misc);
 	if (unlikely(ret)) {
 		printk(KERN_ERR "logger: failed to register misc "
@@ -579,8 +826,8 @@ static int __init init_log(struct logger_log *log)
 		return ret;
 	}
 
-	printk(KERN_INFO "logger: created %luK log '%s'\n",
-	       (unsigned long) log->size >> 10, log->misc.name);
+	printk(KERN_INFO "logger: created %luK log '%s' (%d rings)\n",
+	       (unsigned long) log->size >> 10, log->misc.name, log->nr_rings);
 
 	return 0;
 }
@@ -25,6 +25,11 @@
 #include <linux/mtd/partitions.h>
 #include <asm/mach/flash.h>
 #include <asm/io.h>
+#ifdef CONFIG_MTD_NAND_MXC_SDMA
+#include <linux/completion.h>
+#include <linux/dma-mapping.h>
+#include <asm/dma.h>
+#endif
 #include "mxc_nd2.h"
 
 #define DVR_VER "2.5"
@@ -49,6 +54,8 @@ static struct mxc_mtd_s *mxc_nand_data;
 struct nand_info {
 	bool bStatusRequest;
 	u16 colAddr;
+	/* data_buf/oob_buf hold the page, else it is only in the NFC RAM */
+	bool bBufValid;
 };
 
 static struct nand_info g_nandfc_info;
@@ -68,6 +75,17 @@ static int g_page_mask;
 
 static struct clk *nfc_clk;
 
+#ifdef CONFIG_MTD_NAND_MXC_SDMA
+/*
+ * Define the SDMA timeout for a page transfer in msec
+ */
+#define NFC_DMA_TIMEOUT_MS	100
+
+static int nfc_dma_chan = -1;
+static int nfc_dma_err;
+static struct completion nfc_dma_done;
+#endif
+
 /*
  * OOB placement block for use with hardware ecc generation
  */
@@ -249,9 +267,13 @@ static void auto_cmd_interleave(struct mtd_info *mtd, u16 cmd)
 			/* reset addr cycle */
 			mxc_do_addr_cycle(mtd, 0, page_addr++);
 
-			/* data transfer */
-			memcpy(MAIN_AREA0, dbuf, dlen);
-			copy_spare(mtd, obuf, SPARE_AREA0, olen, false);
+			/* data transfer, unless write_page already filled
+			 * the NFC RAM
+			 */
+			if (g_nandfc_info.bBufValid) {
+				memcpy(MAIN_AREA0, dbuf, dlen);
+				copy_spare(mtd, obuf, SPARE_AREA0, olen, false);
+			}
 
 			/* update the value */
 			dbuf += dlen;
@@ -277,19 +299,24 @@ static void auto_cmd_interleave(struct mtd_info *mtd, u16 cmd)
 			NFC_SET_RBA(0);
 			ACK_OPS;
 			raw_write(NFC_AUTO_READ, REG_NFC_OPS);
-			wait_op_done(TROP_US_DELAY, false);
+			wait_op_done(TROP_US_DELAY, true);
 
 			/* check ecc error */
 			mxc_check_ecc_status(mtd);
 
-			/* data transfer */
-			memcpy(dbuf, MAIN_AREA0, dlen);
-			copy_spare(mtd, obuf, SPARE_AREA0, olen, true);
+			/* data transfer, a single chunk is left in the
+			 * NFC RAM for read_page to pick up
+			 */
+			if (j > 1) {
+				memcpy(dbuf, MAIN_AREA0, dlen);
+				copy_spare(mtd, obuf, SPARE_AREA0, olen, true);
+			}
 
 			/* update the value */
 			dbuf += dlen;
 			obuf += olen;
 		}
+		g_nandfc_info.bBufValid = (j > 1);
 		break;
 	case NAND_CMD_ERASE2:
 		for (i = 0; i < j; i++) {
@@ -404,7 +431,7 @@ static void send_prog_page(u8 buf_id)
 	raw_write(NFC_INPUT, REG_NFC_OPS);
 
 	/* Wait for operation to complete */
-	wait_op_done(TROP_US_DELAY, false);
+	wait_op_done(TROP_US_DELAY, true);
 #endif
 }
 
@@ -429,7 +456,7 @@ static void send_read_page(u8 buf_id)
 	raw_write(NFC_OUTPUT, REG_NFC_OPS);
 
 	/* Wait for operation to complete */
-	wait_op_done(TROP_US_DELAY, false);
+	wait_op_done(TROP_US_DELAY, true);
 #endif
 }
 
@@ -591,6 +618,133 @@ static int mxc_nand_calculate_ecc(struct mtd_info *mtd, const u_char * dat,
 	return 0;
 }
 
+#ifdef CONFIG_MTD_NAND_MXC_SDMA
+static void mxc_nand_dma_callback(void *arg, int error, unsigned int count)
+{
+	nfc_dma_err = (error == MXC_DMA_DONE) ? 0 : -EIO;
+	complete(&nfc_dma_done);
+}
+
+/*!
+ * This function moves the main area of a page between the NFC RAM buffer
+ * and \b buf with an SDMA memory channel.
+ *
+ * @param       mtd     MTD structure for the NAND Flash
+ * @param       buf     page buffer
+ * @param       bfrom   true to read from the NFC RAM
+ *
+ * @return      0 on success, else the caller copies with the CPU
+ */
+static int mxc_nand_dma_main(struct mtd_info *mtd, u_char *buf, bool bfrom)
+{
+	struct device *dev = mxc_nand_data->dev;
+	enum dma_data_direction dir = bfrom ? DMA_FROM_DEVICE : DMA_TO_DEVICE;
+	mxc_dma_requestbuf_t req;
+	dma_addr_t addr;
+	int len = mtd->writesize;
+	int ret;
+
+	/* lowmem and cache line aligned only, vmalloc buffers use the CPU */
+	if (nfc_dma_chan < 0 || !virt_addr_valid(buf) ||
+	    !virt_addr_valid(buf + len - 1) ||
+	    ((unsigned long)buf & (L1_CACHE_BYTES - 1)))
+		return -EINVAL;
+
+	addr = dma_map_single(dev, buf, len, dir);
+	if (bfrom) {
+		req.src_addr = NFC_AXI_BASE_ADDR;
+		req.dst_addr = addr;
+	} else {
+		req.src_addr = addr;
+		req.dst_addr = NFC_AXI_BASE_ADDR;
+	}
+	req.num_of_bytes = len;
+
+	INIT_COMPLETION(nfc_dma_done);
+	ret = mxc_dma_config(nfc_dma_chan, &req, 1,
+			     bfrom ? MXC_DMA_MODE_READ : MXC_DMA_MODE_WRITE);
+	if (ret == 0) {
+		mxc_dma_enable(nfc_dma_chan);
+		if (wait_for_completion_timeout(&nfc_dma_done,
+				msecs_to_jiffies(NFC_DMA_TIMEOUT_MS)) == 0) {
+			printk(KERN_WARNING "%s: SDMA timeout, using CPU copies\n",
+			       __func__);
+			mxc_dma_disable(nfc_dma_chan);
+			mxc_dma_free(nfc_dma_chan);
+			nfc_dma_chan = -1;
+			ret = -ETIMEDOUT;
+		} else {
+			mxc_dma_disable(nfc_dma_chan);
+			ret = nfc_dma_err;
+		}
+	}
+	dma_unmap_single(dev, addr, len, dir);
+
+	return ret;
+}
+#endif
+
+/*!
+ * This function moves the main area of a page straight between the NFC RAM
+ * buffer and \b buf, without going through data_buf.
+ *
+ * @param       mtd     MTD structure for the NAND Flash
+ * @param       buf     page buffer
+ * @param       bfrom   true to read from the NFC RAM
+ */
+static void mxc_nand_copy_main(struct mtd_info *mtd, u_char *buf, bool bfrom)
+{
+	/* The NFC RAM does not allow byte access, bounce unaligned buffers */
+	if ((unsigned long)buf & 3) {
+		if (bfrom) {
+			memcpy(data_buf, MAIN_AREA0, mtd->writesize);
+			memcpy(buf, data_buf, mtd->writesize);
+		} else {
+			memcpy(data_buf, buf, mtd->writesize);
+			memcpy(MAIN_AREA0, data_buf, mtd->writesize);
+		}
+		return;
+	}
+
+#ifdef CONFIG_MTD_NAND_MXC_SDMA
+	if (mxc_nand_dma_main(mtd, buf, bfrom) == 0)
+		return;
+#endif
+
+	if (bfrom)
+		memcpy(buf, MAIN_AREA0, mtd->writesize);
+	else
+		memcpy(MAIN_AREA0, buf, mtd->writesize);
+}
+
+/*!
+ * This function copies the page in the NFC RAM buffer into data_buf and
+ * oob_buf for the byte oriented accessors, if not done yet. Whole page
+ * reads and writes do not need it.
+ *
+ * @param       mtd     MTD structure for the NAND Flash
+ */
+static void mxc_nand_stage_buf(struct mtd_info *mtd)
+{
+	if (g_nandfc_info.bBufValid || !mtd->writesize)
+		return;
+
+	/* FIXME:the NFC interal buffer
+	 * access has some limitation, it
+	 * does not allow byte access. To
+	 * make the code simple and ease use
+	 * not every time check the address
+	 * alignment.Use the temp buffer
+	 * to accomadate the data.since We
+	 * know data_buf will be at leat 4
+	 * byte alignment, so we can use
+	 * memcpy safely
+	 */
+	memcpy(data_buf, MAIN_AREA0, mtd->writesize);
+	copy_spare(mtd, oob_buf, SPARE_AREA0, mtd->oobsize, true);
+	g_nandfc_info.bBufValid = true;
+}
+
 /*!
  * This function id is used to read the data buffer from the NAND Flash. To
  * read the data from NAND Flash first the data output cycle is initiated by
@@ -605,6 +759,8 @@ static void mxc_nand_read_buf(struct mtd_info *mtd, u_char * buf, int len)
 {
 	u16 col = g_nandfc_info.colAddr;
 
+	mxc_nand_stage_buf(mtd);
+
 	if (mtd->writesize) {
 
 		int j = mtd->writesize - col;
@@ -710,6 +866,9 @@ static void mxc_nand_write_buf(struct mtd_info *mtd,
 	int j = mtd->writesize - col;
 	int n = mtd->oobsize + j;
 
+	/* keep the rest of the page when patching part of it */
+	mxc_nand_stage_buf(mtd);
+
 	n = min(n, len);
 
 	if (j > 0) {
@@ -742,10 +901,13 @@ static void mxc_nand_write_buf(struct mtd_info *mtd,
 static int mxc_nand_verify_buf(struct mtd_info *mtd, const u_char * buf,
 			       int len)
 {
-	u_char *s = data_buf;
+	u_char *s;
 
 	const u_char *p = buf;
 
+	mxc_nand_stage_buf(mtd);
+	s = data_buf;
+
 	for (; len > 0; len--) {
 		if (*p++ != *s++)
 			return -EFAULT;
@@ -889,12 +1051,16 @@ static void mxc_nand_command(struct mtd_info *mtd, unsigned command,
 			 */
 
 			mxc_nand_command(mtd, NAND_CMD_READ0, 0, page_addr);
+		} else {
+			/* write_buf fills data_buf from scratch */
+			g_nandfc_info.bBufValid = true;
 		}
 
 		g_nandfc_info.colAddr = column;
 		break;
 
 	case NAND_CMD_PAGEPROG:
+	case NAND_CMD_CACHEDPROG:
 #ifndef NFC_AUTO_MODE_ENABLE
 		/* FIXME:the NFC interal buffer
 		 * access has some limitation, it
@@ -905,10 +1071,14 @@ static void mxc_nand_command(struct mtd_info *mtd, unsigned command,
 		 * to accomadate the data.since We
 		 * know data_buf will be at leat 4
 		 * byte alignment, so we can use
-		 * memcpy safely
+		 * memcpy safely. write_page puts
+		 * whole pages in the NFC RAM itself.
 		 */
-		memcpy(MAIN_AREA0, data_buf, mtd->writesize);
-		copy_spare(mtd, oob_buf, SPARE_AREA0, mtd->oobsize, false);
+		if (g_nandfc_info.bBufValid) {
+			memcpy(MAIN_AREA0, data_buf, mtd->writesize);
+			copy_spare(mtd, oob_buf, SPARE_AREA0, mtd->oobsize,
+				   false);
+		}
 #endif
 
 		if (IS_LARGE_PAGE_NAND)
@@ -952,19 +1122,8 @@ static void mxc_nand_command(struct mtd_info *mtd, unsigned command,
 		}
 
 #ifndef NFC_AUTO_MODE_ENABLE
-		/* FIXME, the NFC interal buffer
-		 * access has some limitation, it
-		 * does not allow byte access. To
-		 * make the code simple and ease use
-		 * not every time check the address
-		 * alignment.Use the temp buffer
-		 * to accomadate the data.since We
-		 * know data_buf will be at leat 4
-		 * byte alignment, so we can use
-		 * memcpy safely
-		 */
-		memcpy(data_buf, MAIN_AREA0, mtd->writesize);
-		copy_spare(mtd, oob_buf, SPARE_AREA0, mtd->oobsize, true);
+		/* The page stays in the NFC RAM until it is asked for */
+		g_nandfc_info.bBufValid = false;
 #endif
 
 		break;
@@ -973,6 +1132,7 @@ static void mxc_nand_command(struct mtd_info *mtd, unsigned command,
 		send_read_id();
 		g_nandfc_info.colAddr = column;
 		memcpy(data_buf, MAIN_AREA0, 2048);
+		g_nandfc_info.bBufValid = true;
 
 		break;
 	}
@@ -987,7 +1147,10 @@ static int mxc_nand_read_oob(struct mtd_info *mtd,
 		sndcmd = 0;
 	}
 
-	memcpy(chip->oob_poi, oob_buf, mtd->oobsize);
+	if (g_nandfc_info.bBufValid)
+		memcpy(chip->oob_poi, oob_buf, mtd->oobsize);
+	else
+		copy_spare(mtd, chip->oob_poi, SPARE_AREA0, mtd->oobsize, true);
 
 	return sndcmd;
 }
@@ -1000,8 +1163,13 @@ static int mxc_nand_read_page(struct mtd_info *mtd, struct nand_chip *chip,
 	mxc_check_ecc_status(mtd);
 #endif
 
-	memcpy(buf, data_buf, mtd->writesize);
-	memcpy(chip->oob_poi, oob_buf, mtd->oobsize);
+	if (g_nandfc_info.bBufValid) {
+		memcpy(buf, data_buf, mtd->writesize);
+		memcpy(chip->oob_poi, oob_buf, mtd->oobsize);
+	} else {
+		mxc_nand_copy_main(mtd, buf, true);
+		copy_spare(mtd, chip->oob_poi, SPARE_AREA0, mtd->oobsize, true);
+	}
 
 	return 0;
 }
@@ -1009,9 +1177,144 @@ static int mxc_nand_read_page(struct mtd_info *mtd, struct nand_chip *chip,
 static void mxc_nand_write_page(struct mtd_info *mtd, struct nand_chip *chip,
 				const uint8_t * buf)
 {
-	memcpy(data_buf, buf, mtd->writesize);
-	memcpy(oob_buf, chip->oob_poi, mtd->oobsize);
+	/* interleaved pages are split up by auto_cmd_interleave() */
+	if (num_of_interleave > 1) {
+		memcpy(data_buf, buf, mtd->writesize);
+		memcpy(oob_buf, chip->oob_poi, mtd->oobsize);
+		g_nandfc_info.bBufValid = true;
+		return;
+	}
+
+	mxc_nand_copy_main(mtd, (u_char *) buf, false);
+	copy_spare(mtd, chip->oob_poi, SPARE_AREA0, mtd->oobsize, false);
+	g_nandfc_info.bBufValid = false;
+}
 
+/*
+ * Function to wait until the array is idle again after a cache program.
+ * nand_wait() only waits for the cache register (SR6).
+ */
+static int mxc_nand_wait_true_ready(struct mtd_info *mtd,
+				    struct nand_chip *chip)
+{
+	unsigned long timeo = jiffies + msecs_to_jiffies(20);
+	int status;
+
+	chip->cmdfunc(mtd, NAND_CMD_STATUS, -1, -1);
+	do {
+		status = chip->read_byte(mtd);
+		if (status & NAND_STATUS_TRUE_READY)
+			break;
+		cond_resched();
+	} while (time_before(jiffies, timeo));
+
+	return status;
+}
+
+/*!
+ * This function writes one page. Pages followed by another page of the same
+ * block are written with cache program, so the next page is loaded while
+ * the array programs this one.
+ *
+ * @param       mtd     MTD structure for the NAND Flash
+ * @param       chip    NAND chip structure
+ * @param       buf     data to be written
+ * @param       page    page number to write
+ * @param       cached  more pages follow in this write
+ * @param       raw     use the _raw version of write_page
+ *
+ * @return      0 on success, -EIO on program failure
+ */
+static int mxc_nand_write_page_cached(struct mtd_info *mtd,
+				      struct nand_chip *chip,
+				      const uint8_t * buf, int page,
+				      int cached, int raw)
+{
+	int blockmask = (1 << (chip->phys_erase_shift - chip->page_shift)) - 1;
+	int status;
+
+	chip->cmdfunc(mtd, NAND_CMD_SEQIN, 0x00, page);
+
+	if (unlikely(raw))
+		chip->ecc.write_page_raw(mtd, chip, buf);
+	else
+		chip->ecc.write_page(mtd, chip, buf);
+
+	/* A cache sequence must not cross the block */
+	if (((page + 1) & blockmask) == 0)
+		cached = 0;
+
+#ifdef CONFIG_MTD_NAND_VERIFY_WRITE
+	/* the read back can not be issued while the array is busy */
+	cached = 0;
+#endif
+
+	if (cached && (chip->options & NAND_CACHEPRG)) {
+		chip->cmdfunc(mtd, NAND_CMD_CACHEDPROG, -1, -1);
+		status = chip->waitfunc(mtd, chip);
+
+		/* SR1 reports the page before this one */
+		if (status & NAND_STATUS_FAIL_N1) {
+			mxc_nand_wait_true_ready(mtd, chip);
+			return -EIO;
+		}
+	} else {
+		chip->cmdfunc(mtd, NAND_CMD_PAGEPROG, -1, -1);
+		status = chip->waitfunc(mtd, chip);
+
+		/* the last page of a cache sequence has to finish too */
+		if (chip->options & NAND_CACHEPRG) {
+			if (!(status & NAND_STATUS_TRUE_READY))
+				status = mxc_nand_wait_true_ready(mtd, chip);
+			if (status & NAND_STATUS_FAIL_N1)
+				return -EIO;
+		}
+
+		if ((status & NAND_STATUS_FAIL) && (chip->errstat))
+			status = chip->errstat(mtd, chip, FL_WRITING, status,
+					       page);
+
+		if (status & NAND_STATUS_FAIL)
+			return -EIO;
+	}
+
+#ifdef CONFIG_MTD_NAND_VERIFY_WRITE
+	/* Send command to read back the data */
+	chip->cmdfunc(mtd, NAND_CMD_READ0, 0, page);
+
+	if (chip->verify_buf(mtd, buf, mtd->writesize))
+		return -EIO;
+#endif
+	return 0;
+}
+
+/*
+ * Function to use cache program only when the 3rd ID byte advertises it.
+ * nand_base sets NAND_CACHEPRG from its chip tables, so the flag is cleared
+ * here first.  The NFC auto mode has no cache program command.
+ */
+static void mxc_nand_detect_cacheprg(struct mtd_info *mtd)
+{
+	struct nand_chip *this = mtd->priv;
+#ifndef NFC_AUTO_MODE_ENABLE
+	u8 id[3];
+	int i;
+#endif
+
+	this->options &= ~NAND_CACHEPRG;
+
+#ifndef NFC_AUTO_MODE_ENABLE
+	this->select_chip(mtd, 0);
+	this->cmdfunc(mtd, NAND_CMD_READID, 0x00, -1);
+	for (i = 0; i < 3; i++)
+		id[i] = this->read_byte(mtd);
+	this->select_chip(mtd, -1);
+
+	if (id[2] & 0x80) {
+		this->options |= NAND_CACHEPRG;
+		pr_info("MXC_ND2: using cache program\n");
+	}
+#endif
 }
 
 /* Define some generic bad / good block scan pattern which are used
@@ -1210,6 +1513,7 @@ static int __init mxcnd_probe(struct platform_device *pdev)
 	this->read_buf = mxc_nand_read_buf;
 	this->verify_buf = mxc_nand_verify_buf;
 	this->scan_bbt = mxc_nand_scan_bbt;
+	this->write_page = mxc_nand_write_page_cached;
 
 	/* NAND bus width determines access funtions used by upper layer */
 	if (flash->width == 2) {
@@ -1229,6 +1533,15 @@ static int __init mxcnd_probe(struct platform_device *pdev)
 		goto out_1;
 	}
 
+#ifdef CONFIG_MTD_NAND_MXC_SDMA
+	init_completion(&nfc_dma_done);
+	nfc_dma_chan = mxc_dma_request(MXC_DMA_MEMORY, "mxc_nd2");
+	if (nfc_dma_chan < 0)
+		pr_info("MXC_ND2: no SDMA channel, using CPU copies\n");
+	else
+		mxc_dma_callback_set(nfc_dma_chan, mxc_nand_dma_callback, NULL);
+#endif
+
 	if (hardware_ecc) {
 		this->ecc.read_page = mxc_nand_read_page;
 		this->ecc.write_page = mxc_nand_write_page;
@@ -1256,13 +1569,20 @@ static int __init mxcnd_probe(struct platform_device *pdev)
 	this->cmdfunc(mtd, NAND_CMD_RESET, -1, -1);
 
 	/* Scan to find existence of the device */
-	if (nand_scan(mtd, NFC_GET_MAXCHIP_SP())) {
+	if (nand_scan_ident(mtd, NFC_GET_MAXCHIP_SP())) {
 		DEBUG(MTD_DEBUG_LEVEL0,
 		      "MXC_ND2: Unable to find any NAND device.\n");
 		err = -ENXIO;
 		goto out_1;
 	}
 
+	mxc_nand_detect_cacheprg(mtd);
+
+	if (nand_scan_tail(mtd)) {
+		err = -ENXIO;
+		goto out_1;
+	}
+
 	/* Register the partitions */
 #ifdef CONFIG_MTD_PARTITIONS
 	nr_parts =
@@ -1313,6 +1633,10 @@ static int __exit mxcnd_remove(struct platform_device *pdev)
 
 	if (mxc_nand_data) {
 		nand_release(mtd);
+#ifdef CONFIG_MTD_NAND_MXC_SDMA
+		if (nfc_dma_chan >= 0)
+			mxc_dma_free(nfc_dma_chan);
+#endif
 		free_irq(MXC_INT_NANDFC, NULL);
 		kfree(mxc_nand_data);
 	}
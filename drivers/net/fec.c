@@ -40,6 +40,10 @@
 #include <linux/workqueue.h>
 #include <linux/bitops.h>
 #include <linux/clk.h>
+#include <linux/ethtool.h>
+#include <linux/hrtimer.h>
+#include <linux/mii.h>
+#include <linux/phy.h>
 
 #include <asm/irq.h>
 #include <asm/uaccess.h>
@@ -69,10 +73,6 @@
 #define	FEC_MAX_PORTS	1
 #endif
 
-#if defined(CONFIG_M5272) || defined(CONFIG_ARCH_MXC)
-#define HAVE_mii_link_interrupt
-#endif
-
 /*
  * Define the fixed address of the FEC hardware.
  */
@@ -117,40 +117,35 @@ static unsigned char	fec_mac_default[] = {
 #define	FEC_FLASHMAC	0
 #endif
 
-/* Forward declarations of some structures to support different PHYs
-*/
-
-typedef struct {
-	uint mii_data;
-	void (*funct)(uint mii_reg, struct net_device *dev);
-} phy_cmd_t;
-
-typedef struct {
-	uint id;
-	char *name;
-
-	const phy_cmd_t *config;
-	const phy_cmd_t *startup;
-	const phy_cmd_t *ack_int;
-	const phy_cmd_t *shutdown;
-} phy_info_t;
-
 /* The number of Tx and Rx buffers.  These are allocated from the page
  * pool.  The code may assume these are power of two, so it it best
  * to keep them that size.
  * We don't need to allocate pages for the transmitter.  We just use
- * the skbuffer directly.
+ * the skbuffer directly, one descriptor per frame, unless the FEC cannot
+ * fetch it because of its alignment.  Such frames are copied into the
+ * descriptor's bounce buffer.
  */
 #define FEC_ENET_RX_PAGES	8
 #define FEC_ENET_RX_FRSIZE	2048
 #define FEC_ENET_RX_FRPPG	(PAGE_SIZE / FEC_ENET_RX_FRSIZE)
 #define RX_RING_SIZE		(FEC_ENET_RX_FRPPG * FEC_ENET_RX_PAGES)
+#define FEC_RX_RING_MIN		8
+#define FEC_RX_RING_MAX		256
 #define FEC_ENET_TX_FRSIZE	2048
-#define FEC_ENET_TX_FRPPG	(PAGE_SIZE / FEC_ENET_TX_FRSIZE)
-#define TX_RING_SIZE		16	/* Must be power of two */
-#define TX_RING_MOD_MASK	15	/*   for this to work */
+#define TX_RING_SIZE		64	/* Default transmit ring size */
+#define FEC_TX_RING_MIN		8
+#define FEC_TX_RING_MAX		256
+
+/* Default number of receive frames handled per NAPI poll. */
+#define FEC_NAPI_WEIGHT		RX_RING_SIZE
 
-#if (((RX_RING_SIZE + TX_RING_SIZE) * 8) > PAGE_SIZE)
+/* Upper bound for the software interrupt coalescing interval. */
+#define FEC_COAL_USECS_MAX	10000
+
+/* Both rings live in one page, the Tx ring at a fixed offset behind the
+ * largest Rx ring, so resizing a ring never moves the other one.
+ */
+#if (((FEC_RX_RING_MAX + FEC_TX_RING_MAX) * 8) > PAGE_SIZE)
 #error "FEC: descriptor ring size constants too large"
 #endif
 
@@ -173,6 +168,10 @@ typedef struct {
 #define FEC_ENET_MASK   ((uint)0xfff80000)
 #endif
 
+/* Events serviced from the NAPI poll routine rather than the interrupt. */
+#define FEC_ENET_NAPI_EVENTS	(FEC_ENET_TXF | FEC_ENET_TXB | \
+				 FEC_ENET_RXF | FEC_ENET_RXB)
+
 /* The FEC stores dest/src/type, data, and checksum for receive packets.
  */
 #define PKT_MAXBUF_SIZE		1518
@@ -206,12 +205,13 @@ struct fec_enet_private {
 
 	struct net_device *netdev;
 
-	/* The saved address of a sent-in-place packet/buffer, for skfree(). */
-	unsigned char *tx_bounce[TX_RING_SIZE];
-	struct	sk_buff* tx_skbuff[TX_RING_SIZE];
-	struct  sk_buff* rx_skbuff[RX_RING_SIZE];
-	ushort	skb_cur;
-	ushort	skb_dirty;
+	/* Bounce buffers for misaligned frames, one per descriptor. */
+	unsigned char *tx_bounce[FEC_TX_RING_MAX];
+	struct	sk_buff* tx_skbuff[FEC_TX_RING_MAX];
+	struct  sk_buff* rx_skbuff[FEC_RX_RING_MAX];
+	uint	rx_ring_size;	/* Descriptors in use in the Rx ring */
+	uint	tx_ring_size;	/* Descriptors in use in the Tx ring */
+	uint	tx_free;	/* Descriptors not owned by a pending frame */
 
 	/* CPM dual port RAM relative addresses.
 	*/
@@ -220,29 +220,37 @@ struct fec_enet_private {
 	cbd_t	*tx_bd_base;
 	cbd_t	*cur_rx, *cur_tx;		/* The next free ring entry */
 	cbd_t	*dirty_tx;	/* The ring entries to be free()ed. */
-	uint	tx_full;
 	/* hold while accessing the HW like ringbuffer for tx/rx but not MAC */
 	spinlock_t hw_lock;
-	/* hold while accessing the mii_list_t() elements */
-	spinlock_t mii_lock;
 
-	uint	phy_id;
-	uint	phy_id_done;
-	uint	phy_status;
+	struct napi_struct napi;
+
+	/* The FEC has no interrupt coalescing of its own.  While traffic
+	 * flows, interrupts stay masked and coal_timer schedules the NAPI
+	 * poll every rx_coal_usecs; see fec_enet_napi_poll().
+	 */
+	struct hrtimer coal_timer;
+	uint	rx_coal_usecs;
+	uint	rx_coal_frames;
+	uint	coal_adaptive;
+
+	/* Receive path counters, reported through ethtool -S. */
+	unsigned long rx_copybreak;	/* frames copied into a small skb */
+	unsigned long rx_zerocopy;	/* frames passed up in the ring skb */
+	unsigned long rx_alloc_fail;	/* frames dropped, buffer recycled */
+	unsigned long tx_bounced;	/* frames copied for alignment */
+	unsigned long coal_timer_polls;	/* polls started by coal_timer */
+
+	/* MDIO bus and the PHY attached while the interface is open */
+	struct	mii_bus *mii_bus;
+	struct	phy_device *phy_dev;
+	struct	completion mdio_done;
 	uint	phy_speed;
-	phy_info_t const	*phy;
-	struct work_struct phy_task;
 	struct net_device *net;
 
-	uint	sequence_done;
-	uint	mii_phy_task_queued;
-
-	uint	phy_addr;
-
 	int	index;
 	int	opened;
 	int	link;
-	int	old_link;
 	int	full_duplex;
 
 	struct clk *clk;
@@ -251,14 +259,18 @@ struct fec_enet_private {
 static int fec_enet_open(struct net_device *dev);
 static int fec_enet_start_xmit(struct sk_buff *skb, struct net_device *dev);
 static void fec_enet_mii(struct net_device *dev);
+static void fec_enet_adjust_link(struct net_device *dev);
 static irqreturn_t fec_enet_interrupt(int irq, void * dev_id);
-static void fec_enet_tx(struct net_device *dev);
-static void fec_enet_rx(struct net_device *dev);
+static int fec_enet_tx(struct net_device *dev);
+static int fec_enet_rx(struct net_device *dev, int budget);
+static int fec_enet_napi_poll(struct napi_struct *napi, int budget);
 static int fec_enet_close(struct net_device *dev);
 static void set_multicast_list(struct net_device *dev);
 static void fec_restart(struct net_device *dev, int duplex);
 static void fec_stop(struct net_device *dev);
 static void fec_set_mac_address(struct net_device *dev);
+static int fec_enet_alloc_rx_ring(struct net_device *dev);
+static int fec_enet_alloc_tx_bounce(struct fec_enet_private *fep);
 
 static void __inline__ fec_dcache_inv_range(void * start, void * end);
 static void __inline__ fec_dcache_flush_range(void * start, void * end);
@@ -269,71 +281,71 @@ static void __inline__ fec_dcache_flush_range(void * start, void * end);
  *     The resean is ethernet header is 14bytes.
  *     And the max size of tcp & ip header is 128bytes. Normally it is 40bytes.
  *     So I set the default value between 128 to 256.
+ *  Frames at or above the threshold are handed up in the ring skb itself
+ *  and the descriptor is refilled with a fresh buffer; frames below it are
+ *  copied and the ring buffer is recycled in place.  -1 disables copying.
  */
 static int fec_copy_threshold = -1;
+module_param(fec_copy_threshold, int, 0644);
+MODULE_PARM_DESC(fec_copy_threshold, "Receive copy-break threshold in bytes");
 
-/* MII processing.  We keep this as simple as possible.  Requests are
- * placed on the list (if there is room).  When the request is finished
- * by the MII, an optional function may be called.
+/*
+ *  fec_napi_weight is the maximum number of frames handled by one NAPI
+ *  poll before the receive interrupt is re-armed.
  */
-typedef struct mii_list {
-	uint	mii_regval;
-	void	(*mii_func)(uint val, struct net_device *dev);
-	struct	mii_list *mii_next;
-} mii_list_t;
-
-#define		NMII	20
-static mii_list_t	mii_cmds[NMII];
-static mii_list_t	*mii_free;
-static mii_list_t	*mii_head;
-static mii_list_t	*mii_tail;
+static int fec_napi_weight = FEC_NAPI_WEIGHT;
+module_param(fec_napi_weight, int, 0444);
+MODULE_PARM_DESC(fec_napi_weight, "NAPI receive budget per poll");
 
-static int	mii_queue(struct net_device *dev, int request,
-				void (*func)(uint, struct net_device *));
+/*
+ *  fec_tx_ring_size is the number of transmit descriptors, one per frame.
+ */
+static int fec_tx_ring_size = TX_RING_SIZE;
+module_param(fec_tx_ring_size, int, 0444);
+MODULE_PARM_DESC(fec_tx_ring_size, "Number of transmit descriptors");
 
 /* Make MII read/write commands for the FEC.
 */
 #define mk_mii_read(REG)	(0x60020000 | ((REG & 0x1f) << 18))
 #define mk_mii_write(REG, VAL)	(0x50020000 | ((REG & 0x1f) << 18) | \
 						(VAL & 0xffff))
-#define mk_mii_end	0
+#define mk_mii_phy(ADDR)	(((ADDR) & 0x1f) << 23)
+
+/* A management frame takes about 25 usec at 2.5 MHz. */
+#define FEC_MII_TIMEOUT		(HZ / 10)
 
 /* Transmitter timeout.
 */
 #define TX_TIMEOUT (2*HZ)
 
-/* Register definitions for the PHY.
-*/
 
-#define MII_REG_CR          0  /* Control Register                         */
-#define MII_REG_SR          1  /* Status Register                          */
-#define MII_REG_PHYIR1      2  /* PHY Identification Register 1            */
-#define MII_REG_PHYIR2      3  /* PHY Identification Register 2            */
-#define MII_REG_ANAR        4  /* A-N Advertisement Register               */
-#define MII_REG_ANLPAR      5  /* A-N Link Partner Ability Register        */
-#define MII_REG_ANER        6  /* A-N Expansion Register                   */
-#define MII_REG_ANNPTR      7  /* A-N Next Page Transmit Register          */
-#define MII_REG_ANLPRNPR    8  /* A-N Link Partner Received Next Page Reg. */
-
-/* values for phy_status */
-
-#define PHY_CONF_ANE	0x0001  /* 1 auto-negotiation enabled */
-#define PHY_CONF_LOOP	0x0002  /* 1 loopback mode enabled */
-#define PHY_CONF_SPMASK	0x00f0  /* mask for speed */
-#define PHY_CONF_10HDX	0x0010  /* 10 Mbit half duplex supported */
-#define PHY_CONF_10FDX	0x0020  /* 10 Mbit full duplex supported */
-#define PHY_CONF_100HDX	0x0040  /* 100 Mbit half duplex supported */
-#define PHY_CONF_100FDX	0x0080  /* 100 Mbit full duplex supported */
-
-#define PHY_STAT_LINK	0x0100  /* 1 up - 0 down */
-#define PHY_STAT_FAULT	0x0200  /* 1 remote fault */
-#define PHY_STAT_ANC	0x0400  /* 1 auto-negotiation complete	*/
-#define PHY_STAT_SPMASK	0xf000  /* mask for speed */
-#define PHY_STAT_10HDX	0x1000  /* 10 Mbit half duplex selected	*/
-#define PHY_STAT_10FDX	0x2000  /* 10 Mbit full duplex selected	*/
-#define PHY_STAT_100HDX	0x4000  /* 100 Mbit half duplex selected */
-#define PHY_STAT_100FDX	0x8000  /* 100 Mbit full duplex selected */
 
+/* Attach a frame to a transmit descriptor.  The FEC fetches the buffer
+ * directly unless its start is misaligned, in which case the frame goes
+ * through the descriptor's bounce buffer.  On MXC the FEC wants 16 byte
+ * alignment, which the stack rarely provides, so most frames are copied.
+ */
+static void
+fec_enet_tx_map(struct fec_enet_private *fep, volatile cbd_t *bdp,
+		void *buf, unsigned int len)
+{
+	unsigned int index;
+
+	if ((unsigned long)buf & FEC_ALIGNMENT) {
+		index = bdp - fep->tx_bd_base;
+		memcpy(fep->tx_bounce[index], buf, len);
+		buf = fep->tx_bounce[index];
+		fep->tx_bounced++;
+	}
+
+	/* Push the data cache so the FEC does not get stale memory
+	 * data.
+	 */
+	fec_dcache_flush_range(buf, buf + len);
+
+	bdp->cbd_bufaddr = __pa(buf);
+	bdp->cbd_datlen = len;
+}
 
 static int
 fec_enet_start_xmit(struct sk_buff *skb, struct net_device *dev)
@@ -353,63 +365,36 @@ fec_enet_start_xmit(struct sk_buff *skb, struct net_device *dev)
 	}
 
 	spin_lock_irqsave(&fep->hw_lock, flags);
-	/* Fill in a Tx ring entry */
-	bdp = fep->cur_tx;
-
-	status = bdp->cbd_sc;
-#ifndef final_version
-	if (status & BD_ENET_TX_READY) {
+	if (!fep->tx_free) {
 		/* Ooops.  All transmit buffers are full.  Bail out.
-		 * This should not happen, since dev->tbusy should be set.
+		 * This should not happen, since the queue is stopped
+		 * when the last descriptor is taken.
 		 */
 		printk("%s: tx queue full!.\n", dev->name);
+		netif_stop_queue(dev);
 		spin_unlock_irqrestore(&fep->hw_lock, flags);
 		return 1;
 	}
-#endif
 
-	/* Clear all of the status flags.
-	 */
-	status &= ~BD_ENET_TX_STATS;
-
-	/* Set buffer length and buffer pointer.
-	*/
-	bdp->cbd_bufaddr = __pa(skb->data);
-	bdp->cbd_datlen = skb->len;
-
-	/*
-	 *	On some FEC implementations data must be aligned on
-	 *	4-byte boundaries. Use bounce buffers to copy data
-	 *	and get it aligned. Ugh.
-	 */
-	if ((bdp->cbd_bufaddr) & FEC_ALIGNMENT) {
-		unsigned int index;
-		index = bdp - fep->tx_bd_base;
-		memcpy(fep->tx_bounce[index], (void *) skb->data, skb->len);
-		bdp->cbd_bufaddr = __pa(fep->tx_bounce[index]);
-	}
+	/* Fill in a Tx ring entry */
+	bdp = fep->cur_tx;
+	fec_enet_tx_map(fep, bdp, skb->data, skb->len);
 
 	/* Save skb pointer.
 	*/
-	fep->tx_skbuff[fep->skb_cur] = skb;
-
-	dev->stats.tx_bytes += skb->len;
-	fep->skb_cur = (fep->skb_cur+1) & TX_RING_MOD_MASK;
-
-	/* Push the data cache so the CPM does not get stale memory
-	 * data.
-	 */
-	fec_dcache_flush_range(__va(bdp->cbd_bufaddr), __va(bdp->cbd_bufaddr) +
-		 bdp->cbd_datlen);
+	fep->tx_skbuff[bdp - fep->tx_bd_base] = skb;
 
 	/* Send it on its way.  Tell FEC it's ready, interrupt when done,
 	 * it's the last BD of the frame, and to put the CRC on the end.
+	 * Keep only the wrap bit of the old status.
 	 */
-
+	status = bdp->cbd_sc & BD_ENET_TX_WRAP;
 	status |= (BD_ENET_TX_READY | BD_ENET_TX_INTR
 			| BD_ENET_TX_LAST | BD_ENET_TX_TC);
+	wmb();
 	bdp->cbd_sc = status;
 
+	dev->stats.tx_bytes += skb->len;
 	dev->trans_start = jiffies;
 
 	/* Trigger transmission start */
@@ -417,18 +402,14 @@ fec_enet_start_xmit(struct sk_buff *skb, struct net_device *dev)
 
 	/* If this was the last BD in the ring, start at the beginning again.
 	*/
-	if (status & BD_ENET_TX_WRAP) {
+	if (status & BD_ENET_TX_WRAP)
 		bdp = fep->tx_bd_base;
-	} else {
+	else
 		bdp++;
-	}
-
-	if (bdp == fep->dirty_tx) {
-		fep->tx_full = 1;
-		netif_stop_queue(dev);
-	}
 
 	fep->cur_tx = (cbd_t *)bdp;
+	if (!--fep->tx_free)
+		netif_stop_queue(dev);
 
 	spin_unlock_irqrestore(&fep->hw_lock, flags);
 
@@ -447,14 +428,14 @@ fec_timeout(struct net_device *dev)
 	int	i;
 	cbd_t	*bdp;
 
-	printk("Ring data dump: cur_tx %lx%s, dirty_tx %lx cur_rx: %lx\n",
-	       (unsigned long)fep->cur_tx, fep->tx_full ? " (full)" : "",
+	printk("Ring data dump: cur_tx %lx (%u free), dirty_tx %lx cur_rx: %lx\n",
+	       (unsigned long)fep->cur_tx, fep->tx_free,
 	       (unsigned long)fep->dirty_tx,
 	       (unsigned long)fep->cur_rx);
 
 	bdp = fep->tx_bd_base;
-	printk(" tx: %u buffers\n",  TX_RING_SIZE);
-	for (i = 0 ; i < TX_RING_SIZE; i++) {
+	printk(" tx: %u buffers\n",  fep->tx_ring_size);
+	for (i = 0 ; i < fep->tx_ring_size; i++) {
 		printk("  %08x: %04x %04x %08x\n",
 		       (uint) bdp,
 		       bdp->cbd_sc,
@@ -464,8 +445,8 @@ fec_timeout(struct net_device *dev)
 	}
 
 	bdp = fep->rx_bd_base;
-	printk(" rx: %lu buffers\n",  (unsigned long) RX_RING_SIZE);
-	for (i = 0 ; i < RX_RING_SIZE; i++) {
+	printk(" rx: %u buffers\n",  fep->rx_ring_size);
+	for (i = 0 ; i < fep->rx_ring_size; i++) {
 		printk("  %08x: %04x %04x %08x\n",
 		       (uint) bdp,
 		       bdp->cbd_sc,
@@ -486,32 +467,33 @@ static irqreturn_t
 fec_enet_interrupt(int irq, void * dev_id)
 {
 	struct	net_device *dev = dev_id;
+	struct	fec_enet_private *fep = netdev_priv(dev);
 	volatile fec_t	*fecp;
 	uint	int_events;
 	irqreturn_t ret = IRQ_NONE;
 
 	fecp = (volatile fec_t*)dev->base_addr;
 
-	/* Get the interrupt events that caused us to be here.
+	/* Get the interrupt events that caused us to be here.  Only
+	 * acknowledge the unmasked ones: events latched while the NAPI
+	 * poll runs must raise a fresh interrupt once it unmasks them.
 	*/
 	do {
-		int_events = fecp->fec_ievent;
+		int_events = fecp->fec_ievent & fecp->fec_imask;
 		fecp->fec_ievent = int_events;
 
-		/* Handle receive event in its own function.
+		/* Receive and transmit completion are handled by the NAPI
+		 * poll routine.  Mask them until the poll has drained both
+		 * rings.
 		 */
-		if (int_events & (FEC_ENET_RXF | FEC_ENET_RXB)) {
-			ret = IRQ_HANDLED;
-			fec_enet_rx(dev);
-		}
-
-		/* Transmit OK, or non-fatal error. Update the buffer
-		   descriptors. FEC handles all errors, we just discover
-		   them as part of the transmit process.
-		*/
-		if (int_events & (FEC_ENET_TXF | FEC_ENET_TXB)) {
+		if (int_events & FEC_ENET_NAPI_EVENTS) {
 			ret = IRQ_HANDLED;
-			fec_enet_tx(dev);
+			if (netif_rx_schedule_prep(dev, &fep->napi)) {
+				spin_lock(&fep->hw_lock);
+				fecp->fec_imask &= ~FEC_ENET_NAPI_EVENTS;
+				spin_unlock(&fep->hw_lock);
+				__netif_rx_schedule(dev, &fep->napi);
+			}
 		}
 
 		if (int_events & FEC_ENET_MII) {
@@ -525,56 +507,61 @@ fec_enet_interrupt(int irq, void * dev_id)
 }
 
 
-static void
+/* Reclaim the descriptors the FEC has finished with, called from the
+ * NAPI poll routine.  Returns the number of frames completed.
+ */
+static int
 fec_enet_tx(struct net_device *dev)
 {
 	struct	fec_enet_private *fep;
 	volatile cbd_t	*bdp;
 	unsigned short status;
 	struct	sk_buff	*skb;
+	unsigned long flags;
+	int	index;
+	int	completed = 0;
 
 	fep = netdev_priv(dev);
-	spin_lock_irq(&fep->hw_lock);
+	spin_lock_irqsave(&fep->hw_lock, flags);
 	bdp = fep->dirty_tx;
 
-	while (((status = bdp->cbd_sc) & BD_ENET_TX_READY) == 0) {
-		if (bdp == fep->cur_tx && fep->tx_full == 0) break;
-
-		skb = fep->tx_skbuff[fep->skb_dirty];
-		/* Check for errors. */
-		if (status & (BD_ENET_TX_HB | BD_ENET_TX_LC |
-				   BD_ENET_TX_RL | BD_ENET_TX_UN |
-				   BD_ENET_TX_CSL)) {
-			dev->stats.tx_errors++;
-			if (status & BD_ENET_TX_HB)  /* No heartbeat */
-				dev->stats.tx_heartbeat_errors++;
-			if (status & BD_ENET_TX_LC)  /* Late collision */
-				dev->stats.tx_window_errors++;
-			if (status & BD_ENET_TX_RL)  /* Retrans limit */
-				dev->stats.tx_aborted_errors++;
-			if (status & BD_ENET_TX_UN)  /* Underrun */
-				dev->stats.tx_fifo_errors++;
-			if (status & BD_ENET_TX_CSL) /* Carrier lost */
-				dev->stats.tx_carrier_errors++;
-		} else {
-			dev->stats.tx_packets++;
-		}
+	while (fep->tx_free < fep->tx_ring_size &&
+	       ((status = bdp->cbd_sc) & BD_ENET_TX_READY) == 0) {
+		index = bdp - fep->tx_bd_base;
+		skb = fep->tx_skbuff[index];
+		if (skb != NULL) {
+			/* Check for errors. */
+			if (status & (BD_ENET_TX_HB | BD_ENET_TX_LC |
+					   BD_ENET_TX_RL | BD_ENET_TX_UN |
+					   BD_ENET_TX_CSL)) {
+				dev->stats.tx_errors++;
+				if (status & BD_ENET_TX_HB)  /* No heartbeat */
+					dev->stats.tx_heartbeat_errors++;
+				if (status & BD_ENET_TX_LC)  /* Late collision */
+					dev->stats.tx_window_errors++;
+				if (status & BD_ENET_TX_RL)  /* Retrans limit */
+					dev->stats.tx_aborted_errors++;
+				if (status & BD_ENET_TX_UN)  /* Underrun */
+					dev->stats.tx_fifo_errors++;
+				if (status & BD_ENET_TX_CSL) /* Carrier lost */
+					dev->stats.tx_carrier_errors++;
+			} else {
+				dev->stats.tx_packets++;
+			}
 
-#ifndef final_version
-		if (status & BD_ENET_TX_READY)
-			printk("HEY! Enet xmit interrupt and TX_READY.\n");
-#endif
-		/* Deferred means some collisions occurred during transmit,
-		 * but we eventually sent the packet OK.
-		 */
-		if (status & BD_ENET_TX_DEF)
-			dev->stats.collisions++;
+			/* Deferred means some collisions occurred during
+			 * transmit, but we eventually sent the packet OK.
+			 */
+			if (status & BD_ENET_TX_DEF)
+				dev->stats.collisions++;
 
-		/* Free the sk buffer associated with this last transmit.
-		 */
-		dev_kfree_skb_any(skb);
-		fep->tx_skbuff[fep->skb_dirty] = NULL;
-		fep->skb_dirty = (fep->skb_dirty + 1) & TX_RING_MOD_MASK;
+			/* Free the sk buffer associated with this frame.
+			 */
+			dev_kfree_skb_any(skb);
+			fep->tx_skbuff[index] = NULL;
+			completed++;
+		}
+		fep->tx_free++;
 
 		/* Update pointer to next buffer descriptor to be transmitted.
 		 */
@@ -582,37 +569,57 @@ fec_enet_tx(struct net_device *dev)
 			bdp = fep->tx_bd_base;
 		else
 			bdp++;
-
-		/* Since we have freed up a buffer, the ring is no longer
-		 * full.
-		 */
-		if (fep->tx_full) {
-			fep->tx_full = 0;
-			if (netif_queue_stopped(dev))
-				netif_wake_queue(dev);
-		}
 	}
 	fep->dirty_tx = (cbd_t *)bdp;
-	spin_unlock_irq(&fep->hw_lock);
+
+	/* Since we have freed up buffers, the tx ring is no longer full.
+	 */
+	if (completed && netif_queue_stopped(dev) && fep->link)
+		netif_wake_queue(dev);
+	spin_unlock_irqrestore(&fep->hw_lock, flags);
+
+	return completed;
 }
 
 
+/* Allocate a receive buffer for the ring.  The FEC needs the buffer
+ * start aligned, so reserve up to the alignment boundary and make sure
+ * no dirty cache line covers the area the controller will write.
+ */
+static struct sk_buff *
+fec_enet_rx_alloc_skb(struct net_device *dev)
+{
+	struct	sk_buff	*skb;
+
+	skb = netdev_alloc_skb(dev, FEC_ENET_RX_FRSIZE + FEC_ALIGNMENT);
+	if (skb == NULL)
+		return NULL;
+
+	skb_reserve(skb, FEC_ADDR_ALIGNMENT(skb->data) - skb->data);
+	fec_dcache_inv_range(skb->data, skb->data + FEC_ENET_RX_FRSIZE);
+	return skb;
+}
+
 /* During a receive, the cur_rx points to the current incoming buffer.
  * When we update through the ring, if the next incoming buffer has
  * not been given to the system, we just set the empty indicator,
  * effectively tossing the packet.
+ *
+ * The ring is only touched from the NAPI poll routine, so no lock is
+ * needed here.  At most budget frames are passed to the stack.
  */
-static void
-fec_enet_rx(struct net_device *dev)
+static int
+fec_enet_rx(struct net_device *dev, int budget)
 {
 	struct	fec_enet_private *fep;
 	volatile fec_t	*fecp;
 	volatile cbd_t *bdp;
 	unsigned short status;
-	struct	sk_buff	*skb;
+	struct	sk_buff	*skb, *nskb;
 	ushort	pkt_len;
 	__u8 *data;
-	int     rx_index ;
+	int     rx_index;
+	int	received = 0;
 
 #ifdef CONFIG_M532x
 	flush_cache_all();
@@ -621,15 +628,15 @@ fec_enet_rx(struct net_device *dev)
 	fep = netdev_priv(dev);
 	fecp = (volatile fec_t*)dev->base_addr;
 
-	spin_lock_irq(&fep->hw_lock);
-
 	/* First, grab all of the stats for the incoming packet.
 	 * These get messed up if we get called due to a busy condition.
 	 */
 	bdp = fep->cur_rx;
 
-while (!((status = bdp->cbd_sc) & BD_ENET_RX_EMPTY)) {
+while (received < budget &&
+       !((status = bdp->cbd_sc) & BD_ENET_RX_EMPTY)) {
 	rx_index = bdp - fep->rx_bd_base;
+	received++;
 #ifndef final_version
 	/* Since we have allocated space to hold a complete frame,
 	 * the last indicator should be set.
@@ -669,44 +676,56 @@ while (!((status = bdp->cbd_sc) & BD_ENET_RX_EMPTY)) {
 
 	/* Process the incoming frame.
 	 */
-	dev->stats.rx_packets++;
 	pkt_len = bdp->cbd_datlen;
-	dev->stats.rx_bytes += pkt_len;
 	data = (__u8*)__va(bdp->cbd_bufaddr);
 
-	/* This does 16 byte alignment, exactly what we need.
-	 * The packet length includes FCS, but we don't want to
+	/* The packet length includes FCS, but we don't want to
 	 * include that when passing upstream as it messes up
 	 * bridging applications.
 	 */
-	if ((pkt_len - 4) < fec_copy_threshold) {
-		skb = dev_alloc_skb(pkt_len);
+	if ((int)(pkt_len - 4) < fec_copy_threshold) {
+		/* Small frame: copy it out and leave the ring buffer
+		 * where it is.  The CPU has just read the buffer, so
+		 * drop those lines again before the FEC refills it.
+		 */
+		skb = netdev_alloc_skb(dev, pkt_len + NET_IP_ALIGN);
+		if (skb == NULL)
+			goto rx_alloc_failed;
+
+		skb_reserve(skb, NET_IP_ALIGN);	/* align the ip header */
+		skb_put(skb, pkt_len - 4);	/* Make room */
+		skb_copy_to_linear_data(skb, data, pkt_len - 4);
+		fec_dcache_inv_range(data, data + pkt_len);
+		fep->rx_copybreak++;
 	} else {
-		skb = dev_alloc_skb(FEC_ENET_RX_FRSIZE);
+		/* Large frame: hand the ring skb itself to the stack and
+		 * attach a freshly allocated buffer to the descriptor.
+		 */
+		nskb = fec_enet_rx_alloc_skb(dev);
+		if (nskb == NULL)
+			goto rx_alloc_failed;
+
+		skb = fep->rx_skbuff[rx_index];
+		fep->rx_skbuff[rx_index] = nskb;
+		bdp->cbd_bufaddr = __pa(nskb->data);
+		skb_put(skb, pkt_len - 4);	/* Make room */
+		fep->rx_zerocopy++;
 	}
 
-	if (skb == NULL) {
+	dev->stats.rx_packets++;
+	dev->stats.rx_bytes += pkt_len;
+	skb->protocol = eth_type_trans(skb, dev);
+	netif_receive_skb(skb);
+	goto rx_processing_done;
+
+rx_alloc_failed:
+	/* Keep the old buffer in the ring; the frame is lost. */
+	if (printk_ratelimit())
 		printk("%s: Memory squeeze, dropping packet.\n", dev->name);
-		dev->stats.rx_dropped++;
-	} else {
-		if ((pkt_len - 4) < fec_copy_threshold) {
-			skb_reserve(skb, 2);    /*skip 2bytes, so ipheader is align 4bytes*/
-			skb_put(skb,pkt_len-4); /* Make room */
-			skb_copy_to_linear_data(skb, data, pkt_len-4);
-		} else {
-			struct sk_buff * pskb = fep->rx_skbuff[rx_index];
-
-			fec_dcache_inv_range(skb->data, skb->data +
-					     FEC_ENET_RX_FRSIZE);
-			fep->rx_skbuff[rx_index] = skb;
-			skb->data = FEC_ADDR_ALIGNMENT(skb->data);
-			bdp->cbd_bufaddr = __pa(skb->data);
-                        skb_put(pskb,pkt_len-4);        /* Make room */
-                        skb = pskb;
-                }
-		skb->protocol=eth_type_trans(skb,dev);
-		netif_rx(skb);
-	}
+	dev->stats.rx_dropped++;
+	fep->rx_alloc_fail++;
+	fec_dcache_inv_range(data, data + pkt_len);
+
   rx_processing_done:
 
 	/* Clear the status flags for this buffer.
@@ -725,584 +744,142 @@ while (!((status = bdp->cbd_sc) & BD_ENET_RX_EMPTY)) {
 	else
 		bdp++;
 
-#if 1
 	/* Doing this here will keep the FEC running while we process
 	 * incoming frames.  On a heavily loaded network, we should be
 	 * able to keep up at the expense of system resources.
 	 */
 	fecp->fec_r_des_active = 0x01000000;
-#endif
    } /* while (!((status = bdp->cbd_sc) & BD_ENET_RX_EMPTY)) */
 	fep->cur_rx = (cbd_t *)bdp;
 
-#if 0
-	/* Doing this here will allow us to process all frames in the
-	 * ring before the FEC is allowed to put more there.  On a heavily
-	 * loaded network, some frames may be lost.  Unfortunately, this
-	 * increases the interrupt overhead since we can potentially work
-	 * our way back to the interrupt return only to come right back
-	 * here.
-	 */
-	fecp->fec_r_des_active = 0;
-#endif
-
-	spin_unlock_irq(&fep->hw_lock);
-}
-
-
-/* called from interrupt context */
-static void
-fec_enet_mii(struct net_device *dev)
-{
-	struct	fec_enet_private *fep;
-	volatile fec_t	*ep;
-	mii_list_t	*mip;
-	uint		mii_reg;
-
-	fep = netdev_priv(dev);
-	spin_lock_irq(&fep->mii_lock);
-
-	ep = fep->hwp;
-	mii_reg = ep->fec_mii_data;
-
-	if ((mip = mii_head) == NULL) {
-		printk("MII and no head!\n");
-		goto unlock;
-	}
-
-	if (mip->mii_func != NULL)
-		(*(mip->mii_func))(mii_reg, dev);
-
-	mii_head = mip->mii_next;
-	mip->mii_next = mii_free;
-	mii_free = mip;
-
-	if ((mip = mii_head) != NULL)
-		ep->fec_mii_data = mip->mii_regval;
-
-unlock:
-	spin_unlock_irq(&fep->mii_lock);
+	return received;
 }
 
+/* Decide whether the poll that just completed frames should leave
+ * interrupts masked and come back from coal_timer instead.  With
+ * rx_coal_usecs at zero every event raises an interrupt.  Otherwise the
+ * driver stays in timer mode until a poll finds no work, or, in adaptive
+ * mode, finds fewer than rx_coal_frames frames.
+ */
 static int
-mii_queue(struct net_device *dev, int regval, void (*func)(uint, struct net_device *))
+fec_enet_coalesce(struct fec_enet_private *fep, int frames)
 {
-	struct fec_enet_private *fep;
-	unsigned long	flags;
-	mii_list_t	*mip;
-	int		retval;
-
-	/* Add PHY address to register command.
-	*/
-	fep = netdev_priv(dev);
-	spin_lock_irqsave(&fep->mii_lock, flags);
-
-	regval |= fep->phy_addr << 23;
-	retval = 0;
-
-	if ((mip = mii_free) != NULL) {
-		mii_free = mip->mii_next;
-		mip->mii_regval = regval;
-		mip->mii_func = func;
-		mip->mii_next = NULL;
-		if (mii_head) {
-			mii_tail->mii_next = mip;
-			mii_tail = mip;
-		} else {
-			mii_head = mii_tail = mip;
-			fep->hwp->fec_mii_data = regval;
-		}
-	} else {
-		retval = 1;
-	}
-
-	spin_unlock_irqrestore(&fep->mii_lock, flags);
-	return retval;
+	if (!fep->rx_coal_usecs || !frames)
+		return 0;
+	if (fep->coal_adaptive && frames < fep->rx_coal_frames)
+		return 0;
+	return 1;
 }
 
-static void mii_do_cmd(struct net_device *dev, const phy_cmd_t *c)
+static enum hrtimer_restart
+fec_enet_coal_timer(struct hrtimer *timer)
 {
-	if(!c)
-		return;
+	struct	fec_enet_private *fep;
 
-	for (; c->mii_data != mk_mii_end; c++)
-		mii_queue(dev, c->mii_data, c->funct);
+	fep = container_of(timer, struct fec_enet_private, coal_timer);
+	fep->coal_timer_polls++;
+	netif_rx_schedule(fep->netdev, &fep->napi);
+	return HRTIMER_NORESTART;
 }
 
-static void mii_parse_sr(uint mii_reg, struct net_device *dev)
+/* NAPI poll routine.  Transmit completions are reclaimed in one batch
+ * per poll and do not count against the budget; receive and transmit
+ * interrupts stay masked for as long as the receive ring keeps
+ * delivering a full budget of frames, or while coalescing.
+ */
+static int
+fec_enet_napi_poll(struct napi_struct *napi, int budget)
 {
-	struct fec_enet_private *fep = netdev_priv(dev);
-	volatile uint *s = &(fep->phy_status);
-	uint status;
-
-	status = *s & ~(PHY_STAT_LINK | PHY_STAT_FAULT | PHY_STAT_ANC);
-
-	if (mii_reg & 0x0004)
-		status |= PHY_STAT_LINK;
-	if (mii_reg & 0x0010)
-		status |= PHY_STAT_FAULT;
-	if (mii_reg & 0x0020)
-		status |= PHY_STAT_ANC;
-	*s = status;
-}
+	struct	fec_enet_private *fep;
+	struct	net_device *dev;
+	volatile fec_t	*fecp;
+	unsigned long flags;
+	int	work_done, tx_done;
 
-static void mii_parse_cr(uint mii_reg, struct net_device *dev)
-{
-	struct fec_enet_private *fep = netdev_priv(dev);
-	volatile uint *s = &(fep->phy_status);
-	uint status;
+	fep = container_of(napi, struct fec_enet_private, napi);
+	dev = fep->netdev;
+	fecp = fep->hwp;
 
-	status = *s & ~(PHY_CONF_ANE | PHY_CONF_LOOP);
+	tx_done = fec_enet_tx(dev);
+	work_done = fec_enet_rx(dev, budget);
 
-	if (mii_reg & 0x1000)
-		status |= PHY_CONF_ANE;
-	if (mii_reg & 0x4000)
-		status |= PHY_CONF_LOOP;
-	*s = status;
-}
+	if (work_done < budget) {
+		netif_rx_complete(dev, napi);
 
-static void mii_parse_anar(uint mii_reg, struct net_device *dev)
-{
-	struct fec_enet_private *fep = netdev_priv(dev);
-	volatile uint *s = &(fep->phy_status);
-	uint status;
+		if (fec_enet_coalesce(fep, work_done + tx_done)) {
+			hrtimer_start(&fep->coal_timer,
+				      ktime_set(0, fep->rx_coal_usecs *
+						NSEC_PER_USEC),
+				      HRTIMER_MODE_REL);
+			return work_done;
+		}
 
-	status = *s & ~(PHY_CONF_SPMASK);
+		/* Events latched meanwhile were left pending by the
+		 * interrupt handler and fire as soon as they are unmasked.
+		 */
+		spin_lock_irqsave(&fep->hw_lock, flags);
+		fecp->fec_imask |= FEC_ENET_NAPI_EVENTS;
+		spin_unlock_irqrestore(&fep->hw_lock, flags);
+	}
 
-	if (mii_reg & 0x0020)
-		status |= PHY_CONF_10HDX;
-	if (mii_reg & 0x0040)
-		status |= PHY_CONF_10FDX;
-	if (mii_reg & 0x0080)
-		status |= PHY_CONF_100HDX;
-	if (mii_reg & 0x00100)
-		status |= PHY_CONF_100FDX;
-	*s = status;
+	return work_done;
 }
 
-/* ------------------------------------------------------------------------- */
-/* The Level one LXT970 is used by many boards				     */
-
-#define MII_LXT970_MIRROR    16  /* Mirror register           */
-#define MII_LXT970_IER       17  /* Interrupt Enable Register */
-#define MII_LXT970_ISR       18  /* Interrupt Status Register */
-#define MII_LXT970_CONFIG    19  /* Configuration Register    */
-#define MII_LXT970_CSR       20  /* Chip Status Register      */
 
-static void mii_parse_lxt970_csr(uint mii_reg, struct net_device *dev)
+/* The FEC raises its MII event when a management frame has been
+ * shifted out, or a read result is available.  Called from interrupt
+ * context.
+ */
+static void
+fec_enet_mii(struct net_device *dev)
 {
-	struct fec_enet_private *fep = netdev_priv(dev);
-	volatile uint *s = &(fep->phy_status);
-	uint status;
+	struct	fec_enet_private *fep = netdev_priv(dev);
 
-	status = *s & ~(PHY_STAT_SPMASK);
-	if (mii_reg & 0x0800) {
-		if (mii_reg & 0x1000)
-			status |= PHY_STAT_100FDX;
-		else
-			status |= PHY_STAT_100HDX;
-	} else {
-		if (mii_reg & 0x1000)
-			status |= PHY_STAT_10FDX;
-		else
-			status |= PHY_STAT_10HDX;
-	}
-	*s = status;
+	complete(&fep->mdio_done);
 }
 
-static phy_cmd_t const phy_cmd_lxt970_config[] = {
-		{ mk_mii_read(MII_REG_CR), mii_parse_cr },
-		{ mk_mii_read(MII_REG_ANAR), mii_parse_anar },
-		{ mk_mii_end, }
-	};
-static phy_cmd_t const phy_cmd_lxt970_startup[] = { /* enable interrupts */
-		{ mk_mii_write(MII_LXT970_IER, 0x0002), NULL },
-		{ mk_mii_write(MII_REG_CR, 0x1200), NULL }, /* autonegotiate */
-		{ mk_mii_end, }
-	};
-static phy_cmd_t const phy_cmd_lxt970_ack_int[] = {
-		/* read SR and ISR to acknowledge */
-		{ mk_mii_read(MII_REG_SR), mii_parse_sr },
-		{ mk_mii_read(MII_LXT970_ISR), NULL },
-
-		/* find out the current status */
-		{ mk_mii_read(MII_LXT970_CSR), mii_parse_lxt970_csr },
-		{ mk_mii_end, }
-	};
-static phy_cmd_t const phy_cmd_lxt970_shutdown[] = { /* disable interrupts */
-		{ mk_mii_write(MII_LXT970_IER, 0x0000), NULL },
-		{ mk_mii_end, }
-	};
-static phy_info_t const phy_info_lxt970 = {
-	.id = 0x07810000,
-	.name = "LXT970",
-	.config = phy_cmd_lxt970_config,
-	.startup = phy_cmd_lxt970_startup,
-	.ack_int = phy_cmd_lxt970_ack_int,
-	.shutdown = phy_cmd_lxt970_shutdown
-};
-
-/* ------------------------------------------------------------------------- */
-/* The Level one LXT971 is used on some of my custom boards                  */
-
-/* register definitions for the 971 */
-
-#define MII_LXT971_PCR       16  /* Port Control Register     */
-#define MII_LXT971_SR2       17  /* Status Register 2         */
-#define MII_LXT971_IER       18  /* Interrupt Enable Register */
-#define MII_LXT971_ISR       19  /* Interrupt Status Register */
-#define MII_LXT971_LCR       20  /* LED Control Register      */
-#define MII_LXT971_TCR       30  /* Transmit Control Register */
-
-/*
- * I had some nice ideas of running the MDIO faster...
- * The 971 should support 8MHz and I tried it, but things acted really
- * weird, so 2.5 MHz ought to be enough for anyone...
+/* Issue one management frame and sleep until the FEC reports it done.
+ * Accesses are serialised by the mii_bus lock.
  */
-
-static void mii_parse_lxt971_sr2(uint mii_reg, struct net_device *dev)
+static int
+fec_enet_mdio_xfer(struct fec_enet_private *fep, uint regval)
 {
-	struct fec_enet_private *fep = netdev_priv(dev);
-	volatile uint *s = &(fep->phy_status);
-	uint status;
+	volatile fec_t	*fecp = fep->hwp;
 
-	status = *s & ~(PHY_STAT_SPMASK | PHY_STAT_LINK | PHY_STAT_ANC);
+	INIT_COMPLETION(fep->mdio_done);
+	fecp->fec_mii_data = regval;
 
-	if (mii_reg & 0x0400) {
-		fep->link = 1;
-		status |= PHY_STAT_LINK;
-	} else {
-		fep->link = 0;
-	}
-	if (mii_reg & 0x0080)
-		status |= PHY_STAT_ANC;
-	if (mii_reg & 0x4000) {
-		if (mii_reg & 0x0200)
-			status |= PHY_STAT_100FDX;
-		else
-			status |= PHY_STAT_100HDX;
-	} else {
-		if (mii_reg & 0x0200)
-			status |= PHY_STAT_10FDX;
-		else
-			status |= PHY_STAT_10HDX;
+	if (!wait_for_completion_timeout(&fep->mdio_done, FEC_MII_TIMEOUT)) {
+		printk("FEC: MDIO transfer timed out\n");
+		return -ETIMEDOUT;
 	}
-	if (mii_reg & 0x0008)
-		status |= PHY_STAT_FAULT;
-
-	*s = status;
+	return fecp->fec_mii_data & 0xffff;
 }
 
-static phy_cmd_t const phy_cmd_lxt971_config[] = {
-		/* limit to 10MBit because my prototype board
-		 * doesn't work with 100. */
-		{ mk_mii_read(MII_REG_CR), mii_parse_cr },
-		{ mk_mii_read(MII_REG_ANAR), mii_parse_anar },
-		{ mk_mii_read(MII_LXT971_SR2), mii_parse_lxt971_sr2 },
-		{ mk_mii_end, }
-	};
-static phy_cmd_t const phy_cmd_lxt971_startup[] = {  /* enable interrupts */
-		{ mk_mii_write(MII_LXT971_IER, 0x00f2), NULL },
-		{ mk_mii_write(MII_REG_CR, 0x1200), NULL }, /* autonegotiate */
-		{ mk_mii_write(MII_LXT971_LCR, 0xd422), NULL }, /* LED config */
-		/* Somehow does the 971 tell me that the link is down
-		 * the first read after power-up.
-		 * read here to get a valid value in ack_int */
-		{ mk_mii_read(MII_REG_SR), mii_parse_sr },
-		{ mk_mii_end, }
-	};
-static phy_cmd_t const phy_cmd_lxt971_ack_int[] = {
-		/* acknowledge the int before reading status ! */
-		{ mk_mii_read(MII_LXT971_ISR), NULL },
-		/* find out the current status */
-		{ mk_mii_read(MII_REG_SR), mii_parse_sr },
-		{ mk_mii_read(MII_LXT971_SR2), mii_parse_lxt971_sr2 },
-		{ mk_mii_end, }
-	};
-static phy_cmd_t const phy_cmd_lxt971_shutdown[] = { /* disable interrupts */
-		{ mk_mii_write(MII_LXT971_IER, 0x0000), NULL },
-		{ mk_mii_end, }
-	};
-static phy_info_t const phy_info_lxt971 = {
-	.id = 0x0001378e,
-	.name = "LXT971",
-	.config = phy_cmd_lxt971_config,
-	.startup = phy_cmd_lxt971_startup,
-	.ack_int = phy_cmd_lxt971_ack_int,
-	.shutdown = phy_cmd_lxt971_shutdown
-};
-
-/* ------------------------------------------------------------------------- */
-/* The Quality Semiconductor QS6612 is used on the RPX CLLF                  */
-
-/* register definitions */
-
-#define MII_QS6612_MCR       17  /* Mode Control Register      */
-#define MII_QS6612_FTR       27  /* Factory Test Register      */
-#define MII_QS6612_MCO       28  /* Misc. Control Register     */
-#define MII_QS6612_ISR       29  /* Interrupt Source Register  */
-#define MII_QS6612_IMR       30  /* Interrupt Mask Register    */
-#define MII_QS6612_PCR       31  /* 100BaseTx PHY Control Reg. */
-
-static void mii_parse_qs6612_pcr(uint mii_reg, struct net_device *dev)
+static int
+fec_enet_mdio_read(struct mii_bus *bus, int mii_id, int regnum)
 {
-	struct fec_enet_private *fep = netdev_priv(dev);
-	volatile uint *s = &(fep->phy_status);
-	uint status;
-
-	status = *s & ~(PHY_STAT_SPMASK);
-
-	switch((mii_reg >> 2) & 7) {
-	case 1: status |= PHY_STAT_10HDX; break;
-	case 2: status |= PHY_STAT_100HDX; break;
-	case 5: status |= PHY_STAT_10FDX; break;
-	case 6: status |= PHY_STAT_100FDX; break;
-}
-
-	*s = status;
+	return fec_enet_mdio_xfer(bus->priv,
+				  mk_mii_read(regnum) | mk_mii_phy(mii_id));
 }
 
-static phy_cmd_t const phy_cmd_qs6612_config[] = {
-		/* The PHY powers up isolated on the RPX,
-		 * so send a command to allow operation.
-		 */
-		{ mk_mii_write(MII_QS6612_PCR, 0x0dc0), NULL },
-
-		/* parse cr and anar to get some info */
-		{ mk_mii_read(MII_REG_CR), mii_parse_cr },
-		{ mk_mii_read(MII_REG_ANAR), mii_parse_anar },
-		{ mk_mii_end, }
-	};
-static phy_cmd_t const phy_cmd_qs6612_startup[] = {  /* enable interrupts */
-		{ mk_mii_write(MII_QS6612_IMR, 0x003a), NULL },
-		{ mk_mii_write(MII_REG_CR, 0x1200), NULL }, /* autonegotiate */
-		{ mk_mii_end, }
-	};
-static phy_cmd_t const phy_cmd_qs6612_ack_int[] = {
-		/* we need to read ISR, SR and ANER to acknowledge */
-		{ mk_mii_read(MII_QS6612_ISR), NULL },
-		{ mk_mii_read(MII_REG_SR), mii_parse_sr },
-		{ mk_mii_read(MII_REG_ANER), NULL },
-
-		/* read pcr to get info */
-		{ mk_mii_read(MII_QS6612_PCR), mii_parse_qs6612_pcr },
-		{ mk_mii_end, }
-	};
-static phy_cmd_t const phy_cmd_qs6612_shutdown[] = { /* disable interrupts */
-		{ mk_mii_write(MII_QS6612_IMR, 0x0000), NULL },
-		{ mk_mii_end, }
-	};
-static phy_info_t const phy_info_qs6612 = {
-	.id = 0x00181440,
-	.name = "QS6612",
-	.config = phy_cmd_qs6612_config,
-	.startup = phy_cmd_qs6612_startup,
-	.ack_int = phy_cmd_qs6612_ack_int,
-	.shutdown = phy_cmd_qs6612_shutdown
-};
-
-/* ------------------------------------------------------------------------- */
-/* AMD AM79C874 phy                                                          */
-
-/* register definitions for the 874 */
-
-#define MII_AM79C874_MFR       16  /* Miscellaneous Feature Register */
-#define MII_AM79C874_ICSR      17  /* Interrupt/Status Register      */
-#define MII_AM79C874_DR        18  /* Diagnostic Register            */
-#define MII_AM79C874_PMLR      19  /* Power and Loopback Register    */
-#define MII_AM79C874_MCR       21  /* ModeControl Register           */
-#define MII_AM79C874_DC        23  /* Disconnect Counter             */
-#define MII_AM79C874_REC       24  /* Recieve Error Counter          */
-
-static void mii_parse_am79c874_dr(uint mii_reg, struct net_device *dev)
+static int
+fec_enet_mdio_write(struct mii_bus *bus, int mii_id, int regnum, u16 value)
 {
-	struct fec_enet_private *fep = netdev_priv(dev);
-	volatile uint *s = &(fep->phy_status);
-	uint status;
-
-	status = *s & ~(PHY_STAT_SPMASK | PHY_STAT_ANC);
-
-	if (mii_reg & 0x0080)
-		status |= PHY_STAT_ANC;
-	if (mii_reg & 0x0400)
-		status |= ((mii_reg & 0x0800) ? PHY_STAT_100FDX : PHY_STAT_100HDX);
-	else
-		status |= ((mii_reg & 0x0800) ? PHY_STAT_10FDX : PHY_STAT_10HDX);
+	int ret;
 
-	*s = status;
+	ret = fec_enet_mdio_xfer(bus->priv,
+				 mk_mii_write(regnum, value) | mk_mii_phy(mii_id));
+	return ret < 0 ? ret : 0;
 }
 
-static phy_cmd_t const phy_cmd_am79c874_config[] = {
-		{ mk_mii_read(MII_REG_CR), mii_parse_cr },
-		{ mk_mii_read(MII_REG_ANAR), mii_parse_anar },
-		{ mk_mii_read(MII_AM79C874_DR), mii_parse_am79c874_dr },
-		{ mk_mii_end, }
-	};
-static phy_cmd_t const phy_cmd_am79c874_startup[] = {  /* enable interrupts */
-		{ mk_mii_write(MII_AM79C874_ICSR, 0xff00), NULL },
-		{ mk_mii_write(MII_REG_CR, 0x1200), NULL }, /* autonegotiate */
-		{ mk_mii_read(MII_REG_SR), mii_parse_sr },
-		{ mk_mii_end, }
-	};
-static phy_cmd_t const phy_cmd_am79c874_ack_int[] = {
-		/* find out the current status */
-		{ mk_mii_read(MII_REG_SR), mii_parse_sr },
-		{ mk_mii_read(MII_AM79C874_DR), mii_parse_am79c874_dr },
-		/* we only need to read ISR to acknowledge */
-		{ mk_mii_read(MII_AM79C874_ICSR), NULL },
-		{ mk_mii_end, }
-	};
-static phy_cmd_t const phy_cmd_am79c874_shutdown[] = { /* disable interrupts */
-		{ mk_mii_write(MII_AM79C874_ICSR, 0x0000), NULL },
-		{ mk_mii_end, }
-	};
-static phy_info_t const phy_info_am79c874 = {
-	.id = 0x00022561,
-	.name = "AM79C874",
-	.config = phy_cmd_am79c874_config,
-	.startup = phy_cmd_am79c874_startup,
-	.ack_int = phy_cmd_am79c874_ack_int,
-	.shutdown = phy_cmd_am79c874_shutdown
-};
-
-
-/* ------------------------------------------------------------------------- */
-/* Kendin KS8721BL phy                                                       */
-
-/* register definitions for the 8721 */
-
-#define MII_KS8721BL_RXERCR	21
-#define MII_KS8721BL_ICSR	22
-#define	MII_KS8721BL_PHYCR	31
-
-static phy_cmd_t const phy_cmd_ks8721bl_config[] = {
-		{ mk_mii_read(MII_REG_CR), mii_parse_cr },
-		{ mk_mii_read(MII_REG_ANAR), mii_parse_anar },
-		{ mk_mii_end, }
-	};
-static phy_cmd_t const phy_cmd_ks8721bl_startup[] = {  /* enable interrupts */
-		{ mk_mii_write(MII_KS8721BL_ICSR, 0xff00), NULL },
-		{ mk_mii_write(MII_REG_CR, 0x1200), NULL }, /* autonegotiate */
-		{ mk_mii_read(MII_REG_SR), mii_parse_sr },
-		{ mk_mii_end, }
-	};
-static phy_cmd_t const phy_cmd_ks8721bl_ack_int[] = {
-		/* find out the current status */
-		{ mk_mii_read(MII_REG_SR), mii_parse_sr },
-		/* we only need to read ISR to acknowledge */
-		{ mk_mii_read(MII_KS8721BL_ICSR), NULL },
-		{ mk_mii_end, }
-	};
-static phy_cmd_t const phy_cmd_ks8721bl_shutdown[] = { /* disable interrupts */
-		{ mk_mii_write(MII_KS8721BL_ICSR, 0x0000), NULL },
-		{ mk_mii_end, }
-	};
-static phy_info_t const phy_info_ks8721bl = {
-	.id = 0x00022161,
-	.name = "KS8721BL",
-	.config = phy_cmd_ks8721bl_config,
-	.startup = phy_cmd_ks8721bl_startup,
-	.ack_int = phy_cmd_ks8721bl_ack_int,
-	.shutdown = phy_cmd_ks8721bl_shutdown
-};
-
-/* ------------------------------------------------------------------------- */
-/* register definitions for the DP83848 */
-
-#define MII_DP8384X_PHYSTST    16  /* PHY Status Register */
-
-static void mii_parse_dp8384x_sr2(uint mii_reg, struct net_device *dev)
+static int
+fec_enet_mdio_reset(struct mii_bus *bus)
 {
-	struct fec_enet_private *fep = dev->priv;
-	volatile uint *s = &(fep->phy_status);
-
-	*s &= ~(PHY_STAT_SPMASK | PHY_STAT_LINK | PHY_STAT_ANC);
-
-	/* Link up */
-	if (mii_reg & 0x0001) {
-		fep->link = 1;
-		*s |= PHY_STAT_LINK;
-	} else
-		fep->link = 0;
-	/* Status of link */
-	if (mii_reg & 0x0010)   /* Autonegotioation complete */
-		*s |= PHY_STAT_ANC;
-	if (mii_reg & 0x0002) {   /* 10MBps? */
-		if (mii_reg & 0x0004)   /* Full Duplex? */
-			*s |= PHY_STAT_10FDX;
-		else
-			*s |= PHY_STAT_10HDX;
-	} else {                  /* 100 Mbps? */
-		if (mii_reg & 0x0004)   /* Full Duplex? */
-			*s |= PHY_STAT_100FDX;
-		else
-			*s |= PHY_STAT_100HDX;
-	}
-	if (mii_reg & 0x0008)
-		*s |= PHY_STAT_FAULT;
-}
-
-static phy_info_t phy_info_dp83848= {
-	0x020005c9,
-	"DP83848",
-
-	(const phy_cmd_t []) {  /* config */
-		{ mk_mii_read(MII_REG_CR), mii_parse_cr },
-		{ mk_mii_read(MII_REG_ANAR), mii_parse_anar },
-		{ mk_mii_read(MII_DP8384X_PHYSTST), mii_parse_dp8384x_sr2 },
-		{ mk_mii_end, }
-	},
-	(const phy_cmd_t []) {  /* startup - enable interrupts */
-		{ mk_mii_write(MII_REG_CR, 0x1200), NULL }, /* autonegotiate */
-		{ mk_mii_read(MII_REG_SR), mii_parse_sr },
-		{ mk_mii_end, }
-	},
-	(const phy_cmd_t []) { /* ack_int - never happens, no interrupt */
-		{ mk_mii_end, }
-	},
-	(const phy_cmd_t []) {  /* shutdown */
-		{ mk_mii_end, }
-	},
-};
-
-static phy_info_t phy_info_lan8700 = {
-	0x0007C0C,
-	"LAN8700",
-	(const phy_cmd_t []) { /* config */
-		{ mk_mii_read(MII_REG_CR), mii_parse_cr },
-		{ mk_mii_read(MII_REG_ANAR), mii_parse_anar },
-		{ mk_mii_end, }
-	},
-	(const phy_cmd_t []) { /* startup */
-		{ mk_mii_write(MII_REG_CR, 0x1200), NULL }, /* autonegotiate */
-		{ mk_mii_read(MII_REG_SR), mii_parse_sr },
-		{ mk_mii_end, }
-	},
-	(const phy_cmd_t []) { /* act_int */
-		{ mk_mii_end, }
-	},
-	(const phy_cmd_t []) { /* shutdown */
-		{ mk_mii_end, }
-	},
-};
-/* ------------------------------------------------------------------------- */
-
-static phy_info_t const * const phy_info[] = {
-	&phy_info_lxt970,
-	&phy_info_lxt971,
-	&phy_info_qs6612,
-	&phy_info_am79c874,
-	&phy_info_ks8721bl,
-	&phy_info_dp83848,
-	&phy_info_lan8700,
-	NULL
-};
+	return 0;
+}
 
 /* ------------------------------------------------------------------------- */
-#ifdef HAVE_mii_link_interrupt
-static irqreturn_t
-mii_link_interrupt(int irq, void * dev_id);
-#endif
 
 #if defined(CONFIG_M5272)
 /*
@@ -1334,7 +911,6 @@ static void __inline__ fec_request_intrs(struct net_device *dev)
 		{ "fec(RX)", 86, fec_enet_interrupt },
 		{ "fec(TX)", 87, fec_enet_interrupt },
 		{ "fec(OTHER)", 88, fec_enet_interrupt },
-		{ "fec(MII)", 66, mii_link_interrupt },
 		{ NULL },
 	};
 
@@ -1347,8 +923,9 @@ static void __inline__ fec_request_intrs(struct net_device *dev)
 	/* Unmask interrupt at ColdFire 5272 SIM */
 	icrp = (volatile unsigned long *) (MCF_MBAR + MCFSIM_ICR3);
 	*icrp = 0x00000ddd;
+	/* The PHY link interrupt is left masked, phylib polls the PHY */
 	icrp = (volatile unsigned long *) (MCF_MBAR + MCFSIM_ICR1);
-	*icrp = 0x0d000000;
+	*icrp = 0x08000000;
 }
 
 static void __inline__ fec_set_mii(struct net_device *dev, struct fec_enet_private *fep)
@@ -1402,23 +979,12 @@ static void __inline__ fec_get_mac(struct net_device *dev)
 		 dev->dev_addr[ETH_ALEN-1] = fec_mac_default[ETH_ALEN-1] + fep->index;
 }
 
-static void __inline__ fec_enable_phy_intr(void)
-{
-}
-
-static void __inline__ fec_disable_phy_intr(void)
-{
-	volatile unsigned long *icrp;
-	icrp = (volatile unsigned long *) (MCF_MBAR + MCFSIM_ICR1);
-	*icrp = 0x08000000;
-}
-
-static void __inline__ fec_phy_ack_intr(void)
+/*
+ * interrupt line of the PHY, or PHY_POLL to let phylib poll it
+ */
+static int __inline__ fec_phy_irq(void)
 {
-	volatile unsigned long *icrp;
-	/* Acknowledge the interrupt */
-	icrp = (volatile unsigned long *) (MCF_MBAR + MCFSIM_ICR1);
-	*icrp = 0x0d000000;
+	return PHY_POLL;
 }
 
 static void __inline__ fec_localhw_setup(struct net_device *dev)
@@ -1612,16 +1178,12 @@ static void __inline__ fec_get_mac(struct net_device *dev)
 		dev->dev_addr[ETH_ALEN-1] = fec_mac_default[ETH_ALEN-1] + fep->index;
 }
 
-static void __inline__ fec_enable_phy_intr(void)
-{
-}
-
-static void __inline__ fec_disable_phy_intr(void)
-{
-}
-
-static void __inline__ fec_phy_ack_intr(void)
+/*
+ * interrupt line of the PHY, or PHY_POLL to let phylib poll it
+ */
+static int __inline__ fec_phy_irq(void)
 {
+	return PHY_POLL;
 }
 
 static void __inline__ fec_localhw_setup(struct net_device *dev)
@@ -1771,16 +1333,12 @@ static void __inline__ fec_get_mac(struct net_device *dev)
 		dev->dev_addr[ETH_ALEN-1] = fec_mac_default[ETH_ALEN-1] + fep->index;
 }
 
-static void __inline__ fec_enable_phy_intr(void)
-{
-}
-
-static void __inline__ fec_disable_phy_intr(void)
-{
-}
-
-static void __inline__ fec_phy_ack_intr(void)
+/*
+ * interrupt line of the PHY, or PHY_POLL to let phylib poll it
+ */
+static int __inline__ fec_phy_irq(void)
 {
+	return PHY_POLL;
 }
 
 static void __inline__ fec_localhw_setup(struct net_device *dev)
@@ -1952,20 +1510,16 @@ static void __inline__ fec_get_mac(struct net_device *dev)
 	memcpy(dev->dev_addr, iap, ETH_ALEN);
 
 	/* Adjust MAC if using default MAC address */
-	if (iap == fec_mac_default)
-		dev->dev_addr[ETH_ALEN-1] = fec_mac_default[ETH_ALEN-1] + fep->index;
-}
-
-static void __inline__ fec_enable_phy_intr(void)
-{
-}
-
-static void __inline__ fec_disable_phy_intr(void)
-{
+	if (iap == fec_mac_default)
+		dev->dev_addr[ETH_ALEN-1] = fec_mac_default[ETH_ALEN-1] + fep->index;
 }
 
-static void __inline__ fec_phy_ack_intr(void)
+/*
+ * interrupt line of the PHY, or PHY_POLL to let phylib poll it
+ */
+static int __inline__ fec_phy_irq(void)
 {
+	return PHY_POLL;
 }
 
 static void __inline__ fec_localhw_setup(struct net_device *dev)
@@ -2010,7 +1564,6 @@ static void __inline__ fec_unmap_uncache(void *  addr)
 
 extern void gpio_fec_active(void);
 extern void gpio_fec_inactive(void);
-extern unsigned int expio_intr_fec;
 
 /*
  * do some initializtion based architecture of this chip
@@ -2045,11 +1598,6 @@ static void __inline__ fec_request_intrs(struct net_device *dev)
 	/* Setup interrupt handlers. */
 	if (request_irq(MXC_INT_FEC, fec_enet_interrupt, 0, "fec", dev) != 0)
 		panic("FEC: Could not allocate FEC IRQ(%d)!\n", MXC_INT_FEC);
-	/* TODO: disable now due to CPLD issue */
-	if ((expio_intr_fec > 0) &&
-	(request_irq(expio_intr_fec, mii_link_interrupt, 0, "fec(MII)", dev) != 0))
-		panic("FEC: Could not allocate FEC(MII) IRQ(%d)!\n", expio_intr_fec);
-	disable_irq(expio_intr_fec);
 }
 
 static void __inline__ fec_set_mii(struct net_device *dev, struct fec_enet_private *fep)
@@ -2147,22 +1695,14 @@ static int fec_mac_setup(char *new_mac)
 __setup("fec_mac=", fec_mac_setup);
 #endif
 
-static void __inline__ fec_enable_phy_intr(void)
-{
-	if (expio_intr_fec > 0)
-		enable_irq(expio_intr_fec);
-}
-
-static void __inline__ fec_disable_phy_intr(void)
-{
-	if (expio_intr_fec > 0)
-		disable_irq(expio_intr_fec);
-}
-
-static void __inline__ fec_phy_ack_intr(void)
+/*
+ * interrupt line of the PHY, or PHY_POLL to let phylib poll it.
+ * The boards' expio_intr_fec is no usable PHY interrupt: the CPLD
+ * routing is unreliable, and on MX25 3stack it is the power fail line.
+ */
+static int __inline__ fec_phy_irq(void)
 {
-	if (expio_intr_fec > 0)
-		disable_irq(expio_intr_fec);
+	return PHY_POLL;
 }
 
 #ifdef CONFIG_ARCH_MX25
@@ -2307,7 +1847,15 @@ static void __inline__ fec_set_mii(struct net_device *dev, struct fec_enet_priva
 		((bd->bi_busfreq * 1000000) / 2500000) & 0x7e;
 }
 
-static void __inline__ fec_enable_phy_intr(void)
+/*
+ * interrupt line of the PHY, or PHY_POLL to let phylib poll it
+ */
+static int __inline__ fec_phy_irq(void)
+{
+	return PHY_POLL;
+}
+
+static void __inline__ fec_localhw_setup(struct net_device *dev)
 {
 	volatile fec_t *fecp;
 
@@ -2316,21 +1864,7 @@ static void __inline__ fec_enable_phy_intr(void)
 	/* Enable MII command finished interrupt
 	*/
 	fecp->fec_ivec = (FEC_INTERRUPT/2) << 29;
-}
-
-static void __inline__ fec_disable_phy_intr(void)
-{
-}
-
-static void __inline__ fec_phy_ack_intr(void)
-{
-}
-
-static void __inline__ fec_localhw_setup(struct net_device *dev)
-{
-	volatile fec_t *fecp;
 
-	fecp = fep->hwp;
 	fecp->fec_r_hash = PKT_MAXBUF_SIZE;
 	/* Enable big endian and don't care about SDMA FC.
 	*/
@@ -2377,279 +1911,170 @@ static void __inline__ fec_unmap_uncache(void *  addr)
 
 /* ------------------------------------------------------------------------- */
 
-static void mii_display_status(struct net_device *dev)
+/* Called by phylib whenever the PHY state changes.  The MAC has to be
+ * restarted to follow a duplex change.  The NAPI poll and the coalescing
+ * timer are kept off the rings while the MAC is stopped or restarted.
+ */
+static void fec_enet_adjust_link(struct net_device *dev)
 {
 	struct fec_enet_private *fep = netdev_priv(dev);
-	volatile uint *s = &(fep->phy_status);
-
-	if (!fep->link && !fep->old_link) {
-		/* Link is still down - don't print anything */
-		return;
-	}
-
-	printk("%s: status: ", dev->name);
-
-	if (!fep->link) {
-		printk("link down");
-	} else {
-		printk("link up");
-
-		switch(*s & PHY_STAT_SPMASK) {
-		case PHY_STAT_100FDX: printk(", 100MBit Full Duplex"); break;
-		case PHY_STAT_100HDX: printk(", 100MBit Half Duplex"); break;
-		case PHY_STAT_10FDX: printk(", 10MBit Full Duplex"); break;
-		case PHY_STAT_10HDX: printk(", 10MBit Half Duplex"); break;
-		default:
-			printk(", Unknown speed/duplex");
+	struct phy_device *phy_dev = fep->phy_dev;
+	int status_change = 0;
+
+	if (phy_dev->link) {
+		if (!fep->link || fep->full_duplex != phy_dev->duplex) {
+			if (fep->opened) {
+				napi_disable(&fep->napi);
+				hrtimer_cancel(&fep->coal_timer);
+			}
+			netif_tx_lock_bh(dev);
+			fec_restart(dev, phy_dev->duplex);
+			fep->link = 1;
+			netif_tx_unlock_bh(dev);
+			if (fep->opened) {
+				napi_enable(&fep->napi);
+				netif_wake_queue(dev);
+			}
+			status_change = 1;
 		}
-
-		if (*s & PHY_STAT_ANC)
-			printk(", auto-negotiation complete");
-	}
-
-	if (*s & PHY_STAT_FAULT)
-		printk(", remote fault");
-
-	printk(".\n");
-}
-
-static void mii_display_config(struct work_struct *work)
-{
-	struct fec_enet_private *fep = container_of(work, struct fec_enet_private, phy_task);
-	struct net_device *dev = fep->netdev;
-	uint status = fep->phy_status;
-
-	/*
-	** When we get here, phy_task is already removed from
-	** the workqueue.  It is thus safe to allow to reuse it.
-	*/
-	fep->mii_phy_task_queued = 0;
-	printk("%s: config: auto-negotiation ", dev->name);
-
-	if (status & PHY_CONF_ANE)
-		printk("on");
-	else
-		printk("off");
-
-	if (status & PHY_CONF_100FDX)
-		printk(", 100FDX");
-	if (status & PHY_CONF_100HDX)
-		printk(", 100HDX");
-	if (status & PHY_CONF_10FDX)
-		printk(", 10FDX");
-	if (status & PHY_CONF_10HDX)
-		printk(", 10HDX");
-	if (!(status & PHY_CONF_SPMASK))
-		printk(", No speed/duplex selected?");
-
-	if (status & PHY_CONF_LOOP)
-		printk(", loopback enabled");
-
-	printk(".\n");
-
-	fep->sequence_done = 1;
-}
-
-static void mii_relink(struct work_struct *work)
-{
-	struct fec_enet_private *fep = container_of(work, struct fec_enet_private, phy_task);
-	struct net_device *dev = fep->netdev;
-	int duplex;
-
-	/*
-	** When we get here, phy_task is already removed from
-	** the workqueue.  It is thus safe to allow to reuse it.
-	*/
-	fep->mii_phy_task_queued = 0;
-	fep->link = (fep->phy_status & PHY_STAT_LINK) ? 1 : 0;
-	mii_display_status(dev);
-	fep->old_link = fep->link;
-
-	if (fep->link) {
-		duplex = 0;
-		if (fep->phy_status
-		    & (PHY_STAT_100FDX | PHY_STAT_10FDX))
-			duplex = 1;
-		fec_restart(dev, duplex);
-	} else
+	} else if (fep->link) {
+		if (fep->opened) {
+			napi_disable(&fep->napi);
+			hrtimer_cancel(&fep->coal_timer);
+		}
+		netif_tx_lock_bh(dev);
 		fec_stop(dev);
+		fep->link = 0;
+		netif_tx_unlock_bh(dev);
+		if (fep->opened)
+			napi_enable(&fep->napi);
+		status_change = 1;
+	}
 
-#if 0
-	enable_irq(fep->mii_irq);
-#endif
-
-}
-
-/* mii_queue_relink is called in interrupt context from mii_link_interrupt */
-static void mii_queue_relink(uint mii_reg, struct net_device *dev)
-{
-	struct fec_enet_private *fep = netdev_priv(dev);
-
-	/*
-	** We cannot queue phy_task twice in the workqueue.  It
-	** would cause an endless loop in the workqueue.
-	** Fortunately, if the last mii_relink entry has not yet been
-	** executed now, it will do the job for the current interrupt,
-	** which is just what we want.
-	*/
-	if (fep->mii_phy_task_queued)
-		return;
-
-	fep->mii_phy_task_queued = 1;
-	INIT_WORK(&fep->phy_task, mii_relink);
-	schedule_work(&fep->phy_task);
+	if (status_change)
+		phy_print_status(phy_dev);
 }
 
-/* mii_queue_config is called in interrupt context from fec_enet_mii */
-static void mii_queue_config(uint mii_reg, struct net_device *dev)
+/* Attach to the first PHY found on our MDIO bus.  Link changes are
+ * signalled by the PHY interrupt when the board wires one up and the
+ * PHY driver can acknowledge it, otherwise phylib polls the PHY.
+ */
+static int fec_enet_mii_probe(struct net_device *dev)
 {
 	struct fec_enet_private *fep = netdev_priv(dev);
+	struct phy_device *phy_dev = NULL;
+	int phy_addr;
 
-	if (fep->mii_phy_task_queued)
-		return;
-
-	fep->mii_phy_task_queued = 1;
-	INIT_WORK(&fep->phy_task, mii_display_config);
-	schedule_work(&fep->phy_task);
-}
-
-phy_cmd_t const phy_cmd_relink[] = {
-	{ mk_mii_read(MII_REG_CR), mii_queue_relink },
-	{ mk_mii_end, }
-	};
-phy_cmd_t const phy_cmd_config[] = {
-	{ mk_mii_read(MII_REG_CR), mii_queue_config },
-	{ mk_mii_end, }
-	};
+	if (fep->mii_bus == NULL)
+		return -ENODEV;
 
-/* Read remainder of PHY ID.
-*/
-static void
-mii_discover_phy3(uint mii_reg, struct net_device *dev)
-{
-	struct fec_enet_private *fep;
-	int i;
+	for (phy_addr = 0; phy_addr < PHY_MAX_ADDR; phy_addr++) {
+		if (fep->mii_bus->phy_map[phy_addr]) {
+			phy_dev = fep->mii_bus->phy_map[phy_addr];
+			break;
+		}
+	}
 
-	fep = netdev_priv(dev);
-	fep->phy_id |= (mii_reg & 0xffff);
-	printk("fec: PHY @ 0x%x, ID 0x%08x", fep->phy_addr, fep->phy_id);
+	if (phy_dev == NULL)
+		return -ENODEV;
 
-	for(i = 0; phy_info[i]; i++) {
-		if(phy_info[i]->id == (fep->phy_id >> 4))
-			break;
+	phy_dev = phy_connect(dev, phy_dev->dev.bus_id, fec_enet_adjust_link,
+			      0, PHY_INTERFACE_MODE_MII);
+	if (IS_ERR(phy_dev)) {
+		printk("%s: could not attach to PHY\n", dev->name);
+		return PTR_ERR(phy_dev);
 	}
 
-	if (phy_info[i])
-		printk(" -- %s\n", phy_info[i]->name);
-	else
-		printk(" -- unknown PHY!\n");
+	/* The FEC is a 10/100 MAC */
+	phy_dev->supported &= PHY_BASIC_FEATURES;
+	phy_dev->advertising = phy_dev->supported;
 
-	fep->phy = phy_info[i];
-	fep->phy_id_done = 1;
+	printk("%s: PHY @ 0x%x, driver %s (%s)\n", dev->name, phy_dev->addr,
+	       phy_dev->drv->name, phy_dev->irq > 0 ? "irq" : "polled");
+
+	fep->phy_dev = phy_dev;
+	fep->link = 0;
+	fep->full_duplex = 0;
+	return 0;
 }
 
-/* Scan all of the MII PHY addresses looking for someone to respond
- * with a valid ID.  This usually happens quickly.
- */
-static void
-mii_discover_phy(uint mii_reg, struct net_device *dev)
+static int fec_enet_mii_init(struct net_device *dev)
 {
-	struct fec_enet_private *fep;
-	volatile fec_t *fecp;
-	uint phytype;
+	struct fec_enet_private *fep = netdev_priv(dev);
+	int err, i;
 
-	fep = netdev_priv(dev);
-	fecp = fep->hwp;
+	init_completion(&fep->mdio_done);
 
-	if (fep->phy_addr < 32) {
-		if ((phytype = (mii_reg & 0xffff)) != 0xffff && phytype != 0) {
+	fep->mii_bus = mdiobus_alloc();
+	if (fep->mii_bus == NULL)
+		return -ENOMEM;
 
-			/* Got first part of ID, now get remainder.
-			*/
-			fep->phy_id = phytype << 16;
-			mii_queue(dev, mk_mii_read(MII_REG_PHYIR2),
-							mii_discover_phy3);
-		} else {
-			fep->phy_addr++;
-			mii_queue(dev, mk_mii_read(MII_REG_PHYIR1),
-							mii_discover_phy);
-		}
-	} else {
-		printk("FEC: No PHY device found.\n");
-		/* Disable external MII interface */
-		fecp->fec_mii_speed = fep->phy_speed = 0;
-		fec_disable_phy_intr();
+	fep->mii_bus->name = "fec_enet_mii_bus";
+	fep->mii_bus->read = fec_enet_mdio_read;
+	fep->mii_bus->write = fec_enet_mdio_write;
+	fep->mii_bus->reset = fec_enet_mdio_reset;
+	snprintf(fep->mii_bus->id, MII_BUS_ID_SIZE, "%x", fep->index);
+	fep->mii_bus->priv = fep;
+
+	fep->mii_bus->irq = kmalloc(sizeof(int) * PHY_MAX_ADDR, GFP_KERNEL);
+	if (fep->mii_bus->irq == NULL) {
+		err = -ENOMEM;
+		goto out_free;
 	}
-}
+	/* phylib falls back to polling for PHY drivers without interrupt
+	 * support, and phy_connect()/phy_disconnect() start and stop the
+	 * interrupt.
+	 */
+	for (i = 0; i < PHY_MAX_ADDR; i++)
+		fep->mii_bus->irq[i] = fec_phy_irq();
 
-/* This interrupt occurs when the PHY detects a link change.
-*/
-#ifdef HAVE_mii_link_interrupt
-static irqreturn_t
-mii_link_interrupt(int irq, void * dev_id)
-{
-	struct	net_device *dev = dev_id;
-	struct fec_enet_private *fep = netdev_priv(dev);
+	err = mdiobus_register(fep->mii_bus);
+	if (err)
+		goto out_free_irq;
 
-	fec_phy_ack_intr();
+	return 0;
 
-#if 0
-	disable_irq(fep->mii_irq);  /* disable now, enable later */
-#endif
-        /*
-	 * Some board will trigger phy interrupt before phy enable.
-	 * And at that moment , fep->phy is not initialized.
-	 */
-	if (fep->phy) {
-		mii_do_cmd(dev, fep->phy->ack_int);
-		mii_do_cmd(dev, phy_cmd_relink);  /* restart and display status */
-	}
-	return IRQ_HANDLED;
+out_free_irq:
+	kfree(fep->mii_bus->irq);
+out_free:
+	mdiobus_free(fep->mii_bus);
+	fep->mii_bus = NULL;
+	return err;
 }
-#endif
 
 static int
 fec_enet_open(struct net_device *dev)
 {
 	struct fec_enet_private *fep = netdev_priv(dev);
+	int err;
+
+	/* The ring sizes may have changed while the interface was down. */
+	err = fec_enet_alloc_rx_ring(dev);
+	if (!err)
+		err = fec_enet_alloc_tx_bounce(fep);
+	if (err)
+		return err;
 
-	/* I should reset the ring buffers here, but I don't yet know
-	 * a simple way to do that.
-	 */
 	fec_set_mac_address(dev);
 
-	fep->sequence_done = 0;
 	fep->link = 0;
 
-	if (fep->phy) {
-		mii_do_cmd(dev, fep->phy->ack_int);
-		mii_do_cmd(dev, fep->phy->config);
-		mii_do_cmd(dev, phy_cmd_config);  /* display configuration */
-
-		/* Poll until the PHY tells us its configuration
-		 * (not link state).
-		 * Request is initiated by mii_do_cmd above, but answer
-		 * comes by interrupt.
-		 * This should take about 25 usec per register at 2.5 MHz,
-		 * and we read approximately 5 registers.
-		 */
-		while(!fep->sequence_done)
-			schedule();
-
-		mii_do_cmd(dev, fep->phy->startup);
-
-		/* Set the initial link state to true. A lot of hardware
-		 * based on this device does not implement a PHY interrupt,
-		 * so we are never notified of link change.
-		 */
-		fep->link = 1;
-	} else {
+	err = fec_enet_mii_probe(dev);
+	if (err == -ENODEV) {
 		fep->link = 1; /* lets just try it and see */
 		/* no phy,  go full duplex,  it's most likely a hub chip */
 		fec_restart(dev, 1);
+	} else if (err) {
+		return err;
+	} else {
+		/* phylib reports the carrier once autonegotiation is done */
+		netif_carrier_off(dev);
 	}
 
+	napi_enable(&fep->napi);
 	fep->opened = 1;
+	if (fep->phy_dev)
+		phy_start(fep->phy_dev);
 	netif_start_queue(dev);
 	return 0;		/* Success */
 }
@@ -2661,7 +2086,15 @@ fec_enet_close(struct net_device *dev)
 
 	/* Don't know what to do yet.
 	*/
+	if (fep->phy_dev) {
+		phy_stop(fep->phy_dev);
+		phy_disconnect(fep->phy_dev);
+		fep->phy_dev = NULL;
+	}
+
 	fep->opened = 0;
+	napi_disable(&fep->napi);
+	hrtimer_cancel(&fep->coal_timer);
 	if (fep->link) {
 		fec_stop(dev);
 	}
@@ -2764,6 +2197,283 @@ fec_set_mac_address(struct net_device *dev)
 
 }
 
+/* Attach a receive buffer to every descriptor of the current ring size
+ * and release the buffers of the descriptors beyond it.
+ */
+static int
+fec_enet_alloc_rx_ring(struct net_device *dev)
+{
+	struct fec_enet_private *fep = netdev_priv(dev);
+	struct sk_buff *skb;
+	int i;
+
+	for (i = 0; i < FEC_RX_RING_MAX; i++) {
+		if (i >= fep->rx_ring_size) {
+			if (fep->rx_skbuff[i]) {
+				kfree_skb(fep->rx_skbuff[i]);
+				fep->rx_skbuff[i] = NULL;
+			}
+			continue;
+		}
+		if (fep->rx_skbuff[i] == NULL) {
+			skb = fec_enet_rx_alloc_skb(dev);
+			if (skb == NULL)
+				return -ENOMEM;
+			fep->rx_skbuff[i] = skb;
+		}
+		fep->rx_bd_base[i].cbd_bufaddr = __pa(fep->rx_skbuff[i]->data);
+	}
+	return 0;
+}
+
+/* Allocate the transmit bounce buffers missing for the current ring
+ * size and free those of the descriptors beyond it.  They are only used
+ * for misaligned frames.
+ */
+static int
+fec_enet_alloc_tx_bounce(struct fec_enet_private *fep)
+{
+	int i;
+
+	for (i = 0; i < FEC_TX_RING_MAX; i++) {
+		if (i >= fep->tx_ring_size) {
+			kfree(fep->tx_bounce[i]);
+			fep->tx_bounce[i] = NULL;
+			continue;
+		}
+		if (fep->tx_bounce[i])
+			continue;
+		fep->tx_bounce[i] = kmalloc(FEC_ENET_TX_FRSIZE, GFP_KERNEL);
+		if (fep->tx_bounce[i] == NULL)
+			return -ENOMEM;
+	}
+	return 0;
+}
+
+static int fec_enet_ioctl(struct net_device *dev, struct ifreq *rq, int cmd)
+{
+	struct fec_enet_private *fep = netdev_priv(dev);
+
+	if (!netif_running(dev))
+		return -EINVAL;
+	if (!fep->phy_dev)
+		return -ENODEV;
+	return phy_mii_ioctl(fep->phy_dev, if_mii(rq), cmd);
+}
+
+/* ------------------------------------------------------------------------- */
+/* ethtool support */
+
+static void fec_get_ringparam(struct net_device *dev,
+			      struct ethtool_ringparam *ring)
+{
+	struct fec_enet_private *fep = netdev_priv(dev);
+
+	ring->rx_max_pending = FEC_RX_RING_MAX;
+	ring->tx_max_pending = FEC_TX_RING_MAX;
+	ring->rx_pending = fep->rx_ring_size;
+	ring->tx_pending = fep->tx_ring_size;
+}
+
+static int fec_set_ringparam(struct net_device *dev,
+			     struct ethtool_ringparam *ring)
+{
+	struct fec_enet_private *fep = netdev_priv(dev);
+	uint old_rx_size = fep->rx_ring_size;
+	uint old_tx_size = fep->tx_ring_size;
+	int err;
+
+	if (ring->rx_mini_pending || ring->rx_jumbo_pending)
+		return -EINVAL;
+	if (ring->rx_pending < FEC_RX_RING_MIN ||
+	    ring->rx_pending > FEC_RX_RING_MAX ||
+	    ring->tx_pending < FEC_TX_RING_MIN ||
+	    ring->tx_pending > FEC_TX_RING_MAX)
+		return -EINVAL;
+
+	/* A closed interface gets its rings allocated by open. */
+	if (!netif_running(dev)) {
+		fep->rx_ring_size = ring->rx_pending;
+		fep->tx_ring_size = ring->tx_pending;
+		return 0;
+	}
+
+	/* The rings can only be changed with the controller stopped and
+	 * nothing left in the transmit path.
+	 */
+	napi_disable(&fep->napi);
+	hrtimer_cancel(&fep->coal_timer);
+	netif_tx_disable(dev);
+	fec_stop(dev);
+
+	fep->rx_ring_size = ring->rx_pending;
+	err = fec_enet_alloc_rx_ring(dev);
+	if (err) {
+		fep->rx_ring_size = old_rx_size;
+		fec_enet_alloc_rx_ring(dev);
+	} else {
+		fep->tx_ring_size = ring->tx_pending;
+		err = fec_enet_alloc_tx_bounce(fep);
+		if (err) {
+			fep->tx_ring_size = old_tx_size;
+			fec_enet_alloc_tx_bounce(fep);
+		}
+	}
+
+	/* Frames queued on the old ring are dropped by fec_restart().
+	 * Without a link the restart is left to fec_enet_adjust_link().
+	 */
+	if (fep->link) {
+		netif_tx_lock_bh(dev);
+		fec_restart(dev, fep->full_duplex);
+		netif_tx_unlock_bh(dev);
+	}
+	napi_enable(&fep->napi);
+	if (fep->link)
+		netif_wake_queue(dev);
+	return err;
+}
+
+static int fec_get_coalesce(struct net_device *dev,
+			    struct ethtool_coalesce *ec)
+{
+	struct fec_enet_private *fep = netdev_priv(dev);
+
+	/* Transmit completions are reclaimed by the receive poll, so there
+	 * are no transmit settings of their own.  The frame count is only
+	 * used to leave timer mode, see fec_enet_coalesce().
+	 */
+	ec->rx_coalesce_usecs = fep->rx_coal_usecs;
+	if (fep->coal_adaptive)
+		ec->rx_max_coalesced_frames = fep->rx_coal_frames;
+	ec->use_adaptive_rx_coalesce = fep->coal_adaptive;
+	return 0;
+}
+
+static int fec_set_coalesce(struct net_device *dev,
+			    struct ethtool_coalesce *ec)
+{
+	struct fec_enet_private *fep = netdev_priv(dev);
+	struct ethtool_coalesce supported;
+
+	/* Reject everything but the receive interval, the adaptive mode
+	 * and, in adaptive mode only, its frame count.
+	 */
+	memset(&supported, 0, sizeof(supported));
+	supported.cmd = ec->cmd;
+	supported.rx_coalesce_usecs = ec->rx_coalesce_usecs;
+	supported.rx_max_coalesced_frames = ec->rx_max_coalesced_frames;
+	supported.use_adaptive_rx_coalesce = ec->use_adaptive_rx_coalesce;
+	if (memcmp(&supported, ec, sizeof(supported)))
+		return -EINVAL;
+
+	if (ec->rx_coalesce_usecs > FEC_COAL_USECS_MAX ||
+	    ec->rx_max_coalesced_frames > fep->rx_ring_size ||
+	    (ec->rx_max_coalesced_frames && !ec->use_adaptive_rx_coalesce))
+		return -EINVAL;
+
+	fep->rx_coal_usecs = ec->rx_coalesce_usecs;
+	fep->rx_coal_frames = ec->rx_max_coalesced_frames;
+	fep->coal_adaptive = ec->use_adaptive_rx_coalesce;
+	return 0;
+}
+
+static const char fec_gstrings_stats[][ETH_GSTRING_LEN] = {
+	"rx_copybreak",
+	"rx_zerocopy",
+	"rx_alloc_fail",
+	"tx_bounced",
+	"coal_timer_polls",
+};
+
+#define FEC_STATS_LEN	ARRAY_SIZE(fec_gstrings_stats)
+
+static void fec_get_drvinfo(struct net_device *dev,
+			    struct ethtool_drvinfo *info)
+{
+	strcpy(info->driver, "fec");
+	strcpy(info->version, "0.2");
+	sprintf(info->bus_info, "fec.%d", ((struct fec_enet_private *)
+					   netdev_priv(dev))->index);
+}
+
+static int fec_get_settings(struct net_device *dev, struct ethtool_cmd *cmd)
+{
+	struct fec_enet_private *fep = netdev_priv(dev);
+
+	if (!fep->phy_dev)
+		return -ENODEV;
+	return phy_ethtool_gset(fep->phy_dev, cmd);
+}
+
+static int fec_set_settings(struct net_device *dev, struct ethtool_cmd *cmd)
+{
+	struct fec_enet_private *fep = netdev_priv(dev);
+
+	if (!fep->phy_dev)
+		return -ENODEV;
+	return phy_ethtool_sset(fep->phy_dev, cmd);
+}
+
+static int fec_nway_reset(struct net_device *dev)
+{
+	struct fec_enet_private *fep = netdev_priv(dev);
+
+	if (!fep->phy_dev)
+		return -ENODEV;
+	return phy_start_aneg(fep->phy_dev);
+}
+
+static u32 fec_get_link(struct net_device *dev)
+{
+	struct fec_enet_private *fep = netdev_priv(dev);
+
+	return fep->link;
+}
+
+static int fec_get_sset_count(struct net_device *dev, int sset)
+{
+	switch (sset) {
+	case ETH_SS_STATS:
+		return FEC_STATS_LEN;
+	default:
+		return -EOPNOTSUPP;
+	}
+}
+
+static void fec_get_strings(struct net_device *dev, u32 stringset, u8 *buf)
+{
+	if (stringset == ETH_SS_STATS)
+		memcpy(buf, fec_gstrings_stats, sizeof(fec_gstrings_stats));
+}
+
+static void fec_get_ethtool_stats(struct net_device *dev,
+				  struct ethtool_stats *stats, u64 *data)
+{
+	struct fec_enet_private *fep = netdev_priv(dev);
+
+	data[0] = fep->rx_copybreak;
+	data[1] = fep->rx_zerocopy;
+	data[2] = fep->rx_alloc_fail;
+	data[3] = fep->tx_bounced;
+	data[4] = fep->coal_timer_polls;
+}
+
+static struct ethtool_ops fec_ethtool_ops = {
+	.get_settings		= fec_get_settings,
+	.set_settings		= fec_set_settings,
+	.get_drvinfo		= fec_get_drvinfo,
+	.nway_reset		= fec_nway_reset,
+	.get_link		= fec_get_link,
+	.get_coalesce		= fec_get_coalesce,
+	.set_coalesce		= fec_set_coalesce,
+	.get_ringparam		= fec_get_ringparam,
+	.set_ringparam		= fec_set_ringparam,
+	.get_sset_count		= fec_get_sset_count,
+	.get_strings		= fec_get_strings,
+	.get_ethtool_stats	= fec_get_ethtool_stats,
+};
+
 /* Initialize the FEC Ethernet on 860T (or ColdFire 5272).
  */
  /*
@@ -2775,9 +2485,8 @@ int __init fec_enet_init(struct net_device *dev)
 	unsigned long	mem_addr;
 	volatile cbd_t	*bdp;
 	cbd_t		*cbd_base;
-	struct  sk_buff* pskb;
 	volatile fec_t	*fecp;
-	int 		i, j;
+	int 		i;
 	static int	index = 0;
 
 	/* Only allow us to be probed once. */
@@ -2796,7 +2505,6 @@ int __init fec_enet_init(struct net_device *dev)
 
 	fep->cbd_mem_base = (void *)mem_addr;
 	spin_lock_init(&fep->hw_lock);
-	spin_lock_init(&fep->mii_lock);
 
 	/* Create an Ethernet device instance.
 	*/
@@ -2831,53 +2539,55 @@ int __init fec_enet_init(struct net_device *dev)
 	/* Set receive and transmit descriptor base.
 	*/
 	fep->rx_bd_base = cbd_base;
-	fep->tx_bd_base = cbd_base + RX_RING_SIZE;
+	fep->tx_bd_base = cbd_base + FEC_RX_RING_MAX;
 
 	fep->dirty_tx = fep->cur_tx = fep->tx_bd_base;
 	fep->cur_rx = fep->rx_bd_base;
 
-	fep->skb_cur = fep->skb_dirty = 0;
+	fep->rx_ring_size = RX_RING_SIZE;
+	fep->tx_ring_size = clamp_t(int, fec_tx_ring_size,
+				    FEC_TX_RING_MIN, FEC_TX_RING_MAX);
+	fep->tx_free = fep->tx_ring_size;
 
 	/* Initialize the receive buffer descriptors.
 	*/
-	bdp = fep->rx_bd_base;
-	for (i=0; i<RX_RING_SIZE; i++,  bdp++) {
-		pskb = dev_alloc_skb(FEC_ENET_RX_FRSIZE);
-		if(pskb == NULL) {
-			for(; i>0; i--) {
-				if( fep->rx_skbuff[i-1] ) {
-					kfree_skb(fep->rx_skbuff[i-1]);
-					fep->rx_skbuff[i-1] = NULL;
-				}
+	if (fec_enet_alloc_rx_ring(dev)) {
+		for (i = 0; i < FEC_RX_RING_MAX; i++) {
+			if (fep->rx_skbuff[i]) {
+				kfree_skb(fep->rx_skbuff[i]);
+				fep->rx_skbuff[i] = NULL;
 			}
-			printk("FEC: allocate skb fail when initializing rx buffer \n");
-			free_page(mem_addr);
-			return -ENOMEM;
 		}
-		fep->rx_skbuff[i] = pskb;
-		fec_dcache_inv_range(pskb->data, pskb->data +
-				     FEC_ENET_RX_FRSIZE);
-		pskb->data = FEC_ADDR_ALIGNMENT(pskb->data);
-		bdp->cbd_sc = BD_ENET_RX_EMPTY;
-		bdp->cbd_bufaddr = __pa(pskb->data);
+		printk("FEC: allocate skb fail when initializing rx buffer \n");
+		free_page(mem_addr);
+		return -ENOMEM;
 	}
+	bdp = fep->rx_bd_base;
+	for (i=0; i<fep->rx_ring_size; i++,  bdp++)
+		bdp->cbd_sc = BD_ENET_RX_EMPTY;
+
 	/* Set the last buffer to wrap.
 	*/
 	bdp--;
 	bdp->cbd_sc |= BD_SC_WRAP;
 
+	if (fec_enet_alloc_tx_bounce(fep)) {
+		for (i = 0; i < FEC_TX_RING_MAX; i++) {
+			kfree(fep->tx_bounce[i]);
+			fep->tx_bounce[i] = NULL;
+		}
+		for (i = 0; i < fep->rx_ring_size; i++) {
+			kfree_skb(fep->rx_skbuff[i]);
+			fep->rx_skbuff[i] = NULL;
+		}
+		printk("FEC: allocate tx bounce buffers failed\n");
+		return -ENOMEM;
+	}
+
 	/* ...and the same for transmmit.
 	*/
 	bdp = fep->tx_bd_base;
-	for (i=0, j=FEC_ENET_TX_FRPPG; i<TX_RING_SIZE; i++) {
-		if (j >= FEC_ENET_TX_FRPPG) {
-			mem_addr = __get_free_page(GFP_KERNEL);
-			j = 1;
-		} else {
-			mem_addr += FEC_ENET_TX_FRSIZE;
-			j++;
-		}
-		fep->tx_bounce[i] = (unsigned char *) mem_addr;
+	for (i=0; i<fep->tx_ring_size; i++) {
 
 		/* Initialize the BD for every fragment in the page.
 		*/
@@ -2894,7 +2604,7 @@ int __init fec_enet_init(struct net_device *dev)
 	/* Set receive and transmit descriptor base.
 	*/
 	fecp->fec_r_des_start = __pa((uint)(fep->cbd_mem_base));
-	fecp->fec_x_des_start = __pa((uint)(fep->cbd_mem_base + RX_RING_SIZE*sizeof(cbd_t)));
+	fecp->fec_x_des_start = __pa((uint)(fep->cbd_mem_base + FEC_RX_RING_MAX*sizeof(cbd_t)));
 
 	/* Install our interrupt handlers. This varies depending on
 	 * the architecture.
@@ -2924,20 +2634,24 @@ int __init fec_enet_init(struct net_device *dev)
 	dev->watchdog_timeo = TX_TIMEOUT;
 	dev->stop = fec_enet_close;
 	dev->set_multicast_list = set_multicast_list;
+	dev->do_ioctl = fec_enet_ioctl;
+	dev->ethtool_ops = &fec_ethtool_ops;
 
-	for (i=0; i<NMII-1; i++)
-		mii_cmds[i].mii_next = &mii_cmds[i+1];
-	mii_free = mii_cmds;
+	netif_napi_add(dev, &fep->napi, fec_enet_napi_poll, fec_napi_weight);
+
+	hrtimer_init(&fep->coal_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	fep->coal_timer.function = fec_enet_coal_timer;
+	fep->rx_coal_frames = RX_RING_SIZE / 2;
+	fep->coal_adaptive = 1;
 
 	/* setup MII interface */
 	fec_set_mii(dev, fep);
 
-	/* Queue up command to detect the PHY and initialize the
-	 * remainder of the interface.
+	/* Register the MDIO bus; phylib probes the PHYs on it.  Without
+	 * one the interface still runs, forced to full duplex.
 	 */
-	fep->phy_id_done = 0;
-	fep->phy_addr = 0;
-	mii_queue(dev, mk_mii_read(MII_REG_PHYIR1), mii_discover_phy);
+	if (fec_enet_mii_init(dev))
+		printk("FEC: MDIO bus registration failed\n");
 
 	index++;
 	return 0;
@@ -2972,8 +2686,6 @@ fec_restart(struct net_device *dev, int duplex)
 	 */
 	fecp->fec_ievent = FEC_ENET_MASK;
 
-	fec_enable_phy_intr();
-
 	/* Set station address.
 	*/
 	fec_set_mac_address(dev);
@@ -2992,15 +2704,15 @@ fec_restart(struct net_device *dev, int duplex)
 	/* Set receive and transmit descriptor base.
 	*/
 	fecp->fec_r_des_start = __pa((uint)(fep->cbd_mem_base));
-	fecp->fec_x_des_start = __pa((uint)(fep->cbd_mem_base + RX_RING_SIZE*sizeof(cbd_t)));
+	fecp->fec_x_des_start = __pa((uint)(fep->cbd_mem_base + FEC_RX_RING_MAX*sizeof(cbd_t)));
 
 	fep->dirty_tx = fep->cur_tx = fep->tx_bd_base;
 	fep->cur_rx = fep->rx_bd_base;
 
 	/* Reset SKB transmit buffers.
 	*/
-	fep->skb_cur = fep->skb_dirty = 0;
-	for (i=0; i<=TX_RING_MOD_MASK; i++) {
+	fep->tx_free = fep->tx_ring_size;
+	for (i=0; i<FEC_TX_RING_MAX; i++) {
 		if (fep->tx_skbuff[i] != NULL) {
 			dev_kfree_skb_any(fep->tx_skbuff[i]);
 			fep->tx_skbuff[i] = NULL;
@@ -3010,7 +2722,7 @@ fec_restart(struct net_device *dev, int duplex)
 	/* Initialize the receive buffer descriptors.
 	*/
 	bdp = fep->rx_bd_base;
-	for (i=0; i<RX_RING_SIZE; i++) {
+	for (i=0; i<fep->rx_ring_size; i++) {
 
 		/* Initialize the BD for every fragment in the page.
 		*/
@@ -3026,7 +2738,7 @@ fec_restart(struct net_device *dev, int duplex)
 	/* ...and the same for transmmit.
 	*/
 	bdp = fep->tx_bd_base;
-	for (i=0; i<TX_RING_SIZE; i++) {
+	for (i=0; i<fep->tx_ring_size; i++) {
 
 		/* Initialize the BD for every fragment in the page.
 		*/
@@ -3092,7 +2804,6 @@ fec_stop(struct net_device *dev)
 	/* Clear outstanding MII command interrupts.
 	*/
 	fecp->fec_ievent = FEC_ENET_MII;
-	fec_enable_phy_intr();
 
 	fecp->fec_imask = FEC_ENET_MII;
 	fecp->fec_mii_speed = fep->phy_speed;
@@ -25,9 +25,18 @@
 /*
  * This file provides a single place to access to compression and
  * decompression.
+ *
+ * Every compressor has a cryptoapi handle, and so a workspace, per CPU.
+ * Callers use the workspace of the CPU they happen to run on, so
+ * compression and decompression on different CPUs go in parallel. A
+ * per-workspace mutex covers the case of a task being preempted or migrated
+ * while using it.
  */
 
 #include <linux/crypto.h>
+#include <linux/percpu.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 #include "ubifs.h"
 
 /* Fake description object for the "none" compressor */
@@ -38,11 +47,8 @@ static struct ubifs_compressor none_compr = {
 };
 
 #ifdef CONFIG_UBIFS_FS_LZO
-static DEFINE_MUTEX(lzo_mutex);
-
 static struct ubifs_compressor lzo_compr = {
 	.compr_type = UBIFS_COMPR_LZO,
-	.comp_mutex = &lzo_mutex,
 	.name = "LZO",
 	.capi_name = "lzo",
 };
@@ -54,13 +60,8 @@ static struct ubifs_compressor lzo_compr = {
 #endif
 
 #ifdef CONFIG_UBIFS_FS_ZLIB
-static DEFINE_MUTEX(deflate_mutex);
-static DEFINE_MUTEX(inflate_mutex);
-
 static struct ubifs_compressor zlib_compr = {
 	.compr_type = UBIFS_COMPR_ZLIB,
-	.comp_mutex = &deflate_mutex,
-	.decomp_mutex = &inflate_mutex,
 	.name = "zlib",
 	.capi_name = "deflate",
 };
@@ -74,6 +75,20 @@ static struct ubifs_compressor zlib_compr = {
 /* All UBIFS compressors */
 struct ubifs_compressor *ubifs_compressors[UBIFS_COMPR_TYPES_CNT];
 
+/**
+ * get_workspace - get and lock the current CPU's workspace of a compressor.
+ * @compr: compressor description object
+ */
+static struct ubifs_compr_ws *get_workspace(struct ubifs_compressor *compr)
+{
+	struct ubifs_compr_ws *ws;
+
+	ws = per_cpu_ptr(compr->ws, get_cpu());
+	put_cpu();
+	mutex_lock(&ws->mutex);
+	return ws;
+}
+
 /**
  * ubifs_compress - compress data.
  * @in_buf: data to compress
@@ -97,6 +112,7 @@ void ubifs_compress(const void *in_buf, int in_len, void *out_buf, int *out_len,
 {
 	int err;
 	struct ubifs_compressor *compr = ubifs_compressors[*compr_type];
+	struct ubifs_compr_ws *ws;
 
 	if (*compr_type == UBIFS_COMPR_NONE)
 		goto no_compr;
@@ -105,12 +121,9 @@ void ubifs_compress(const void *in_buf, int in_len, void *out_buf, int *out_len,
 	if (in_len < UBIFS_MIN_COMPR_LEN)
 		goto no_compr;
 
-	if (compr->comp_mutex)
-		mutex_lock(compr->comp_mutex);
-	err = crypto_comp_compress(compr->cc, in_buf, in_len, out_buf,
-				   out_len);
-	if (compr->comp_mutex)
-		mutex_unlock(compr->comp_mutex);
+	ws = get_workspace(compr);
+	err = crypto_comp_compress(ws->cc, in_buf, in_len, out_buf, out_len);
+	mutex_unlock(&ws->mutex);
 	if (unlikely(err)) {
 		ubifs_warn("cannot compress %d bytes, compressor %s, "
 			   "error %d, leave data uncompressed",
@@ -133,6 +146,141 @@ no_compr:
 	*compr_type = UBIFS_COMPR_NONE;
 }
 
+/**
+ * poor_saving - check whether compression did not pay off.
+ * @in_len: length of the input data
+ * @out_len: length of the output data
+ * @compr_type: compression type actually used
+ *
+ * Returns non-zero if the data was left uncompressed or was compressed by
+ * less than 1/2^%ADAPT_COMPR_MIN_SAVING_SHIFT of its size.
+ */
+static int poor_saving(int in_len, int out_len, int compr_type)
+{
+	if (compr_type == UBIFS_COMPR_NONE)
+		return 1;
+	return in_len - out_len < in_len >> ADAPT_COMPR_MIN_SAVING_SHIFT;
+}
+
+/**
+ * compare_compressors - compress data with both LZO and zlib.
+ * @in_buf: data to compress
+ * @in_len: length of the data to compress
+ * @out_buf: output buffer where compressed data should be stored
+ * @out_len: output buffer length is returned here
+ * @compr_type: actually used compression type is returned here
+ *
+ * This function compresses @in_buf with both LZO and zlib and keeps the zlib
+ * output only if it is smaller than the LZO one by a noticeable amount, since
+ * zlib is considerably slower at both compression and decompression. Returns
+ * zero in case of success and %-ENOMEM if the temporary buffer could not be
+ * allocated, in which case nothing is done.
+ */
+static int compare_compressors(const void *in_buf, int in_len, void *out_buf,
+			       int *out_len, int *compr_type)
+{
+	void *buf;
+	int lzo_len, zlib_len, zlib_type = UBIFS_COMPR_ZLIB;
+
+	buf = kmalloc(UBIFS_BLOCK_SIZE * WORST_COMPR_FACTOR, GFP_NOFS);
+	if (!buf)
+		return -ENOMEM;
+
+	*compr_type = UBIFS_COMPR_LZO;
+	lzo_len = UBIFS_BLOCK_SIZE * WORST_COMPR_FACTOR;
+	ubifs_compress(in_buf, in_len, out_buf, &lzo_len, compr_type);
+	zlib_len = UBIFS_BLOCK_SIZE * WORST_COMPR_FACTOR;
+	ubifs_compress(in_buf, in_len, buf, &zlib_len, &zlib_type);
+
+	if (zlib_type == UBIFS_COMPR_ZLIB &&
+	    zlib_len + (in_len >> ADAPT_COMPR_MIN_SAVING_SHIFT) < lzo_len) {
+		memcpy(out_buf, buf, zlib_len);
+		lzo_len = zlib_len;
+		*compr_type = UBIFS_COMPR_ZLIB;
+	}
+
+	*out_len = lzo_len;
+	kfree(buf);
+	return 0;
+}
+
+/**
+ * ubifs_compress_adaptive - compress data, adapting to the inode's contents.
+ * @c: UBIFS file-system description object
+ * @ui: UBIFS inode the data belongs to
+ * @in_buf: data to compress
+ * @in_len: length of the data to compress
+ * @out_buf: output buffer where compressed data should be stored
+ * @out_len: output buffer length is returned here
+ * @compr_type: type of compression to use on enter, actually used compression
+ *              type on exit
+ *
+ * This is a version of 'ubifs_compress()' which remembers how well the data of
+ * an inode compresses. When compression does not pay off, the following blocks
+ * of the inode are stored uncompressed without trying, and the length of this
+ * uncompressed run doubles each time compression fails again, up to
+ * %ADAPT_COMPR_MAX_SKIP blocks. This way already compressed media files cost
+ * almost no compression CPU time. Every %ADAPT_COMPR_SAMPLE_BLOCKS blocks the
+ * data is compressed with both LZO and zlib, and the winner is used for the
+ * following blocks of the inode.
+ */
+void ubifs_compress_adaptive(struct ubifs_info *c, struct ubifs_inode *ui,
+			     const void *in_buf, int in_len, void *out_buf,
+			     int *out_len, int *compr_type)
+{
+	int sample = 0, err;
+
+	spin_lock(&ui->ui_lock);
+	if (ui->compr_skip > 0) {
+		ui->compr_skip -= 1;
+		spin_unlock(&ui->ui_lock);
+		atomic_long_inc(&c->cstats.skipped);
+		memcpy(out_buf, in_buf, in_len);
+		*out_len = in_len;
+		*compr_type = UBIFS_COMPR_NONE;
+		return;
+	}
+	if (--ui->compr_sample <= 0) {
+		ui->compr_sample = ADAPT_COMPR_SAMPLE_BLOCKS;
+		sample = 1;
+	}
+	if (ui->compr_pick)
+		*compr_type = ui->compr_pick;
+	spin_unlock(&ui->ui_lock);
+
+	if (sample && in_len >= UBIFS_MIN_COMPR_LEN &&
+	    ubifs_compressors[UBIFS_COMPR_LZO]->capi_name &&
+	    ubifs_compressors[UBIFS_COMPR_ZLIB]->capi_name) {
+		err = compare_compressors(in_buf, in_len, out_buf, out_len,
+					  compr_type);
+		if (!err)
+			atomic_long_inc(&c->cstats.samples);
+		else
+			sample = 0;
+	} else
+		sample = 0;
+
+	if (!sample)
+		ubifs_compress(in_buf, in_len, out_buf, out_len, compr_type);
+
+	/* Tiny blocks do not tell anything about the inode's data */
+	if (in_len < UBIFS_MIN_COMPR_LEN)
+		return;
+
+	spin_lock(&ui->ui_lock);
+	if (sample && *compr_type != UBIFS_COMPR_NONE)
+		ui->compr_pick = *compr_type;
+	if (poor_saving(in_len, *out_len, *compr_type)) {
+		if (ui->compr_backoff == 0)
+			ui->compr_backoff = 1;
+		else if (ui->compr_backoff < ADAPT_COMPR_MAX_SKIP)
+			ui->compr_backoff <<= 1;
+		ui->compr_skip = ui->compr_backoff;
+	} else
+		ui->compr_backoff = 0;
+	spin_unlock(&ui->ui_lock);
+}
+
 /**
  * ubifs_decompress - decompress data.
  * @in_buf: data to decompress
@@ -150,6 +298,7 @@ int ubifs_decompress(const void *in_buf, int in_len, void *out_buf,
 {
 	int err;
 	struct ubifs_compressor *compr;
+	struct ubifs_compr_ws *ws;
 
 	if (unlikely(compr_type < 0 || compr_type >= UBIFS_COMPR_TYPES_CNT)) {
 		ubifs_err("invalid compression type %d", compr_type);
@@ -169,12 +318,9 @@ int ubifs_decompress(const void *in_buf, int in_len, void *out_buf,
 		return 0;
 	}
 
-	if (compr->decomp_mutex)
-		mutex_lock(compr->decomp_mutex);
-	err = crypto_comp_decompress(compr->cc, in_buf, in_len, out_buf,
-				     out_len);
-	if (compr->decomp_mutex)
-		mutex_unlock(compr->decomp_mutex);
+	ws = get_workspace(compr);
+	err = crypto_comp_decompress(ws->cc, in_buf, in_len, out_buf, out_len);
+	mutex_unlock(&ws->mutex);
 	if (err)
 		ubifs_err("cannot decompress %d bytes, compressor %s, "
 			  "error %d", in_len, compr->name, err);
@@ -182,21 +328,56 @@ int ubifs_decompress(const void *in_buf, int in_len, void *out_buf,
 	return err;
 }
 
+/**
+ * compr_exit - de-initialize a compressor.
+ * @compr: compressor description object
+ */
+static void compr_exit(struct ubifs_compressor *compr)
+{
+	int cpu;
+	struct ubifs_compr_ws *ws;
+
+	if (!compr->ws)
+		return;
+
+	for_each_possible_cpu(cpu) {
+		ws = per_cpu_ptr(compr->ws, cpu);
+		if (ws->cc && !IS_ERR(ws->cc))
+			crypto_free_comp(ws->cc);
+	}
+	free_percpu(compr->ws);
+	compr->ws = NULL;
+}
+
 /**
  * compr_init - initialize a compressor.
  * @compr: compressor description object
  *
- * This function initializes the requested compressor and returns zero in case
- * of success or a negative error code in case of failure.
+ * This function initializes the requested compressor, allocating a workspace
+ * for every possible CPU, and returns zero in case of success or a negative
+ * error code in case of failure.
  */
 static int __init compr_init(struct ubifs_compressor *compr)
 {
+	int cpu, err;
+	struct ubifs_compr_ws *ws;
+
 	if (compr->capi_name) {
-		compr->cc = crypto_alloc_comp(compr->capi_name, 0, 0);
-		if (IS_ERR(compr->cc)) {
-			ubifs_err("cannot initialize compressor %s, error %ld",
-				  compr->name, PTR_ERR(compr->cc));
-			return PTR_ERR(compr->cc);
+		compr->ws = alloc_percpu(struct ubifs_compr_ws);
+		if (!compr->ws)
+			return -ENOMEM;
+
+		for_each_possible_cpu(cpu) {
+			ws = per_cpu_ptr(compr->ws, cpu);
+			mutex_init(&ws->mutex);
+			ws->cc = crypto_alloc_comp(compr->capi_name, 0, 0);
+			if (IS_ERR(ws->cc)) {
+				err = PTR_ERR(ws->cc);
+				ubifs_err("cannot initialize compressor %s, "
+					  "error %d", compr->name, err);
+				compr_exit(compr);
+				return err;
+			}
 		}
 	}
 
@@ -204,17 +385,6 @@ static int __init compr_init(struct ubifs_compressor *compr)
 	return 0;
 }
 
-/**
- * compr_exit - de-initialize a compressor.
- * @compr: compressor description object
- */
-static void compr_exit(struct ubifs_compressor *compr)
-{
-	if (compr->capi_name)
-		crypto_free_comp(compr->cc);
-	return;
-}
-
 /**
  * ubifs_compressors_init - initialize UBIFS compressors.
  *
@@ -244,8 +414,121 @@ out_lzo:
 /**
  * ubifs_compressors_exit - de-initialize UBIFS compressors.
  */
-void __exit ubifs_compressors_exit(void)
+void ubifs_compressors_exit(void)
 {
 	compr_exit(&lzo_compr);
 	compr_exit(&zlib_compr);
 }
+
+#ifdef CONFIG_DEBUG_FS
+
+/* The "ubifs" debugfs directory, %NULL if debugfs is not available */
+static struct dentry *dfs_rootdir;
+
+static int compr_stats_show(struct seq_file *s, void *v)
+{
+	int i;
+	struct ubifs_info *c = s->private;
+	struct ubifs_compr_stats *cstats = &c->cstats;
+
+	for (i = 0; i < UBIFS_COMPR_TYPES_CNT; i++)
+		seq_printf(s, "%-16s %lu\n", ubifs_compressors[i]->name,
+			   atomic_long_read(&cstats->blocks[i]));
+	seq_printf(s, "in_bytes         %lu\n",
+		   atomic_long_read(&cstats->in_bytes));
+	seq_printf(s, "out_bytes        %lu\n",
+		   atomic_long_read(&cstats->out_bytes));
+	seq_printf(s, "uncompressed     %lu\n",
+		   atomic_long_read(&cstats->uncompr));
+	seq_printf(s, "skipped          %lu\n",
+		   atomic_long_read(&cstats->skipped));
+	seq_printf(s, "samples          %lu\n",
+		   atomic_long_read(&cstats->samples));
+	seq_printf(s, "adaptive         %d\n", c->adaptive_compr);
+	return 0;
+}
+
+static int compr_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, compr_stats_show, inode->i_private);
+}
+
+static const struct file_operations compr_stats_fops = {
+	.owner   = THIS_MODULE,
+	.open    = compr_stats_open,
+	.read    = seq_read,
+	.llseek  = seq_lseek,
+	.release = single_release,
+};
+
+/**
+ * ubifs_compr_dfs_init - create the UBIFS debugfs directory.
+ *
+ * Failures are not fatal, the statistics are just not exposed then.
+ */
+void __init ubifs_compr_dfs_init(void)
+{
+	dfs_rootdir = debugfs_create_dir("ubifs", NULL);
+	if (IS_ERR(dfs_rootdir) || !dfs_rootdir) {
+		ubifs_warn("cannot create \"ubifs\" debugfs directory");
+		dfs_rootdir = NULL;
+	}
+}
+
+/**
+ * ubifs_compr_dfs_exit - remove the UBIFS debugfs directory.
+ */
+void ubifs_compr_dfs_exit(void)
+{
+	if (dfs_rootdir)
+		debugfs_remove(dfs_rootdir);
+}
+
+/**
+ * ubifs_compr_dfs_add - expose compression statistics of a file-system.
+ * @c: UBIFS file-system description object
+ *
+ * This function creates the "ubiX_Y/compr_stats" debugfs file for the
+ * file-system mounted on UBI device X, volume Y.
+ */
+void ubifs_compr_dfs_add(struct ubifs_info *c)
+{
+	char name[32];
+	struct dentry *dent;
+
+	c->dfs_dir = NULL;
+	if (!dfs_rootdir)
+		return;
+
+	sprintf(name, "ubi%d_%d", c->vi.ubi_num, c->vi.vol_id);
+	dent = debugfs_create_dir(name, dfs_rootdir);
+	if (IS_ERR(dent) || !dent)
+		goto out;
+
+	c->dfs_dir = dent;
+	dent = debugfs_create_file("compr_stats", S_IRUGO, c->dfs_dir, c,
+				   &compr_stats_fops);
+	if (IS_ERR(dent) || !dent) {
+		debugfs_remove(c->dfs_dir);
+		c->dfs_dir = NULL;
+		goto out;
+	}
+	return;
+
+out:
+	ubifs_warn("cannot create debugfs directory \"%s\"", name);
+}
+
+/**
+ * ubifs_compr_dfs_remove - remove compression statistics of a file-system.
+ * @c: UBIFS file-system description object
+ */
+void ubifs_compr_dfs_remove(struct ubifs_info *c)
+{
+	if (c->dfs_dir) {
+		debugfs_remove_recursive(c->dfs_dir);
+		c->dfs_dir = NULL;
+	}
+}
+
+#endif /* CONFIG_DEBUG_FS */
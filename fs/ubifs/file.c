@@ -54,6 +54,8 @@
 #include "ubifs.h"
 #include <linux/mount.h>
 #include <linux/namei.h>
+#include <linux/cpu.h>
+#include <linux/workqueue.h>
 
 static int read_block(struct inode *inode, void *addr, unsigned int block,
 		      struct ubifs_data_node *dn)
@@ -879,7 +881,52 @@ static int ubifs_readpage(struct file *file, struct page *page)
 	return 0;
 }
 
-static int do_writepage(struct page *page, int len)
+/**
+ * struct wb_job - a data block compressed by a 'ubifs_writepages()' worker.
+ * @work: work item
+ * @batch: batch the job belongs to
+ * @key: data node key
+ * @buf: block data
+ * @dn: data node prepared from @buf
+ * @dlen: length of @dn
+ */
+struct wb_job {
+	struct work_struct work;
+	struct wb_batch *batch;
+	union ubifs_key key;
+	const void *buf;
+	struct ubifs_data_node *dn;
+	int dlen;
+};
+
+/*
+ * Most data blocks 'ubifs_writepages()' compresses in parallel before
+ * writing them to the journal.
+ */
+#define WB_BATCH_BLOCKS 16
+#define WB_BATCH_PAGES (WB_BATCH_BLOCKS >> UBIFS_BLOCKS_PER_PAGE_SHIFT)
+
+/**
+ * struct wb_batch - pages collected by 'ubifs_writepages()'.
+ * @c: UBIFS file-system description object
+ * @inode: inode the pages belong to
+ * @pg_cnt: count of pages in @pages
+ * @pages: locked pages lying fully inside @i_size, in ascending order
+ * @pending: count of jobs not yet compressed
+ * @done: completed when the last job has been compressed
+ * @jobs: compression jobs, %UBIFS_BLOCKS_PER_PAGE per page
+ */
+struct wb_batch {
+	struct ubifs_info *c;
+	struct inode *inode;
+	int pg_cnt;
+	struct page *pages[WB_BATCH_PAGES];
+	atomic_t pending;
+	struct completion done;
+	struct wb_job jobs[WB_BATCH_BLOCKS];
+};
+
+static int do_writepage(struct page *page, int len, struct wb_job *jobs)
 {
 	int err = 0, i, blen;
 	unsigned int block;
@@ -903,7 +950,11 @@ static int do_writepage(struct page *page, int len)
 	while (len) {
 		blen = min_t(int, len, UBIFS_BLOCK_SIZE);
 		data_key_init(c, &key, inode->i_ino, block);
-		err = ubifs_jnl_write_data(c, inode, &key, addr, blen);
+		if (jobs)
+			err = ubifs_jnl_write_data_node(c, &key, jobs[i].dn,
+							jobs[i].dlen);
+		else
+			err = ubifs_jnl_write_data(c, inode, &key, addr, blen);
 		if (err)
 			break;
 		if (++i >= UBIFS_BLOCKS_PER_PAGE)
@@ -1015,7 +1066,7 @@ static int ubifs_writepage(struct page *page, struct writeback_control *wbc)
 			 * with this.
 			 */
 		}
-		return do_writepage(page, PAGE_CACHE_SIZE);
+		return do_writepage(page, PAGE_CACHE_SIZE, NULL);
 	}
 
 	/*
@@ -1036,13 +1087,217 @@ static int ubifs_writepage(struct page *page, struct writeback_control *wbc)
 			goto out_unlock;
 	}
 
-	return do_writepage(page, len);
+	return do_writepage(page, len, NULL);
 
 out_unlock:
 	unlock_page(page);
 	return err;
 }
 
+/**
+ * wb_compress_work - compress one data block of a batch.
+ * @work: the job's work item
+ */
+static void wb_compress_work(struct work_struct *work)
+{
+	struct wb_job *job = container_of(work, struct wb_job, work);
+	struct wb_batch *batch = job->batch;
+
+	job->dlen = ubifs_prepare_data_node(batch->c, batch->inode, &job->key,
+					    job->buf, UBIFS_BLOCK_SIZE, job->dn);
+	if (atomic_dec_and_test(&batch->pending))
+		complete(&batch->done);
+}
+
+/**
+ * flush_batch - compress the batched pages in parallel and write them out.
+ * @batch: the batch
+ * @wbc: write-back control
+ *
+ * The data blocks of all the pages are spread over the online CPUs and
+ * compressed there. The resulting data nodes are then written to the journal
+ * in page order, as 'ubifs_writepage()' would have done. Returns zero in case
+ * of success and a negative error code in case of failure.
+ */
+static int flush_batch(struct wb_batch *batch, struct writeback_control *wbc)
+{
+	struct inode *inode = batch->inode;
+	struct ubifs_inode *ui = ubifs_inode(inode);
+	int i, n, cpu, err = 0, err1;
+	loff_t synced_i_size;
+	void *addr;
+
+	if (!batch->pg_cnt)
+		return 0;
+
+	/*
+	 * A single block is not worth farming out, and if there is no memory
+	 * for the data nodes just write the pages the usual way.
+	 */
+	n = batch->pg_cnt * UBIFS_BLOCKS_PER_PAGE;
+	for (i = 0; i < n && n > 1; i++) {
+		if (!batch->jobs[i].dn)
+			batch->jobs[i].dn = kmalloc(COMPRESSED_DATA_NODE_BUF_SZ,
+						    GFP_NOFS);
+		if (!batch->jobs[i].dn)
+			n = 0;
+	}
+	if (n < 2) {
+		for (i = 0; i < batch->pg_cnt; i++) {
+			err1 = ubifs_writepage(batch->pages[i], wbc);
+			if (err1 && !err)
+				err = err1;
+		}
+		batch->pg_cnt = 0;
+		return err;
+	}
+
+	for (i = n = 0; i < batch->pg_cnt; i++) {
+		struct page *page = batch->pages[i];
+		unsigned int block = page->index << UBIFS_BLOCKS_PER_PAGE_SHIFT;
+		int j;
+
+		addr = kmap(page);
+		for (j = 0; j < UBIFS_BLOCKS_PER_PAGE; j++, n++) {
+			struct wb_job *job = &batch->jobs[n];
+
+			data_key_init(batch->c, &job->key, inode->i_ino,
+				      block + j);
+			job->buf = addr + j * UBIFS_BLOCK_SIZE;
+		}
+	}
+
+	atomic_set(&batch->pending, n);
+	init_completion(&batch->done);
+	get_online_cpus();
+	cpu = first_cpu(cpu_online_map);
+	for (i = 0; i < n; i++) {
+		INIT_WORK(&batch->jobs[i].work, wb_compress_work);
+		queue_work_on(cpu, ubifs_compr_wq, &batch->jobs[i].work);
+		cpu = next_cpu(cpu, cpu_online_map);
+		if (cpu >= nr_cpu_ids)
+			cpu = first_cpu(cpu_online_map);
+	}
+	wait_for_completion(&batch->done);
+	put_online_cpus();
+
+	for (i = 0; i < batch->pg_cnt; i++) {
+		struct page *page = batch->pages[i];
+		pgoff_t end_index = i_size_read(inode) >> PAGE_CACHE_SHIFT;
+
+		kunmap(page);
+
+		/* The page is no longer fully inside @i_size, start over */
+		if (page->index >= end_index) {
+			err1 = ubifs_writepage(page, wbc);
+			goto next;
+		}
+
+		/* As in 'ubifs_writepage()' */
+		spin_lock(&ui->ui_lock);
+		synced_i_size = ui->synced_i_size;
+		spin_unlock(&ui->ui_lock);
+		if (page->index >= synced_i_size >> PAGE_CACHE_SHIFT) {
+			err1 = inode->i_sb->s_op->write_inode(inode, 1);
+			if (err1) {
+				unlock_page(page);
+				goto next;
+			}
+		}
+
+		err1 = do_writepage(page, PAGE_CACHE_SIZE,
+				    &batch->jobs[i * UBIFS_BLOCKS_PER_PAGE]);
+next:
+		if (err1 && !err)
+			err = err1;
+	}
+
+	batch->pg_cnt = 0;
+	return err;
+}
+
+/**
+ * batch_writepage - 'write_cache_pages()' callback of 'ubifs_writepages()'.
+ * @page: locked page to write
+ * @wbc: write-back control
+ * @data: the batch
+ *
+ * Pages lying fully inside @i_size are collected into the batch. Other pages
+ * are written by 'ubifs_writepage()' after the batch has been flushed. The
+ * batch is also flushed before taking a page with a lower index, so pages are
+ * only ever locked in ascending order while others are held.
+ */
+static int batch_writepage(struct page *page, struct writeback_control *wbc,
+			   void *data)
+{
+	struct wb_batch *batch = data;
+	pgoff_t end_index = i_size_read(batch->inode) >> PAGE_CACHE_SHIFT;
+	int err = 0, err1;
+
+	if (batch->pg_cnt &&
+	    page->index <= batch->pages[batch->pg_cnt - 1]->index)
+		err = flush_batch(batch, wbc);
+
+	if (page->index >= end_index) {
+		err1 = flush_batch(batch, wbc);
+		if (!err)
+			err = err1;
+		err1 = ubifs_writepage(page, wbc);
+		return err ? err : err1;
+	}
+
+	batch->pages[batch->pg_cnt++] = page;
+	if (batch->pg_cnt == WB_BATCH_PAGES) {
+		err1 = flush_batch(batch, wbc);
+		if (!err)
+			err = err1;
+	}
+
+	return err;
+}
+
+/**
+ * ubifs_writepages - write back dirty pages of an inode.
+ * @mapping: address space of the inode
+ * @wbc: write-back control
+ *
+ * When the inode is compressed and there is more than one CPU, the dirty
+ * pages are compressed in batches by all CPUs at once, see 'flush_batch()'.
+ * Otherwise this is the same as writing the pages one by one.
+ */
+static int ubifs_writepages(struct address_space *mapping,
+			    struct writeback_control *wbc)
+{
+	struct inode *inode = mapping->host;
+	struct ubifs_inode *ui = ubifs_inode(inode);
+	struct wb_batch *batch;
+	int i, err, err1;
+
+	if (num_online_cpus() < 2 || !(ui->flags & UBIFS_COMPR_FL) ||
+	    ui->compr_type == UBIFS_COMPR_NONE)
+		return generic_writepages(mapping, wbc);
+
+	batch = kzalloc(sizeof(struct wb_batch), GFP_NOFS);
+	if (!batch)
+		return generic_writepages(mapping, wbc);
+
+	/* Data node buffers are allocated by 'flush_batch()' as needed */
+	for (i = 0; i < WB_BATCH_BLOCKS; i++)
+		batch->jobs[i].batch = batch;
+	batch->c = inode->i_sb->s_fs_info;
+	batch->inode = inode;
+
+	err = write_cache_pages(mapping, wbc, batch_writepage, batch);
+	err1 = flush_batch(batch, wbc);
+	if (!err)
+		err = err1;
+
+	for (i = 0; i < WB_BATCH_BLOCKS; i++)
+		kfree(batch->jobs[i].dn);
+	kfree(batch);
+	return err;
+}
+
 /**
  * do_attr_changes - change inode attributes.
  * @inode: inode to change attributes for
@@ -1543,6 +1798,7 @@ static int ubifs_file_mmap(struct file *file, struct vm_area_struct *vma)
 struct address_space_operations ubifs_file_address_operations = {
 	.readpage       = ubifs_readpage,
 	.writepage      = ubifs_writepage,
+	.writepages     = ubifs_writepages,
 	.write_begin    = ubifs_write_begin,
 	.write_end      = ubifs_write_end,
 	.invalidatepage = ubifs_invalidatepage,
@@ -672,55 +672,87 @@ out_ro:
 }
 
 /**
- * ubifs_jnl_write_data - write a data node to the journal.
+ * ubifs_prepare_data_node - fill in and compress a data node.
  * @c: UBIFS file-system description object
  * @inode: inode the data node belongs to
  * @key: node key
- * @buf: buffer to write
+ * @buf: data to put in the node
  * @len: data length (must not exceed %UBIFS_BLOCK_SIZE)
+ * @data: node to fill in, %COMPRESSED_DATA_NODE_BUF_SZ bytes long
  *
- * This function writes a data node to the journal. Returns %0 if the data node
- * was successfully written, and a negative error code in case of failure.
+ * This function builds a data node for @buf, compressing the data if the
+ * inode asks for it. It does not touch the journal, so it may run on many
+ * data nodes in parallel. The block is accounted in the compression
+ * statistics of @c. Returns the length of the resulting node.
  */
-int ubifs_jnl_write_data(struct ubifs_info *c, const struct inode *inode,
-			 const union ubifs_key *key, const void *buf, int len)
+int ubifs_prepare_data_node(struct ubifs_info *c,
+			    const struct inode *inode,
+			    const union ubifs_key *key, const void *buf,
+			    int len, struct ubifs_data_node *data)
 {
-	struct ubifs_data_node *data;
-	int err, lnum, offs, compr_type, out_len;
-	int dlen = UBIFS_DATA_NODE_SZ + UBIFS_BLOCK_SIZE * WORST_COMPR_FACTOR;
+	int compr_type, out_len;
 	struct ubifs_inode *ui = ubifs_inode(inode);
+	struct ubifs_compr_stats *cstats = &c->cstats;
 
-	dbg_jnl("ino %lu, blk %u, len %d, key %s",
-		(unsigned long)key_inum(c, key), key_block(c, key), len,
-		DBGKEY(key));
 	ubifs_assert(len <= UBIFS_BLOCK_SIZE);
 
-	data = kmalloc(dlen, GFP_NOFS);
-	if (!data)
-		return -ENOMEM;
-
 	data->ch.node_type = UBIFS_DATA_NODE;
 	key_write(c, key, &data->key);
 	data->size = cpu_to_le32(len);
 	zero_data_node_unused(data);
 
-	if (!(ui->flags && UBIFS_COMPR_FL))
+	if (!(ui->flags & UBIFS_COMPR_FL))
 		/* Compression is disabled for this inode */
 		compr_type = UBIFS_COMPR_NONE;
 	else
 		compr_type = ui->compr_type;
 
-	out_len = dlen - UBIFS_DATA_NODE_SZ;
-	ubifs_compress(buf, len, &data->data, &out_len, &compr_type);
+	out_len = UBIFS_BLOCK_SIZE * WORST_COMPR_FACTOR;
+	if (compr_type == UBIFS_COMPR_NONE)
+		ubifs_compress(buf, len, &data->data, &out_len, &compr_type);
+	else {
+		if (c->adaptive_compr)
+			ubifs_compress_adaptive(c, ui, buf, len, &data->data,
+						&out_len, &compr_type);
+		else
+			ubifs_compress(buf, len, &data->data, &out_len,
+				       &compr_type);
+		if (compr_type == UBIFS_COMPR_NONE)
+			atomic_long_inc(&cstats->uncompr);
+	}
 	ubifs_assert(out_len <= UBIFS_BLOCK_SIZE);
 
-	dlen = UBIFS_DATA_NODE_SZ + out_len;
+	atomic_long_inc(&cstats->blocks[compr_type]);
+	atomic_long_add(len, &cstats->in_bytes);
+	atomic_long_add(out_len, &cstats->out_bytes);
+
 	data->compr_type = cpu_to_le16(compr_type);
+	return UBIFS_DATA_NODE_SZ + out_len;
+}
+
+/**
+ * ubifs_jnl_write_data_node - write a prepared data node to the journal.
+ * @c: UBIFS file-system description object
+ * @key: node key
+ * @data: data node prepared by 'ubifs_prepare_data_node()'
+ * @dlen: data node length
+ *
+ * This function writes a data node to the journal. Returns %0 if the data node
+ * was successfully written, and a negative error code in case of failure.
+ */
+int ubifs_jnl_write_data_node(struct ubifs_info *c, const union ubifs_key *key,
+			      struct ubifs_data_node *data, int dlen)
+{
+	int err, lnum, offs;
+
+	dbg_jnl("ino %lu, blk %u, dlen %d, key %s",
+		(unsigned long)key_inum(c, key), key_block(c, key), dlen,
+		DBGKEY(key));
 
 	/* Make reservation before allocating sequence numbers */
 	err = make_reservation(c, DATAHD, dlen);
 	if (err)
-		goto out_free;
+		return err;
 
 	err = write_node(c, DATAHD, data, dlen, &lnum, &offs);
 	if (err)
@@ -733,7 +765,6 @@ int ubifs_jnl_write_data(struct ubifs_info *c, const struct inode *inode,
 		goto out_ro;
 
 	finish_reservation(c);
-	kfree(data);
 	return 0;
 
 out_release:
@@ -741,7 +772,32 @@ out_release:
 out_ro:
 	ubifs_ro_mode(c, err);
 	finish_reservation(c);
-out_free:
+	return err;
+}
+
+/**
+ * ubifs_jnl_write_data - write a data node to the journal.
+ * @c: UBIFS file-system description object
+ * @inode: inode the data node belongs to
+ * @key: node key
+ * @buf: buffer to write
+ * @len: data length (must not exceed %UBIFS_BLOCK_SIZE)
+ *
+ * This function writes a data node to the journal. Returns %0 if the data node
+ * was successfully written, and a negative error code in case of failure.
+ */
+int ubifs_jnl_write_data(struct ubifs_info *c, const struct inode *inode,
+			 const union ubifs_key *key, const void *buf, int len)
+{
+	struct ubifs_data_node *data;
+	int err, dlen;
+
+	data = kmalloc(COMPRESSED_DATA_NODE_BUF_SZ, GFP_NOFS);
+	if (!data)
+		return -ENOMEM;
+
+	dlen = ubifs_prepare_data_node(c, inode, key, buf, len, data);
+	err = ubifs_jnl_write_data_node(c, key, data, dlen);
 	kfree(data);
 	return err;
 }
@@ -34,6 +34,7 @@
 #include <linux/parser.h>
 #include <linux/seq_file.h>
 #include <linux/mount.h>
+#include <linux/workqueue.h>
 #include "ubifs.h"
 
 /*
@@ -45,6 +46,9 @@
 /* Slab cache for UBIFS inodes */
 struct kmem_cache *ubifs_inode_slab;
 
+/* Per-CPU workers compressing data nodes for 'ubifs_writepages()' */
+struct workqueue_struct *ubifs_compr_wq;
+
 /* UBIFS TNC shrinker description */
 static struct shrinker ubifs_shrinker_info = {
 	.shrink = ubifs_shrinker,
@@ -417,6 +421,11 @@ static int ubifs_show_options(struct seq_file *s, struct vfsmount *mnt)
 	else if (c->mount_opts.chk_data_crc == 1)
 		seq_printf(s, ",no_chk_data_crc");
 
+	if (c->mount_opts.adaptive_compr == 2)
+		seq_printf(s, ",adaptive_compr");
+	else if (c->mount_opts.adaptive_compr == 1)
+		seq_printf(s, ",no_adaptive_compr");
+
 	return 0;
 }
 
@@ -878,6 +887,8 @@ static int check_volume_empty(struct ubifs_info *c)
  * Opt_no_bulk_read: disable bulk-reads
  * Opt_chk_data_crc: check CRCs when reading data nodes
  * Opt_no_chk_data_crc: do not check CRCs when reading data nodes
+ * Opt_adaptive_compr: pick compressors per inode, skip incompressible data
+ * Opt_no_adaptive_compr: always use the inode's compressor
  * Opt_err: just end of array marker
  */
 enum {
@@ -887,6 +898,8 @@ enum {
 	Opt_no_bulk_read,
 	Opt_chk_data_crc,
 	Opt_no_chk_data_crc,
+	Opt_adaptive_compr,
+	Opt_no_adaptive_compr,
 	Opt_err,
 };
 
@@ -897,6 +910,8 @@ static const match_table_t tokens = {
 	{Opt_no_bulk_read, "no_bulk_read"},
 	{Opt_chk_data_crc, "chk_data_crc"},
 	{Opt_no_chk_data_crc, "no_chk_data_crc"},
+	{Opt_adaptive_compr, "adaptive_compr"},
+	{Opt_no_adaptive_compr, "no_adaptive_compr"},
 	{Opt_err, NULL},
 };
 
@@ -950,6 +965,14 @@ static int ubifs_parse_options(struct ubifs_info *c, char *options,
 			c->mount_opts.chk_data_crc = 1;
 			c->no_chk_data_crc = 1;
 			break;
+		case Opt_adaptive_compr:
+			c->mount_opts.adaptive_compr = 2;
+			c->adaptive_compr = 1;
+			break;
+		case Opt_no_adaptive_compr:
+			c->mount_opts.adaptive_compr = 1;
+			c->adaptive_compr = 0;
+			break;
 		default:
 			ubifs_err("unrecognized mount option \"%s\" "
 				  "or missing value", p);
@@ -1299,6 +1322,7 @@ static int mount_ubifs(struct ubifs_info *c)
 	dbg_msg("max. seq. number:    %llu", c->max_sqnum);
 	dbg_msg("commit number:       %llu", c->cmt_no);
 
+	ubifs_compr_dfs_add(c);
 	return 0;
 
 out_infos:
@@ -1349,6 +1373,8 @@ static void ubifs_umount(struct ubifs_info *c)
 	list_del(&c->infos_list);
 	spin_unlock(&ubifs_infos_lock);
 
+	ubifs_compr_dfs_remove(c);
+
 	if (c->bgt)
 		kthread_stop(c->bgt);
 
@@ -2051,8 +2077,17 @@ static int __init ubifs_init(void)
 	if (err)
 		goto out_compr;
 
+	ubifs_compr_wq = create_workqueue("ubifs_compr");
+	if (!ubifs_compr_wq) {
+		err = -ENOMEM;
+		goto out_wq;
+	}
+
+	ubifs_compr_dfs_init();
 	return 0;
 
+out_wq:
+	ubifs_compressors_exit();
 out_compr:
 	unregister_shrinker(&ubifs_shrinker_info);
 	kmem_cache_destroy(ubifs_inode_slab);
@@ -2068,6 +2103,8 @@ static void __exit ubifs_exit(void)
 	ubifs_assert(list_empty(&ubifs_infos));
 	ubifs_assert(atomic_long_read(&ubifs_clean_zn_cnt) == 0);
 
+	ubifs_compr_dfs_exit();
+	destroy_workqueue(ubifs_compr_wq);
 	ubifs_compressors_exit();
 	unregister_shrinker(&ubifs_shrinker_info);
 	kmem_cache_destroy(ubifs_inode_slab);
@@ -428,6 +428,93 @@ static int tnc_read_node_nm(struct ubifs_info *c, struct ubifs_zbranch *zbr,
 	return err;
 }
 
+/**
+ * lnc_read_ahead - read directory entries into the leaf node cache in one go.
+ * @c: UBIFS file-system description object
+ * @znode: level 0 znode
+ * @n: slot of the directory or extended attribute entry about to be read
+ *
+ * Readdir and cold-cache lookups read directory entries one by one, and each
+ * of them would cost a separate flash read. This function is called just
+ * before the entry of slot @n is read and, if @znode refers to other entries
+ * of the same directory which are not in the leaf node cache and sit close to
+ * that entry in the same LEB, reads all of them with one flash read and adds
+ * them to the leaf node cache. Since entries are sorted by name hash, they are
+ * not stored in key order on the flash, so the entries are looked for on
+ * either side of the entry of slot @n.
+ *
+ * Nothing is read ahead from journal heads, which may be in the middle of
+ * being written. This is an optimization only, so errors are not reported,
+ * the entries which could not be read ahead are read later as usual.
+ */
+static void lnc_read_ahead(struct ubifs_info *c, struct ubifs_znode *znode,
+			   int n)
+{
+	struct ubifs_zbranch *zbr = &znode->zbranch[n], *zb;
+	int i, err, lo, hi, cnt = 0, type = key_type(c, &zbr->key);
+	ino_t inum = key_inum(c, &zbr->key);
+	void *buf;
+
+	ubifs_assert(znode->level == 0);
+	if (zbr->leaf || ubifs_get_wbuf(c, zbr->lnum))
+		return;
+
+	lo = zbr->offs;
+	hi = zbr->offs + zbr->len;
+	for (i = 0; i < znode->child_cnt; i++) {
+		zb = &znode->zbranch[i];
+		if (i == n || zb->leaf || zb->lnum != zbr->lnum ||
+		    key_inum(c, &zb->key) != inum ||
+		    key_type(c, &zb->key) != type)
+			continue;
+		if (max(hi, zb->offs + zb->len) - min(lo, zb->offs) >
+		    UBIFS_LNC_RA_BYTES)
+			continue;
+		lo = min(lo, zb->offs);
+		hi = max(hi, zb->offs + zb->len);
+		cnt += 1;
+	}
+	if (!cnt)
+		return;
+
+	buf = kmalloc(hi - lo, GFP_NOFS);
+	if (!buf)
+		return;
+
+	dbg_tnc("LEB %d:%d, %d entries, length %d", zbr->lnum, lo, cnt + 1,
+		hi - lo);
+	err = ubi_read(c->ubi, zbr->lnum, buf, lo, hi - lo);
+	if (err && err != -EBADMSG)
+		goto out;
+
+	for (i = 0; i < znode->child_cnt; i++) {
+		struct ubifs_ch *ch;
+		union ubifs_key key1;
+
+		zb = &znode->zbranch[i];
+		if (zb->leaf || zb->lnum != zbr->lnum || zb->offs < lo ||
+		    zb->offs + zb->len > hi ||
+		    key_inum(c, &zb->key) != inum ||
+		    key_type(c, &zb->key) != type)
+			continue;
+
+		ch = buf + zb->offs - lo;
+		if (ch->node_type != type ||
+		    ubifs_check_node(c, ch, zb->lnum, zb->offs, 1, 0) ||
+		    le32_to_cpu(ch->len) != zb->len)
+			continue;
+
+		key_read(c, (void *)ch + UBIFS_KEY_OFFSET, &key1);
+		if (!keys_eq(c, &zb->key, &key1))
+			continue;
+
+		lnc_add(c, zb, ch);
+	}
+
+out:
+	kfree(buf);
+}
+
 /**
  * try_read_node - read a node if it is a node.
  * @c: UBIFS file-system description object
@@ -1461,6 +1548,7 @@ again:
 		 * In this case the leaf node cache gets used, so we pass the
 		 * address of the zbranch and keep the mutex locked
 		 */
+		lnc_read_ahead(c, znode, n);
 		err = tnc_read_node_nm(c, zt, node);
 		goto out;
 	}
@@ -2824,6 +2912,7 @@ struct ubifs_dent_node *ubifs_tnc_next_ent(struct ubifs_info *c,
 		goto out_free;
 	}
 
+	lnc_read_ahead(c, znode, n);
 	err = tnc_read_node_nm(c, zbr, dent);
 	if (unlikely(err))
 		goto out_free;
@@ -257,34 +257,21 @@ long ubifs_destroy_tnc_subtree(struct ubifs_znode *znode)
 }
 
 /**
- * read_znode - read an indexing node from flash and fill znode.
+ * parse_znode - fill znode from an indexing node.
  * @c: UBIFS file-system description object
- * @lnum: LEB of the indexing node to read
+ * @idx: the indexing node, already checked by 'ubifs_check_node()'
+ * @lnum: LEB of the indexing node
  * @offs: node offset
- * @len: node length
- * @znode: znode to read to
+ * @znode: znode to fill
  *
- * This function reads an indexing node from the flash media and fills znode
- * with the read data. Returns zero in case of success and a negative error
- * code in case of failure. The read indexing node is validated and if anything
- * is wrong with it, this function prints complaint messages and returns
- * %-EINVAL.
+ * This function fills @znode with the contents of the indexing node @idx and
+ * validates them. Returns zero in case of success and %-EINVAL if anything is
+ * wrong with the indexing node, in which case complaint messages are printed.
  */
-static int read_znode(struct ubifs_info *c, int lnum, int offs, int len,
-		      struct ubifs_znode *znode)
+static int parse_znode(struct ubifs_info *c, struct ubifs_idx_node *idx,
+		       int lnum, int offs, struct ubifs_znode *znode)
 {
 	int i, err, type, cmp;
-	struct ubifs_idx_node *idx;
-
-	idx = kmalloc(c->max_idx_node_sz, GFP_NOFS);
-	if (!idx)
-		return -ENOMEM;
-
-	err = ubifs_read_node(c, idx, UBIFS_IDX_NODE, len, lnum, offs);
-	if (err < 0) {
-		kfree(idx);
-		return err;
-	}
 
 	znode->child_cnt = le16_to_cpu(idx->child_cnt);
 	znode->level = le16_to_cpu(idx->level);
@@ -382,16 +369,205 @@ static int read_znode(struct ubifs_info *c, int lnum, int offs, int len,
 		}
 	}
 
-	kfree(idx);
 	return 0;
 
 out_dump:
 	ubifs_err("bad indexing node at LEB %d:%d, error %d", lnum, offs, err);
 	dbg_dump_node(c, idx);
-	kfree(idx);
 	return -EINVAL;
 }
 
+/**
+ * read_znode - read an indexing node from flash and fill znode.
+ * @c: UBIFS file-system description object
+ * @lnum: LEB of the indexing node to read
+ * @offs: node offset
+ * @len: node length
+ * @znode: znode to read to
+ *
+ * This function reads an indexing node from the flash media and fills znode
+ * with the read data. Returns zero in case of success and a negative error
+ * code in case of failure. The read indexing node is validated and if anything
+ * is wrong with it, this function prints complaint messages and returns
+ * %-EINVAL.
+ */
+static int read_znode(struct ubifs_info *c, int lnum, int offs, int len,
+		      struct ubifs_znode *znode)
+{
+	int err;
+	struct ubifs_idx_node *idx;
+
+	idx = kmalloc(c->max_idx_node_sz, GFP_NOFS);
+	if (!idx)
+		return -ENOMEM;
+
+	err = ubifs_read_node(c, idx, UBIFS_IDX_NODE, len, lnum, offs);
+	if (!err)
+		err = parse_znode(c, idx, lnum, offs, znode);
+
+	kfree(idx);
+	return err;
+}
+
+/**
+ * check_idx_node - check an indexing node which has already been read.
+ * @c: UBIFS file-system description object
+ * @buf: the node
+ * @len: expected node length
+ * @lnum: LEB the node was read from
+ * @offs: node offset
+ * @quiet: print no messages
+ *
+ * This function does the checks 'ubifs_read_node()' does for nodes which were
+ * read as a part of a larger chunk. Returns zero if the node is fine and
+ * %-EINVAL if not.
+ */
+static int check_idx_node(const struct ubifs_info *c, void *buf, int len,
+			  int lnum, int offs, int quiet)
+{
+	struct ubifs_ch *ch = buf;
+
+	if (ch->node_type != UBIFS_IDX_NODE ||
+	    ubifs_check_node(c, buf, lnum, offs, quiet, 0) ||
+	    le32_to_cpu(ch->len) != len) {
+		if (!quiet) {
+			ubifs_err("bad node at LEB %d:%d", lnum, offs);
+			dbg_dump_node(c, buf);
+			dbg_dump_stack();
+		}
+		return -EINVAL;
+	}
+	return 0;
+}
+
+/**
+ * install_znode - link a freshly loaded znode into the TNC tree.
+ * @c: UBIFS file-system description object
+ * @zbr: znode branch
+ * @znode: the znode
+ * @parent: znode's parent
+ * @iip: index in parent
+ */
+static void install_znode(struct ubifs_info *c, struct ubifs_zbranch *zbr,
+			  struct ubifs_znode *znode,
+			  struct ubifs_znode *parent, int iip)
+{
+	atomic_long_inc(&c->clean_zn_cnt);
+
+	/*
+	 * Increment the global clean znode counter as well. It is OK that
+	 * global and per-FS clean znode counters may be inconsistent for some
+	 * short time (because we might be preempted at this point), the global
+	 * one is only used in shrinker.
+	 */
+	atomic_long_inc(&ubifs_clean_zn_cnt);
+
+	zbr->znode = znode;
+	znode->parent = parent;
+	znode->time = get_seconds();
+	znode->iip = iip;
+}
+
+/**
+ * ra_siblings_cnt - count sibling znodes worth reading ahead.
+ * @parent: parent znode
+ * @iip: index in parent of the znode which is being loaded
+ *
+ * Returns how many of the znodes following slot @iip in @parent are not in
+ * the TNC yet and sit further in the same LEB, close enough to be read with
+ * the znode of slot @iip in one go.
+ */
+static int ra_siblings_cnt(const struct ubifs_znode *parent, int iip)
+{
+	const struct ubifs_zbranch *zbr = &parent->zbranch[iip], *sib;
+	int i, end = zbr->offs + zbr->len;
+
+	for (i = iip + 1; i < parent->child_cnt; i++) {
+		if (i - iip >= UBIFS_TNC_RA_ZNODES)
+			break;
+		sib = &parent->zbranch[i];
+		if (sib->znode || sib->lnum != zbr->lnum || sib->offs < end ||
+		    sib->offs + sib->len - zbr->offs > UBIFS_TNC_RA_BYTES)
+			break;
+		end = sib->offs + sib->len;
+	}
+
+	return i - iip - 1;
+}
+
+/**
+ * read_znodes - read a znode and its following siblings in one go.
+ * @c: UBIFS file-system description object
+ * @parent: parent znode
+ * @iip: index in parent of the znode to load
+ * @cnt: how many following siblings to read as well
+ * @znode: znode to read to
+ *
+ * This function reads the indexing node of slot @iip of @parent to @znode,
+ * just like 'read_znode()' does, but it reads @cnt following siblings with
+ * the same flash read and adds them to the TNC as well. Cold-cache lookups
+ * tend to need the siblings soon, and reading them one by one would cost a
+ * separate flash read each. Problems with the siblings are not reported, the
+ * siblings are just left on the flash and will be reported when actually
+ * needed. Returns zero in case of success and a negative error code in case
+ * of failure.
+ */
+static int read_znodes(struct ubifs_info *c, struct ubifs_znode *parent,
+		       int iip, int cnt, struct ubifs_znode *znode)
+{
+	int i, err, len, lnum, offs;
+	struct ubifs_zbranch *zbr = &parent->zbranch[iip], *sib;
+	struct ubifs_znode *zn;
+	void *buf;
+
+	lnum = zbr->lnum;
+	offs = zbr->offs;
+	sib = &parent->zbranch[iip + cnt];
+	len = sib->offs + sib->len - offs;
+
+	buf = kmalloc(len, GFP_NOFS);
+	if (!buf)
+		return read_znode(c, lnum, offs, zbr->len, znode);
+
+	dbg_tnc("LEB %d:%d, %d siblings, length %d", lnum, offs, cnt, len);
+	err = ubi_read(c->ubi, lnum, buf, offs, len);
+	if (err && err != -EBADMSG) {
+		ubifs_err("cannot read index nodes from LEB %d:%d, error %d",
+			  lnum, offs, err);
+		goto out;
+	}
+
+	err = check_idx_node(c, buf, zbr->len, lnum, offs, 0);
+	if (!err)
+		err = parse_znode(c, buf, lnum, offs, znode);
+	if (err)
+		goto out;
+
+	for (i = iip + 1; i <= iip + cnt; i++) {
+		void *node;
+
+		sib = &parent->zbranch[i];
+		node = buf + sib->offs - offs;
+		if (check_idx_node(c, node, sib->len, lnum, sib->offs, 1))
+			break;
+
+		zn = kzalloc(c->max_znode_sz, GFP_NOFS);
+		if (!zn)
+			break;
+
+		if (parse_znode(c, node, lnum, sib->offs, zn)) {
+			kfree(zn);
+			break;
+		}
+
+		install_znode(c, sib, zn, parent, i);
+	}
+
+out:
+	kfree(buf);
+	return err;
+}
+
 /**
  * ubifs_load_znode - load znode to TNC cache.
  * @c: UBIFS file-system description object
@@ -401,13 +577,14 @@ out_dump:
  *
  * This function loads znode pointed to by @zbr into the TNC cache and
  * returns pointer to it in case of success and a negative error code in case
- * of failure.
+ * of failure. The following siblings of the znode may be loaded as well, see
+ * 'read_znodes()'.
  */
 struct ubifs_znode *ubifs_load_znode(struct ubifs_info *c,
 				     struct ubifs_zbranch *zbr,
 				     struct ubifs_znode *parent, int iip)
 {
-	int err;
+	int err, cnt = 0;
 	struct ubifs_znode *znode;
 
 	ubifs_assert(!zbr->znode);
@@ -419,25 +596,16 @@ struct ubifs_znode *ubifs_load_znode(struct ubifs_info *c,
 	if (!znode)
 		return ERR_PTR(-ENOMEM);
 
-	err = read_znode(c, zbr->lnum, zbr->offs, zbr->len, znode);
+	if (parent)
+		cnt = ra_siblings_cnt(parent, iip);
+	if (cnt)
+		err = read_znodes(c, parent, iip, cnt, znode);
+	else
+		err = read_znode(c, zbr->lnum, zbr->offs, zbr->len, znode);
 	if (err)
 		goto out;
 
-	atomic_long_inc(&c->clean_zn_cnt);
-
-	/*
-	 * Increment the global clean znode counter as well. It is OK that
-	 * global and per-FS clean znode counters may be inconsistent for some
-	 * short time (because we might be preempted at this point), the global
-	 * one is only used in shrinker.
-	 */
-	atomic_long_inc(&ubifs_clean_zn_cnt);
-
-	zbr->znode = znode;
-	znode->parent = parent;
-	znode->time = get_seconds();
-	znode->iip = iip;
-
+	install_znode(c, zbr, znode, parent, iip);
 	return znode;
 
 out:
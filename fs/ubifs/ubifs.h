@@ -139,12 +139,39 @@
  */
 #define WORST_COMPR_FACTOR 2
 
+/* Size of the buffer a data node is built and compressed in */
+#define COMPRESSED_DATA_NODE_BUF_SZ \
+	(UBIFS_DATA_NODE_SZ + UBIFS_BLOCK_SIZE * WORST_COMPR_FACTOR)
+
+/*
+ * Adaptive compression: how many data blocks are written between two
+ * LZO-versus-zlib comparisons of an inode, the longest run of blocks written
+ * uncompressed after compression did not pay off, and the minimum saving (as
+ * a fraction of the block size) which makes zlib preferred over LZO or
+ * compression preferred over storing the data as is.
+ */
+#define ADAPT_COMPR_SAMPLE_BLOCKS 32
+#define ADAPT_COMPR_MAX_SKIP 64
+#define ADAPT_COMPR_MIN_SAVING_SHIFT 4
+
 /* Maximum expected tree height for use by bottom_up_buf */
 #define BOTTOM_UP_HEIGHT 64
 
 /* Maximum number of data nodes to bulk-read */
 #define UBIFS_MAX_BULK_READ 32
 
+/*
+ * When a znode is loaded from flash, the following sibling znodes which sit
+ * in the same LEB are read in the same go, as long as they are not more than
+ * 'UBIFS_TNC_RA_ZNODES' znodes and 'UBIFS_TNC_RA_BYTES' bytes. Similarly, when
+ * a directory entry is read, the entries of the same directory which are
+ * referred to by the same znode and sit within 'UBIFS_LNC_RA_BYTES' bytes in
+ * the same LEB are read in one go and added to the leaf node cache.
+ */
+#define UBIFS_TNC_RA_ZNODES 8
+#define UBIFS_TNC_RA_BYTES 8192
+#define UBIFS_LNC_RA_BYTES 8192
+
 /*
  * Lockdep classes for UBIFS inode @ui_mutex.
  */
@@ -335,13 +362,21 @@ struct ubifs_gced_idx_leb {
  * @ui_mutex: serializes inode write-back with the rest of VFS operations,
  *            serializes "clean <-> dirty" state changes, serializes bulk-read,
  *            protects @dirty, @bulk_read, @ui_size, and @xattr_size
- * @ui_lock: protects @synced_i_size
+ * @ui_lock: protects @synced_i_size and the adaptive compression fields
  * @synced_i_size: synchronized size of inode, i.e. the value of inode size
  *                 currently stored on the flash; used only for regular file
  *                 inodes
  * @ui_size: inode size used by UBIFS when writing to flash
  * @flags: inode flags (@UBIFS_COMPR_FL, etc)
  * @compr_type: default compression type used for this inode
+ * @compr_skip: how many more data blocks to write uncompressed (adaptive
+ *              compression)
+ * @compr_backoff: length of the next uncompressed run if compression does not
+ *                 pay off again (adaptive compression)
+ * @compr_sample: data blocks left till the next compressor comparison
+ *                (adaptive compression)
+ * @compr_pick: compressor picked by the last comparison, %0 if none yet
+ *              (adaptive compression)
  * @last_page_read: page number of last page read (for bulk read)
  * @read_in_a_row: number of consecutive pages read in a row (for bulk read)
  * @data_len: length of the data attached to the inode
@@ -392,6 +427,10 @@ struct ubifs_inode {
 	loff_t ui_size;
 	int flags;
 	int compr_type;
+	int compr_skip;
+	int compr_backoff;
+	int compr_sample;
+	int compr_pick;
 	pgoff_t last_page_read;
 	pgoff_t read_in_a_row;
 	int data_len;
@@ -790,24 +829,49 @@ struct ubifs_node_range {
 	int max_len;
 };
 
+/**
+ * struct ubifs_compr_ws - per-CPU compressor workspace.
+ * @cc: cryptoapi compressor handle, which owns the workspace memory
+ * @mutex: serializes users of the workspace
+ */
+struct ubifs_compr_ws {
+	struct crypto_comp *cc;
+	struct mutex mutex;
+};
+
 /**
  * struct ubifs_compressor - UBIFS compressor description structure.
  * @compr_type: compressor type (%UBIFS_COMPR_LZO, etc)
- * @cc: cryptoapi compressor handle
- * @comp_mutex: mutex used during compression
- * @decomp_mutex: mutex used during decompression
+ * @ws: per-CPU workspaces (%NULL if the compressor is not compiled in)
  * @name: compressor name
  * @capi_name: cryptoapi compressor name
  */
 struct ubifs_compressor {
 	int compr_type;
-	struct crypto_comp *cc;
-	struct mutex *comp_mutex;
-	struct mutex *decomp_mutex;
+	struct ubifs_compr_ws *ws;
 	const char *name;
 	const char *capi_name;
 };
 
+/**
+ * struct ubifs_compr_stats - data compression statistics.
+ * @blocks: count of data blocks written, per compression type
+ * @in_bytes: amount of data written, before compression
+ * @out_bytes: amount of data written, after compression
+ * @uncompr: count of data blocks written uncompressed even though compression
+ *           is enabled for the inode
+ * @skipped: how many of @uncompr were not even tried to be compressed
+ * @samples: count of LZO-versus-zlib comparisons
+ */
+struct ubifs_compr_stats {
+	atomic_long_t blocks[UBIFS_COMPR_TYPES_CNT];
+	atomic_long_t in_bytes;
+	atomic_long_t out_bytes;
+	atomic_long_t uncompr;
+	atomic_long_t skipped;
+	atomic_long_t samples;
+};
+
 /**
  * struct ubifs_budget_req - budget requirements of an operation.
  *
@@ -895,11 +959,13 @@ struct ubifs_orphan {
  * @unmount_mode: selected unmount mode (%0 default, %1 normal, %2 fast)
  * @bulk_read: enable bulk-reads
  * @chk_data_crc: check CRCs when reading data nodes
+ * @adaptive_compr: pick compressors per inode and skip incompressible data
  */
 struct ubifs_mount_opts {
 	unsigned int unmount_mode:2;
 	unsigned int bulk_read:2;
 	unsigned int chk_data_crc:2;
+	unsigned int adaptive_compr:2;
 };
 
 /**
@@ -946,6 +1012,7 @@ struct ubifs_mount_opts {
  * @no_chk_data_crc: do not check CRCs when reading data nodes (except during
  *                   recovery)
  * @bulk_read: enable bulk-reads
+ * @adaptive_compr: pick compressors per inode and skip incompressible data
  *
  * @tnc_mutex: protects the Tree Node Cache (TNC), @zroot, @cnext, @enext, and
  *             @calc_idx_sz
@@ -987,6 +1054,8 @@ struct ubifs_mount_opts {
  * @main_first: first LEB of the main area
  * @main_bytes: main area size in bytes
  * @default_compr: default compression algorithm (%UBIFS_COMPR_LZO, etc)
+ * @cstats: data compression statistics
+ * @dfs_dir: debugfs directory of this file-system
  *
  * @key_hash_type: type of the key hash
  * @key_hash: direntry key hash function
@@ -1196,6 +1265,7 @@ struct ubifs_info {
 	unsigned int big_lpt:1;
 	unsigned int no_chk_data_crc:1;
 	unsigned int bulk_read:1;
+	unsigned int adaptive_compr:1;
 
 	struct mutex tnc_mutex;
 	struct ubifs_zbranch zroot;
@@ -1238,6 +1308,10 @@ struct ubifs_info {
 	int main_first;
 	long long main_bytes;
 	int default_compr;
+	struct ubifs_compr_stats cstats;
+#ifdef CONFIG_DEBUG_FS
+	struct dentry *dfs_dir;
+#endif
 
 	uint8_t key_hash_type;
 	uint32_t (*key_hash)(const char *str, int len);
@@ -1413,6 +1487,7 @@ extern struct list_head ubifs_infos;
 extern spinlock_t ubifs_infos_lock;
 extern atomic_long_t ubifs_clean_zn_cnt;
 extern struct kmem_cache *ubifs_inode_slab;
+extern struct workqueue_struct *ubifs_compr_wq;
 extern struct super_operations ubifs_super_operations;
 extern struct address_space_operations ubifs_file_address_operations;
 extern struct file_operations ubifs_file_operations;
@@ -1476,6 +1551,12 @@ int ubifs_consolidate_log(struct ubifs_info *c);
 int ubifs_jnl_update(struct ubifs_info *c, const struct inode *dir,
 		     const struct qstr *nm, const struct inode *inode,
 		     int deletion, int xent);
+int ubifs_prepare_data_node(struct ubifs_info *c,
+			    const struct inode *inode,
+			    const union ubifs_key *key, const void *buf,
+			    int len, struct ubifs_data_node *data);
+int ubifs_jnl_write_data_node(struct ubifs_info *c, const union ubifs_key *key,
+			      struct ubifs_data_node *data, int dlen);
 int ubifs_jnl_write_data(struct ubifs_info *c, const struct inode *inode,
 			 const union ubifs_key *key, const void *buf, int len);
 int ubifs_jnl_write_inode(struct ubifs_info *c, const struct inode *inode);
@@ -1714,11 +1795,25 @@ long ubifs_compat_ioctl(struct file *file, unsigned int cmd, unsigned long arg);
 
 /* compressor.c */
 int __init ubifs_compressors_init(void);
-void __exit ubifs_compressors_exit(void);
+void ubifs_compressors_exit(void);
 void ubifs_compress(const void *in_buf, int in_len, void *out_buf, int *out_len,
 		    int *compr_type);
 int ubifs_decompress(const void *buf, int len, void *out, int *out_len,
 		     int compr_type);
+void ubifs_compress_adaptive(struct ubifs_info *c, struct ubifs_inode *ui,
+			     const void *in_buf, int in_len, void *out_buf,
+			     int *out_len, int *compr_type);
+#ifdef CONFIG_DEBUG_FS
+void __init ubifs_compr_dfs_init(void);
+void ubifs_compr_dfs_exit(void);
+void ubifs_compr_dfs_add(struct ubifs_info *c);
+void ubifs_compr_dfs_remove(struct ubifs_info *c);
+#else
+static inline void ubifs_compr_dfs_init(void) {}
+static inline void ubifs_compr_dfs_exit(void) {}
+static inline void ubifs_compr_dfs_add(struct ubifs_info *c) {}
+static inline void ubifs_compr_dfs_remove(struct ubifs_info *c) {}
+#endif
 
 #include "debug.h"
 #include "misc.h"
@@ -701,6 +701,7 @@ int unionfs_file_release(struct inode *inode, struct file *file)
 		spin_unlock(&inodeinfo->rdlock);
 		fileinfo->rdstate = NULL;
 	}
+	put_rdsnap(fileinfo->rdsnap);
 	kfree(fileinfo);
 
 	unionfs_unlock_dentry(dentry);
@@ -219,68 +219,43 @@ out:
 	return err;
 }
 
-static int __copyup_reg_data(struct dentry *dentry,
-			     struct dentry *new_lower_dentry, int new_bindex,
-			     struct dentry *old_lower_dentry, int old_bindex,
-			     struct file **copyup_file, loff_t len)
+/* Does a block of file data hold nothing but zeroes? */
+static bool is_zero_data(const char *buf, size_t len)
+{
+	const unsigned long *p = (const unsigned long *)buf;
+	size_t i;
+
+	for (i = 0; i < len / sizeof(unsigned long); i++)
+		if (p[i])
+			return false;
+	for (i = i * sizeof(unsigned long); i < len; i++)
+		if (buf[i])
+			return false;
+	return true;
+}
+
+/*
+ * Copy file data by reading it through a bounce buffer.  Used for lower
+ * file systems which do not read through the page cache.
+ */
+static int copyup_data_rw(struct file *input_file, struct file *output_file,
+			  loff_t len)
 {
-	struct super_block *sb = dentry->d_sb;
-	struct file *input_file;
-	struct file *output_file;
-	struct vfsmount *output_mnt;
 	mm_segment_t old_fs;
 	char *buf = NULL;
 	ssize_t read_bytes, write_bytes;
 	loff_t size;
 	int err = 0;
 
-	/* open old file */
-	unionfs_mntget(dentry, old_bindex);
-	branchget(sb, old_bindex);
-	/* dentry_open calls dput and mntput if it returns an error */
-	input_file = dentry_open(old_lower_dentry,
-				 unionfs_lower_mnt_idx(dentry, old_bindex),
-				 O_RDONLY | O_LARGEFILE);
-	if (IS_ERR(input_file)) {
-		dput(old_lower_dentry);
-		err = PTR_ERR(input_file);
-		goto out;
-	}
-	if (unlikely(!input_file->f_op || !input_file->f_op->read)) {
-		err = -EINVAL;
-		goto out_close_in;
-	}
-
-	/* open new file */
-	dget(new_lower_dentry);
-	output_mnt = unionfs_mntget(sb->s_root, new_bindex);
-	branchget(sb, new_bindex);
-	output_file = dentry_open(new_lower_dentry, output_mnt,
-				  O_RDWR | O_LARGEFILE);
-	if (IS_ERR(output_file)) {
-		err = PTR_ERR(output_file);
-		goto out_close_in2;
-	}
-	if (unlikely(!output_file->f_op || !output_file->f_op->write)) {
-		err = -EINVAL;
-		goto out_close_out;
-	}
-
 	/* allocating a buffer */
 	buf = kmalloc(PAGE_SIZE, GFP_KERNEL);
-	if (unlikely(!buf)) {
-		err = -ENOMEM;
-		goto out_close_out;
-	}
-
-	input_file->f_pos = 0;
-	output_file->f_pos = 0;
+	if (unlikely(!buf))
+		return -ENOMEM;
 
 	old_fs = get_fs();
 	set_fs(KERNEL_DS);
 
 	size = len;
-	err = 0;
 	do {
 		if (len >= PAGE_SIZE)
 			size = PAGE_SIZE;
@@ -315,6 +290,164 @@ static int __copyup_reg_data(struct dentry *dentry,
 	set_fs(old_fs);
 
 	kfree(buf);
+	return err;
+}
+
+/*
+ * Copy file data straight out of the lower file's page cache, one page at
+ * a time, into the new file.  This saves the bounce buffer copy, keeps the
+ * lower file's read-ahead going as a sequential read would, and lets us
+ * skip pages of zeroes, so that holes in sparse files stay holes and large
+ * mostly-empty files copy up quickly.  A pending fatal signal aborts the
+ * copy-up, which matters for very large files.
+ */
+static int copyup_data_pages(struct file *input_file,
+			     struct file *output_file, loff_t len)
+{
+	struct address_space *mapping = input_file->f_mapping;
+	struct dentry *output_dentry = output_file->f_path.dentry;
+	struct inode *output_inode = output_dentry->d_inode;
+	pgoff_t index, last_index;
+	mm_segment_t old_fs;
+	loff_t pos = 0;
+	int err = 0;
+
+	/* never copy beyond the end of the file, as the read path would */
+	len = min_t(loff_t, len, i_size_read(mapping->host));
+	if (!len)
+		return 0;
+	last_index = (len - 1) >> PAGE_CACHE_SHIFT;
+
+	old_fs = get_fs();
+	set_fs(KERNEL_DS);
+
+	for (index = 0; index <= last_index; index++) {
+		struct page *page;
+		size_t bytes;
+		ssize_t write_bytes;
+		loff_t write_pos = pos;
+		char *kaddr;
+
+		if (fatal_signal_pending(current)) {
+			err = -EINTR;
+			break;
+		}
+
+		page = find_get_page(mapping, index);
+		if (!page) {
+			page_cache_sync_readahead(mapping, &input_file->f_ra,
+						  input_file, index,
+						  last_index - index + 1);
+		} else {
+			if (PageReadahead(page))
+				page_cache_async_readahead(mapping,
+							   &input_file->f_ra,
+							   input_file, page,
+							   index,
+							   last_index - index
+							   + 1);
+			page_cache_release(page);
+		}
+
+		page = read_mapping_page(mapping, index, input_file);
+		if (IS_ERR(page)) {
+			err = PTR_ERR(page);
+			break;
+		}
+
+		bytes = min_t(loff_t, PAGE_CACHE_SIZE, len - pos);
+		kaddr = kmap(page);
+		if (is_zero_data(kaddr, bytes)) {
+			/* leave a hole */
+			write_bytes = bytes;
+		} else {
+			/* see Documentation/filesystems/unionfs/issues.txt */
+			lockdep_off();
+			write_bytes =
+				output_file->f_op->write(output_file,
+							 (char __user *)kaddr,
+							 bytes, &write_pos);
+			lockdep_on();
+		}
+		kunmap(page);
+		page_cache_release(page);
+
+		if (write_bytes < 0 || write_bytes < bytes) {
+			err = write_bytes < 0 ? write_bytes : -EIO;
+			break;
+		}
+		pos += bytes;
+		cond_resched();
+	}
+
+	set_fs(old_fs);
+
+	/* the file may end in a hole which we skipped */
+	if (!err && i_size_read(output_inode) < len) {
+		struct iattr newattrs;
+
+		newattrs.ia_size = len;
+		newattrs.ia_valid = ATTR_SIZE;
+		mutex_lock(&output_inode->i_mutex);
+		err = notify_change(output_dentry, &newattrs);
+		mutex_unlock(&output_inode->i_mutex);
+	}
+
+	input_file->f_pos = pos;
+	output_file->f_pos = pos;
+	return err;
+}
+
+static int __copyup_reg_data(struct dentry *dentry,
+			     struct dentry *new_lower_dentry, int new_bindex,
+			     struct dentry *old_lower_dentry, int old_bindex,
+			     struct file **copyup_file, loff_t len)
+{
+	struct super_block *sb = dentry->d_sb;
+	struct file *input_file;
+	struct file *output_file;
+	struct vfsmount *output_mnt;
+	int err = 0;
+
+	/* open old file */
+	unionfs_mntget(dentry, old_bindex);
+	branchget(sb, old_bindex);
+	/* dentry_open calls dput and mntput if it returns an error */
+	input_file = dentry_open(old_lower_dentry,
+				 unionfs_lower_mnt_idx(dentry, old_bindex),
+				 O_RDONLY | O_LARGEFILE);
+	if (IS_ERR(input_file)) {
+		dput(old_lower_dentry);
+		err = PTR_ERR(input_file);
+		goto out;
+	}
+	if (unlikely(!input_file->f_op || !input_file->f_op->read)) {
+		err = -EINVAL;
+		goto out_close_in;
+	}
+
+	/* open new file */
+	dget(new_lower_dentry);
+	output_mnt = unionfs_mntget(sb->s_root, new_bindex);
+	branchget(sb, new_bindex);
+	output_file = dentry_open(new_lower_dentry, output_mnt,
+				  O_RDWR | O_LARGEFILE);
+	if (IS_ERR(output_file)) {
+		err = PTR_ERR(output_file);
+		goto out_close_in2;
+	}
+	if (unlikely(!output_file->f_op || !output_file->f_op->write)) {
+		err = -EINVAL;
+		goto out_close_out;
+	}
+
+	input_file->f_pos = 0;
+	output_file->f_pos = 0;
+
+	if (input_file->f_mapping->a_ops->readpage)
+		err = copyup_data_pages(input_file, output_file, len);
+	else
+		err = copyup_data_rw(input_file, output_file, len);
 
 	if (!err)
 		err = output_file->f_op->fsync(output_file,
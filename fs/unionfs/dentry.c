@@ -208,8 +208,14 @@ validate_lowers:
 			valid = false;
 	}
 
-	if (!dentry->d_inode ||
-	    ibstart(dentry->d_inode) < 0 ||
+	/* a cached miss stays valid until a parent lower dir changes */
+	if (!dentry->d_inode) {
+		if (!is_valid_negative(dentry, parent))
+			valid = false;
+		goto out;
+	}
+
+	if (ibstart(dentry->d_inode) < 0 ||
 	    ibend(dentry->d_inode) < 0) {
 		valid = false;
 		goto out;
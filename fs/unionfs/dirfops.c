@@ -27,6 +27,7 @@ static void verify_rdstate_offset(struct unionfs_dir_state *rdstate)
 
 struct unionfs_getdents_callback {
 	struct unionfs_dir_state *rdstate;
+	struct unionfs_dir_snapshot *snap;	/* fill this, not the user */
 	void *dirent;
 	int entries_written;
 	int filldir_called;
@@ -66,8 +67,12 @@ static int unionfs_filldir(void *dirent, const char *oname, int namelen,
 		off_t pos = rdstate2offset(buf->rdstate);
 		u64 unionfs_ino = ino;
 
-		err = buf->filldir(buf->dirent, name, namelen, pos,
-				   unionfs_ino, d_type);
+		if (buf->snap)
+			err = add_rdsnap_entry(buf->snap, name, namelen,
+					       unionfs_ino, d_type);
+		else
+			err = buf->filldir(buf->dirent, name, namelen, pos,
+					   unionfs_ino, d_type);
 		buf->rdstate->offset++;
 		verify_rdstate_offset(buf->rdstate);
 	}
@@ -89,6 +94,117 @@ out:
 	return err;
 }
 
+/*
+ * Read all the lower directories of @file in a single pass and return the
+ * merged listing as a snapshot, which is also cached in the inode unless a
+ * lower directory is being changed.  Returns NULL if the listing is too
+ * big to snapshot or memory is short, in which case the caller falls back
+ * to the incremental readdir.  A listing that is too big is recorded in
+ * the inode, so that it is not tried again until a lower directory
+ * changes.
+ */
+static struct unionfs_dir_snapshot *build_rdsnap(struct file *file)
+{
+	int err = 0;
+	int bindex;
+	loff_t offset;
+	struct inode *inode = file->f_path.dentry->d_inode;
+	struct file *lower_file;
+	struct unionfs_getdents_callback buf;
+	struct unionfs_dir_state *uds;
+	struct unionfs_dir_snapshot *snap;
+
+	snap = alloc_rdsnap(file);
+	if (unlikely(!snap))
+		return NULL;
+	uds = alloc_rdstate(inode, fbstart(file));
+	if (unlikely(!uds)) {
+		put_rdsnap(snap);
+		return NULL;
+	}
+
+	for (bindex = fbstart(file); bindex <= fbend(file); bindex++) {
+		lower_file = unionfs_lower_file_idx(file, bindex);
+		if (!lower_file)
+			continue;
+
+		uds->bindex = bindex;
+		offset = vfs_llseek(lower_file, 0, SEEK_SET);
+		if (offset < 0) {
+			err = offset;
+			goto out;
+		}
+
+		/* Keep reading until the lower directory has no more. */
+		do {
+			buf.filldir_called = 0;
+			buf.filldir_error = 0;
+			buf.entries_written = 0;
+			buf.dirent = NULL;
+			buf.filldir = NULL;
+			buf.rdstate = uds;
+			buf.snap = snap;
+			buf.sb = inode->i_sb;
+
+			err = vfs_readdir(lower_file, unionfs_filldir, &buf);
+			if (err < 0)
+				goto out;
+			if (buf.filldir_error) {
+				err = buf.filldir_error;
+				goto out;
+			}
+		} while (buf.filldir_called);
+
+		/* Copy the atime. */
+		fsstack_copy_attr_atime(inode,
+					lower_file->f_path.dentry->d_inode);
+	}
+
+	/* Save the number of hash entries for next time. */
+	UNIONFS_I(inode)->hashsize = uds->hashentries;
+	install_rdsnap(inode, snap);
+
+out:
+	free_rdstate(uds);
+	if (err == -E2BIG)
+		install_rdsnap_oversize(inode, snap);
+	if (err) {
+		put_rdsnap(snap);
+		snap = NULL;
+	}
+	return snap;
+}
+
+/*
+ * Serve a readdir from a merged listing snapshot.  Returns 1 if there is
+ * no usable snapshot and the incremental readdir has to be used instead.
+ */
+static int readdir_rdsnap(struct file *file, void *dirent, filldir_t filldir)
+{
+	struct unionfs_dir_snapshot *snap = UNIONFS_F(file)->rdsnap;
+
+	if (!snap) {
+		if (UNIONFS_F(file)->rdstate || file->f_pos == DIREOF)
+			return 1;
+		snap = find_rdsnap(file, file->f_pos);
+		if (!snap && file->f_pos == 0)
+			snap = build_rdsnap(file);
+		if (snap && snap->oversize) {
+			put_rdsnap(snap);
+			snap = NULL;
+		}
+		if (!snap)
+			return 1;
+		UNIONFS_F(file)->rdsnap = snap;
+	}
+
+	if (filldir_rdsnap(file, snap, dirent, filldir)) {
+		put_rdsnap(snap);
+		UNIONFS_F(file)->rdsnap = NULL;
+	}
+	return 0;
+}
+
 static int unionfs_readdir(struct file *file, void *dirent, filldir_t filldir)
 {
 	int err = 0;
@@ -111,6 +227,9 @@ static int unionfs_readdir(struct file *file, void *dirent, filldir_t filldir)
 
 	inode = dentry->d_inode;
 
+	if (!readdir_rdsnap(file, dirent, filldir))
+		goto out;
+
 	uds = UNIONFS_F(file)->rdstate;
 	if (!uds) {
 		if (file->f_pos == DIREOF) {
@@ -144,6 +263,7 @@ static int unionfs_readdir(struct file *file, void *dirent, filldir_t filldir)
 		buf.dirent = dirent;
 		buf.filldir = filldir;
 		buf.rdstate = uds;
+		buf.snap = NULL;
 		buf.sb = inode->i_sb;
 
 		/* Read starting from where we last left off. */
@@ -206,6 +326,8 @@ out:
  *	This really has no effect, but returns where you are.
  *  (2) seeking to the beginning of the file
  *	This throws out all state, and lets you begin again.
+ *  (3) seeking to any position within a cached merged listing
+ *	The listing does not change, so positions in it stay meaningful.
  */
 static loff_t unionfs_dir_llseek(struct file *file, loff_t offset, int origin)
 {
@@ -235,7 +357,10 @@ static loff_t unionfs_dir_llseek(struct file *file, loff_t offset, int origin)
 				free_rdstate(rdstate);
 				UNIONFS_F(file)->rdstate = NULL;
 			}
-			init_rdstate(file);
+			put_rdsnap(UNIONFS_F(file)->rdsnap);
+			UNIONFS_F(file)->rdsnap = NULL;
+			/* readdir sets up its state again from position 0 */
+			file->f_pos = 0;
 			err = 0;
 			break;
 		case SEEK_CUR:
@@ -249,7 +374,20 @@ static loff_t unionfs_dir_llseek(struct file *file, loff_t offset, int origin)
 	} else {
 		switch (origin) {
 		case SEEK_SET:
-			if (rdstate) {
+			if (UNIONFS_F(file)->rdsnap) {
+				struct unionfs_dir_snapshot *snap;
+
+				/* Any position within the snapshot is fine. */
+				snap = UNIONFS_F(file)->rdsnap;
+				if ((offset >> RDOFFBITS) == snap->cookie &&
+				    (offset & DIREOF) > 0 &&
+				    (offset & DIREOF) <= snap->nents + 1) {
+					file->f_pos = offset;
+					err = offset;
+				} else {
+					err = -EINVAL;
+				}
+			} else if (rdstate) {
 				if (offset == rdstate2offset(rdstate))
 					err = offset;
 				else if (file->f_pos == DIREOF)
@@ -258,11 +396,19 @@ static loff_t unionfs_dir_llseek(struct file *file, loff_t offset, int origin)
 					err = -EINVAL;
 			} else {
 				struct inode *inode;
+				struct unionfs_dir_snapshot *snap;
 				inode = dentry->d_inode;
 				rdstate = find_rdstate(inode, offset);
 				if (rdstate) {
 					UNIONFS_F(file)->rdstate = rdstate;
 					err = rdstate->offset;
+					break;
+				}
+				snap = find_rdsnap(file, offset);
+				if (snap) {
+					UNIONFS_F(file)->rdsnap = snap;
+					file->f_pos = offset;
+					err = offset;
 				} else {
 					err = -EINVAL;
 				}
@@ -114,6 +114,8 @@ void free_dentry_private_data(struct dentry *dentry)
 		return;
 	kfree(UNIONFS_D(dentry)->lower_paths);
 	UNIONFS_D(dentry)->lower_paths = NULL;
+	kfree(UNIONFS_D(dentry)->neg_stamps);
+	UNIONFS_D(dentry)->neg_stamps = NULL;
 	kmem_cache_free(unionfs_dentry_cachep, dentry->d_fsdata);
 	dentry->d_fsdata = NULL;
 }
@@ -137,6 +139,7 @@ static inline int __realloc_dentry_private_data(struct dentry *dentry)
 	info->bend = -1;
 	info->bopaque = -1;
 	info->bcount = sbmax(dentry->d_sb);
+	info->neg_cached = false;
 	atomic_set(&info->generation,
 			atomic_read(&UNIONFS_SB(dentry->d_sb)->generation));
 
@@ -171,6 +174,7 @@ int new_dentry_private_data(struct dentry *dentry, int subclass)
 	mutex_lock_nested(&info->lock, subclass);
 
 	info->lower_paths = NULL;
+	info->neg_stamps = NULL;
 
 	dentry->d_fsdata = info;
 
@@ -275,6 +279,198 @@ void release_lower_nd(struct nameidata *nd, int err)
 #endif /* ALLOC_LOWER_ND_FILE */
 }
 
+/* Last branch of @parent whose lower directory a lookup has to search. */
+static inline int lower_dirs_end(struct dentry *parent)
+{
+	int bend = dbend(parent);
+
+	if (dbopaque(parent) >= 0 && dbopaque(parent) < bend)
+		bend = dbopaque(parent);
+	return bend;
+}
+
+/*
+ * Record in @dentry each lower directory @parent spans, with its
+ * mtime/ctime; a lookup which missed on all of them stays a miss until
+ * one of them changes.  Returns false if the stamps cannot be kept, or
+ * a directory is changing too fast for its times to tell.
+ */
+static bool set_negative_stamps(struct dentry *dentry, struct dentry *parent)
+{
+	struct unionfs_dentry_info *info = UNIONFS_D(dentry);
+	struct unionfs_neg_stamp *stamps, *stamp;
+	struct dentry *lower_dir_dentry;
+	int bindex, bstart, bend;
+
+	bstart = dbstart(parent);
+	bend = lower_dirs_end(parent);
+	if (bstart < 0 || bend < bstart)
+		return false;
+
+	stamps = krealloc(info->neg_stamps,
+			  (bend - bstart + 1) * sizeof(*stamps), GFP_KERNEL);
+	if (unlikely(!stamps))
+		return false;
+	info->neg_stamps = stamps;
+	info->neg_bstart = bstart;
+	info->neg_bend = bend;
+
+	for (bindex = bstart; bindex <= bend; bindex++) {
+		stamp = &stamps[bindex - bstart];
+		stamp->inode = NULL;
+		lower_dir_dentry = unionfs_lower_dentry_idx(parent, bindex);
+		if (!lower_dir_dentry || !lower_dir_dentry->d_inode)
+			continue;
+		stamp->inode = lower_dir_dentry->d_inode;
+		if (lower_dir_changing(stamp->inode))
+			return false;
+		stamp->mtime = stamp->inode->i_mtime;
+		stamp->ctime = stamp->inode->i_ctime;
+	}
+	return true;
+}
+
+/*
+ * Can a cached negative @dentry still be used?  Yes if nothing was added
+ * to or removed from any of the parent's lower directories since the
+ * lookup, and the lower dentry we kept still lives in the parent's lower
+ * directory.  Both dentries' info nodes must be locked.
+ */
+bool is_valid_negative(struct dentry *dentry, struct dentry *parent)
+{
+	struct unionfs_dentry_info *info = UNIONFS_D(dentry);
+	struct unionfs_neg_stamp *stamp;
+	struct dentry *lower_dentry, *lower_dir_dentry;
+	struct inode *lower_inode;
+	int bindex = dbstart(dentry);
+
+	if (!info->neg_cached || bindex < 0)
+		return false;
+	lower_dentry = unionfs_lower_dentry_idx(dentry, bindex);
+	if (!lower_dentry || lower_dentry->d_inode ||
+	    lower_dentry->d_parent != unionfs_lower_dentry_idx(parent, bindex))
+		return false;
+	if (info->neg_bstart != dbstart(parent) ||
+	    info->neg_bend != lower_dirs_end(parent))
+		return false;
+
+	for (bindex = info->neg_bstart; bindex <= info->neg_bend; bindex++) {
+		stamp = &info->neg_stamps[bindex - info->neg_bstart];
+		lower_dir_dentry = unionfs_lower_dentry_idx(parent, bindex);
+		lower_inode = NULL;
+		if (lower_dir_dentry)
+			lower_inode = lower_dir_dentry->d_inode;
+		if (stamp->inode != lower_inode)
+			return false;
+		if (!lower_inode)
+			continue;
+		if (lower_dir_changing(lower_inode) ||
+		    !timespec_equal(&stamp->mtime, &lower_inode->i_mtime) ||
+		    !timespec_equal(&stamp->ctime, &lower_inode->i_ctime))
+			return false;
+	}
+	return true;
+}
+
+/* Release probe results which unionfs_lookup_full did not use. */
+static void put_probes(struct sioq_args *probes, int bend)
+{
+	struct lookup_probe_args *p;
+	int bindex;
+
+	if (!probes)
+		return;
+	for (bindex = 0; bindex <= bend; bindex++) {
+		p = &probes[bindex].probe;
+		if (!p->lower_dir)
+			continue;
+		dput(p->dentry);
+		if (p->mnt)
+			mntput(p->mnt);
+		put_group_info(p->groups);
+	}
+	kfree(probes);
+}
+
+/*
+ * Look up @name in branches @bstart..@bend of @parent concurrently, for
+ * those branches which unionfs_lookup_full would look in.  The caller
+ * probes the first such branch itself while the others run on other CPUs.
+ * Returns an array of results indexed by branch (holes have a NULL
+ * lower_dir), or NULL if the caller should look up serially.  All probes
+ * have finished on return; free with put_probes().
+ */
+static struct sioq_args *probe_branches(struct dentry *dentry,
+					struct dentry *parent,
+					int bstart, int bend)
+{
+	struct sioq_args *probes;
+	struct lookup_probe_args *p;
+	struct dentry *lower_dir_dentry;
+	int bindex, cpu, first = -1;
+	int nprobes = 0;
+
+	if (num_online_cpus() < 2)
+		return NULL;
+
+	probes = kcalloc(bend + 1, sizeof(struct sioq_args), GFP_KERNEL);
+	if (unlikely(!probes))
+		return NULL;
+
+	for (bindex = bstart; bindex <= bend; bindex++) {
+		if (unionfs_lower_dentry_idx(dentry, bindex))
+			continue;
+		lower_dir_dentry = unionfs_lower_dentry_idx(parent, bindex);
+		if (!lower_dir_dentry || !lower_dir_dentry->d_inode ||
+		    !S_ISDIR(lower_dir_dentry->d_inode->i_mode))
+			continue;
+		p = &probes[bindex].probe;
+		p->lower_dir = lower_dir_dentry;
+		p->lower_dir_mnt = unionfs_lower_mnt_idx(parent, bindex);
+		p->name = dentry->d_name.name;
+		p->task = current;
+		p->fsuid = current->fsuid;
+		p->fsgid = current->fsgid;
+		p->groups = get_group_info(current->group_info);
+		p->cap = current->cap_effective;
+		nprobes++;
+	}
+	if (nprobes < 2)
+		goto out;
+
+	get_online_cpus();
+	cpu = raw_smp_processor_id();
+	for (bindex = bstart; bindex <= bend; bindex++) {
+		if (!probes[bindex].probe.lower_dir)
+			continue;
+		if (first < 0) {
+			first = bindex;
+			continue;
+		}
+		cpu = next_cpu(cpu, cpu_online_map);
+		if (cpu >= nr_cpu_ids)
+			cpu = first_cpu(cpu_online_map);
+		queue_sioq_on(cpu, __unionfs_lookup_probe, &probes[bindex]);
+	}
+	put_online_cpus();
+
+	for (bindex = bstart; bindex <= bend; bindex++) {
+		if (!probes[bindex].probe.lower_dir)
+			continue;
+		if (bindex == first) {
+			init_completion(&probes[bindex].comp);
+			__unionfs_lookup_probe(&probes[bindex].work);
+			continue;
+		}
+		finish_sioq(__unionfs_lookup_probe, &probes[bindex]);
+	}
+	return probes;
+
+out:
+	put_probes(probes, bend);
+	return NULL;
+}
+
 /*
  * Main (and complex) driver function for Unionfs's lookup
  *
@@ -296,8 +492,10 @@ struct dentry *unionfs_lookup_full(struct dentry *dentry,
 	struct dentry *wh_lower_dentry = NULL;
 	struct dentry *lower_dir_dentry = NULL;
 	struct dentry *d_interposed = NULL;
+	struct sioq_args *probes = NULL;
 	int bindex, bstart, bend, bopaque;
-	int opaque, num_positive = 0;
+	int opaque, whiteout, num_positive = 0;
+	int probes_end = -1;
 	const char *name;
 	int namelen;
 	int pos_start, pos_end;
@@ -336,6 +534,14 @@ struct dentry *unionfs_lookup_full(struct dentry *dentry,
 	if ((bopaque >= 0) && (bopaque < bend))
 		bend = bopaque;
 
+	/* on deep enough stacks, probe the branches in parallel first */
+	if (UNIONFS_SB(dentry->d_sb)->parallel_lookup > 0 &&
+	    bend - bstart + 1 >= UNIONFS_SB(dentry->d_sb)->parallel_lookup) {
+		probes = probe_branches(dentry, parent, bstart, bend);
+		if (probes)
+			probes_end = bend;
+	}
+
 	/* lookup all possible dentries */
 	for (bindex = bstart; bindex <= bend; bindex++) {
 
@@ -364,30 +570,46 @@ struct dentry *unionfs_lookup_full(struct dentry *dentry,
 			continue; /* XXX: should be BUG_ON */
 
 		/* check for whiteouts: stop lookup if found */
-		wh_lower_dentry = lookup_whiteout(name, lower_dir_dentry);
-		if (IS_ERR(wh_lower_dentry)) {
-			err = PTR_ERR(wh_lower_dentry);
-			goto out_free;
+		if (probes) {
+			err = probes[bindex].err;
+			if (err)
+				goto out_free;
+			whiteout = probes[bindex].probe.whiteout;
+		} else {
+			wh_lower_dentry = lookup_whiteout(name,
+							  lower_dir_dentry);
+			if (IS_ERR(wh_lower_dentry)) {
+				err = PTR_ERR(wh_lower_dentry);
+				goto out_free;
+			}
+			whiteout = (wh_lower_dentry->d_inode != NULL);
+			dput(wh_lower_dentry);
 		}
-		if (wh_lower_dentry->d_inode) {
+		if (whiteout) {
 			dbend(dentry) = dbopaque(dentry) = bindex;
 			if (dbstart(dentry) < 0)
 				dbstart(dentry) = bindex;
-			dput(wh_lower_dentry);
 			break;
 		}
-		dput(wh_lower_dentry);
 
 		/* Now do regular lookup; lookup @name */
-		lower_dir_mnt = unionfs_lower_mnt_idx(parent, bindex);
-		lower_mnt = NULL; /* XXX: needed? */
-
-		lower_dentry = __lookup_one(lower_dir_dentry, lower_dir_mnt,
-					    name, &lower_mnt);
-
-		if (IS_ERR(lower_dentry)) {
-			err = PTR_ERR(lower_dentry);
-			goto out_free;
+		if (probes) {
+			/* take over the probe's references */
+			lower_dentry = probes[bindex].probe.dentry;
+			lower_mnt = probes[bindex].probe.mnt;
+			probes[bindex].probe.dentry = NULL;
+			probes[bindex].probe.mnt = NULL;
+		} else {
+			lower_dir_mnt = unionfs_lower_mnt_idx(parent, bindex);
+			lower_mnt = NULL; /* XXX: needed? */
+
+			lower_dentry = __lookup_one(lower_dir_dentry,
+						    lower_dir_mnt, name,
+						    &lower_mnt);
+			if (IS_ERR(lower_dentry)) {
+				err = PTR_ERR(lower_dentry);
+				goto out_free;
+			}
 		}
 		unionfs_set_lower_dentry_idx(dentry, bindex, lower_dentry);
 		if (!lower_mnt)
@@ -450,6 +672,15 @@ struct dentry *unionfs_lookup_full(struct dentry *dentry,
 	}
 	if (lookupmode == INTERPOSE_PARTIAL)
 		goto out;
+
+	/*
+	 * Remember what the parent's lower directories looked like, so
+	 * that this miss can be answered from the dcache until one of
+	 * them changes (see is_valid_negative).
+	 */
+	UNIONFS_D(dentry)->neg_cached =
+		(dbstart(dentry) >= 0 && set_negative_stamps(dentry, parent));
+
 	if (lookupmode == INTERPOSE_LOOKUP) {
 		/*
 		 * If all we found was a whiteout in the first available
@@ -457,7 +688,7 @@ struct dentry *unionfs_lookup_full(struct dentry *dentry,
 		 * file to be created.
 		 */
 		if (dbopaque(dentry) < 0)
-			goto out;
+			goto out_negative;
 		/* XXX: need to get mnt here */
 		bindex = dbstart(dentry);
 		if (unionfs_lower_dentry_idx(dentry, bindex))
@@ -480,17 +711,31 @@ struct dentry *unionfs_lookup_full(struct dentry *dentry,
 		lower_mnt = unionfs_mntget(dentry->d_sb->s_root, bindex);
 		unionfs_set_lower_mnt_idx(dentry, bindex, lower_mnt);
 
-		goto out;
+		goto out_negative;
 	}
 
-	/* if we're revalidating a positive dentry, don't make it negative */
-	if (lookupmode != INTERPOSE_REVAL)
+	/*
+	 * If we're revalidating a positive dentry, don't make it negative;
+	 * a cached negative one being revalidated is already hashed.
+	 */
+	if (lookupmode != INTERPOSE_REVAL && d_unhashed(dentry))
 		d_add(dentry, NULL);
 
 	goto out;
 
+out_negative:
+	/*
+	 * A new negative dentry is hashed only if ->d_revalidate will be
+	 * able to tell when it goes stale; otherwise it is looked up again
+	 * next time, as before.
+	 */
+	if (UNIONFS_D(dentry)->neg_cached && is_valid_negative(dentry, parent))
+		d_add(dentry, NULL);
+	goto out;
+
 out_positive:
 	/*** handle POSITIVE dentries ***/
+	UNIONFS_D(dentry)->neg_cached = false;
 
 	/*
 	 * This unionfs dentry is positive (at least one lower inode
@@ -554,6 +799,7 @@ out_free:
 	UNIONFS_D(dentry)->lower_paths = NULL;
 
 out:
+	put_probes(probes, probes_end);
 	if (dentry && UNIONFS_D(dentry)) {
 		BUG_ON(dbstart(dentry) < 0 && dbend(dentry) >= 0);
 		BUG_ON(dbstart(dentry) >= 0 && dbend(dentry) < 0);
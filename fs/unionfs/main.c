@@ -129,7 +129,7 @@ skip:
 	switch (flag) {
 	case INTERPOSE_DEFAULT:
 		/* for operations which create new inodes */
-		d_add(dentry, inode);
+		unionfs_d_add(dentry, inode);
 		break;
 	case INTERPOSE_REVAL_NEG:
 		d_instantiate(dentry, inode);
@@ -264,6 +264,26 @@ int parse_branch_mode(const char *name, int *perms)
 	return -EINVAL;
 }
 
+/*
+ * parse the parallel_lookup= mount/remount argument: the number of
+ * branches a directory must span before lookups in it probe all branches
+ * at once (0 disables).
+ */
+int parse_parallel_lookup_option(struct super_block *sb, char *optarg)
+{
+	unsigned long n;
+	char *end;
+
+	n = simple_strtoul(optarg, &end, 10);
+	if (*end || n > UNIONFS_MAX_BRANCHES) {
+		printk(KERN_ERR "unionfs: invalid parallel_lookup value '%s'\n",
+		       optarg);
+		return -EINVAL;
+	}
+	UNIONFS_SB(sb)->parallel_lookup = n;
+	return 0;
+}
+
 /*
  * parse the dirs= mount argument
  *
@@ -489,6 +509,12 @@ static struct unionfs_dentry_info *unionfs_parse_options(
 				goto out_error;
 			continue;
 		}
+		if (!strcmp("parallel_lookup", optname)) {
+			err = parse_parallel_lookup_option(sb, optarg);
+			if (err)
+				goto out_error;
+			continue;
+		}
 
 		err = -EINVAL;
 		printk(KERN_ERR
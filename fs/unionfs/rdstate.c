@@ -86,6 +86,22 @@ static int guesstimate_hash_size(struct inode *inode)
 	return hashsize;
 }
 
+/* Get a new readdir cookie for this directory inode. */
+static unsigned int next_rdcookie(struct inode *inode)
+{
+	unsigned int cookie;
+
+	spin_lock(&UNIONFS_I(inode)->rdlock);
+	if (UNIONFS_I(inode)->cookie >= (MAXRDCOOKIE - 1))
+		UNIONFS_I(inode)->cookie = 1;
+	else
+		UNIONFS_I(inode)->cookie++;
+
+	cookie = UNIONFS_I(inode)->cookie;
+	spin_unlock(&UNIONFS_I(inode)->rdlock);
+	return cookie;
+}
+
 int init_rdstate(struct file *file)
 {
 	BUG_ON(sizeof(loff_t) !=
@@ -140,14 +156,7 @@ struct unionfs_dir_state *alloc_rdstate(struct inode *inode, int bindex)
 	if (unlikely(!rdstate))
 		return NULL;
 
-	spin_lock(&UNIONFS_I(inode)->rdlock);
-	if (UNIONFS_I(inode)->cookie >= (MAXRDCOOKIE - 1))
-		UNIONFS_I(inode)->cookie = 1;
-	else
-		UNIONFS_I(inode)->cookie++;
-
-	rdstate->cookie = UNIONFS_I(inode)->cookie;
-	spin_unlock(&UNIONFS_I(inode)->rdlock);
+	rdstate->cookie = next_rdcookie(inode);
 	rdstate->offset = 1;
 	rdstate->access = jiffies;
 	rdstate->bindex = bindex;
@@ -283,3 +292,280 @@ int add_filldir_node(struct unionfs_dir_state *rdstate, const char *name,
 out:
 	return err;
 }
+
+/*
+ * Cached merged directory listings.  The entries are packed into
+ * page-sized chunks, in the order readdir returned them.
+ */
+struct rdsnap_chunk {
+	struct list_head list;
+	int nents;		/* entries in this chunk */
+	int used;		/* bytes used in data[] */
+	char data[0];
+};
+
+struct rdsnap_entry {
+	u64 ino;
+	unsigned int d_type;
+	int namelen;
+	char name[0];
+};
+
+#define RDSNAP_CHUNK_DATA (PAGE_SIZE - sizeof(struct rdsnap_chunk))
+#define RDSNAP_ENTRY_SIZE(namelen) \
+	ALIGN(sizeof(struct rdsnap_entry) + (namelen) + 1, sizeof(u64))
+
+/* Turn a position within a snapshot into an offset. */
+static inline off_t rdsnap2offset(struct unionfs_dir_snapshot *snap,
+				  int index)
+{
+	return ((snap->cookie & MAXRDCOOKIE) << RDOFFBITS) |
+		((index + 1) & DIREOF);
+}
+
+/*
+ * Start a snapshot of the merged listing of a directory which is open as
+ * @file, recording what the lower directories look like right now.  The
+ * caller then fills it with add_rdsnap_entry().  If a lower directory is
+ * being changed, the snapshot can still be used for the current readdir,
+ * but it is not cacheable.
+ */
+struct unionfs_dir_snapshot *alloc_rdsnap(struct file *file)
+{
+	struct inode *inode = file->f_path.dentry->d_inode;
+	struct unionfs_dir_snapshot *snap;
+	struct unionfs_rdsnap_lower *lower;
+	struct file *lower_file;
+	int bindex, bstart, bend;
+
+	bstart = fbstart(file);
+	bend = fbend(file);
+	snap = kzalloc(sizeof(struct unionfs_dir_snapshot) +
+		       (bend - bstart + 1) * sizeof(struct unionfs_rdsnap_lower),
+		       GFP_KERNEL);
+	if (unlikely(!snap))
+		return NULL;
+
+	atomic_set(&snap->count, 1);
+	snap->cookie = next_rdcookie(inode);
+	snap->sbgen = atomic_read(&UNIONFS_SB(inode->i_sb)->generation);
+	snap->cacheable = true;
+	INIT_LIST_HEAD(&snap->chunks);
+	snap->bstart = bstart;
+	snap->bend = bend;
+
+	for (bindex = bstart; bindex <= bend; bindex++) {
+		lower_file = unionfs_lower_file_idx(file, bindex);
+		if (!lower_file)
+			continue;
+		lower = &snap->lower[bindex - bstart];
+		lower->inode = lower_file->f_path.dentry->d_inode;
+		lower->mtime = lower->inode->i_mtime;
+		lower->ctime = lower->inode->i_ctime;
+		if (lower_dir_changing(lower->inode))
+			snap->cacheable = false;
+	}
+
+	return snap;
+}
+
+static void free_rdsnap_chunks(struct unionfs_dir_snapshot *snap)
+{
+	struct rdsnap_chunk *chunk, *tmp;
+
+	list_for_each_entry_safe(chunk, tmp, &snap->chunks, list) {
+		list_del(&chunk->list);
+		kfree(chunk);
+	}
+}
+
+void put_rdsnap(struct unionfs_dir_snapshot *snap)
+{
+	if (!snap || !atomic_dec_and_test(&snap->count))
+		return;
+
+	free_rdsnap_chunks(snap);
+	kfree(snap);
+}
+
+/* Append an entry; returns -E2BIG if the listing is too big to cache. */
+int add_rdsnap_entry(struct unionfs_dir_snapshot *snap, const char *name,
+		     int namelen, u64 ino, unsigned int d_type)
+{
+	struct rdsnap_chunk *chunk = NULL;
+	struct rdsnap_entry *ent;
+	int size = RDSNAP_ENTRY_SIZE(namelen);
+
+	if (snap->bytes + size > RDSNAP_MAX_BYTES ||
+	    snap->nents >= DIREOF - 1)
+		return -E2BIG;
+
+	if (!list_empty(&snap->chunks))
+		chunk = list_entry(snap->chunks.prev, struct rdsnap_chunk,
+				   list);
+	if (!chunk || chunk->used + size > RDSNAP_CHUNK_DATA) {
+		chunk = kmalloc(PAGE_SIZE, GFP_KERNEL);
+		if (unlikely(!chunk))
+			return -ENOMEM;
+		chunk->nents = 0;
+		chunk->used = 0;
+		list_add_tail(&chunk->list, &snap->chunks);
+	}
+
+	ent = (struct rdsnap_entry *)(chunk->data + chunk->used);
+	ent->ino = ino;
+	ent->d_type = d_type;
+	ent->namelen = namelen;
+	memcpy(ent->name, name, namelen);
+	ent->name[namelen] = '\0';
+
+	chunk->used += size;
+	chunk->nents++;
+	snap->nents++;
+	snap->bytes += size;
+	return 0;
+}
+
+/* Is the snapshot still what a readdir of @file would return? */
+static bool rdsnap_valid(struct file *file, struct unionfs_dir_snapshot *snap)
+{
+	struct super_block *sb = file->f_path.dentry->d_sb;
+	struct unionfs_rdsnap_lower *lower;
+	struct file *lower_file;
+	struct inode *lower_inode;
+	int bindex;
+
+	if (snap->sbgen != atomic_read(&UNIONFS_SB(sb)->generation) ||
+	    snap->bstart != fbstart(file) || snap->bend != fbend(file))
+		return false;
+
+	for (bindex = snap->bstart; bindex <= snap->bend; bindex++) {
+		lower_file = unionfs_lower_file_idx(file, bindex);
+		lower_inode = NULL;
+		if (lower_file)
+			lower_inode = lower_file->f_path.dentry->d_inode;
+		lower = &snap->lower[bindex - snap->bstart];
+		if (lower->inode != lower_inode)
+			return false;
+		if (!lower_inode)
+			continue;
+		if (!timespec_equal(&lower->mtime, &lower_inode->i_mtime) ||
+		    !timespec_equal(&lower->ctime, &lower_inode->i_ctime))
+			return false;
+	}
+
+	return true;
+}
+
+/*
+ * Get a reference to the cached listing of the directory open as @file,
+ * if there is one and it is still valid.  If @fpos is not zero, it has to
+ * be a position within that listing.  A stale listing is dropped.  The
+ * caller has to check for an oversize snapshot, which has no entries.
+ */
+struct unionfs_dir_snapshot *find_rdsnap(struct file *file, loff_t fpos)
+{
+	struct inode *inode = file->f_path.dentry->d_inode;
+	struct unionfs_inode_info *info = UNIONFS_I(inode);
+	struct unionfs_dir_snapshot *snap, *stale = NULL;
+
+	spin_lock(&info->rdlock);
+	snap = info->rdsnap;
+	if (snap && !rdsnap_valid(file, snap)) {
+		stale = snap;
+		info->rdsnap = NULL;
+		snap = NULL;
+	}
+	if (snap && fpos &&
+	    (snap->oversize || (fpos >> RDOFFBITS) != snap->cookie ||
+	     (fpos & DIREOF) > snap->nents + 1))
+		snap = NULL;
+	if (snap)
+		atomic_inc(&snap->count);
+	spin_unlock(&info->rdlock);
+
+	put_rdsnap(stale);
+	return snap;
+}
+
+/* Make @snap the cached listing of @inode, if it may be cached. */
+void install_rdsnap(struct inode *inode, struct unionfs_dir_snapshot *snap)
+{
+	struct unionfs_inode_info *info = UNIONFS_I(inode);
+	struct unionfs_dir_snapshot *old;
+
+	if (!snap->cacheable)
+		return;
+
+	atomic_inc(&snap->count);
+	spin_lock(&info->rdlock);
+	old = info->rdsnap;
+	info->rdsnap = snap;
+	spin_unlock(&info->rdlock);
+	put_rdsnap(old);
+}
+
+/*
+ * Remember that the listing @snap was being built for is too big to
+ * snapshot.  The entries gathered so far are freed, but the lower stamps
+ * are kept, so the marker goes stale exactly when a full snapshot would.
+ */
+void install_rdsnap_oversize(struct inode *inode,
+			     struct unionfs_dir_snapshot *snap)
+{
+	free_rdsnap_chunks(snap);
+	snap->nents = 0;
+	snap->bytes = 0;
+	snap->oversize = true;
+	install_rdsnap(inode, snap);
+}
+
+void drop_rdsnap(struct inode *inode)
+{
+	struct unionfs_inode_info *info = UNIONFS_I(inode);
+	struct unionfs_dir_snapshot *snap;
+
+	spin_lock(&info->rdlock);
+	snap = info->rdsnap;
+	info->rdsnap = NULL;
+	spin_unlock(&info->rdlock);
+	put_rdsnap(snap);
+}
+
+/*
+ * Return entries of a snapshot starting from the position of @file, in a
+ * single pass and without touching the lower directories.  Returns 1 once
+ * the whole listing has been returned, 0 otherwise.
+ */
+int filldir_rdsnap(struct file *file, struct unionfs_dir_snapshot *snap,
+		   void *dirent, filldir_t filldir)
+{
+	struct rdsnap_chunk *chunk;
+	struct rdsnap_entry *ent;
+	int index = 0, start = 0, used, size;
+
+	if (file->f_pos > 0)
+		start = (file->f_pos & DIREOF) - 1;
+
+	list_for_each_entry(chunk, &snap->chunks, list) {
+		if (index + chunk->nents <= start) {
+			index += chunk->nents;
+			continue;
+		}
+		for (used = 0; used < chunk->used; used += size, index++) {
+			ent = (struct rdsnap_entry *)(chunk->data + used);
+			size = RDSNAP_ENTRY_SIZE(ent->namelen);
+			if (index < start)
+				continue;
+			if (filldir(dirent, ent->name, ent->namelen,
+				    rdsnap2offset(snap, index), ent->ino,
+				    ent->d_type)) {
+				file->f_pos = rdsnap2offset(snap, index);
+				return 0;
+			}
+		}
+	}
+
+	file->f_pos = DIREOF;
+	return 1;
+}
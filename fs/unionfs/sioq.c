@@ -23,22 +23,39 @@
 
 static struct workqueue_struct *superio_workqueue;
 
+/*
+ * Parallel branch lookups get their own queue: a probe can recurse into a
+ * stacked unionfs which then waits in run_sioq, and that must not queue
+ * behind the probe itself.
+ */
+static struct workqueue_struct *lookup_workqueue;
+
 int __init init_sioq(void)
 {
 	int err;
 
 	superio_workqueue = create_workqueue("unionfs_siod");
-	if (!IS_ERR(superio_workqueue))
+	if (IS_ERR(superio_workqueue)) {
+		err = PTR_ERR(superio_workqueue);
+		goto out_err;
+	}
+	lookup_workqueue = create_workqueue("unionfs_lookupd");
+	if (!IS_ERR(lookup_workqueue))
 		return 0;
 
-	err = PTR_ERR(superio_workqueue);
+	err = PTR_ERR(lookup_workqueue);
+	destroy_workqueue(superio_workqueue);
+out_err:
 	printk(KERN_ERR "unionfs: create_workqueue failed %d\n", err);
 	superio_workqueue = NULL;
+	lookup_workqueue = NULL;
 	return err;
 }
 
 void stop_sioq(void)
 {
+	if (lookup_workqueue)
+		destroy_workqueue(lookup_workqueue);
 	if (superio_workqueue)
 		destroy_workqueue(superio_workqueue);
 }
@@ -55,6 +72,29 @@ void run_sioq(work_func_t func, struct sioq_args *args)
 	wait_for_completion(&args->comp);
 }
 
+/*
+ * Start @func on @cpu without waiting for it; finish_sioq() must be called
+ * on @args afterwards.
+ */
+void queue_sioq_on(int cpu, work_func_t func, struct sioq_args *args)
+{
+	INIT_WORK(&args->work, func);
+	init_completion(&args->comp);
+	queue_work_on(cpu, lookup_workqueue, &args->work);
+}
+
+/*
+ * Wait for work started by queue_sioq_on().  If no worker has picked it up
+ * yet, take it back and run it here instead: we never sleep waiting for
+ * work which has not started, so nested probes cannot deadlock.
+ */
+void finish_sioq(work_func_t func, struct sioq_args *args)
+{
+	if (cancel_work_sync(&args->work))
+		func(&args->work);
+	wait_for_completion(&args->comp);
+}
+
 void __unionfs_create(struct work_struct *work)
 {
 	struct sioq_args *args = container_of(work, struct sioq_args, work);
@@ -99,3 +139,68 @@ void __unionfs_unlink(struct work_struct *work)
 	args->err = vfs_unlink(u->parent, u->dentry);
 	complete(&args->comp);
 }
+
+/*
+ * Look up @name, and its whiteout, in one lower directory on behalf of a
+ * parallel unionfs_lookup_full.  A worker takes on the credentials of the
+ * task doing the lookup, so that lower permission checks come out the
+ * same as for a serial lookup.
+ */
+static void lookup_probe(struct sioq_args *args)
+{
+	struct lookup_probe_args *p = &args->probe;
+	struct dentry *wh_dentry;
+
+	wh_dentry = lookup_whiteout(p->name, p->lower_dir);
+	if (IS_ERR(wh_dentry)) {
+		args->err = PTR_ERR(wh_dentry);
+		return;
+	}
+	p->whiteout = (wh_dentry->d_inode != NULL);
+	dput(wh_dentry);
+	if (p->whiteout)
+		return;
+
+	p->mnt = NULL;
+	p->dentry = __lookup_one(p->lower_dir, p->lower_dir_mnt, p->name,
+				 &p->mnt);
+	if (IS_ERR(p->dentry)) {
+		args->err = PTR_ERR(p->dentry);
+		p->dentry = NULL;
+	}
+}
+
+void __unionfs_lookup_probe(struct work_struct *work)
+{
+	struct sioq_args *args = container_of(work, struct sioq_args, work);
+	struct lookup_probe_args *p = &args->probe;
+	struct group_info *old_groups;
+	uid_t old_fsuid;
+	gid_t old_fsgid;
+	kernel_cap_t old_cap;
+
+	/* run by the looking-up task itself */
+	if (current == p->task) {
+		lookup_probe(args);
+		goto out;
+	}
+
+	old_fsuid = current->fsuid;
+	old_fsgid = current->fsgid;
+	old_cap = current->cap_effective;
+	old_groups = get_group_info(current->group_info);
+	args->err = set_current_groups(p->groups);
+	if (!args->err) {
+		current->fsuid = p->fsuid;
+		current->fsgid = p->fsgid;
+		current->cap_effective = p->cap;
+		lookup_probe(args);
+		current->cap_effective = old_cap;
+		current->fsgid = old_fsgid;
+		current->fsuid = old_fsuid;
+		set_current_groups(old_groups);
+	}
+	put_group_info(old_groups);
+out:
+	complete(&args->comp);
+}
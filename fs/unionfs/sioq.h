@@ -56,6 +56,22 @@ struct unlink_args {
 	struct dentry *dentry;
 };
 
+struct lookup_probe_args {
+	struct dentry *lower_dir;
+	struct vfsmount *lower_dir_mnt;
+	const char *name;
+	/* credentials of the task doing the lookup */
+	struct task_struct *task;
+	uid_t fsuid;
+	gid_t fsgid;
+	struct group_info *groups;
+	kernel_cap_t cap;
+	/* results */
+	bool whiteout;
+	struct dentry *dentry;
+	struct vfsmount *mnt;
+};
+
 
 struct sioq_args {
 	struct completion comp;
@@ -71,6 +87,7 @@ struct sioq_args {
 		struct mknod_args mknod;
 		struct symlink_args symlink;
 		struct unlink_args unlink;
+		struct lookup_probe_args probe;
 	};
 };
 
@@ -78,6 +95,8 @@ struct sioq_args {
 extern int __init init_sioq(void);
 extern void stop_sioq(void);
 extern void run_sioq(work_func_t func, struct sioq_args *args);
+extern void queue_sioq_on(int cpu, work_func_t func, struct sioq_args *args);
+extern void finish_sioq(work_func_t func, struct sioq_args *args);
 
 /* Extern definitions for our privilege escalation helpers */
 extern void __unionfs_create(struct work_struct *work);
@@ -87,5 +106,6 @@ extern void __unionfs_symlink(struct work_struct *work);
 extern void __unionfs_unlink(struct work_struct *work);
 extern void __delete_whiteouts(struct work_struct *work);
 extern void __is_opaque_dir(struct work_struct *work);
+extern void __unionfs_lookup_probe(struct work_struct *work);
 
 #endif /* not _SIOQ_H */
@@ -668,6 +668,12 @@ static int unionfs_remount_fs(struct super_block *sb, int *flags,
 				goto out_release;
 			continue;
 		}
+		if (!strcmp("parallel_lookup", optname)) {
+			err = parse_parallel_lookup_option(sb, optarg);
+			if (err)
+				goto out_release;
+			continue;
+		}
 
 		/*
 		 * When you use "mount -o remount,ro", mount(8) will
@@ -860,6 +866,7 @@ static void unionfs_clear_inode(struct inode *inode)
 		list_del(&rdstate->cache);
 		free_rdstate(rdstate);
 	}
+	drop_rdsnap(inode);
 
 	/*
 	 * Decrement a reference to a lower_inode, which was incremented
@@ -1022,6 +1029,9 @@ static int unionfs_show_options(struct seq_file *m, struct vfsmount *mnt)
 		if (bindex != bend)
 			seq_printf(m, ":");
 	}
+	if (UNIONFS_SB(sb)->parallel_lookup)
+		seq_printf(m, ",parallel_lookup=%d",
+			   UNIONFS_SB(sb)->parallel_lookup);
 
 out:
 	free_page((unsigned long) tmp_page);
@@ -81,6 +81,9 @@ extern struct vm_operations_struct unionfs_vm_ops;
 /* How long should an entry be allowed to persist */
 #define RDCACHE_JIFFIES	(5*HZ)
 
+/* Largest merged directory listing we keep cached */
+#define RDSNAP_MAX_BYTES	(256*1024)
+
 /* compatibility with Real-Time patches */
 #ifdef CONFIG_PREEMPT_RT
 # define unionfs_rw_semaphore	compat_rw_semaphore
@@ -95,6 +98,7 @@ struct unionfs_file_info {
 	atomic_t generation;
 
 	struct unionfs_dir_state *rdstate;
+	struct unionfs_dir_snapshot *rdsnap;
 	struct file **lower_files;
 	int *saved_branch_ids; /* IDs of branches when file was opened */
 	struct vm_operations_struct *lower_vm_ops;
@@ -112,6 +116,8 @@ struct unionfs_inode_info {
 	int rdcount;
 	int hashsize;
 	int cookie;
+	/* Cached merged listing, protected by rdlock. */
+	struct unionfs_dir_snapshot *rdsnap;
 
 	/* The lower inodes */
 	struct inode **lower_inodes;
@@ -119,6 +125,13 @@ struct unionfs_inode_info {
 	struct inode vfs_inode;
 };
 
+/* What a parent's lower directory looked like when a lookup missed. */
+struct unionfs_neg_stamp {
+	struct inode *inode;
+	struct timespec mtime;
+	struct timespec ctime;
+};
+
 /* unionfs dentry data in memory */
 struct unionfs_dentry_info {
 	/*
@@ -133,6 +146,15 @@ struct unionfs_dentry_info {
 	int bcount;
 	atomic_t generation;
 	struct path *lower_paths;
+	/*
+	 * A negative dentry is kept hashed only while none of the parent's
+	 * lower directories change: neg_stamps has one entry per parent
+	 * branch from neg_bstart to neg_bend, taken when the lookup missed.
+	 */
+	bool neg_cached;
+	int neg_bstart;
+	int neg_bend;
+	struct unionfs_neg_stamp *neg_stamps;
 };
 
 /* These are the pointers to our various objects. */
@@ -167,6 +189,7 @@ struct unionfs_sb_info {
 	pid_t write_lock_owner;	/* PID of rw_sem owner (write lock) */
 	int high_branch_id;	/* last unique branch ID given */
 	char *dev_name;		/* to identify different unions in pr_debug */
+	int parallel_lookup;	/* min. branches to probe in parallel, or 0 */
 	struct unionfs_data *data;
 };
 
@@ -208,6 +231,36 @@ struct unionfs_dir_state {
 	struct list_head list[0];
 };
 
+/* What a lower directory looked like when a snapshot was taken. */
+struct unionfs_rdsnap_lower {
+	struct inode *inode;
+	struct timespec mtime;
+	struct timespec ctime;
+};
+
+/*
+ * Merged directory listing, with duplicates and whiteouts already filtered
+ * out, so that a readdir which finds a valid one does not have to read and
+ * hash the lower directories again.  A snapshot is never changed once
+ * built; it is dropped when any lower directory changes or the branch
+ * configuration does.  A listing too big to snapshot is remembered the
+ * same way, as an empty snapshot marked oversize, so that it is not built
+ * again until then.
+ */
+struct unionfs_dir_snapshot {
+	atomic_t count;
+	unsigned int cookie;	/* same meaning as in unionfs_dir_state */
+	int sbgen;		/* super-block generation when taken */
+	bool cacheable;		/* no lower directory was changing */
+	bool oversize;		/* listing exceeded RDSNAP_MAX_BYTES */
+	int nents;		/* number of entries */
+	unsigned long bytes;	/* memory used by the entries */
+	struct list_head chunks;
+	int bstart;
+	int bend;
+	struct unionfs_rdsnap_lower lower[0];
+};
+
 /* externs needed for fanout.h or sioq.h */
 extern int unionfs_get_nlinks(const struct inode *inode);
 extern void unionfs_copy_attr_times(struct inode *upper);
@@ -239,6 +292,23 @@ extern struct filldir_node *find_filldir_node(struct unionfs_dir_state *rdstate,
 					      const char *name, int namelen,
 					      int is_whiteout);
 
+/* Cached merged directory listings. */
+extern struct unionfs_dir_snapshot *alloc_rdsnap(struct file *file);
+extern void put_rdsnap(struct unionfs_dir_snapshot *snap);
+extern int add_rdsnap_entry(struct unionfs_dir_snapshot *snap,
+			    const char *name, int namelen, u64 ino,
+			    unsigned int d_type);
+extern struct unionfs_dir_snapshot *find_rdsnap(struct file *file,
+						loff_t fpos);
+extern void install_rdsnap(struct inode *inode,
+			   struct unionfs_dir_snapshot *snap);
+extern void install_rdsnap_oversize(struct inode *inode,
+				    struct unionfs_dir_snapshot *snap);
+extern void drop_rdsnap(struct inode *inode);
+extern int filldir_rdsnap(struct file *file,
+			  struct unionfs_dir_snapshot *snap,
+			  void *dirent, filldir_t filldir);
+
 extern struct dentry **alloc_new_dentries(int objs);
 extern struct unionfs_data *alloc_new_data(int objs);
 
@@ -366,6 +436,11 @@ extern int unionfs_partial_lookup(struct dentry *dentry,
 extern struct dentry *unionfs_lookup_full(struct dentry *dentry,
 					  struct dentry *parent,
 					  int lookupmode);
+extern struct dentry *__lookup_one(struct dentry *base,
+				   struct vfsmount *mnt, const char *name,
+				   struct vfsmount **new_mnt);
+extern bool is_valid_negative(struct dentry *dentry, struct dentry *parent);
+extern int parse_parallel_lookup_option(struct super_block *sb, char *optarg);
 
 /* copies a file from dbstart to newbindex branch */
 extern int copyup_file(struct inode *dir, struct file *file, int bstart,
@@ -465,6 +540,27 @@ static inline int d_deleted(struct dentry *d)
 	return d_unhashed(d) && (d != d->d_sb->s_root);
 }
 
+/* A lower directory changed so recently that a later change may not show. */
+static inline bool lower_dir_changing(struct inode *lower_inode)
+{
+	struct timespec now = current_fs_time(lower_inode->i_sb);
+
+	return (lower_inode->i_mtime.tv_sec + 1 >= now.tv_sec ||
+		lower_inode->i_ctime.tv_sec + 1 >= now.tv_sec);
+}
+
+/*
+ * Instantiate a new object's @dentry.  It may be a cached negative dentry
+ * which is already hashed, and must not be hashed twice.
+ */
+static inline void unionfs_d_add(struct dentry *dentry, struct inode *inode)
+{
+	if (d_unhashed(dentry))
+		d_add(dentry, inode);
+	else
+		d_instantiate(dentry, inode);
+}
+
 /* unionfs_permission, check if we should bypass error to facilitate copyup */
 #define IS_COPYUP_ERR(err) ((err) == -EROFS)
 
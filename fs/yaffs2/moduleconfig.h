@@ -42,6 +42,10 @@
 /* Meaning: Cache short names, taking more RAM, but faster look-ups */
 #define CONFIG_YAFFS_SHORT_NAMES_IN_RAM
 
+/* Default: Selected */
+/* Meaning: Allocate tnodes from a slab cache that can be shrunk */
+#define CONFIG_YAFFS_TNODE_SLAB
+
 /* Default: 10 */
 /* Meaning: set the count of blocks to reserve for checkpointing */
 #define CONFIG_YAFFS_CHECKPOINT_RESERVED_BLOCKS 10
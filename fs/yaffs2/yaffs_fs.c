@@ -51,6 +51,8 @@ extern const char *yaffs_guts_c_version;
 #include <linux/interrupt.h>
 #include <linux/string.h>
 #include <linux/ctype.h>
+#include <linux/kthread.h>
+#include <linux/freezer.h>
 
 #include "asm/div64.h"
 
@@ -104,16 +106,29 @@ extern const char *yaffs_guts_c_version;
 unsigned int yaffs_traceMask = YAFFS_TRACE_BAD_BLOCKS;
 unsigned int yaffs_wr_attempts = YAFFS_WR_ATTEMPTS;
 unsigned int yaffs_auto_checkpoint = 1;
+/* Blocks written before write_super refreshes the checkpoint, 0 for never */
+unsigned int yaffs_checkpoint_refresh = 64;
+/* Background GC: 0 off, 1 mostly dirty blocks only, 2 also any dirty block
+ * when erased blocks run low.
+ */
+unsigned int yaffs_bg_gc = 1;
+unsigned int yaffs_bg_gc_interval = 50;	/* ms between blocks while busy */
 
 /* Module Parameters */
 #if (LINUX_VERSION_CODE > KERNEL_VERSION(2,5,0))
 module_param(yaffs_traceMask,uint,0644);
 module_param(yaffs_wr_attempts,uint,0644);
 module_param(yaffs_auto_checkpoint,uint,0644);
+module_param(yaffs_checkpoint_refresh,uint,0644);
+module_param(yaffs_bg_gc,uint,0644);
+module_param(yaffs_bg_gc_interval,uint,0644);
 #else
 MODULE_PARM(yaffs_traceMask,"i");
 MODULE_PARM(yaffs_wr_attempts,"i");
 MODULE_PARM(yaffs_auto_checkpoint,"i");
+MODULE_PARM(yaffs_checkpoint_refresh,"i");
+MODULE_PARM(yaffs_bg_gc,"i");
+MODULE_PARM(yaffs_bg_gc_interval,"i");
 #endif
 
 #if (LINUX_VERSION_CODE < KERNEL_VERSION(2,6,25))
@@ -212,7 +227,14 @@ static void yaffs_put_inode(struct inode *inode);
 static void yaffs_delete_inode(struct inode *);
 static void yaffs_clear_inode(struct inode *);
 
+/* Most pages yaffs_readpages() reads with one multi-chunk read */
+#define YAFFS_READAHEAD_PAGES	8
+
 static int yaffs_readpage(struct file *file, struct page *page);
+#if (LINUX_VERSION_CODE > KERNEL_VERSION(2,6,0))
+static int yaffs_readpages(struct file *file, struct address_space *mapping,
+			   struct list_head *pages, unsigned nr_pages);
+#endif
 #if (LINUX_VERSION_CODE > KERNEL_VERSION(2,5,0))
 static int yaffs_writepage(struct page *page, struct writeback_control *wbc);
 #else
@@ -233,6 +255,9 @@ static int yaffs_follow_link(struct dentry *dentry, struct nameidata *nd);
 
 static struct address_space_operations yaffs_file_address_operations = {
 	.readpage = yaffs_readpage,
+#if (LINUX_VERSION_CODE > KERNEL_VERSION(2,6,0))
+	.readpages = yaffs_readpages,
+#endif
 	.writepage = yaffs_writepage,
 	.prepare_write = yaffs_prepare_write,
 	.commit_write = yaffs_commit_write,
@@ -337,6 +362,66 @@ static void yaffs_GrossUnlock(yaffs_Device * dev)
 
 }
 
+/* Background garbage collection.
+ * Runs one block at a time, and only starts while nobody else holds the
+ * device, so that writers find erased blocks waiting rather than having to
+ * collect them themselves. A writer that arrives during a collection waits
+ * for that block. Backs off to ten times the interval when there is
+ * nothing worth collecting.
+ */
+static int yaffs_bg_gc_thread(void *data)
+{
+	yaffs_Device *dev = (yaffs_Device *)data;
+	unsigned interval;
+	int collected;
+
+	set_freezable();
+
+	while (!kthread_should_stop()) {
+		collected = 0;
+		dev->backgroundGC = (yaffs_bg_gc > 0);
+
+		if (yaffs_bg_gc && !down_trylock(&dev->grossLock)) {
+			collected = yaffs_BackgroundGarbageCollect(dev, yaffs_bg_gc);
+			yaffs_GrossUnlock(dev);
+		}
+
+		try_to_freeze();
+
+		interval = yaffs_bg_gc_interval ? yaffs_bg_gc_interval : 1;
+		if (!collected)
+			interval *= 10;
+		schedule_timeout_interruptible(msecs_to_jiffies(interval));
+	}
+
+	dev->backgroundGC = 0;
+	return 0;
+}
+
+static void yaffs_start_bg_gc(yaffs_Device *dev)
+{
+	struct task_struct *tsk;
+
+	if (dev->bgGCThread)
+		return;
+
+	tsk = kthread_run(yaffs_bg_gc_thread, dev, "yaffs-gc/%s", dev->name);
+	if (IS_ERR(tsk)) {
+		T(YAFFS_TRACE_ALWAYS,
+		  ("yaffs: could not start background GC for %s\n", dev->name));
+		return;
+	}
+	dev->bgGCThread = tsk;
+}
+
+static void yaffs_stop_bg_gc(yaffs_Device *dev)
+{
+	if (dev->bgGCThread) {
+		kthread_stop(dev->bgGCThread);
+		dev->bgGCThread = NULL;
+	}
+}
+
 static int yaffs_readlink(struct dentry *dentry, char __user * buffer,
 			  int buflen)
 {
@@ -625,6 +710,85 @@ static int yaffs_readpage(struct file *f, struct page *pg)
 	return yaffs_readpage_unlock(f, pg);
 }
 
+#if (LINUX_VERSION_CODE > KERNEL_VERSION(2,6,0))
+/* Fill a run of locked, consecutive pages with one multi-chunk read through
+ * the device's read-ahead buffer, then release them.
+ */
+static void yaffs_readpage_run(yaffs_Object *obj, struct page **pages, int n)
+{
+	yaffs_Device *dev = obj->myDev;
+	int chunksPerPage = PAGE_CACHE_SIZE / dev->nDataBytesPerChunk;
+	int i;
+
+	T(YAFFS_TRACE_OS, (KERN_DEBUG "yaffs_readpage_run at %08x, %d pages\n",
+			   (unsigned)(pages[0]->index << PAGE_CACHE_SHIFT), n));
+
+	yaffs_GrossLock(dev);
+
+	yaffs_ReadFileChunks(obj, pages[0]->index * chunksPerPage + 1,
+			     n * chunksPerPage, dev->readAheadBuffer);
+
+	for (i = 0; i < n; i++) {
+		memcpy(kmap(pages[i]), dev->readAheadBuffer + i * PAGE_CACHE_SIZE,
+		       PAGE_CACHE_SIZE);
+		flush_dcache_page(pages[i]);
+		kunmap(pages[i]);
+	}
+
+	yaffs_GrossUnlock(dev);
+
+	for (i = 0; i < n; i++) {
+		SetPageUptodate(pages[i]);
+		ClearPageError(pages[i]);
+		unlock_page(pages[i]);
+		page_cache_release(pages[i]);
+	}
+}
+
+/* Read-ahead. The VM hands us the pages in a list, lowest index last.
+ * Consecutive pages are batched up to YAFFS_READAHEAD_PAGES at a time so
+ * that the chunks behind them can be read in large runs.
+ */
+static int yaffs_readpages(struct file *f, struct address_space *mapping,
+			   struct list_head *pages, unsigned nr_pages)
+{
+	yaffs_Object *obj = yaffs_DentryToObject(f->f_dentry);
+	yaffs_Device *dev = obj->myDev;
+	struct page *run[YAFFS_READAHEAD_PAGES];
+	struct page *page;
+	int n = 0;
+
+	while (!list_empty(pages)) {
+		page = list_entry(pages->prev, struct page, lru);
+		list_del(&page->lru);
+
+		if (add_to_page_cache_lru(page, mapping, page->index,
+					  GFP_KERNEL)) {
+			page_cache_release(page);
+			continue;
+		}
+
+		if (!dev->readAheadBuffer) {
+			yaffs_readpage_unlock(f, page);
+			page_cache_release(page);
+			continue;
+		}
+
+		if (n && (n == YAFFS_READAHEAD_PAGES ||
+			  page->index != run[n - 1]->index + 1)) {
+			yaffs_readpage_run(obj, run, n);
+			n = 0;
+		}
+		run[n++] = page;
+	}
+
+	if (n)
+		yaffs_readpage_run(obj, run, n);
+
+	return 0;
+}
+#endif
+
 /* writepage inspired by/stolen from smbfs */
 
 #if (LINUX_VERSION_CODE > KERNEL_VERSION(2,5,0))
@@ -1474,9 +1638,16 @@ static void yaffs_write_super(struct super_block *sb)
 static int yaffs_write_super(struct super_block *sb)
 #endif
 {
+	yaffs_Device *dev = yaffs_SuperToDevice(sb);
 
 	T(YAFFS_TRACE_OS, (KERN_DEBUG "yaffs_write_super\n"));
-	if (yaffs_auto_checkpoint >= 2)
+	/* Besides checkpointing on every write_super at level 2, refresh the
+	 * checkpoint at level 1 once enough has been written since the last
+	 * one. That bounds what a mount after a power cut has to replay.
+	 */
+	if (yaffs_auto_checkpoint >= 2 ||
+	    (yaffs_auto_checkpoint >= 1 && yaffs_checkpoint_refresh &&
+	     yaffs_CheckpointRefreshDue(dev, yaffs_checkpoint_refresh)))
 		yaffs_do_sync_fs(sb);
 #if (LINUX_VERSION_CODE < KERNEL_VERSION(2,6,18))
 	return 0; 
@@ -1573,6 +1744,8 @@ static int yaffs_remount_fs(struct super_block *sb, int *flags, char *data)
 		T(YAFFS_TRACE_OS,
 			(KERN_DEBUG "yaffs_remount_fs: %s: RO\n", dev->name ));
 
+		yaffs_stop_bg_gc(dev);
+
 		yaffs_GrossLock(dev);
 
 		yaffs_FlushEntireDeviceCache(dev);
@@ -1587,6 +1760,8 @@ static int yaffs_remount_fs(struct super_block *sb, int *flags, char *data)
 	else {
 		T(YAFFS_TRACE_OS,
 			(KERN_DEBUG "yaffs_remount_fs: %s: RW\n", dev->name ));
+
+		yaffs_start_bg_gc(dev);
 	}
 
 	return 0;
@@ -1599,6 +1774,8 @@ static void yaffs_put_super(struct super_block *sb)
 
 	T(YAFFS_TRACE_OS, (KERN_DEBUG "yaffs_put_super\n"));
 
+	yaffs_stop_bg_gc(dev);
+
 	yaffs_GrossLock(dev);
 
 	yaffs_FlushEntireDeviceCache(dev);
@@ -1621,6 +1798,11 @@ static void yaffs_put_super(struct super_block *sb)
 		dev->spareBuffer = NULL;
 	}
 
+	if(dev->readAheadBuffer){
+		kfree(dev->readAheadBuffer);
+		dev->readAheadBuffer = NULL;
+	}
+
 	kfree(dev);
 }
 
@@ -1652,6 +1834,7 @@ typedef struct {
 	int skip_checkpoint_read;
 	int skip_checkpoint_write;
 	int no_cache;
+	int n_caches;
 } yaffs_options;
 
 #define MAX_OPT_LEN 20
@@ -1679,6 +1862,16 @@ static int yaffs_parse_options(yaffs_options *options, const char *options_str)
 			options->inband_tags = 1;
 		else if(!strcmp(cur_opt,"no-cache"))
 			options->no_cache = 1;
+		else if(!strncmp(cur_opt,"cache=",6)){
+			char *end;
+
+			options->n_caches = simple_strtoul(cur_opt + 6, &end, 0);
+			if(*end || options->n_caches > YAFFS_MAX_SHORT_OP_CACHES){
+				printk(KERN_INFO "yaffs: cache must be 0..%d\n",
+				       YAFFS_MAX_SHORT_OP_CACHES);
+				error = 1;
+			}
+		}
 		else if(!strcmp(cur_opt,"no-checkpoint-read"))
 			options->skip_checkpoint_read = 1;
 		else if(!strcmp(cur_opt,"no-checkpoint-write"))
@@ -1707,6 +1900,7 @@ static struct super_block *yaffs_internal_read_super(int yaffsVersion,
 	char devname_buf[BDEVNAME_SIZE + 1];
 	struct mtd_info *mtd;
 	int err;
+	unsigned long mountStart;
 	char *data_str = (char *)data;
 
 	yaffs_options options;
@@ -1732,6 +1926,7 @@ static struct super_block *yaffs_internal_read_super(int yaffsVersion,
 	printk(KERN_INFO "yaffs: passed flags \"%s\"\n",data_str);
 
 	memset(&options,0,sizeof(options));
+	options.n_caches = YAFFS_DEFAULT_SHORT_OP_CACHES;
 
 	if(yaffs_parse_options(&options,data_str)){
 		/* Option parsing failed */
@@ -1888,7 +2083,7 @@ static struct super_block *yaffs_internal_read_super(int yaffsVersion,
 	dev->nChunksPerBlock = YAFFS_CHUNKS_PER_BLOCK;
 	dev->totalBytesPerChunk = YAFFS_BYTES_PER_CHUNK;
 	dev->nReservedBlocks = 5;
-	dev->nShortOpCaches = (options.no_cache) ? 0 : 10;
+	dev->nShortOpCaches = (options.no_cache) ? 0 : options.n_caches;
 	dev->inbandTags = options.inband_tags;
 
 	/* ... and the functions. */
@@ -1897,6 +2092,7 @@ static struct super_block *yaffs_internal_read_super(int yaffsVersion,
 		    nandmtd2_WriteChunkWithTagsToNAND;
 		dev->readChunkWithTagsFromNAND =
 		    nandmtd2_ReadChunkWithTagsFromNAND;
+		dev->readChunksFromNAND = nandmtd2_ReadChunksFromNAND;
 		dev->markNANDBlockBad = nandmtd2_MarkNANDBlockBad;
 		dev->queryNANDBlock = nandmtd2_QueryNANDBlock;
 		dev->spareBuffer = YMALLOC(mtd->oobsize);
@@ -1948,6 +2144,10 @@ static struct super_block *yaffs_internal_read_super(int yaffsVersion,
 	dev->skipCheckpointRead = options.skip_checkpoint_read;
 	dev->skipCheckpointWrite = options.skip_checkpoint_write;
 
+#ifdef CONFIG_YAFFS_TNODE_SLAB
+	sprintf(dev->tnodeCacheName, "yaffs_tnode_mtd%d", mtd->index);
+#endif
+
 	/* we assume this is protected by lock_kernel() in mount/umount */
 	ylist_add_tail(&dev->devList, &yaffs_dev_list);
 
@@ -1955,7 +2155,9 @@ static struct super_block *yaffs_internal_read_super(int yaffsVersion,
 
 	yaffs_GrossLock(dev);
 
+	mountStart = jiffies;
 	err = yaffs_GutsInitialise(dev);
+	dev->mountTime = jiffies_to_msecs(jiffies - mountStart);
 
 	T(YAFFS_TRACE_OS,
 	  ("yaffs_read_super: guts initialised %s\n",
@@ -1987,6 +2189,18 @@ static struct super_block *yaffs_internal_read_super(int yaffsVersion,
 	}
 	sb->s_root = root;
 	sb->s_dirt = !dev->isCheckpointed;
+
+	/* Multi-chunk reads need whole chunks to tile a page. Without the
+	 * buffer yaffs_readpages() just reads a page at a time.
+	 */
+	if (!dev->inbandTags &&
+	    dev->nDataBytesPerChunk <= PAGE_CACHE_SIZE &&
+	    !(PAGE_CACHE_SIZE % dev->nDataBytesPerChunk))
+		dev->readAheadBuffer =
+		    kmalloc(YAFFS_READAHEAD_PAGES * PAGE_CACHE_SIZE, GFP_KERNEL);
+
+	if (!(sb->s_flags & MS_RDONLY))
+		yaffs_start_bg_gc(dev);
 	T(YAFFS_TRACE_ALWAYS,
 	  ("yaffs_read_super: isCheckpointed %d\n", dev->isCheckpointed));
 
@@ -2091,6 +2305,21 @@ static DECLARE_FSTYPE(yaffs2_fs_type, "yaffs2", yaffs2_read_super,
 
 static struct proc_dir_entry *my_proc_entry;
 
+static char *yaffs_dump_gc_latency(char *buf, const char *label,
+				   const __u32 *histogram, __u32 worst)
+{
+	int i;
+
+	buf += sprintf(buf, "%s <1:%u", label, histogram[0]);
+	for (i = 1; i < YAFFS_GC_LATENCY_BUCKETS - 1; i++)
+		buf += sprintf(buf, " <%d:%u", 1 << i, histogram[i]);
+	buf += sprintf(buf, " >=%d:%u max %u.%03u\n",
+		       1 << (YAFFS_GC_LATENCY_BUCKETS - 2), histogram[i],
+		       worst / 1000, worst % 1000);
+
+	return buf;
+}
+
 static char *yaffs_dump_dev(char *buf, yaffs_Device * dev)
 {
 	buf += sprintf(buf, "startBlock......... %d\n", dev->startBlock);
@@ -2114,6 +2343,12 @@ static char *yaffs_dump_dev(char *buf, yaffs_Device * dev)
 	buf += sprintf(buf, "garbageCollections. %d\n", dev->garbageCollections);
 	buf += sprintf(buf, "passiveGCs......... %d\n",
 		    dev->passiveGarbageCollections);
+	buf += sprintf(buf, "backgroundGCs...... %d\n",
+		    dev->backgroundGarbageCollections);
+	buf = yaffs_dump_gc_latency(buf, "fgGCLatency(ms)", dev->fgGCLatency,
+				    dev->fgGCLatencyMax);
+	buf = yaffs_dump_gc_latency(buf, "bgGCLatency(ms)", dev->bgGCLatency,
+				    dev->bgGCLatencyMax);
 	buf += sprintf(buf, "nRetriedWrites..... %d\n", dev->nRetriedWrites);
 	buf += sprintf(buf, "nShortOpCaches..... %d\n", dev->nShortOpCaches);
 	buf += sprintf(buf, "nRetireBlocks...... %d\n", dev->nRetiredBlocks);
@@ -2122,6 +2357,7 @@ static char *yaffs_dump_dev(char *buf, yaffs_Device * dev)
 	buf += sprintf(buf, "tagsEccFixed....... %d\n", dev->tagsEccFixed);
 	buf += sprintf(buf, "tagsEccUnfixed..... %d\n", dev->tagsEccUnfixed);
 	buf += sprintf(buf, "cacheHits.......... %d\n", dev->cacheHits);
+	buf += sprintf(buf, "dirtyCaches........ %d\n", dev->srDirtyCaches);
 	buf += sprintf(buf, "nDeletedFiles...... %d\n", dev->nDeletedFiles);
 	buf += sprintf(buf, "nUnlinkedFiles..... %d\n", dev->nUnlinkedFiles);
 	buf +=
@@ -2129,6 +2365,14 @@ static char *yaffs_dump_dev(char *buf, yaffs_Device * dev)
 	buf += sprintf(buf, "useNANDECC......... %d\n", dev->useNANDECC);
 	buf += sprintf(buf, "isYaffs2........... %d\n", dev->isYaffs2);
 	buf += sprintf(buf, "inbandTags......... %d\n", dev->inbandTags);
+	buf += sprintf(buf, "mountMode.......... %s\n",
+		       dev->mountMode == YAFFS_MOUNT_REPLAY ? "checkpoint+replay" :
+		       dev->mountMode == YAFFS_MOUNT_CHECKPOINT ? "checkpoint" :
+		       "scan");
+	buf += sprintf(buf, "mountTime.......... %d ms\n", dev->mountTime);
+	buf += sprintf(buf, "mountBlocksChecked. %d\n", dev->mountBlocksChecked);
+	buf += sprintf(buf, "mountBlocksReplayed %d\n", dev->mountBlocksReplayed);
+	buf += sprintf(buf, "mountChunksReplayed %d\n", dev->mountChunksReplayed);
 
 	return buf;
 }
@@ -2324,6 +2568,45 @@ static struct file_system_to_install fs_to_install[] = {
 	{NULL, 0}
 };
 
+#if defined(CONFIG_YAFFS_TNODE_SLAB) && \
+    (LINUX_VERSION_CODE > KERNEL_VERSION(2,6,22))
+/* Memory shrinker: ask each idle device to give free tnode memory back.
+ * The count reported is the number of tnodes freed since the last shrink.
+ */
+static int yaffs_shrink_tnodes(int nr_to_scan, gfp_t gfp_mask)
+{
+	struct ylist_head *item;
+	yaffs_Device *dev;
+	int nFreed = 0;
+
+	if (nr_to_scan && !(gfp_mask & __GFP_FS))
+		return -1;
+
+	/* hold lock_kernel while traversing yaffs_dev_list */
+	lock_kernel();
+
+	ylist_for_each(item, &yaffs_dev_list) {
+		dev = ylist_entry(item, yaffs_Device, devList);
+
+		if (nr_to_scan && !down_trylock(&dev->grossLock)) {
+			yaffs_ShrinkTnodePool(dev);
+			yaffs_GrossUnlock(dev);
+		}
+		nFreed += dev->nTnodesFreed;
+	}
+
+	unlock_kernel();
+
+	return nFreed;
+}
+
+static struct shrinker yaffs_tnode_shrinker = {
+	.shrink = yaffs_shrink_tnodes,
+	.seeks = DEFAULT_SEEKS,
+};
+#define YAFFS_TNODE_SHRINKER
+#endif
+
 static int __init init_yaffs_fs(void)
 {
 	int error = 0;
@@ -2370,6 +2653,11 @@ static int __init init_yaffs_fs(void)
 		}
 	}
 
+#ifdef YAFFS_TNODE_SHRINKER
+	if (!error)
+		register_shrinker(&yaffs_tnode_shrinker);
+#endif
+
 	return error;
 }
 
@@ -2381,6 +2669,10 @@ static void __exit exit_yaffs_fs(void)
 	T(YAFFS_TRACE_ALWAYS, ("yaffs " __DATE__ " " __TIME__
 			       " removing. \n"));
 
+#ifdef YAFFS_TNODE_SHRINKER
+	unregister_shrinker(&yaffs_tnode_shrinker);
+#endif
+
 	remove_proc_entry("yaffs", YPROC_ROOT);
 
 	fsinst = fs_to_install;
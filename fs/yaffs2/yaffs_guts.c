@@ -32,6 +32,10 @@ const char *yaffs_guts_c_version =
 #include "yaffs_nand.h"
 #include "yaffs_packedtags2.h"
 
+#ifndef Y_CURRENT_TIME_US
+/* No fine grained clock here, GC latencies all land in the first bucket */
+#define Y_CURRENT_TIME_US() 0
+#endif
 
 #ifdef CONFIG_YAFFS_WINCE
 void yfsd_LockYAFFS(BOOL fsLockOnly);
@@ -94,6 +98,7 @@ loff_t yaffs_GetFileSize(yaffs_Object * obj);
 static int yaffs_AllocateChunk(yaffs_Device * dev, int useReserve, yaffs_BlockInfo **blockUsedPtr);
 
 static void yaffs_VerifyFreeChunks(yaffs_Device * dev);
+static int yaffs_CountFreeChunks(yaffs_Device * dev);
 
 static void yaffs_CheckObjectDetailsLoaded(yaffs_Object *in);
 
@@ -1262,6 +1267,16 @@ static yaffs_Tnode *yaffs_GetTnodeRaw(yaffs_Device * dev)
 {
 	yaffs_Tnode *tn = NULL;
 
+#ifdef CONFIG_YAFFS_TNODE_SLAB
+	if (dev->tnodeCache) {
+		tn = YCACHE_ALLOC(dev->tnodeCache);
+		if (tn)
+			dev->nTnodesCreated++;
+		dev->nCheckpointBlocksRequired = 0; /* force recalculation*/
+		return tn;
+	}
+#endif
+
 	/* If there are none left make more */
 	if (!dev->freeTnodes) {
 		yaffs_CreateTnodes(dev, YAFFS_ALLOCATION_NTNODES);
@@ -1302,6 +1317,15 @@ static yaffs_Tnode *yaffs_GetTnode(yaffs_Device * dev)
 /* FreeTnode frees up a tnode and puts it back on the free list */
 static void yaffs_FreeTnode(yaffs_Device * dev, yaffs_Tnode * tn)
 {
+#ifdef CONFIG_YAFFS_TNODE_SLAB
+	if (tn && dev->tnodeCache) {
+		YCACHE_FREE(dev->tnodeCache, tn);
+		dev->nTnodesCreated--;
+		dev->nTnodesFreed++;
+		dev->nCheckpointBlocksRequired = 0; /* force recalculation*/
+		return;
+	}
+#endif
 	if (tn) {
 #ifdef CONFIG_YAFFS_TNODE_LIST_DEBUG
 		if (tn->internal[YAFFS_NTNODES_INTERNAL] != 0) {
@@ -1319,11 +1343,86 @@ static void yaffs_FreeTnode(yaffs_Device * dev, yaffs_Tnode * tn)
 	
 }
 
+#ifdef CONFIG_YAFFS_TNODE_SLAB
+static void yaffs_FreeTnodeTree(yaffs_Device * dev, yaffs_Tnode * tn,
+				int level)
+{
+	int i;
+
+	if (!tn)
+		return;
+
+	if (level > 0) {
+		for (i = 0; i < YAFFS_NTNODES_INTERNAL; i++)
+			yaffs_FreeTnodeTree(dev, tn->internal[i], level - 1);
+	}
+
+	yaffs_FreeTnode(dev, tn);
+}
+
+/* Pooled tnodes are not freed in bulk with their batch, so walk every file
+ * and give its tree back before the pool goes away.
+ */
+static void yaffs_FreeAllTnodes(yaffs_Device * dev)
+{
+	struct ylist_head *lh;
+	yaffs_Object *obj;
+	int i;
+
+	for (i = 0; i < YAFFS_NOBJECT_BUCKETS; i++) {
+		ylist_for_each(lh, &dev->objectBucket[i].list) {
+			obj = ylist_entry(lh, yaffs_Object, hashLink);
+			if (obj->variantType != YAFFS_OBJECT_TYPE_FILE)
+				continue;
+			yaffs_FreeTnodeTree(dev, obj->variant.fileVariant.top,
+					    obj->variant.fileVariant.topLevel);
+			obj->variant.fileVariant.top = NULL;
+		}
+	}
+}
+#endif
+
+/* Return unused tnode memory to the system, for a memory shrinker.
+ * Returns the number of tnodes freed since the last call, a rough measure
+ * of what there was to give back.
+ */
+int yaffs_ShrinkTnodePool(yaffs_Device * dev)
+{
+	int nFreed = dev->nTnodesFreed;
+
+#ifdef CONFIG_YAFFS_TNODE_SLAB
+	if (dev->tnodeCache)
+		YCACHE_SHRINK(dev->tnodeCache);
+#endif
+	dev->nTnodesFreed = 0;
+
+	return nFreed;
+}
+
 static void yaffs_DeinitialiseTnodes(yaffs_Device * dev)
 {
 	/* Free the list of allocated tnodes */
 	yaffs_TnodeList *tmp;
 
+#ifdef CONFIG_YAFFS_TNODE_SLAB
+	if (dev->tnodeCache) {
+		yaffs_FreeAllTnodes(dev);
+		if (dev->nTnodesCreated) {
+			/* The cache cannot be destroyed while it has objects,
+			 * so it stays around, and so does its name.
+			 */
+			T(YAFFS_TRACE_ERROR,
+			  (TSTR("yaffs: %d tnodes leaked" TENDSTR),
+			   dev->nTnodesCreated));
+		} else {
+			YCACHE_DESTROY(dev->tnodeCache);
+			YFREE(dev->tnodeCacheLabel);
+		}
+		dev->tnodeCache = NULL;
+		dev->tnodeCacheLabel = NULL;
+	}
+#endif
+
 	while (dev->allocatedTnodeList) {
 		tmp = dev->allocatedTnodeList->next;
 
@@ -1343,6 +1442,42 @@ static void yaffs_InitialiseTnodes(yaffs_Device * dev)
 	dev->freeTnodes = NULL;
 	dev->nFreeTnodes = 0;
 	dev->nTnodesCreated = 0;
+	dev->nTnodesFreed = 0;
+
+#ifdef CONFIG_YAFFS_TNODE_SLAB
+	/* Take tnodes one at a time from a slab cache of the exact size so
+	 * that memory freed by deleting and truncating files can go back to
+	 * the system. Batch allocation is the fallback.
+	 */
+	{
+		int tnodeSize = (dev->tnodeWidth * YAFFS_NTNODES_LEVEL0)/8;
+
+		if(tnodeSize < sizeof(yaffs_Tnode))
+			tnodeSize = sizeof(yaffs_Tnode);
+
+		if (!dev->tnodeCacheName[0])
+			yaffs_strcpy(dev->tnodeCacheName, "yaffs_tnode");
+
+		/* The slab keeps a pointer to the name, which has to live
+		 * as long as the cache rather than as long as dev.
+		 */
+		dev->tnodeCache = NULL;
+		dev->tnodeCacheLabel =
+		    YMALLOC(yaffs_strlen(dev->tnodeCacheName) + 1);
+		if (dev->tnodeCacheLabel) {
+			yaffs_strcpy(dev->tnodeCacheLabel, dev->tnodeCacheName);
+			dev->tnodeCache = YCACHE_CREATE(dev->tnodeCacheLabel,
+							tnodeSize);
+			if (!dev->tnodeCache) {
+				YFREE(dev->tnodeCacheLabel);
+				dev->tnodeCacheLabel = NULL;
+			}
+		}
+		if (!dev->tnodeCache)
+			T(YAFFS_TRACE_ALWAYS,
+			  (TSTR("yaffs: no tnode cache, batch allocating" TENDSTR)));
+	}
+#endif
 
 }
 
@@ -1952,6 +2087,7 @@ static yaffs_Object *yaffs_AllocateEmptyObject(yaffs_Device * dev)
 		YINIT_LIST_HEAD(&(tn->hardLinks));
 		YINIT_LIST_HEAD(&(tn->hashLink));
 		YINIT_LIST_HEAD(&tn->siblings);
+		YINIT_LIST_HEAD(&tn->cacheList);
 
                 /* Add it to the lost and found directory.
                  * NB Can't put root or lostNFound in lostNFound so
@@ -2019,6 +2155,7 @@ static void yaffs_FreeObject(yaffs_Object * tn)
 #endif
 
         yaffs_UnhashObject(tn);
+	yaffs_InvalidateWholeChunkCache(tn);
 
         /* Link into the free list. */
         tn->siblings.next = (struct ylist_head *)(dev->freeObjects);
@@ -3206,6 +3343,79 @@ static int yaffs_GarbageCollectBlock(yaffs_Device * dev, int block)
 	return YAFFS_OK;
 }
 
+/* Collect one block and record how long it took in the writer or the
+ * background latency histogram.
+ */
+static int yaffs_TimedGarbageCollectBlock(yaffs_Device * dev, int block,
+					  int background)
+{
+	__u32 *histogram = background ? dev->bgGCLatency : dev->fgGCLatency;
+	__u32 *worst = background ? &dev->bgGCLatencyMax : &dev->fgGCLatencyMax;
+	__u32 start = Y_CURRENT_TIME_US();
+	__u32 elapsed;
+	__u32 ms;
+	int bucket = 0;
+	int retVal;
+
+	retVal = yaffs_GarbageCollectBlock(dev, block);
+
+	elapsed = Y_CURRENT_TIME_US() - start;
+	for (ms = elapsed / 1000; ms && bucket < YAFFS_GC_LATENCY_BUCKETS - 1;
+	     ms >>= 1)
+		bucket++;
+
+	histogram[bucket]++;
+	if (elapsed > *worst)
+		*worst = elapsed;
+
+	return retVal;
+}
+
+/* Background garbage collection.
+ * Called by the OS glue from its own thread, with the device locked, while
+ * nothing else is using it. Collects at most one block per call so that
+ * the caller sets the pace: a mostly dirty block if there is one or, with
+ * aggression above 1, the dirtiest block while erased blocks are running
+ * within YAFFS_BG_GC_HEADROOM of the point where writers would have to
+ * collect aggressively themselves.
+ * Returns 1 if a block was collected.
+ */
+int yaffs_BackgroundGarbageCollect(yaffs_Device * dev, int aggression)
+{
+	int block;
+	int aggressive = 0;
+	int checkpointBlockAdjust;
+
+	if (dev->isDoingGC || aggression <= 0)
+		return 0;
+
+	checkpointBlockAdjust = yaffs_CalcCheckpointBlocksRequired(dev) - dev->blocksInCheckpoint;
+	if(checkpointBlockAdjust < 0)
+		checkpointBlockAdjust = 0;
+
+	if (aggression > 1 &&
+	    dev->nErasedBlocks < (dev->nReservedBlocks + checkpointBlockAdjust + 2 +
+				  YAFFS_BG_GC_HEADROOM))
+		aggressive = 1;
+
+	block = yaffs_FindBlockForGarbageCollection(dev, aggressive);
+	if (block <= 0)
+		return 0;
+
+	dev->garbageCollections++;
+	dev->backgroundGarbageCollections++;
+	if (!aggressive)
+		dev->passiveGarbageCollections++;
+
+	T(YAFFS_TRACE_GC,
+	  (TSTR("yaffs: background GC erasedBlocks %d aggressive %d" TENDSTR),
+	   dev->nErasedBlocks, aggressive));
+
+	yaffs_TimedGarbageCollectBlock(dev, block, 1);
+
+	return 1;
+}
+
 /* New garbage collector
  * If we're very low on erased blocks then we do aggressive garbage collection
  * otherwise we do "leasurely" garbage collection.
@@ -3248,7 +3458,13 @@ static int yaffs_CheckGarbageCollection(yaffs_Device * dev)
 			aggressive = 0;
 		}
 
-		block = yaffs_FindBlockForGarbageCollection(dev, aggressive);
+		/* With a background collector running, leave leisurely
+		 * collection to it rather than stalling the writer.
+		 */
+		if (!aggressive && dev->backgroundGC)
+			block = -1;
+		else
+			block = yaffs_FindBlockForGarbageCollection(dev, aggressive);
 
 		if (block > 0) {
 			dev->garbageCollections++;
@@ -3261,7 +3477,7 @@ static int yaffs_CheckGarbageCollection(yaffs_Device * dev)
 			   ("yaffs: GC erasedBlocks %d aggressive %d" TENDSTR),
 			   dev->nErasedBlocks, aggressive));
 
-			gcOk = yaffs_GarbageCollectBlock(dev, block);
+			gcOk = yaffs_TimedGarbageCollectBlock(dev, block, 0);
 		}
 
 		if (dev->nErasedBlocks < (dev->nReservedBlocks) && block > 0) {
@@ -3852,77 +4068,149 @@ int yaffs_UpdateObjectHeader(yaffs_Object * in, const YCHAR * name, int force,
  *   In Linux, the page cache provides read buffering aand the short op cache provides write 
  *   buffering.
  *
- *   There are a limited number (~10) of cache chunks per device so that we don't
- *   need a very intelligent search.
+ *   Caches are found through a hash of (object, chunkId), aged on an LRU list
+ *   and chained off their object in chunkId order, so that lookups do not walk
+ *   the cache array and an object's dirty chunks can be written out in order.
+ *   The number of caches is set by the "cache=" mount option.
  */
 
-static int yaffs_ObjectHasCachedWriteData(yaffs_Object *obj)
+static struct ylist_head *yaffs_ChunkCacheBucket(yaffs_Device *dev,
+						 const yaffs_Object *obj,
+						 int chunkId)
+{
+	__u32 x = obj->objectId * 0x9E3779B1 + chunkId;
+
+	return &dev->srCacheHash[((x >> 8) ^ x) & (dev->srCacheBuckets - 1)];
+}
+
+/* Hook a free cache up to (obj, chunkId). It goes onto the object's list
+ * behind the last cache with a lower chunkId; appends are the common case
+ * so the search starts at the tail.
+ */
+static void yaffs_AttachChunkCache(yaffs_ChunkCache *cache, yaffs_Object *obj,
+				   int chunkId)
 {
 	yaffs_Device *dev = obj->myDev;
-	int i;
-	yaffs_ChunkCache *cache;
-	int nCaches = obj->myDev->nShortOpCaches;
-	
-	for(i = 0; i < nCaches; i++){
-		cache = &dev->srCache[i];
-		if (cache->object == obj &&
-		    cache->dirty)
+	struct ylist_head *pos;
+
+	cache->object = obj;
+	cache->chunkId = chunkId;
+	cache->dirty = 0;
+	cache->locked = 0;
+	cache->nBytes = 0;
+
+	for (pos = obj->cacheList.prev; pos != &obj->cacheList; pos = pos->prev) {
+		if (ylist_entry(pos, yaffs_ChunkCache, objLink)->chunkId < chunkId)
+			break;
+	}
+	ylist_add(&cache->objLink, pos);
+
+	ylist_add(&cache->hashLink, yaffs_ChunkCacheBucket(dev, obj, chunkId));
+	ylist_del(&cache->lruLink);
+	ylist_add_tail(&cache->lruLink, &dev->srCacheLru);
+}
+
+/* Drop whatever the cache holds and put it back on the free list */
+static void yaffs_DetachChunkCache(yaffs_Device *dev, yaffs_ChunkCache *cache)
+{
+	if (!cache->object)
+		return;
+
+	if (cache->dirty)
+		dev->srDirtyCaches--;
+
+	ylist_del_init(&cache->hashLink);
+	ylist_del_init(&cache->objLink);
+	ylist_del(&cache->lruLink);
+	ylist_add_tail(&cache->lruLink, &dev->srCacheFree);
+
+	cache->object = NULL;
+	cache->dirty = 0;
+}
+
+static int yaffs_ObjectHasCachedWriteData(yaffs_Object *obj)
+{
+	struct ylist_head *pos;
+
+	ylist_for_each(pos, &obj->cacheList) {
+		if (ylist_entry(pos, yaffs_ChunkCache, objLink)->dirty)
 			return 1;
 	}
-	
+
 	return 0;
 }
 
+/* Write out one dirty cache and free it up.
+ * Returns the result of the chunk write.
+ */
+static int yaffs_WriteChunkCache(yaffs_ChunkCache *cache)
+{
+	yaffs_Object *obj = cache->object;
+	int chunkWritten;
+
+	chunkWritten = yaffs_WriteChunkDataToObject(obj, cache->chunkId,
+						    cache->data, cache->nBytes,
+						    1);
+	yaffs_DetachChunkCache(obj->myDev, cache);
+
+	if (chunkWritten <= 0)
+		T(YAFFS_TRACE_ERROR,
+		  (TSTR("yaffs tragedy: no space during cache write" TENDSTR)));
+
+	return chunkWritten;
+}
 
 static void yaffs_FlushFilesChunkCache(yaffs_Object * obj)
 {
-	yaffs_Device *dev = obj->myDev;
-	int lowest = -99;	/* Stop compiler whining. */
-	int i;
 	yaffs_ChunkCache *cache;
-	int chunkWritten = 0;
-	int nCaches = obj->myDev->nShortOpCaches;
+	struct ylist_head *pos;
+	struct ylist_head *n;
 
-	if (nCaches > 0) {
-		do {
-			cache = NULL;
+	/* The list is in chunkId order, so this writes the lowest chunk first. */
+	ylist_for_each_safe(pos, n, &obj->cacheList) {
+		cache = ylist_entry(pos, yaffs_ChunkCache, objLink);
 
-			/* Find the dirty cache for this object with the lowest chunk id. */
-			for (i = 0; i < nCaches; i++) {
-				if (dev->srCache[i].object == obj &&
-				    dev->srCache[i].dirty) {
-					if (!cache
-					    || dev->srCache[i].chunkId <
-					    lowest) {
-						cache = &dev->srCache[i];
-						lowest = cache->chunkId;
-					}
-				}
-			}
-
-			if (cache && !cache->locked) {
-				/* Write it out and free it up */
+		if (!cache->dirty)
+			continue;
 
-				chunkWritten =
-				    yaffs_WriteChunkDataToObject(cache->object,
-								 cache->chunkId,
-								 cache->data,
-								 cache->nBytes,
-								 1);
-				cache->dirty = 0;
-				cache->object = NULL;
-			}
+		if (cache->locked || yaffs_WriteChunkCache(cache) <= 0)
+			break;
+	}
+}
 
-		} while (cache && chunkWritten > 0);
+/* Write out the run of adjacent dirty chunks that this cache belongs to,
+ * lowest chunkId first, so that a partially filled region of a file lands
+ * in consecutive pages rather than interleaved with other writers.
+ */
+static void yaffs_FlushChunkCacheRun(yaffs_ChunkCache *cache)
+{
+	yaffs_Object *obj = cache->object;
+	yaffs_ChunkCache *prev;
+	yaffs_ChunkCache *next;
 
-		if (cache) {
-			/* Hoosterman, disk full while writing cache out. */
-			T(YAFFS_TRACE_ERROR,
-			  (TSTR("yaffs tragedy: no space during cache write" TENDSTR)));
+	while (cache->objLink.prev != &obj->cacheList) {
+		prev = ylist_entry(cache->objLink.prev, yaffs_ChunkCache, objLink);
+		if (!prev->dirty || prev->locked ||
+		    prev->chunkId != cache->chunkId - 1)
+			break;
+		cache = prev;
+	}
 
+	while (cache) {
+		next = NULL;
+		if (cache->objLink.next != &obj->cacheList) {
+			next = ylist_entry(cache->objLink.next, yaffs_ChunkCache,
+					   objLink);
+			if (!next->dirty || next->locked ||
+			    next->chunkId != cache->chunkId + 1)
+				next = NULL;
 		}
-	}
 
+		if (yaffs_WriteChunkCache(cache) <= 0)
+			break;
+
+		cache = next;
+	}
 }
 
 /*yaffs_FlushEntireDeviceCache(dev)
@@ -3933,19 +4221,20 @@ static void yaffs_FlushFilesChunkCache(yaffs_Object * obj)
 void yaffs_FlushEntireDeviceCache(yaffs_Device *dev)
 {
 	yaffs_Object *obj;
-	int nCaches = dev->nShortOpCaches;
-	int i;
+	struct ylist_head *pos;
+	yaffs_ChunkCache *cache;
 	
 	/* Find a dirty object in the cache and flush it...
 	 * until there are no further dirty objects.
 	 */
 	do {
 		obj = NULL;
-		for( i = 0; i < nCaches && !obj; i++) {
-			if (dev->srCache[i].object &&
-			    dev->srCache[i].dirty)
-				obj = dev->srCache[i].object;
-			    
+		ylist_for_each(pos, &dev->srCacheLru) {
+			cache = ylist_entry(pos, yaffs_ChunkCache, lruLink);
+			if (cache->dirty) {
+				obj = cache->object;
+				break;
+			}
 		}
 		if(obj)
 			yaffs_FlushFilesChunkCache(obj);
@@ -3958,92 +4247,60 @@ void yaffs_FlushEntireDeviceCache(yaffs_Device *dev)
 /* Grab us a cache chunk for use.
  * First look for an empty one. 
  * Then look for the least recently used non-dirty one.
- * Then look for the least recently used dirty one...., flush and look again.
  */
 static yaffs_ChunkCache *yaffs_GrabChunkCacheWorker(yaffs_Device * dev)
 {
-	int i;
-	int usage;
-	int theOne;
-
-	if (dev->nShortOpCaches > 0) {
-		for (i = 0; i < dev->nShortOpCaches; i++) {
-			if (!dev->srCache[i].object) 
-				return &dev->srCache[i];
-		}
-
-		return NULL;
+	struct ylist_head *pos;
+	yaffs_ChunkCache *cache;
 
-		theOne = -1;
-		usage = 0;	/* just to stop the compiler grizzling */
+	if (!ylist_empty(&dev->srCacheFree))
+		return ylist_entry(dev->srCacheFree.next, yaffs_ChunkCache,
+				   lruLink);
 
-		for (i = 0; i < dev->nShortOpCaches; i++) {
-			if (!dev->srCache[i].dirty &&
-			    ((dev->srCache[i].lastUse < usage && theOne >= 0) ||
-			     theOne < 0)) {
-				usage = dev->srCache[i].lastUse;
-				theOne = i;
-			}
+	ylist_for_each(pos, &dev->srCacheLru) {
+		cache = ylist_entry(pos, yaffs_ChunkCache, lruLink);
+		if (!cache->dirty && !cache->locked) {
+			yaffs_DetachChunkCache(dev, cache);
+			return cache;
 		}
-
-
-		return theOne >= 0 ? &dev->srCache[theOne] : NULL;
-	} else {
-		return NULL;
 	}
 
+	return NULL;
 }
 
-static yaffs_ChunkCache *yaffs_GrabChunkCache(yaffs_Device * dev)
+/* Grab a cache and attach it to (obj, chunkId).
+ * If every cache is dirty, write out the run of adjacent dirty chunks around
+ * the least recently used unlocked one, then look again.
+ */
+static yaffs_ChunkCache *yaffs_GrabChunkCache(yaffs_Object *obj, int chunkId)
 {
+	yaffs_Device *dev = obj->myDev;
 	yaffs_ChunkCache *cache;
-	yaffs_Object *theObj;
-	int usage;
-	int i;
-	int pushout;
+	struct ylist_head *pos;
 
-	if (dev->nShortOpCaches > 0) {
-		/* Try find a non-dirty one... */
-
-		cache = yaffs_GrabChunkCacheWorker(dev);
-
-		if (!cache) {
-			/* They were all dirty, find the last recently used object and flush
-			 * its cache, then  find again.
-			 * NB what's here is not very accurate, we actually flush the object
-			 * the last recently used page.
-			 */
+	if (dev->nShortOpCaches <= 0)
+		return NULL;
 
-			/* With locking we can't assume we can use entry zero */
+	cache = yaffs_GrabChunkCacheWorker(dev);
 
-			theObj = NULL;
-			usage = -1;
+	if (!cache) {
+		ylist_for_each(pos, &dev->srCacheLru) {
+			cache = ylist_entry(pos, yaffs_ChunkCache, lruLink);
+			if (!cache->locked)
+				break;
 			cache = NULL;
-			pushout = -1;
-
-			for (i = 0; i < dev->nShortOpCaches; i++) {
-				if (dev->srCache[i].object &&
-				    !dev->srCache[i].locked &&
-				    (dev->srCache[i].lastUse < usage || !cache))
-				{
-					usage = dev->srCache[i].lastUse;
-					theObj = dev->srCache[i].object;
-					cache = &dev->srCache[i];
-					pushout = i;
-				}
-			}
-
-			if (!cache || cache->dirty) {
-				/* Flush and try again */
-				yaffs_FlushFilesChunkCache(theObj);
-				cache = yaffs_GrabChunkCacheWorker(dev);
-			}
+		}
 
+		if (cache) {
+			yaffs_FlushChunkCacheRun(cache);
+			cache = yaffs_GrabChunkCacheWorker(dev);
 		}
-		return cache;
-	} else
-		return NULL;
+	}
+
+	if (cache)
+		yaffs_AttachChunkCache(cache, obj, chunkId);
 
+	return cache;
 }
 
 /* Find a cached chunk */
@@ -4051,14 +4308,19 @@ static yaffs_ChunkCache *yaffs_FindChunkCache(const yaffs_Object * obj,
 					      int chunkId)
 {
 	yaffs_Device *dev = obj->myDev;
-	int i;
+	struct ylist_head *bucket;
+	struct ylist_head *pos;
+	yaffs_ChunkCache *cache;
+
 	if (dev->nShortOpCaches > 0) {
-		for (i = 0; i < dev->nShortOpCaches; i++) {
-			if (dev->srCache[i].object == obj &&
-			    dev->srCache[i].chunkId == chunkId) {
+		bucket = yaffs_ChunkCacheBucket(dev, obj, chunkId);
+		ylist_for_each(pos, bucket) {
+			cache = ylist_entry(pos, yaffs_ChunkCache, hashLink);
+			if (cache->object == obj &&
+			    cache->chunkId == chunkId) {
 				dev->cacheHits++;
 
-				return &dev->srCache[i];
+				return cache;
 			}
 		}
 	}
@@ -4071,21 +4333,12 @@ static void yaffs_UseChunkCache(yaffs_Device * dev, yaffs_ChunkCache * cache,
 {
 
 	if (dev->nShortOpCaches > 0) {
-		if (dev->srLastUse < 0 || dev->srLastUse > 100000000) {
-			/* Reset the cache usages */
-			int i;
-			for (i = 1; i < dev->nShortOpCaches; i++) {
-				dev->srCache[i].lastUse = 0;
-			}
-			dev->srLastUse = 0;
-		}
+		ylist_del(&cache->lruLink);
+		ylist_add_tail(&cache->lruLink, &dev->srCacheLru);
 
-		dev->srLastUse++;
-
-		cache->lastUse = dev->srLastUse;
-
-		if (isAWrite) {
+		if (isAWrite && !cache->dirty) {
 			cache->dirty = 1;
+			dev->srDirtyCaches++;
 		}
 	}
 }
@@ -4100,7 +4353,7 @@ static void yaffs_InvalidateChunkCache(yaffs_Object * object, int chunkId)
 		yaffs_ChunkCache *cache = yaffs_FindChunkCache(object, chunkId);
 
 		if (cache) {
-			cache->object = NULL;
+			yaffs_DetachChunkCache(object->myDev, cache);
 		}
 	}
 }
@@ -4110,17 +4363,13 @@ static void yaffs_InvalidateChunkCache(yaffs_Object * object, int chunkId)
  */
 static void yaffs_InvalidateWholeChunkCache(yaffs_Object * in)
 {
-	int i;
 	yaffs_Device *dev = in->myDev;
+	struct ylist_head *pos;
+	struct ylist_head *n;
 
-	if (dev->nShortOpCaches > 0) {
-		/* Invalidate it. */
-		for (i = 0; i < dev->nShortOpCaches; i++) {
-			if (dev->srCache[i].object == in) {
-				dev->srCache[i].object = NULL;
-			}
-		}
-	}
+	ylist_for_each_safe(pos, n, &in->cacheList)
+		yaffs_DetachChunkCache(dev,
+				       ylist_entry(pos, yaffs_ChunkCache, objLink));
 }
 
 /*--------------------- Checkpointing --------------------*/
@@ -4568,6 +4817,10 @@ static int yaffs_WriteCheckpointData(yaffs_Device *dev)
 		
 	if(ok)
 		ok = yaffs_CheckpointOpen(dev,1);
+
+	/* Opening for write has erased the old checkpoint */
+	if(ok)
+		dev->checkpointSequence = 0;
 	
 	if(ok){
 		T(YAFFS_TRACE_CHECKPOINT,(TSTR("write checkpoint validity" TENDSTR)));
@@ -4594,9 +4847,10 @@ static int yaffs_WriteCheckpointData(yaffs_Device *dev)
 	if(!yaffs_CheckpointClose(dev))
 		 ok = 0;
 		 
-	if(ok)
+	if(ok) {
 	    	dev->isCheckpointed = 1;
-	 else 
+		dev->checkpointSequence = dev->sequenceNumber;
+	} else 
 	 	dev->isCheckpointed = 0;
 
 	return dev->isCheckpointed;
@@ -4651,9 +4905,14 @@ static int yaffs_ReadCheckpointData(yaffs_Device *dev)
 static void yaffs_InvalidateCheckpoint(yaffs_Device *dev)
 {
 	if(dev->isCheckpointed || 
-	   dev->blocksInCheckpoint > 0){
+	   (dev->blocksInCheckpoint > 0 && !dev->checkpointSequence)){
 		dev->isCheckpointed = 0;
-		yaffs_CheckpointInvalidateStream(dev);
+		/* An intact checkpoint is left on NAND so that the next mount
+		 * can start from it and replay only the blocks written since.
+		 * It is erased when the next checkpoint is written.
+		 */
+		if(!dev->checkpointSequence)
+			yaffs_CheckpointInvalidateStream(dev);
 		if(dev->superBlock && dev->markSuperBlockDirty)
 			dev->markSuperBlockDirty(dev->superBlock);
 	}
@@ -4672,6 +4931,7 @@ int yaffs_CheckpointSave(yaffs_Device *dev)
 	if(!dev->isCheckpointed) {
 		yaffs_InvalidateCheckpoint(dev);
 		yaffs_WriteCheckpointData(dev);
+		dev->refreshSequence = dev->sequenceNumber;
 	}
 	
 	T(YAFFS_TRACE_ALWAYS,(TSTR("save exit: isCheckpointed %d"TENDSTR),dev->isCheckpointed));
@@ -4687,6 +4947,7 @@ int yaffs_CheckpointRestore(yaffs_Device *dev)
 	retval = yaffs_ReadCheckpointData(dev);
 
 	if(dev->isCheckpointed){
+		dev->checkpointSequence = dev->sequenceNumber;
 		yaffs_VerifyObjects(dev);
 		yaffs_VerifyBlocks(dev);
 		yaffs_VerifyFreeChunks(dev);
@@ -4697,6 +4958,17 @@ int yaffs_CheckpointRestore(yaffs_Device *dev)
 	return retval;
 }
 
+/* Has enough been written since the last checkpoint that it is worth
+ * writing a new one, to bound the replay done by the next mount?
+ */
+int yaffs_CheckpointRefreshDue(yaffs_Device *dev, int nBlocks)
+{
+	if(dev->isCheckpointed || dev->skipCheckpointWrite || !dev->isYaffs2)
+		return 0;
+
+	return (dev->sequenceNumber - dev->refreshSequence) >= nBlocks;
+}
+
 /*--------------------- File read/write ------------------------
  * Read and write have very similar structures.
  * In general the read/write has three parts to it
@@ -4749,15 +5021,10 @@ int yaffs_ReadDataFromFile(yaffs_Object * in, __u8 * buffer, loff_t offset,
 				/* If we can't find the data in the cache, then load it up. */
 
 				if (!cache) {
-					cache = yaffs_GrabChunkCache(in->myDev);
-					cache->object = in;
-					cache->chunkId = chunk;
-					cache->dirty = 0;
-					cache->locked = 0;
+					cache = yaffs_GrabChunkCache(in, chunk);
 					yaffs_ReadChunkDataFromObject(in, chunk,
 								      cache->
 								      data);
-					cache->nBytes = 0;
 				}
 
 				yaffs_UseChunkCache(dev, cache, 0);
@@ -4827,6 +5094,48 @@ int yaffs_ReadDataFromFile(yaffs_Object * in, __u8 * buffer, loff_t offset,
 	return nDone;
 }
 
+/* Read nChunks whole chunks of a file, starting at chunkInInode, into buffer.
+ * Chunks held in the short op cache are copied from there and holes read as
+ * zeros. Runs of chunks that sit in consecutive NAND pages, which is how a
+ * file written sequentially usually ends up, are read with one driver call.
+ * Not for use with inband tags.
+ */
+int yaffs_ReadFileChunks(yaffs_Object * in, int chunkInInode, int nChunks,
+			 __u8 * buffer)
+{
+	yaffs_Device *dev = in->myDev;
+	yaffs_ChunkCache *cache;
+	int chunkInNAND;
+	int i;
+	int n;
+
+	for (i = 0; i < nChunks; i += n, buffer += n * dev->nDataBytesPerChunk) {
+		n = 1;
+
+		cache = yaffs_FindChunkCache(in, chunkInInode + i);
+		if (cache) {
+			memcpy(buffer, cache->data, dev->nDataBytesPerChunk);
+			continue;
+		}
+
+		chunkInNAND = yaffs_FindChunkInFile(in, chunkInInode + i, NULL);
+		if (chunkInNAND < 0) {
+			memset(buffer, 0, dev->nDataBytesPerChunk);
+			continue;
+		}
+
+		while (i + n < nChunks &&
+		       !yaffs_FindChunkCache(in, chunkInInode + i + n) &&
+		       yaffs_FindChunkInFile(in, chunkInInode + i + n, NULL) ==
+		       chunkInNAND + n)
+			n++;
+
+		yaffs_ReadChunksFromNAND(dev, chunkInNAND, n, buffer);
+	}
+
+	return nChunks;
+}
+
 int yaffs_WriteDataToFile(yaffs_Object * in, const __u8 * buffer, loff_t offset,
 			  int nBytes, int writeThrough)
 {
@@ -4892,11 +5201,7 @@ int yaffs_WriteDataToFile(yaffs_Object * in, const __u8 * buffer, loff_t offset,
 				if (!cache
 				    && yaffs_CheckSpaceForAllocation(in->
 								     myDev)) {
-					cache = yaffs_GrabChunkCache(in->myDev);
-					cache->object = in;
-					cache->chunkId = chunk;
-					cache->dirty = 0;
-					cache->locked = 0;
+					cache = yaffs_GrabChunkCache(in, chunk);
 					yaffs_ReadChunkDataFromObject(in, chunk,
 								      cache->
 								      data);
@@ -4926,15 +5231,9 @@ int yaffs_WriteDataToFile(yaffs_Object * in, const __u8 * buffer, loff_t offset,
 					cache->locked = 0;
 					cache->nBytes = nToWriteBack;
 
-					if (writeThrough) {
+					if (writeThrough)
 						chunkWritten =
-						    yaffs_WriteChunkDataToObject
-						    (cache->object,
-						     cache->chunkId,
-						     cache->data, cache->nBytes,
-						     1);
-						cache->dirty = 0;
-					}
+						    yaffs_WriteChunkCache(cache);
 
 				} else {
 					chunkWritten = -1;	/* fail the write */
@@ -6685,6 +6984,511 @@ static int yaffs_ScanBackwards(yaffs_Device * dev)
 	return YAFFS_OK;
 }
 
+/*------------------------------  Checkpoint replay ----------------------------- */
+
+/*
+ * A checkpoint is no longer thrown away on the first write after it was
+ * taken (see yaffs_InvalidateCheckpoint()), so after an unclean shutdown
+ * there is normally a checkpoint on NAND that describes the device as it
+ * was at sequence number dev->checkpointSequence. Instead of scanning every
+ * chunk, yaffs_CheckpointReplay() brings that state up to date:
+ *
+ * - The first chunk of every block is read to find out which blocks have
+ *   changed since the checkpoint. This is one tags read per block.
+ * - Blocks that have been erased, retired or reused since are stale. Any
+ *   checkpoint reference into them is dropped; GC will have written the
+ *   live chunks out again to a newer block.
+ * - Blocks with a sequence number above the checkpoint's, and the rest of
+ *   the block being allocated from when the checkpoint was taken, are
+ *   replayed oldest first using forward scanning rules: a newer data chunk
+ *   replaces the older one and a newer object header replaces the older
+ *   header and its attributes.
+ *
+ * Anything that does not add up fails the replay and the caller falls back
+ * to a full scan.
+ */
+
+static void yaffs_DropStaleChunks(yaffs_Object * in, yaffs_Tnode * tn,
+				  __u32 level, const __u8 * stale)
+{
+	int i;
+	int theChunk;
+	yaffs_Device *dev = in->myDev;
+
+	if (!tn)
+		return;
+
+	if (level > 0) {
+		for (i = 0; i < YAFFS_NTNODES_INTERNAL; i++)
+			yaffs_DropStaleChunks(in, tn->internal[i], level - 1,
+					      stale);
+	} else {
+		for (i = 0; i < YAFFS_NTNODES_LEVEL0; i++) {
+			/* As in SoftDeleteWorker, a chunk group is assumed
+			 * not to span blocks.
+			 */
+			theChunk = yaffs_GetChunkGroupBase(dev, tn, i);
+			if (theChunk &&
+			    stale[theChunk / dev->nChunksPerBlock -
+				  dev->internalStartBlock]) {
+				yaffs_PutLevel0Tnode(dev, tn, i, 0);
+				in->nDataChunks--;
+			}
+		}
+	}
+}
+
+static int yaffs_ReplayDataChunk(yaffs_Device * dev, int chunk,
+				 yaffs_ExtendedTags * tags)
+{
+	yaffs_Object *in;
+	__u32 endpos;
+
+	in = yaffs_FindOrCreateObjectByNumber(dev, tags->objectId,
+					      YAFFS_OBJECT_TYPE_FILE);
+	if (!in)
+		return YAFFS_FAIL;
+
+	if (in->deleted) {
+		/* Left over from a file that has been deleted since */
+		yaffs_DeleteChunk(dev, chunk, 1, __LINE__);
+		return YAFFS_OK;
+	}
+
+	/* Forward rules: this chunk replaces any older one at this position */
+	if (!yaffs_PutChunkIntoFile(in, tags->chunkId, chunk, 1))
+		return YAFFS_FAIL;
+
+	endpos = (tags->chunkId - 1) * dev->nDataBytesPerChunk +
+		 tags->byteCount;
+
+	if (in->variantType == YAFFS_OBJECT_TYPE_FILE &&
+	    in->variant.fileVariant.fileSize < endpos) {
+		/* Data written after the last header extends the file */
+		in->variant.fileVariant.fileSize = endpos;
+		in->variant.fileVariant.scannedFileSize = endpos;
+	}
+
+	return YAFFS_OK;
+}
+
+static int yaffs_ReplayObjectHeader(yaffs_Device * dev, yaffs_BlockInfo * bi,
+				    int chunk, yaffs_ExtendedTags * tags,
+				    __u8 * chunkData,
+				    yaffs_Object ** hardList)
+{
+	yaffs_ObjectHeader *oh = (yaffs_ObjectHeader *) chunkData;
+	yaffs_Object *in;
+	yaffs_Object *parent;
+	yaffs_Object *shadowed;
+	int isNew;
+	int goingAway;
+
+	yaffs_ReadChunkWithTagsFromNAND(dev, chunk, chunkData, NULL);
+
+	if (dev->inbandTags) {
+		/* Fix up the header if they got corrupted by inband tags */
+		oh->shadowsObject = oh->inbandShadowsObject;
+		oh->isShrink = oh->inbandIsShrink;
+	}
+
+	goingAway = (oh->parentObjectId == YAFFS_OBJECTID_DELETED ||
+		     oh->parentObjectId == YAFFS_OBJECTID_UNLINKED);
+
+	in = yaffs_FindObjectByNumber(dev, tags->objectId);
+
+	if (in && (in->variantType != oh->type ||
+		   (!goingAway && (in->parent == dev->deletedDir ||
+				   in->parent == dev->unlinkedDir)))) {
+		/* The object number has been reused since the checkpoint.
+		 * Leave that to a full scan.
+		 */
+		T(YAFFS_TRACE_SCAN,
+		  (TSTR("replay: object %d reused at chunk %d" TENDSTR),
+		   tags->objectId, chunk));
+		return YAFFS_FAIL;
+	}
+
+	isNew = (in == NULL);
+	if (isNew)
+		in = yaffs_FindOrCreateObjectByNumber(dev, tags->objectId,
+						      oh->type);
+	if (!in)
+		return YAFFS_FAIL;
+
+	/* Use new - drop the existing header */
+	if (in->hdrChunk > 0)
+		yaffs_DeleteChunk(dev, in->hdrChunk, 1, __LINE__);
+
+	in->hdrChunk = chunk;
+	in->serial = tags->serialNumber;
+	in->valid = 1;
+	in->lazyLoaded = 0;
+	in->dirty = 0;
+
+	in->yst_mode = oh->yst_mode;
+#ifdef CONFIG_YAFFS_WINCE
+	in->win_atime[0] = oh->win_atime[0];
+	in->win_ctime[0] = oh->win_ctime[0];
+	in->win_mtime[0] = oh->win_mtime[0];
+	in->win_atime[1] = oh->win_atime[1];
+	in->win_ctime[1] = oh->win_ctime[1];
+	in->win_mtime[1] = oh->win_mtime[1];
+#else
+	in->yst_uid = oh->yst_uid;
+	in->yst_gid = oh->yst_gid;
+	in->yst_atime = oh->yst_atime;
+	in->yst_mtime = oh->yst_mtime;
+	in->yst_ctime = oh->yst_ctime;
+	in->yst_rdev = oh->yst_rdev;
+#endif
+
+	if (tags->objectId == YAFFS_OBJECTID_ROOT ||
+	    tags->objectId == YAFFS_OBJECTID_LOSTNFOUND) {
+		/* We only load some info, don't fiddle with directory structure */
+		return YAFFS_OK;
+	}
+
+	yaffs_SetObjectName(in, oh->name);
+
+	if (oh->shadowsObject > 0) {
+		/* A rename over an existing object. If the power went before
+		 * the shadowed object was unlinked, finish that now.
+		 */
+		shadowed = yaffs_FindObjectByNumber(dev, oh->shadowsObject);
+		if (shadowed && shadowed->parent != dev->deletedDir &&
+		    shadowed->parent != dev->unlinkedDir)
+			yaffs_AddObjectToDirectory(dev->unlinkedDir, shadowed);
+	}
+
+	parent = yaffs_FindOrCreateObjectByNumber(dev, oh->parentObjectId,
+						  YAFFS_OBJECT_TYPE_DIRECTORY);
+	if (!parent)
+		return YAFFS_FAIL;
+
+	if (parent->variantType != YAFFS_OBJECT_TYPE_DIRECTORY) {
+		T(YAFFS_TRACE_ERROR,
+		  (TSTR
+		   ("yaffs tragedy: attempting to use non-directory as a directory in replay. Put in lost+found."
+		    TENDSTR)));
+		parent = dev->lostNFoundDir;
+	}
+
+	if (in->parent != parent)
+		yaffs_AddObjectToDirectory(parent, in);
+
+	switch (in->variantType) {
+	case YAFFS_OBJECT_TYPE_FILE:
+		if (oh->isShrink) {
+			if (oh->fileSize < in->variant.fileVariant.fileSize)
+				yaffs_PruneResizedChunks(in, oh->fileSize);
+			bi->hasShrinkHeader = 1;
+		}
+		in->variant.fileVariant.fileSize = oh->fileSize;
+		in->variant.fileVariant.scannedFileSize = oh->fileSize;
+		break;
+	case YAFFS_OBJECT_TYPE_HARDLINK:
+		if (isNew) {
+			in->variant.hardLinkVariant.equivalentObjectId =
+			    oh->equivalentObjectId;
+			in->hardLinks.next = (struct ylist_head *) *hardList;
+			*hardList = in;
+		}
+		break;
+	case YAFFS_OBJECT_TYPE_SYMLINK:
+		if (in->variant.symLinkVariant.alias)
+			YFREE(in->variant.symLinkVariant.alias);
+		in->variant.symLinkVariant.alias = yaffs_CloneString(oh->alias);
+		if (!in->variant.symLinkVariant.alias)
+			return YAFFS_FAIL;
+		break;
+	default:
+		break;
+	}
+
+	if (parent == dev->deletedDir) {
+		yaffs_DestroyObject(in);
+		bi->hasShrinkHeader = 1;
+	}
+
+	return YAFFS_OK;
+}
+
+static int yaffs_CheckpointReplay(yaffs_Device * dev)
+{
+	yaffs_ExtendedTags tags;
+	int blk;
+	int c;
+	int i;
+	int chunk;
+	int startPage;
+	int lastUsed;
+	int ok = 1;
+	int nStale = 0;
+	int nReplay = 0;
+	int nBlocks = dev->internalEndBlock - dev->internalStartBlock + 1;
+	unsigned checkpointSequence = dev->checkpointSequence;
+	int checkpointAllocBlock = dev->allocationBlock;
+	int checkpointAllocPage = dev->allocationPage;
+	yaffs_BlockState state;
+	__u32 sequenceNumber;
+	yaffs_BlockInfo *bi;
+	yaffs_Object *in;
+	yaffs_Object *hardList = NULL;
+	struct ylist_head *lh;
+	__u8 *chunkData;
+	__u8 *stale;
+
+	yaffs_BlockIndex *blockIndex = NULL;
+	int altBlockIndex = 0;
+
+	blockIndex = YMALLOC(nBlocks * sizeof(yaffs_BlockIndex));
+
+	if (!blockIndex) {
+		blockIndex = YMALLOC_ALT(nBlocks * sizeof(yaffs_BlockIndex));
+		altBlockIndex = 1;
+	}
+
+	stale = YMALLOC(nBlocks);
+
+	if (!blockIndex || !stale) {
+		T(YAFFS_TRACE_SCAN,
+		  (TSTR("yaffs_CheckpointReplay() could not allocate block index!" TENDSTR)));
+		ok = 0;
+		goto out;
+	}
+
+	memset(stale, 0, nBlocks);
+
+	dev->allocationBlock = -1;
+	dev->allocationPage = -1;
+
+	/* Find the blocks that changed since the checkpoint */
+	for (blk = dev->internalStartBlock; blk <= dev->internalEndBlock; blk++) {
+		bi = yaffs_GetBlockInfo(dev, blk);
+
+		if (bi->blockState == YAFFS_BLOCK_STATE_CHECKPOINT ||
+		    bi->blockState == YAFFS_BLOCK_STATE_DEAD)
+			continue;
+
+		yaffs_QueryInitialBlockState(dev, blk, &state, &sequenceNumber);
+		dev->mountBlocksChecked++;
+
+		if (sequenceNumber == YAFFS_SEQUENCE_BAD_BLOCK)
+			state = YAFFS_BLOCK_STATE_DEAD;
+
+		if (state == YAFFS_BLOCK_STATE_EMPTY &&
+		    bi->blockState == YAFFS_BLOCK_STATE_EMPTY)
+			continue;
+
+		if (state == YAFFS_BLOCK_STATE_NEEDS_SCANNING &&
+		    bi->blockState != YAFFS_BLOCK_STATE_EMPTY &&
+		    sequenceNumber == bi->sequenceNumber) {
+			/* Unchanged, but the block being allocated from may
+			 * have had more written to it.
+			 */
+			if (blk == checkpointAllocBlock) {
+				blockIndex[nReplay].seq = sequenceNumber;
+				blockIndex[nReplay].block = blk;
+				nReplay++;
+			}
+			continue;
+		}
+
+		if (state == YAFFS_BLOCK_STATE_NEEDS_SCANNING &&
+		    (sequenceNumber <= checkpointSequence ||
+		     sequenceNumber >= YAFFS_HIGHEST_SEQUENCE_NUMBER)) {
+			/* Not what the checkpoint says, yet not newer either */
+			T(YAFFS_TRACE_SCAN,
+			  (TSTR("replay: block %d seq %d, checkpoint has %d" TENDSTR),
+			   blk, sequenceNumber, bi->sequenceNumber));
+			ok = 0;
+			goto out;
+		}
+
+		/* Erased, retired or rewritten since the checkpoint */
+		if (bi->blockState != YAFFS_BLOCK_STATE_EMPTY) {
+			stale[blk - dev->internalStartBlock] = 1;
+			nStale++;
+		}
+
+		yaffs_ClearChunkBits(dev, blk);
+		bi->pagesInUse = 0;
+		bi->softDeletions = 0;
+		bi->hasShrinkHeader = 0;
+		bi->needsRetiring = 0;
+		bi->skipErasedCheck = 0;
+		bi->gcPrioritise = 0;
+		bi->blockState = state;
+		bi->sequenceNumber = sequenceNumber;
+
+		if (state == YAFFS_BLOCK_STATE_NEEDS_SCANNING) {
+			blockIndex[nReplay].seq = sequenceNumber;
+			blockIndex[nReplay].block = blk;
+			nReplay++;
+
+			if (sequenceNumber > dev->sequenceNumber)
+				dev->sequenceNumber = sequenceNumber;
+		}
+	}
+
+	T(YAFFS_TRACE_SCAN,
+	  (TSTR("replay: %d blocks checked, %d stale, %d to replay" TENDSTR),
+	   dev->mountBlocksChecked, nStale, nReplay));
+
+	/* Drop references into the stale blocks */
+	for (i = 0; nStale && i < YAFFS_NOBJECT_BUCKETS; i++) {
+		ylist_for_each(lh, &dev->objectBucket[i].list) {
+			in = ylist_entry(lh, yaffs_Object, hashLink);
+
+			if (in->hdrChunk > 0 &&
+			    stale[in->hdrChunk / dev->nChunksPerBlock -
+				  dev->internalStartBlock])
+				in->hdrChunk = 0;
+
+			if (in->variantType == YAFFS_OBJECT_TYPE_FILE)
+				yaffs_DropStaleChunks(in,
+					in->variant.fileVariant.top,
+					in->variant.fileVariant.topLevel,
+					stale);
+		}
+	}
+
+	yaffs_qsort(blockIndex, nReplay, sizeof(yaffs_BlockIndex), ybicmp);
+
+	chunkData = yaffs_GetTempBuffer(dev, __LINE__);
+
+	/* Replay the newer blocks, oldest first */
+	for (i = 0; ok && i < nReplay; i++) {
+		YYIELD();
+
+		blk = blockIndex[i].block;
+		bi = yaffs_GetBlockInfo(dev, blk);
+
+		if (blk == checkpointAllocBlock &&
+		    bi->sequenceNumber == checkpointSequence)
+			startPage = checkpointAllocPage;
+		else
+			startPage = 0;
+
+		/* Keep DeleteChunk from erasing the block under us */
+		bi->blockState = YAFFS_BLOCK_STATE_NEEDS_SCANNING;
+
+		lastUsed = startPage - 1;
+		for (c = startPage; ok && c < dev->nChunksPerBlock; c++) {
+			chunk = blk * dev->nChunksPerBlock + c;
+
+			yaffs_ReadChunkWithTagsFromNAND(dev, chunk, NULL, &tags);
+
+			if (!tags.chunkUsed)
+				continue;
+
+			lastUsed = c;
+
+			if (tags.eccResult == YAFFS_ECC_RESULT_UNFIXED) {
+				T(YAFFS_TRACE_SCAN,
+				  (TSTR(" Unfixed ECC in chunk(%d:%d), chunk ignored"TENDSTR),
+				   blk, c));
+				continue;
+			}
+
+			yaffs_SetChunkBit(dev, blk, c);
+			bi->pagesInUse++;
+			dev->mountChunksReplayed++;
+
+			if (tags.chunkId > 0)
+				ok = yaffs_ReplayDataChunk(dev, chunk, &tags);
+			else
+				ok = yaffs_ReplayObjectHeader(dev, bi, chunk, &tags,
+							      chunkData, &hardList);
+		}
+
+		if (lastUsed >= startPage)
+			dev->mountBlocksReplayed++;
+
+		if (lastUsed >= dev->nChunksPerBlock - 1) {
+			bi->blockState = YAFFS_BLOCK_STATE_FULL;
+		} else if (i == nReplay - 1) {
+			/* this is the block being allocated from */
+			bi->blockState = YAFFS_BLOCK_STATE_ALLOCATING;
+			dev->allocationBlock = blk;
+			dev->allocationPage = lastUsed + 1;
+			dev->allocationBlockFinder = blk;
+		} else {
+			/* A partially written block that is not the current
+			 * allocation block must have had a write failure.
+			 */
+			bi->blockState = YAFFS_BLOCK_STATE_FULL;
+			bi->gcPrioritise = 1;
+			T(YAFFS_TRACE_ALWAYS,
+			  (TSTR("Partially written block %d detected" TENDSTR),
+			   blk));
+		}
+
+		if (bi->pagesInUse == 0 &&
+		    !bi->hasShrinkHeader &&
+		    bi->blockState == YAFFS_BLOCK_STATE_FULL) {
+			yaffs_BlockBecameDirty(dev, blk);
+		}
+	}
+
+	yaffs_ReleaseTempBuffer(dev, chunkData, __LINE__);
+
+	yaffs_HardlinkFixup(dev, hardList);
+
+	/* Everything still alive must have a header on NAND by now. If not,
+	 * a header was lost with a stale block or an object only showed up
+	 * as data.
+	 */
+	for (i = 0; ok && i < YAFFS_NOBJECT_BUCKETS; i++) {
+		ylist_for_each(lh, &dev->objectBucket[i].list) {
+			in = ylist_entry(lh, yaffs_Object, hashLink);
+
+			if (!in->fake && in->hdrChunk <= 0 &&
+			    in->parent != dev->deletedDir &&
+			    in->parent != dev->unlinkedDir) {
+				T(YAFFS_TRACE_SCAN,
+				  (TSTR("replay: object %d has no header" TENDSTR),
+				   in->objectId));
+				ok = 0;
+				break;
+			}
+		}
+	}
+
+	if (ok) {
+		dev->nErasedBlocks = 0;
+		for (blk = dev->internalStartBlock; blk <= dev->internalEndBlock; blk++) {
+			bi = yaffs_GetBlockInfo(dev, blk);
+			if (bi->blockState == YAFFS_BLOCK_STATE_EMPTY)
+				dev->nErasedBlocks++;
+		}
+		dev->nFreeChunks = yaffs_CountFreeChunks(dev);
+		dev->oldestDirtySequence = 0;
+
+		if (nStale || dev->mountChunksReplayed) {
+			/* What is on NAND no longer matches the checkpoint */
+			dev->isCheckpointed = 0;
+			dev->mountMode = YAFFS_MOUNT_REPLAY;
+		} else {
+			dev->mountMode = YAFFS_MOUNT_CHECKPOINT;
+		}
+	}
+
+out:
+	if (stale)
+		YFREE(stale);
+
+	if (altBlockIndex)
+		YFREE_ALT(blockIndex);
+	else if (blockIndex)
+		YFREE(blockIndex);
+
+	T(YAFFS_TRACE_SCAN, (TSTR("yaffs_CheckpointReplay ends %d" TENDSTR), ok));
+
+	return ok ? YAFFS_OK : YAFFS_FAIL;
+}
+
 /*------------------------------  Directory Functions ----------------------------- */
 
 static void yaffs_RemoveObjectFromDirectory(yaffs_Object * obj)
@@ -7264,6 +8068,11 @@ int yaffs_GutsInitialise(yaffs_Device * dev)
 	/* More device initialisation */
 	dev->garbageCollections = 0;
 	dev->passiveGarbageCollections = 0;
+	dev->backgroundGarbageCollections = 0;
+	memset(dev->fgGCLatency, 0, sizeof(dev->fgGCLatency));
+	memset(dev->bgGCLatency, 0, sizeof(dev->bgGCLatency));
+	dev->fgGCLatencyMax = 0;
+	dev->bgGCLatencyMax = 0;
 	dev->currentDirtyChecker = 0;
 	dev->bufferedBlock = -1;
 	dev->doingBufferedBlockRewrite = 0;
@@ -7284,6 +8093,11 @@ int yaffs_GutsInitialise(yaffs_Device * dev)
 		init_failed = 1;
 	
 	dev->srCache = NULL;
+	dev->srCacheHash = NULL;
+	dev->srCacheBuckets = 0;
+	dev->srDirtyCaches = 0;
+	YINIT_LIST_HEAD(&dev->srCacheLru);
+	YINIT_LIST_HEAD(&dev->srCacheFree);
 	dev->gcCleanupList = NULL;
 	
 	
@@ -7291,30 +8105,51 @@ int yaffs_GutsInitialise(yaffs_Device * dev)
 	    dev->nShortOpCaches > 0) {
 		int i;
 		void *buf;
-		int srCacheBytes = dev->nShortOpCaches * sizeof(yaffs_ChunkCache);
+		int srCacheBytes;
 
 		if (dev->nShortOpCaches > YAFFS_MAX_SHORT_OP_CACHES) {
 			dev->nShortOpCaches = YAFFS_MAX_SHORT_OP_CACHES;
 		}
+		srCacheBytes = dev->nShortOpCaches * sizeof(yaffs_ChunkCache);
 
+		/* About two caches per hash chain */
+		dev->srCacheBuckets = 1;
+		while (dev->srCacheBuckets * 2 < dev->nShortOpCaches)
+			dev->srCacheBuckets <<= 1;
+
+		dev->srCacheHash = YMALLOC(dev->srCacheBuckets *
+					   sizeof(struct ylist_head));
 		buf = dev->srCache =  YMALLOC(srCacheBytes);
 		    
 		if(dev->srCache)
 			memset(dev->srCache,0,srCacheBytes);
+		if(!dev->srCacheHash)
+			buf = NULL;
+
+		for (i = 0; i < dev->srCacheBuckets && buf; i++)
+			YINIT_LIST_HEAD(&dev->srCacheHash[i]);
 		   
 		for (i = 0; i < dev->nShortOpCaches && buf; i++) {
-			dev->srCache[i].object = NULL;
-			dev->srCache[i].lastUse = 0;
-			dev->srCache[i].dirty = 0;
-			dev->srCache[i].data = buf = YMALLOC_DMA(dev->totalBytesPerChunk);
+			yaffs_ChunkCache *cache = &dev->srCache[i];
+
+			YINIT_LIST_HEAD(&cache->hashLink);
+			YINIT_LIST_HEAD(&cache->objLink);
+			ylist_add_tail(&cache->lruLink, &dev->srCacheFree);
+			cache->object = NULL;
+			cache->dirty = 0;
+			cache->data = buf = YMALLOC_DMA(dev->totalBytesPerChunk);
 		}
 		if(!buf)
 			init_failed = 1;
-			
-		dev->srLastUse = 0;
 	}
 
 	dev->cacheHits = 0;
+
+	dev->mountMode = YAFFS_MOUNT_SCAN;
+	dev->mountBlocksChecked = 0;
+	dev->mountBlocksReplayed = 0;
+	dev->mountChunksReplayed = 0;
+	dev->checkpointSequence = 0;
 	
 	if(!init_failed){
 		dev->gcCleanupList = YMALLOC(dev->nChunksPerBlock * sizeof(__u32));
@@ -7338,19 +8173,26 @@ int yaffs_GutsInitialise(yaffs_Device * dev)
 	if(!init_failed){
 		/* Now scan the flash. */
 		if (dev->isYaffs2) {
-			if(yaffs_CheckpointRestore(dev)) {
+			if(yaffs_CheckpointRestore(dev) &&
+			   yaffs_CheckpointReplay(dev)) {
 				yaffs_CheckObjectDetailsLoaded(dev->rootDir);
 				T(YAFFS_TRACE_ALWAYS,
-				  (TSTR("yaffs: restored from checkpoint" TENDSTR)));
+				  (TSTR("yaffs: restored from checkpoint, %d blocks replayed" TENDSTR),
+				   dev->mountBlocksReplayed));
 			} else {
 
 				/* Clean up the mess caused by an aborted checkpoint load 
-				 * and scan backwards. 
+				 * or replay and scan backwards. 
 				 */
 				yaffs_DeinitialiseBlocks(dev);
 				yaffs_DeinitialiseTnodes(dev);
 				yaffs_DeinitialiseObjects(dev);
 				
+				dev->isCheckpointed = 0;
+				dev->checkpointSequence = 0;
+				dev->mountMode = YAFFS_MOUNT_SCAN;
+				dev->mountBlocksReplayed = 0;
+				dev->mountChunksReplayed = 0;
 			
 				dev->nErasedBlocks = 0;
 				dev->nFreeChunks = 0;
@@ -7398,6 +8240,8 @@ int yaffs_GutsInitialise(yaffs_Device * dev)
 
 	dev->nRetiredBlocks = 0;
 
+	dev->refreshSequence = dev->sequenceNumber;
+
 	yaffs_VerifyFreeChunks(dev);
 	yaffs_VerifyBlocks(dev);
 	
@@ -7428,6 +8272,10 @@ void yaffs_Deinitialise(yaffs_Device * dev)
 			YFREE(dev->srCache);
 			dev->srCache = NULL;
 		}
+		if (dev->srCacheHash) {
+			YFREE(dev->srCacheHash);
+			dev->srCacheHash = NULL;
+		}
 
 		YFREE(dev->gcCleanupList);
 
@@ -7488,13 +8336,7 @@ int yaffs_GetNumberOfFreeChunks(yaffs_Device * dev)
 	
 	/* Now count the number of dirty chunks in the cache and subtract those */
 
-	{
-		int i;
-		for (nDirtyCacheChunks = 0, i = 0; i < dev->nShortOpCaches; i++) {
-			if (dev->srCache[i].dirty)
-				nDirtyCacheChunks++;
-		}
-	}
+	nDirtyCacheChunks = dev->srDirtyCaches;
 
 	nFree -= nDirtyCacheChunks;
 
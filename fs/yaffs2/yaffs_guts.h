@@ -88,7 +88,8 @@
 
 /* */
 
-#define YAFFS_MAX_SHORT_OP_CACHES	20
+#define YAFFS_MAX_SHORT_OP_CACHES	256
+#define YAFFS_DEFAULT_SHORT_OP_CACHES	32
 
 #define YAFFS_N_TEMP_BUFFERS		6
 
@@ -111,11 +112,28 @@
 /* Special sequence number for bad block that failed to be marked bad */
 #define YAFFS_SEQUENCE_BAD_BLOCK	0xFFFF0000
 
+/* Garbage collection latency histogram: bucket 0 is under 1ms, bucket n
+ * counts [2^(n-1), 2^n) ms and the last bucket everything above.
+ */
+#define YAFFS_GC_LATENCY_BUCKETS	11
+
+/* Erased blocks, above what makes foreground GC aggressive, that the
+ * background collector tries to keep in hand.
+ */
+#define YAFFS_BG_GC_HEADROOM		8
+
+/* How the device was brought up at mount time */
+#define YAFFS_MOUNT_SCAN		0	/* full scan of every chunk */
+#define YAFFS_MOUNT_CHECKPOINT		1	/* checkpoint, nothing written since */
+#define YAFFS_MOUNT_REPLAY		2	/* checkpoint plus replay of newer blocks */
+
 /* ChunkCache is used for short read/write operations.*/
 typedef struct {
+	struct ylist_head hashLink;	/* chain in dev->srCacheHash, keyed by (object, chunkId) */
+	struct ylist_head lruLink;	/* position in dev->srCacheLru, or on dev->srCacheFree */
+	struct ylist_head objLink;	/* object's cacheList, kept in chunkId order */
 	struct yaffs_ObjectStruct *object;
 	int chunkId;
-	int lastUse;
 	int dirty;
 	int nBytes;		/* Only valid if the cache is dirty */
 	int locked;		/* Can't push out or flush while locked. */
@@ -439,6 +457,8 @@ struct yaffs_ObjectStruct {
         struct yaffs_ObjectStruct *parent; 
         struct ylist_head siblings;
 
+	struct ylist_head cacheList;	/* chunk caches holding this object's data */
+
 	/* Where's my object header in NAND? */
 	int hdrChunk;
 
@@ -586,6 +606,9 @@ struct yaffs_DeviceStruct {
 	int (*readChunkWithTagsFromNAND) (struct yaffs_DeviceStruct * dev,
 					  int chunkInNAND, __u8 * data,
 					  yaffs_ExtendedTags * tags);
+	/* Optional: read the data of nChunks consecutive chunks, no tags */
+	int (*readChunksFromNAND) (struct yaffs_DeviceStruct * dev,
+				   int chunkInNAND, int nChunks, __u8 * data);
 	int (*markNANDBlockBad) (struct yaffs_DeviceStruct * dev, int blockNo);
 	int (*queryNANDBlock) (struct yaffs_DeviceStruct * dev, int blockNo,
 			       yaffs_BlockState * state, __u32 *sequenceNumber);
@@ -639,6 +662,13 @@ struct yaffs_DeviceStruct {
 				 * at compile time so we have to allocate it.
 				 */
 	void (*putSuperFunc) (struct super_block * sb);
+	struct task_struct *bgGCThread;	/* Background garbage collector */
+	__u8 *readAheadBuffer;	/* Bounce buffer for yaffs_readpages() */
+#ifdef CONFIG_YAFFS_TNODE_SLAB
+	struct kmem_cache *tnodeCache;	/* Tnode pool, NULL if batch allocated */
+	char tnodeCacheName[24];	/* Set up by the OS glue before mounting */
+	char *tnodeCacheLabel;		/* Copy of the name owned by the cache */
+#endif
 #endif
 
 	int isMounted;
@@ -669,6 +699,8 @@ struct yaffs_DeviceStruct {
 	__u32 checkpointXor;
 	
 	int nCheckpointBlocksRequired; /* Number of blocks needed to store current checkpoint set */
+	unsigned checkpointSequence;	/* Sequence number the checkpoint on NAND was taken at, 0 if none */
+	unsigned refreshSequence;	/* Sequence number at mount or at the last checkpoint attempt */
 	
 	/* Block Info */
 	yaffs_BlockInfo *blockInfo;
@@ -689,6 +721,7 @@ struct yaffs_DeviceStruct {
 	yaffs_Tnode *freeTnodes;
 	int nFreeTnodes;
 	yaffs_TnodeList *allocatedTnodeList;
+	int nTnodesFreed;	/* Freed to the pool since it was last shrunk */
 
 	int isDoingGC;
 
@@ -717,6 +750,7 @@ struct yaffs_DeviceStruct {
 	int nGCCopies;
 	int garbageCollections;
 	int passiveGarbageCollections;
+	int backgroundGarbageCollections;
 	int nRetriedWrites;
 	int nRetiredBlocks;
 	int eccFixed;
@@ -725,9 +759,22 @@ struct yaffs_DeviceStruct {
 	int tagsEccUnfixed;
 	int nDeletions;
 	int nUnmarkedDeletions;
+
+	/* Mount statistics */
+	int mountMode;		/* YAFFS_MOUNT_xxx */
+	int mountTime;		/* In ms, filled in by the OS glue */
+	int mountBlocksChecked;
+	int mountBlocksReplayed;
+	int mountChunksReplayed;
 	
 	int hasPendingPrioritisedGCs; /* We think this device might have pending prioritised gcs */
 
+	int backgroundGC;	/* Set while the OS runs a background collector for us */
+	__u32 fgGCLatency[YAFFS_GC_LATENCY_BUCKETS];	/* Writer-context GC latency */
+	__u32 bgGCLatency[YAFFS_GC_LATENCY_BUCKETS];	/* Background GC latency */
+	__u32 fgGCLatencyMax;	/* In us */
+	__u32 bgGCLatencyMax;
+
 	/* Special directories */
 	yaffs_Object *rootDir;
 	yaffs_Object *lostNFoundDir;
@@ -741,7 +788,11 @@ struct yaffs_DeviceStruct {
 	int doingBufferedBlockRewrite;
 
 	yaffs_ChunkCache *srCache;
-	int srLastUse;
+	struct ylist_head *srCacheHash;	/* srCacheBuckets chains, a power of two */
+	int srCacheBuckets;
+	struct ylist_head srCacheLru;	/* in-use caches, least recently used first */
+	struct ylist_head srCacheFree;	/* caches not holding anything */
+	int srDirtyCaches;
 
 	int cacheHits;
 
@@ -834,6 +885,8 @@ int yaffs_GetAttributes(yaffs_Object * obj, struct iattr *attr);
 /* File operations */
 int yaffs_ReadDataFromFile(yaffs_Object * obj, __u8 * buffer, loff_t offset,
                            int nBytes);
+int yaffs_ReadFileChunks(yaffs_Object * obj, int chunkInInode, int nChunks,
+			 __u8 * buffer);
 int yaffs_WriteDataToFile(yaffs_Object * obj, const __u8 * buffer, loff_t offset,
                           int nBytes, int writeThrough);
 int yaffs_ResizeFile(yaffs_Object * obj, loff_t newSize);
@@ -842,11 +895,18 @@ yaffs_Object *yaffs_MknodFile(yaffs_Object * parent, const YCHAR * name,
                               __u32 mode, __u32 uid, __u32 gid);
 int yaffs_FlushFile(yaffs_Object * obj, int updateTime);
 
+/* Garbage collection */
+int yaffs_BackgroundGarbageCollect(yaffs_Device *dev, int aggression);
+
+/* Memory management */
+int yaffs_ShrinkTnodePool(yaffs_Device *dev);
+
 /* Flushing and checkpointing */
 void yaffs_FlushEntireDeviceCache(yaffs_Device *dev);
 
 int yaffs_CheckpointSave(yaffs_Device *dev);
 int yaffs_CheckpointRestore(yaffs_Device *dev);
+int yaffs_CheckpointRefreshDue(yaffs_Device *dev, int nBlocks);
 
 /* Directory operations */
 yaffs_Object *yaffs_MknodDirectory(yaffs_Object * parent, const YCHAR * name,
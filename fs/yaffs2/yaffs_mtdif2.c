@@ -193,6 +193,35 @@ int nandmtd2_ReadChunkWithTagsFromNAND(yaffs_Device * dev, int chunkInNAND,
 		return YAFFS_FAIL;
 }
 
+/* Read the data area of a run of consecutive chunks with a single MTD read.
+ * Tags are not needed here, the caller already knows what is in the chunks.
+ * Anything other than a clean read is failed so the caller can fall back to
+ * chunk-at-a-time reads, which account ECC results against each chunk.
+ */
+int nandmtd2_ReadChunksFromNAND(yaffs_Device * dev, int chunkInNAND,
+				int nChunks, __u8 * data)
+{
+	struct mtd_info *mtd = (struct mtd_info *)(dev->genericDevice);
+	size_t len = nChunks * dev->nDataBytesPerChunk;
+	size_t dummy = 0;
+	int retval;
+
+	loff_t addr = ((loff_t) chunkInNAND) * dev->nDataBytesPerChunk;
+
+	T(YAFFS_TRACE_MTD,
+	  (TSTR("nandmtd2_ReadChunksFromNAND chunk %d n %d" TENDSTR),
+	   chunkInNAND, nChunks));
+
+	dev->nPageReads += nChunks;
+
+	retval = mtd->read(mtd, addr, len, &dummy, data);
+
+	if (retval == 0 && dummy == len)
+		return YAFFS_OK;
+	else
+		return YAFFS_FAIL;
+}
+
 int nandmtd2_MarkNANDBlockBad(struct yaffs_DeviceStruct *dev, int blockNo)
 {
 	struct mtd_info *mtd = (struct mtd_info *)(dev->genericDevice);
@@ -51,6 +51,31 @@ int yaffs_ReadChunkWithTagsFromNAND(yaffs_Device * dev, int chunkInNAND,
 	return result;
 }
 
+/* Read the data of a run of consecutive chunks. The driver gets to do it in
+ * one go if it can; if it can't, or reports any ECC trouble, the chunks are
+ * read again one at a time so errors get handled against the right block.
+ */
+int yaffs_ReadChunksFromNAND(yaffs_Device * dev, int chunkInNAND,
+			     int nChunks, __u8 * buffer)
+{
+	int i;
+	int result = YAFFS_OK;
+
+	if (nChunks > 1 && !dev->inbandTags && dev->readChunksFromNAND &&
+	    dev->readChunksFromNAND(dev, chunkInNAND - dev->chunkOffset,
+				    nChunks, buffer) == YAFFS_OK)
+		return YAFFS_OK;
+
+	for (i = 0; i < nChunks; i++) {
+		if (yaffs_ReadChunkWithTagsFromNAND(dev, chunkInNAND + i,
+				buffer + i * dev->nDataBytesPerChunk,
+				NULL) != YAFFS_OK)
+			result = YAFFS_FAIL;
+	}
+
+	return result;
+}
+
 int yaffs_WriteChunkWithTagsToNAND(yaffs_Device * dev,
 						   int chunkInNAND,
 						   const __u8 * buffer,
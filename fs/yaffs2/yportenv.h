@@ -47,6 +47,7 @@
 #include <linux/string.h>
 #include <linux/slab.h>
 #include <linux/vmalloc.h>
+#include <linux/hrtimer.h>
 
 #define YCHAR char
 #define YUCHAR unsigned char
@@ -70,6 +71,18 @@
 #define YFREE_ALT(x)   vfree(x)
 #define YMALLOC_DMA(x) YMALLOC(x)
 
+#ifdef CONFIG_YAFFS_TNODE_SLAB
+#if (LINUX_VERSION_CODE > KERNEL_VERSION(2,6,22))
+#define YCACHE_CREATE(name,size) kmem_cache_create(name,size,0,0,NULL)
+#else
+#define YCACHE_CREATE(name,size) kmem_cache_create(name,size,0,0,NULL,NULL)
+#endif
+#define YCACHE_DESTROY(c)  kmem_cache_destroy(c)
+#define YCACHE_ALLOC(c)    kmem_cache_alloc(c,GFP_NOFS)
+#define YCACHE_FREE(c,x)   kmem_cache_free(c,x)
+#define YCACHE_SHRINK(c)   kmem_cache_shrink(c)
+#endif
+
 // KR - added for use in scan so processes aren't blocked indefinitely.
 #define YYIELD() schedule()
 
@@ -79,6 +92,7 @@
 #if (LINUX_VERSION_CODE > KERNEL_VERSION(2,5,0))
 #define Y_CURRENT_TIME CURRENT_TIME.tv_sec
 #define Y_TIME_CONVERT(x) (x).tv_sec
+#define Y_CURRENT_TIME_US() ((__u32)ktime_to_us(ktime_get()))
 #else
 #define Y_CURRENT_TIME CURRENT_TIME
 #define Y_TIME_CONVERT(x) (x)
@@ -32,6 +32,7 @@ enum {
 	BINDER_TYPE_HANDLE	= B_PACK_CHARS('s', 'h', '*', B_TYPE_LARGE),
 	BINDER_TYPE_WEAK_HANDLE	= B_PACK_CHARS('w', 'h', '*', B_TYPE_LARGE),
 	BINDER_TYPE_FD		= B_PACK_CHARS('f', 'd', '*', B_TYPE_LARGE),
+	BINDER_TYPE_PTR		= B_PACK_CHARS('p', 't', '*', B_TYPE_LARGE),
 };
 
 enum {
@@ -45,6 +46,12 @@ enum {
  * contains offsets into the data where these structures occur.  The Binder
  * driver takes care of re-writing the structure type and data as it moves
  * between processes.
+ *
+ * A BINDER_TYPE_PTR object refers to a separate buffer in the sender, which
+ * the driver gathers into the receiver's transaction buffer along with the
+ * data, instead of the sender first copying it into the data itself.  The
+ * receiver finds 'buffer' pointing at its copy.  Such objects must be sent
+ * with BC_TRANSACTION_SG or BC_REPLY_SG, whose buffers_size covers them all.
  */
 struct flat_binder_object {
 	/* 8 bytes for large_flat_header. */
@@ -55,10 +62,14 @@ struct flat_binder_object {
 	union {
 		void		*binder;	/* local object */
 		signed long	handle;		/* remote object */
+		void		*buffer;	/* BINDER_TYPE_PTR data */
 	};
 
 	/* extra data associated with local object */
-	void			*cookie;
+	union {
+		void		*cookie;
+		size_t		length;		/* of BINDER_TYPE_PTR data */
+	};
 };
 
 /*
@@ -147,6 +158,12 @@ struct binder_transaction_data {
 	} data;
 };
 
+struct binder_transaction_data_sg {
+	struct binder_transaction_data transaction_data;
+	/* total size of BINDER_TYPE_PTR buffers, each aligned to a pointer */
+	size_t buffers_size;
+};
+
 struct binder_ptr_cookie {
 	void *ptr;
 	void *cookie;
@@ -324,6 +341,13 @@ enum BinderDriverCommandProtocol {
 	/*
 	 * void *: cookie
 	 */
+
+	BC_TRANSACTION_SG = _IOW('c', 17, struct binder_transaction_data_sg),
+	BC_REPLY_SG = _IOW('c', 18, struct binder_transaction_data_sg),
+	/*
+	 * binder_transaction_data_sg: the sent command, with the space
+	 * needed for its BINDER_TYPE_PTR buffers.
+	 */
 };
 
 #endif /* _LINUX_BINDER_H */